@@ -1,49 +1,66 @@
 //
 // Created by Jin Siang Teh on 2026-03-01.
 //
-#include "ui.h"
 #include "protocol.h"
-#include "manager.h"
+#include "Ui.h"
 
-#include <stdarg.h>
-#include <time.h>
-#include <string.h>
+#include <ncurses.h>
 
 // ---------------------------------------------------------------------------
 // UI globals
 // ---------------------------------------------------------------------------
-WINDOW *win_srv, *win_cli, *win_mgr;
-pthread_mutex_t ui_mutex = PTHREAD_MUTEX_INITIALIZER;
+static WINDOW *panes[3];   // indexed by LogSource
+static TrackedMutex ui_mutex = TRACKED_MUTEX_INITIALIZER(LOCK_UI);
 
 // ===========================================================================
-// UI & logging
+// Setup
 // ===========================================================================
 
-void w_log_core(WINDOW *win, const char *msg) {
-    pthread_mutex_lock(&ui_mutex);
+int ui_start(void) {
+    // newterm rather than initscr: it reports a missing terminal instead
+    // of exiting the process
+    if (!newterm(NULL, stdout, stdin)) return -1;
+    start_color(); cbreak(); noecho(); curs_set(0);
+    init_pair(1, COLOR_CYAN, COLOR_BLACK);
+
+    int cols = COLS / 3;
+    int rows = LINES - 2;
+    panes[LOG_SERVER]  = newwin(rows, cols - 1, 1, 0);
+    panes[LOG_CLIENT]  = newwin(rows, cols - 1, 1, cols);
+    panes[LOG_MANAGER] = newwin(rows, cols - 1, 1, cols * 2);
+    scrollok(panes[LOG_SERVER], TRUE);
+    scrollok(panes[LOG_CLIENT], TRUE);
+    scrollok(panes[LOG_MANAGER], TRUE);
+
+    attron(A_REVERSE);
+    mvprintw(0, 1,            " SERVER  ");
+    mvprintw(0, cols + 1,     " CLIENTS ");
+    mvprintw(0, cols * 2 + 1, " MANAGER ");
+    attroff(A_REVERSE);
+    refresh();
+    return 0;
+}
+
+void ui_stop(void) {
+    tracked_lock(&ui_mutex);
+    endwin();
+    tracked_unlock(&ui_mutex);
+}
+
+// ===========================================================================
+// Logging
+// ===========================================================================
+
+void ui_write(LogSource src, const char *msg) {
+    WINDOW *win = panes[src];
+    tracked_lock(&ui_mutex);
     time_t now = time(NULL);
-    struct tm *t = localtime(&now);
+    struct tm t;
+    localtime_r(&now, &t);
     wattron(win, COLOR_PAIR(1));
-    wprintw(win, "[%02d:%02d:%02d] ", t->tm_hour, t->tm_min, t->tm_sec);
+    wprintw(win, "[%02d:%02d:%02d] ", t.tm_hour, t.tm_min, t.tm_sec);
     wattroff(win, COLOR_PAIR(1));
     wprintw(win, "%s\n", msg);
     wrefresh(win);
-    pthread_mutex_unlock(&ui_mutex);
-}
-
-void server_log(const char *fmt, ...) {
-    char buf[1024]; va_list a; va_start(a, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, a); va_end(a);
-    w_log_core(win_srv, buf);
-}
-void manager_log(const char *fmt, ...) {
-    char buf[1024]; va_list a; va_start(a, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, a); va_end(a);
-    w_log_core(win_mgr, buf);
+    tracked_unlock(&ui_mutex);
 }
-void client_log(const char *fmt, ...) {
-    char buf[1024]; va_list a; va_start(a, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, a); va_end(a);
-    w_log_core(win_cli, buf);
-    send_log_to_manager(buf);
-}
\ No newline at end of file
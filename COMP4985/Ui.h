@@ -5,26 +5,17 @@
 #ifndef COMP4985_UI_H
 #define COMP4985_UI_H
 
-
-#include <ncurses.h>
-#include <pthread.h>
-
-// ---------------------------------------------------------------------------
-// UI globals — defined in ui.c
-// ---------------------------------------------------------------------------
-extern WINDOW *win_srv;
-extern WINDOW *win_cli;
-extern WINDOW *win_mgr;
-extern pthread_mutex_t ui_mutex;
+#include "logsink.h"
 
 // ---------------------------------------------------------------------------
-// Logging functions — defined in ui.c
+// Terminal UI — three scrolling panes (server, clients, manager), one per
+// LogSource. Only built with COMP4985_HAVE_CURSES; driven by logsink.c.
 // ---------------------------------------------------------------------------
-void w_log_core(WINDOW *win, const char *msg);
-void server_log(const char *fmt, ...);
-void manager_log(const char *fmt, ...);
-void client_log(const char *fmt, ...);
 
+// Returns -1 if the terminal cannot be initialised.
+int  ui_start(void);
+void ui_stop(void);
 
+void ui_write(LogSource src, const char *msg);
 
-#endif //COMP4985_UI_H
\ No newline at end of file
+#endif //COMP4985_UI_H
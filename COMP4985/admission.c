@@ -0,0 +1,104 @@
+#include "protocol.h"
+#include "admission.h"
+#include "timer.h"
+#include "logsink.h"
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+// ===========================================================================
+// Limits and counters
+// ===========================================================================
+
+uint32_t admission_max_connections    = 1024;
+uint64_t admission_max_outbound_bytes = 64ull << 20;
+uint32_t admission_max_rss_mb         = 1024;
+uint32_t admission_max_lag_ms         = 250;
+
+_Atomic uint32_t active_connections = 0;
+_Atomic uint64_t outbound_bytes     = 0;
+
+// Refreshed by the sampler; read lock-free on every request
+static _Atomic int      saturated = 0;
+static _Atomic uint32_t rss_mb    = 0;
+
+// ===========================================================================
+// Sampler
+// ===========================================================================
+
+// Resident set size now, or 0 where the platform cannot tell us (the
+// memory limit is then not enforced). Peak RSS (ru_maxrss) will not do:
+// it never comes down, so crossing the limit once would shed for good.
+static uint32_t current_rss_mb(void) {
+#if defined(__linux__)
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long size = 0, resident = 0;
+    int ok = fscanf(f, "%lu %lu", &size, &resident) == 2;
+    fclose(f);
+    return ok ? (uint32_t)((resident * (unsigned long)sysconf(_SC_PAGESIZE)) >> 20) : 0;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t      count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                  (task_info_t)&info, &count) != KERN_SUCCESS)
+        return 0;
+    return (uint32_t)(info.resident_size >> 20);
+#else
+    return 0;
+#endif
+}
+
+static TimerEntry sampler;
+
+static void admission_sample(TimerEntry *t) {
+    uint32_t rss = current_rss_mb();
+    uint32_t lag = timer_lag_us() / 1000;
+    uint64_t out = atomic_load(&outbound_bytes);
+    atomic_store(&rss_mb, rss);
+
+    const char *why = NULL;
+    if      (rss && rss > admission_max_rss_mb)  why = "memory";
+    else if (lag > admission_max_lag_ms)         why = "loop lag";
+    else if (out > admission_max_outbound_bytes) why = "outbound backlog";
+
+    int was = atomic_exchange(&saturated, why != NULL);
+    if (why && !was)
+        server_log("[SHED] Saturated (%s): rss=%uMB lag=%ums out=%lluB conns=%u",
+                   why, rss, lag, (unsigned long long)out,
+                   atomic_load(&active_connections));
+    else if (!why && was)
+        server_log("[SHED] Recovered: rss=%uMB lag=%ums conns=%u",
+                   rss, lag, atomic_load(&active_connections));
+
+    timer_arm(t, ADMISSION_SAMPLE_MS);
+}
+
+void admission_start(void) {
+    sampler.fire = admission_sample;
+    timer_arm(&sampler, ADMISSION_SAMPLE_MS);
+}
+
+// ===========================================================================
+// Admission decisions
+// ===========================================================================
+
+int admission_saturated(void) {
+    return atomic_load_explicit(&saturated, memory_order_relaxed);
+}
+
+int admission_accept(void) {
+    if (admission_saturated()) return 0;
+
+    uint32_t n = atomic_fetch_add(&active_connections, 1);
+    if (n >= admission_max_connections) {
+        atomic_fetch_sub(&active_connections, 1);
+        return 0;
+    }
+    return 1;
+}
+
+void admission_release(void) {
+    atomic_fetch_sub(&active_connections, 1);
+}
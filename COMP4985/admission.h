@@ -0,0 +1,40 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_ADMISSION_H
+#define COMP4985_ADMISSION_H
+
+#include "protocol.h"
+#include <stdatomic.h>
+
+// ---------------------------------------------------------------------------
+// Admission limits — above any of them the server is "saturated": new
+// connections are refused straight from the accept loop and requests from
+// sessions that have not logged in yet get STATUS_SERVICE_UNAVAILABLE.
+// Logged-in sessions keep being served.
+// ---------------------------------------------------------------------------
+extern uint32_t admission_max_connections;
+extern uint64_t admission_max_outbound_bytes;   // bytes sitting in send()
+extern uint32_t admission_max_rss_mb;           // Linux and macOS only
+extern uint32_t admission_max_lag_ms;           // timer wheel lateness
+
+#define ADMISSION_SAMPLE_MS  500   // RSS / lag sampling period
+
+// Live counters, maintained by the connection threads
+extern _Atomic uint32_t active_connections;
+extern _Atomic uint64_t outbound_bytes;
+
+// Starts the periodic sampler on the timer wheel.
+void admission_start(void);
+
+// Accept loop: 1 if a new connection may be served (and counts it), 0 if
+// it should be refused. Every admitted connection must call
+// admission_release when it closes.
+int  admission_accept(void);
+void admission_release(void);
+
+// 1 while the server is shedding load.
+int  admission_saturated(void);
+
+#endif //COMP4985_ADMISSION_H
@@ -0,0 +1,197 @@
+#define _GNU_SOURCE   // cpu_set_t, pthread_*affinity_np
+#include "protocol.h"
+#include "affinity.h"
+#include "logsink.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <sched.h>
+
+#ifdef COMP4985_HAVE_NUMA
+#include <numa.h>
+#endif
+
+CpuSet        affinity_sets[AFF_ROLES];
+ConnPlacement affinity_conn_placement = CONN_PLACE_CORE;
+
+static const char *const role_names[AFF_ROLES] = {
+    [AFF_ACCEPTOR]    = "acceptor",
+    [AFF_MANAGER]     = "manager",
+    [AFF_REPLICATION] = "replication",
+    [AFF_STORAGE]     = "storage",
+    [AFF_TIMER]       = "timer",
+    [AFF_OFFLOAD]     = "offload",
+};
+
+// ===========================================================================
+// CpuSet
+// ===========================================================================
+
+static void cpuset_add(CpuSet *set, int cpu) {
+    set->bits[cpu / 64] |= 1ULL << (cpu % 64);
+}
+
+static int cpuset_has(const CpuSet *set, int cpu) {
+    return (int)(set->bits[cpu / 64] >> (cpu % 64) & 1);
+}
+
+static long parse_cpu(const char *s, char **end) {
+    if (!isdigit((unsigned char)*s)) return -1;
+    long v = strtol(s, end, 10);
+    return v < AFFINITY_MAX_CPUS ? v : -1;
+}
+
+int cpuset_parse(const char *s, CpuSet *set) {
+    CpuSet out = {0};
+    while (*s) {
+        char *end;
+        long lo = parse_cpu(s, &end), hi = lo;
+        if (lo < 0) return -1;
+        if (*end == '-') {
+            hi = parse_cpu(end + 1, &end);
+            if (hi < lo) return -1;
+        }
+        for (long c = lo; c <= hi; c++) cpuset_add(&out, (int)c);
+
+        if (*end == ',') end++;
+        else if (*end)   return -1;
+        s = end;
+    }
+    *set = out;
+    return 0;
+}
+
+int cpuset_count(const CpuSet *set) {
+    int n = 0;
+    for (size_t i = 0; i < sizeof(set->bits) / sizeof(set->bits[0]); i++)
+        n += __builtin_popcountll(set->bits[i]);
+    return n;
+}
+
+int cpuset_nth(const CpuSet *set, int n) {
+    for (int c = 0; c < AFFINITY_MAX_CPUS; c++)
+        if (cpuset_has(set, c) && n-- == 0) return c;
+    return -1;
+}
+
+static void to_cpu_set(const CpuSet *set, cpu_set_t *out) {
+    CPU_ZERO(out);
+    for (int c = 0; c < AFFINITY_MAX_CPUS && c < CPU_SETSIZE; c++)
+        if (cpuset_has(set, c)) CPU_SET(c, out);
+}
+
+// ===========================================================================
+// Topology
+// ===========================================================================
+
+static int16_t        cpu_node[AFFINITY_MAX_CPUS];
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+// Without libnuma: cpuN/nodeM links in sysfs, one per CPU
+static int sysfs_node_of(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *d = opendir(path);
+    if (!d) return 0;
+
+    int node = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL)
+        if (strncmp(e->d_name, "node", 4) == 0 && isdigit((unsigned char)e->d_name[4])) {
+            node = atoi(e->d_name + 4);
+            break;
+        }
+    closedir(d);
+    return node;
+}
+
+static void topology_load(void) {
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpu > AFFINITY_MAX_CPUS) ncpu = AFFINITY_MAX_CPUS;
+
+#ifdef COMP4985_HAVE_NUMA
+    if (numa_available() >= 0) {
+        for (int c = 0; c < ncpu; c++) {
+            int n = numa_node_of_cpu(c);
+            cpu_node[c] = (int16_t)(n > 0 ? n : 0);
+        }
+        return;
+    }
+#endif
+    for (int c = 0; c < ncpu; c++)
+        cpu_node[c] = (int16_t)sysfs_node_of(c);
+}
+
+int affinity_node_of(int cpu) {
+    if (cpu < 0 || cpu >= AFFINITY_MAX_CPUS) return 0;
+    pthread_once(&topology_once, topology_load);
+    return cpu_node[cpu];
+}
+
+// ===========================================================================
+// Placement
+// ===========================================================================
+
+// Allocations made from here on come from the calling thread's node
+static void bind_memory_local(void) {
+#ifdef COMP4985_HAVE_NUMA
+    if (numa_available() >= 0) numa_set_localalloc();
+#endif
+}
+
+static void pin_self(const CpuSet *set, const char *what) {
+    cpu_set_t cs;
+    to_cpu_set(set, &cs);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+    if (rc != 0) {
+        server_log("[AFFINITY] Cannot pin %s thread: %s", what, strerror(rc));
+        return;
+    }
+    bind_memory_local();
+}
+
+void affinity_enter(AffinityRole role) {
+    if (cpuset_count(&affinity_sets[role]) == 0) return;
+    pin_self(&affinity_sets[role], role_names[role]);
+}
+
+void affinity_enter_cpu(int cpu) {
+    CpuSet set = {0};
+    char   what[32];
+    cpuset_add(&set, cpu);
+    snprintf(what, sizeof(what), "%s (CPU %d)", role_names[AFF_ACCEPTOR], cpu);
+    pin_self(&set, what);
+}
+
+int affinity_spawn_conn(int accept_cpu, void *(*fn)(void *), void *arg) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    // Set at creation rather than from inside the thread, so the very first
+    // touch of the new stack already happens on the right node
+    if (accept_cpu >= 0 && affinity_conn_placement != CONN_PLACE_ANY) {
+        cpu_set_t cs;
+        CPU_ZERO(&cs);
+        if (affinity_conn_placement == CONN_PLACE_CORE) {
+            CPU_SET(accept_cpu, &cs);
+        } else {
+            int  node = affinity_node_of(accept_cpu);
+            long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+            for (int c = 0; c < ncpu && c < CPU_SETSIZE; c++)
+                if (affinity_node_of(c) == node) CPU_SET(c, &cs);
+        }
+        pthread_attr_setaffinity_np(&attr, sizeof(cs), &cs);
+    }
+
+    int rc = pthread_create(&(pthread_t){0}, &attr, fn, arg);
+    if (rc != 0 && accept_cpu >= 0) {
+        // Affinity refused (CPU offline or outside our cpuset): run unpinned
+        pthread_attr_destroy(&attr);
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        rc = pthread_create(&(pthread_t){0}, &attr, fn, arg);
+    }
+    pthread_attr_destroy(&attr);
+    return rc;
+}
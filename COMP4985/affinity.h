@@ -0,0 +1,78 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_AFFINITY_H
+#define COMP4985_AFFINITY_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// CPU affinity and NUMA placement
+//
+// Every long-lived thread belongs to a role, and each role may be pinned to
+// a set of CPUs from the configuration (cpu.<role> = "0-3,8"). An empty set
+// leaves the role to the scheduler.
+//
+//   acceptor      one SO_REUSEPORT listener per listed CPU, pinned to it
+//   manager       manager link, log forwarding and heartbeats
+//   replication   outbound replication queue
+//   storage       snapshot / log persistence, search indexing, trace export
+//   timer         timer wheel tick
+//   offload       offload pool workers (offload.h)
+//
+// Connection threads are created with the CPU set of the acceptor that
+// accepted them (affinity_conn_placement), so their stacks, frame buffers
+// and the store records they create are first touched — and therefore
+// allocated — on that acceptor's node. With libnuma (COMP4985_HAVE_NUMA)
+// pinned threads also switch to a strict local-node allocation policy, so
+// that holds even when the process was started under numactl --interleave.
+// ---------------------------------------------------------------------------
+#define AFFINITY_MAX_CPUS  1024
+
+typedef enum {
+    AFF_ACCEPTOR,
+    AFF_MANAGER,
+    AFF_REPLICATION,
+    AFF_STORAGE,
+    AFF_TIMER,
+    AFF_OFFLOAD,
+    AFF_ROLES
+} AffinityRole;
+
+typedef enum {
+    CONN_PLACE_CORE,   // the accepting acceptor's CPU                 [default]
+    CONN_PLACE_NODE,   // any CPU on the accepting acceptor's node
+    CONN_PLACE_ANY     // wherever the scheduler likes
+} ConnPlacement;
+
+typedef struct {
+    uint64_t bits[AFFINITY_MAX_CPUS / 64];
+} CpuSet;
+
+extern CpuSet        affinity_sets[AFF_ROLES];   // written by config.c
+extern ConnPlacement affinity_conn_placement;
+
+// "0-3,8,10-11" → set. Returns 0, or -1 on a malformed list or a CPU
+// number of AFFINITY_MAX_CPUS or more.
+int  cpuset_parse(const char *s, CpuSet *set);
+int  cpuset_count(const CpuSet *set);
+// n-th lowest CPU in the set, or -1
+int  cpuset_nth(const CpuSet *set, int n);
+
+// NUMA node of cpu (0 when unknown)
+int  affinity_node_of(int cpu);
+
+// Pins the calling thread to its role's set; no-op when the set is empty.
+// Call first thing in the thread function.
+void affinity_enter(AffinityRole role);
+
+// Pins the calling thread to a single CPU (an acceptor).
+void affinity_enter_cpu(int cpu);
+
+// Starts a detached connection thread placed relative to the accepting
+// CPU (-1 = unpinned acceptor: no placement). Returns pthread_create's
+// result.
+int  affinity_spawn_conn(int accept_cpu, void *(*fn)(void *), void *arg);
+
+#endif //COMP4985_AFFINITY_H
@@ -0,0 +1,47 @@
+#include "protocol.h"
+#include "bloom.h"
+
+BloomFilter *bloom_create(uint32_t capacity) {
+    uint64_t bits   = (uint64_t)(capacity ? capacity : 1) * BLOOM_BITS_PER_KEY;
+    uint64_t blocks = 1;
+    while (blocks * 512 < bits) blocks *= 2;
+
+    BloomFilter *f = calloc(1, sizeof(BloomFilter) + blocks * 8 * sizeof(uint64_t));
+    if (!f) return NULL;
+    f->capacity   = capacity;
+    f->block_mask = (uint32_t)(blocks - 1);
+    return f;
+}
+
+// The block comes from the low half of the hash; the BLOOM_K bit positions
+// inside its 512 bits from double hashing the high half.
+typedef struct {
+    uint32_t word[BLOOM_K];
+    uint64_t mask[BLOOM_K];
+} BloomProbes;
+
+static void probes(const BloomFilter *f, uint64_t hash, BloomProbes *p) {
+    uint32_t base = ((uint32_t)hash & f->block_mask) * 8;
+    uint32_t h1   = (uint32_t)(hash >> 32);
+    uint32_t h2   = (h1 >> 9 | h1 << 23) | 1;
+    for (int i = 0; i < BLOOM_K; i++, h1 += h2) {
+        p->word[i] = base + (h1 & 511) / 64;
+        p->mask[i] = 1ULL << (h1 % 64);
+    }
+}
+
+void bloom_add(BloomFilter *f, uint64_t hash) {
+    BloomProbes p;
+    probes(f, hash, &p);
+    for (int i = 0; i < BLOOM_K; i++)
+        atomic_fetch_or_explicit(&f->words[p.word[i]], p.mask[i], memory_order_release);
+}
+
+int bloom_maybe(const BloomFilter *f, uint64_t hash) {
+    BloomProbes p;
+    probes(f, hash, &p);
+    for (int i = 0; i < BLOOM_K; i++)
+        if (!(atomic_load_explicit(&f->words[p.word[i]], memory_order_acquire) & p.mask[i]))
+            return 0;
+    return 1;
+}
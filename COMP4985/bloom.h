@@ -0,0 +1,37 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_BLOOM_H
+#define COMP4985_BLOOM_H
+
+#include "protocol.h"
+#include <stdatomic.h>
+
+// ---------------------------------------------------------------------------
+// Blocked Bloom filter
+//
+// Each key selects one 64-byte block and sets BLOOM_K bits inside it, so a
+// lookup touches a single cache line. Sized at BLOOM_BITS_PER_KEY bits per
+// key of capacity (about 0.5% false positives when full). Keys are only
+// ever added; bits are set and read atomically, so bloom_maybe needs no
+// lock while another thread adds.
+// ---------------------------------------------------------------------------
+#define BLOOM_K             8
+#define BLOOM_BITS_PER_KEY  12
+
+typedef struct {
+    uint32_t         capacity;   // keys it was sized for
+    uint32_t         block_mask; // blocks - 1 (power of two)
+    _Atomic uint64_t words[];    // 8 words per block
+} BloomFilter;
+
+// Returns NULL on allocation failure.
+BloomFilter *bloom_create(uint32_t capacity);
+
+void bloom_add(BloomFilter *f, uint64_t hash);
+
+// 0: the key was never added. 1: it probably was.
+int  bloom_maybe(const BloomFilter *f, uint64_t hash);
+
+#endif //COMP4985_BLOOM_H
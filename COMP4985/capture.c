@@ -0,0 +1,151 @@
+#include "protocol.h"
+#include "capture.h"
+#include "logsink.h"
+#include "metrics.h"
+#include "stats.h"
+
+#include <fcntl.h>
+
+uint32_t capture_max_mb = 1024;
+
+static int              cap_fd = -1;
+static _Atomic int      cap_on;
+static _Atomic uint32_t cap_sessions;
+static uint64_t         cap_start_us;   // stats_now_us() when capture began
+
+// The shared buffer; always big enough for a whole record, since frames
+// never exceed HEADER_SIZE + BUFFER_SIZE
+static pthread_mutex_t  cap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t         *cap_buf;
+static uint32_t         cap_used;
+static uint64_t         cap_oldest_us;  // t_us of the first buffered record
+static uint64_t         cap_written;    // bytes in the file
+
+// ===========================================================================
+// Buffer
+// ===========================================================================
+
+static int write_all(const void *p, size_t n) {
+    const uint8_t *b = p;
+    while (n > 0) {
+        ssize_t w = write(cap_fd, b, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        b += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+// Caller holds cap_mutex. A failed write ends the capture.
+static void buffer_drain(void) {
+    if (cap_used == 0) return;
+    if (write_all(cap_buf, cap_used) < 0) {
+        atomic_store(&cap_on, 0);
+        server_log("[CAPTURE] Write failed: %s — capture stopped", strerror(errno));
+    }
+    cap_written += cap_used;
+    cap_used     = 0;
+    metric_set(METRIC_CAPTURE_BYTES, cap_written);
+}
+
+static void record(uint32_t session, uint8_t kind, const uint8_t *raw,
+                   const void *pay, uint32_t len)
+{
+    if (!session || !atomic_load_explicit(&cap_on, memory_order_relaxed)) return;
+
+    uint32_t      body = kind == CAPTURE_FRAME ? HEADER_SIZE + len : 0;
+    uint32_t      size = (uint32_t)sizeof(CaptureRecord) + body;
+    CaptureRecord r    = { .session = session, .kind = kind, .length = body };
+
+    pthread_mutex_lock(&cap_mutex);
+    if (!atomic_load(&cap_on)) {
+        pthread_mutex_unlock(&cap_mutex);
+        return;
+    }
+
+    // Stamped under the lock, so the file is in time order
+    r.t_us = stats_now_us() - cap_start_us;
+
+    if (capture_max_mb &&
+        cap_written + cap_used + size > (uint64_t)capture_max_mb << 20) {
+        buffer_drain();
+        atomic_store(&cap_on, 0);
+        server_log("[CAPTURE] %u MB written — capture stopped", capture_max_mb);
+        pthread_mutex_unlock(&cap_mutex);
+        return;
+    }
+
+    if (cap_used + size > CAPTURE_BUFFER_BYTES) buffer_drain();
+    if (cap_used == 0) cap_oldest_us = r.t_us;
+    memcpy(cap_buf + cap_used, &r, sizeof(r));
+    cap_used += sizeof(r);
+    if (body) {
+        memcpy(cap_buf + cap_used, raw, HEADER_SIZE);
+        if (len) memcpy(cap_buf + cap_used + HEADER_SIZE, pay, len);
+        cap_used += body;
+        metric_add(METRIC_CAPTURE_FRAMES, 1);
+    }
+
+    if (r.t_us - cap_oldest_us >= CAPTURE_FLUSH_MS * 1000u) buffer_drain();
+    pthread_mutex_unlock(&cap_mutex);
+}
+
+// ===========================================================================
+// Public
+// ===========================================================================
+
+int capture_open(const char *path) {
+    cap_fd  = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    cap_buf = malloc(CAPTURE_BUFFER_BYTES);
+    if (cap_fd < 0 || !cap_buf) {
+        server_log("[CAPTURE] Cannot open %s: %s", path, strerror(errno));
+        if (cap_fd >= 0) close(cap_fd);
+        free(cap_buf);
+        cap_fd  = -1;
+        cap_buf = NULL;
+        return -1;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    CaptureFileHeader fh = {
+        .version         = CAPTURE_VERSION,
+        .started_unix_us = (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u
+    };
+    memcpy(fh.magic, CAPTURE_MAGIC, sizeof(fh.magic));
+    if (write_all(&fh, sizeof(fh)) < 0) {
+        server_log("[CAPTURE] Cannot write %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    cap_written  = sizeof(fh);
+    cap_start_us = stats_now_us();
+    atomic_store(&cap_on, 1);
+    server_log("[CAPTURE] Recording client frames to %s", path);
+    return 0;
+}
+
+void capture_flush(void) {
+    if (cap_fd < 0) return;
+    pthread_mutex_lock(&cap_mutex);
+    buffer_drain();
+    pthread_mutex_unlock(&cap_mutex);
+}
+
+uint32_t capture_session_open(void) {
+    if (!atomic_load_explicit(&cap_on, memory_order_relaxed)) return 0;
+    uint32_t session = atomic_fetch_add(&cap_sessions, 1) + 1;
+    record(session, CAPTURE_OPEN, NULL, NULL, 0);
+    return session;
+}
+
+void capture_session_close(uint32_t session) {
+    record(session, CAPTURE_CLOSE, NULL, NULL, 0);
+}
+
+void capture_frame(uint32_t session, const uint8_t raw[HEADER_SIZE],
+                   const void *pay, uint32_t len)
+{
+    record(session, CAPTURE_FRAME, raw, pay, len);
+}
@@ -0,0 +1,77 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_CAPTURE_H
+#define COMP4985_CAPTURE_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Traffic capture
+//
+// With capture_file set, every frame a client sends is recorded as it
+// comes off the socket — before any check, still compressed if it was —
+// together with when it arrived and which connection sent it. The replay
+// tool (replay.c) plays the file back against another server.
+//
+// File layout: one CaptureFileHeader, then records in arrival order, each
+// a CaptureRecord followed by length bytes:
+//
+//   CAPTURE_OPEN    a connection was accepted (no body)
+//   CAPTURE_FRAME   the 8-byte header and the payload exactly as received
+//   CAPTURE_CLOSE   the connection ended (no body)
+//
+// Sessions are numbered from 1 in accept order. Frames carry passwords as
+// sent, so the file is created mode 0600.
+//
+// Connection threads append to one shared buffer, written out whenever it
+// fills or holds a record older than CAPTURE_FLUSH_MS, and when the
+// server stops; a crash loses at most that tail. Once capture_max_mb have
+// been written capturing stops for good, so it is safe to leave on.
+//
+// Host byte order, like the persistence files.
+// ---------------------------------------------------------------------------
+#define CAPTURE_MAGIC          "C4985CAP"
+#define CAPTURE_VERSION        1
+#define CAPTURE_BUFFER_BYTES   (1u << 20)
+#define CAPTURE_FLUSH_MS       1000
+
+extern uint32_t capture_max_mb;   // 0 = no limit
+
+typedef struct __attribute__((packed)) {
+    char     magic[8];        // CAPTURE_MAGIC, not terminated
+    uint32_t version;         // CAPTURE_VERSION
+    uint32_t reserved;
+    uint64_t started_unix_us; // wall clock when capture began
+} CaptureFileHeader;   // 24 bytes
+
+enum {
+    CAPTURE_OPEN  = 1,
+    CAPTURE_FRAME = 2,
+    CAPTURE_CLOSE = 3
+};
+
+typedef struct __attribute__((packed)) {
+    uint64_t t_us;            // since capture began
+    uint32_t session;
+    uint8_t  kind;            // CAPTURE_*
+    uint32_t length;          // bytes that follow
+} CaptureRecord;   // 17 bytes
+
+// Creates (truncates) path and starts capturing. Returns -1 if it cannot.
+int capture_open(const char *path);
+
+// Writes out whatever is buffered.
+void capture_flush(void);
+
+// A new session number, and its CAPTURE_OPEN record; 0 while capture is
+// off (every call below is then a no-op).
+uint32_t capture_session_open(void);
+void     capture_session_close(uint32_t session);
+
+// Records one received frame: raw is the wire header, pay its payload.
+void capture_frame(uint32_t session, const uint8_t raw[HEADER_SIZE],
+                   const void *pay, uint32_t len);
+
+#endif //COMP4985_CAPTURE_H
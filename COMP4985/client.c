@@ -1,215 +1,1000 @@
 #include "protocol.h"
-#include "ui.h"
+#include "logsink.h"
 #include "client.h"
+#include "store.h"
+#include "compress.h"
+#include "admission.h"
+#include "directory.h"
+#include "manager.h"
+#include "stats.h"
+#include "persist.h"
+#include "frame.h"
+#include "credential.h"
+#include "presence.h"
+#include "search.h"
+#include "readmark.h"
+#include "capture.h"
+#include "trace.h"
+
+#include <poll.h>
 
 // ===========================================================================
-// Client ID counter
+// Client ID counter, read deadlines
 // ===========================================================================
 
-uint8_t next_account_id = 1;
-pthread_mutex_t acc_id_mutex = PTHREAD_MUTEX_INITIALIZER;
+TrackedMutex acc_id_mutex = TRACKED_MUTEX_INITIALIZER(LOCK_ACC_ID);
+
+uint32_t conn_idle_timeout_ms    = CONN_IDLE_TIMEOUT_MS;
+uint32_t conn_header_timeout_ms  = CONN_HEADER_TIMEOUT_MS;
+uint32_t conn_payload_timeout_ms = CONN_PAYLOAD_TIMEOUT_MS;
+
+// ===========================================================================
+// Replies
+// ===========================================================================
+
+static int conn_send_raw(ClientConn *c, uint8_t res_type, uint8_t crud, uint8_t ack,
+                         uint8_t flags, const void *pay, uint32_t len)
+{
+    // Bytes blocked in send() across all connections feed admission control
+    atomic_fetch_add(&outbound_bytes, len);
+    uint64_t t  = trace_enter();
+    int      rc = send_binary_msg_ver(c->sock, c->minor, res_type, crud, ack, flags, pay, len);
+    trace_leave(TRACE_SEND, t);
+    atomic_fetch_sub(&outbound_bytes, len);
+    return rc;
+}
+
+// conn_send with header flags of its own (HDR_FLAG_COMPRESSED is added
+// as needed)
+static int conn_send_flags(ClientConn *c, uint8_t res_type, uint8_t crud, uint8_t ack,
+                           uint8_t flags, const void *pay, uint32_t len)
+{
+    if (c->compress && len >= COMPRESS_THRESHOLD && pay) {
+        uint32_t cap = COMPRESS_BOUND(len);
+        uint8_t *out = malloc(cap);
+        if (out) {
+            uint32_t n = compress_payload(pay, len, out, cap);
+            int rc = -1;
+            if (n > 0)
+                rc = conn_send_raw(c, res_type, crud, ack,
+                                   flags | HDR_FLAG_COMPRESSED, out, n);
+            free(out);
+            if (n > 0) return rc;
+        }
+    }
+    return conn_send_raw(c, res_type, crud, ack, flags, pay, len);
+}
+
+int conn_send(ClientConn *c, uint8_t res_type, uint8_t crud, uint8_t ack,
+              const void *pay, uint32_t len)
+{
+    return conn_send_flags(c, res_type, crud, ack, 0, pay, len);
+}
+
+// Header-only error reply, in the connection's protocol version (v0.2
+// until the first valid frame has pinned one).
+static void conn_error(ClientConn *c, uint8_t res_type, uint8_t crud, uint8_t status) {
+    uint64_t t = trace_enter();
+    send_error_response_ver(c->sock, c->minor ? c->minor : PROTO_VER_MINOR,
+                            res_type, crud, status);
+    trace_leave(TRACE_SEND, t);
+    trace_status(status);
+}
+
+static int conn_wide(const ClientConn *c) {
+    return c->minor == PROTO_VER_MINOR_WIDE;
+}
+
+// Largest ID the connection's payloads can carry
+static uint32_t conn_max_id(const ClientConn *c) {
+    return conn_wide(c) ? DIR_MAX_USER_ID : PROTO_V2_MAX_ID;
+}
+
+// Writes an ID list after a reply header: one byte per ID for v0.2,
+// network-order uint32_t for v0.3. Returns the bytes written.
+static uint32_t put_id_list(const ClientConn *c, uint8_t *out,
+                            const uint32_t *ids, uint32_t n)
+{
+    if (!conn_wide(c)) {
+        for (uint32_t i = 0; i < n; i++) out[i] = (uint8_t)ids[i];
+        return n;
+    }
+    for (uint32_t i = 0; i < n; i++)
+        store_be32(out + (size_t)i * 4, ids[i]);
+    return n * 4;
+}
+
+// Account the connection is logged in as, 0 if none (presence keeps it)
+static uint32_t conn_user_id(const ClientConn *c) {
+    return c->presence.user_id;
+}
+
+// How many IDs fit in a reply after a header of hdr bytes
+static uint32_t id_list_cap(const ClientConn *c, uint32_t hdr) {
+    return conn_wide(c) ? (BUFFER_SIZE - hdr) / 4 : PROTO_V2_MAX_ID;
+}
+
+// ===========================================================================
+// Password hashing — on the offload pool, never on the connection thread
+// ===========================================================================
+
+typedef struct {
+    OffloadTask task;
+    const char *password;   // 16-byte wire field
+    Credential  cred;
+    int         ok;
+} CredentialJob;
+
+static void run_derive(OffloadTask *t) {
+    CredentialJob *j = t->arg;
+    credential_derive(&j->cred, j->password);
+}
+
+static void run_verify(OffloadTask *t) {
+    CredentialJob *j = t->arg;
+    j->ok = credential_verify(&j->cred, j->password);
+}
+
+static void conn_derive(ClientConn *c, Credential *out, const char password[16]) {
+    CredentialJob j = { .task = { .run = run_derive, .arg = &j }, .password = password };
+    offload_run(&j.task, &c->offload);
+    *out = j.cred;
+}
+
+// Checks a login against the account's verifier. A username with no
+// account logs in as before; an account without a verifier (restored from
+// a log that predates them) is refused, never adopted.
+static int conn_check_password(ClientConn *c, const char username[16],
+                               const char password[16])
+{
+    uint32_t      id;
+    CredentialJob j = { .task = { .run = run_verify, .arg = &j }, .password = password };
+    if (!directory_lookup_user(username, &id)) return 1;
+    if (!directory_user_credential(id, &j.cred)) return 0;
+
+    offload_run(&j.task, &c->offload);
+    return j.ok;
+}
 
 // ===========================================================================
 // Per-interaction handlers
+//
+// Each request is decoded into its native struct, v0.2 or v0.3 depending on
+// the connection, and the reply is encoded back into buffer.
 // ===========================================================================
 
 // spec row 8/9 — Create Account
 // RECV: res=00010  crud=00  ack=0
 // SEND: res=00010  crud=00  ack=1
-void handle_create_account(int sock, uint8_t *buffer) {
-    AccountCreatePayload *acc = (AccountCreatePayload *)buffer;
-
-    pthread_mutex_lock(&acc_id_mutex);
-    acc->client_id = next_account_id++;
-    pthread_mutex_unlock(&acc_id_mutex);
+void handle_create_account(ClientConn *c, uint8_t *buffer, uint32_t plen) {
+    AccountCreatePayload   acc;
+    AccountCreatePayloadV3 acc3;
+    int ok = conn_wide(c) ? account_create_v3_decode(&acc3, buffer, plen) >= 0
+                          : account_create_decode(&acc, buffer, plen) >= 0;
+    if (!ok) {
+        conn_error(c, RES_USER, CRUD_CREATE, STATUS_MALFORMED_REQUEST);
+        return;
+    }
+    const char *username = conn_wide(c) ? acc3.username : acc.username;
+    const char *password = conn_wide(c) ? acc3.password : acc.password;
+
+    // Obvious duplicates are refused before paying for a verifier
+    uint32_t   id = 0;
+    Credential cred;
+    int rc = DIR_EXISTS;
+    if (!directory_lookup_user(username, &id)) {
+        conn_derive(c, &cred, password);
+        rc = directory_add_user(username, conn_max_id(c), &cred, &id);
+    }
+    if (rc != DIR_OK) {
+        client_log("[CREATE ACCOUNT] User: %.16s → %s", username,
+                   rc == DIR_EXISTS     ? "already exists" :
+                   rc == DIR_UNASSIGNED ? "no server id yet" : "no ids left");
+        conn_error(c, RES_USER, CRUD_CREATE,
+                   rc == DIR_EXISTS     ? STATUS_ALREADY_EXISTS :
+                   rc == DIR_UNASSIGNED ? STATUS_SERVICE_UNAVAILABLE
+                                        : STATUS_RESOURCE_EXHAUSTED);
+        return;
+    }
+    persist_commit_dir();   // the id must survive a crash once it is ACKed
 
-    client_log("[CREATE ACCOUNT] User: %.16s → ID: %d",
-               acc->username, acc->client_id);
+    client_log("[CREATE ACCOUNT] User: %.16s → ID: %u", username, id);
 
-    send_binary_msg(sock, RES_USER, CRUD_CREATE, IS_ACK,
-                    buffer, sizeof(AccountCreatePayload));
+    uint32_t n;
+    if (conn_wide(c)) {
+        acc3.client_id = id;
+        n = account_create_v3_encode(&acc3, buffer);
+    } else {
+        acc.client_id = (uint8_t)id;
+        n = account_create_encode(&acc, buffer);
+    }
+    conn_send(c, RES_USER, CRUD_CREATE, IS_ACK, buffer, n);
 }
 
 // spec row 10/11 (Login) and 12/13 (Logout)
 // RECV: res=00010  crud=10  ack=0  — both share these header bits
 // SEND: res=00010  crud=10  ack=1
 // Differentiated by status byte: 0x00=Login, 0x01=Logout
-void handle_login_logout(int sock, uint8_t *buffer) {
-    LoginLogoutPayload *lp = (LoginLogoutPayload *)buffer;
+void handle_login_logout(ClientConn *c, uint8_t *buffer, uint32_t plen) {
+    LoginLogoutPayload lp;
+    if (login_logout_decode(&lp, buffer, plen) < 0) {
+        conn_error(c, RES_USER, CRUD_UPDATE, STATUS_MALFORMED_REQUEST);
+        return;
+    }
 
-    if (lp->status == STATUS_LOGIN) {
+    uint8_t ack_flags = 0;
+
+    if (lp.status == STATUS_LOGIN) {
+        if (!conn_check_password(c, lp.username, lp.password)) {
+            client_log("[LOGIN]  User: %.16s  → wrong password", lp.username);
+            conn_error(c, RES_USER, CRUD_UPDATE, STATUS_INVALID_CREDENTIALS);
+            return;
+        }
         char ip_str[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &lp->client_ip, ip_str, sizeof(ip_str));
-        client_log("[LOGIN]  User: %.16s  IP: %s", lp->username, ip_str);
-    } else if (lp->status == STATUS_LOGOUT) {
-        client_log("[LOGOUT] User: %.16s", lp->username);
+        inet_ntop(AF_INET, &lp.client_ip, ip_str, sizeof(ip_str));
+        memcpy(c->user, lp.username, sizeof(c->user));
+        if (c->req_flags & HDR_FLAG_COMPRESS_OK) {
+            c->compress = 1;
+            ack_flags  |= HDR_FLAG_COMPRESS_OK;
+        }
+        // Only accounts have presence; a name without one just logs in
+        uint32_t id;
+        if (directory_lookup_user(lp.username, &id)) {
+            presence_login(c, id, (c->req_flags & HDR_FLAG_PRESENCE) != 0);
+            if (c->presence.fd >= 0 && (c->req_flags & HDR_FLAG_PRESENCE))
+                ack_flags |= HDR_FLAG_PRESENCE;
+        } else {
+            presence_logout(c);
+        }
+        client_log("[LOGIN]  User: %.16s  IP: %s%s%s", lp.username, ip_str,
+                   c->compress ? "  (compressed)" : "",
+                   ack_flags & HDR_FLAG_PRESENCE ? "  (presence)" : "");
+    } else if (lp.status == STATUS_LOGOUT) {
+        memset(c->user, 0, sizeof(c->user));
+        presence_logout(c);
+        client_log("[LOGOUT] User: %.16s", lp.username);
     } else {
         client_log("[LOGIN/LOGOUT] User: %.16s  Unknown status: 0x%02X",
-                   lp->username, lp->status);
+                   lp.username, lp.status);
     }
 
-    send_binary_msg(sock, RES_USER, CRUD_UPDATE, IS_ACK,
-                    buffer, sizeof(LoginLogoutPayload));
+    conn_send_raw(c, RES_USER, CRUD_UPDATE, IS_ACK, ack_flags,
+                  buffer, login_logout_encode(&lp, buffer));
 }
 
 // spec row 20/21 — User Read
 // RECV: res=00010  crud=01  ack=0
 // SEND: res=00010  crud=01  ack=1
-void handle_user_read(int sock, uint8_t *buffer) {
-    UserReadPayload *ur = (UserReadPayload *)buffer;
-    client_log("[USER READ] Auth: %.16s  Lookup: %.16s",
-               ur->username, ur->username_for_user_id);
-
-    // TODO: ur->user_id = lookup_user_id(ur->username_for_user_id);
+void handle_user_read(ClientConn *c, uint8_t *buffer, uint32_t plen) {
+    UserReadPayload   ur;
+    UserReadPayloadV3 ur3;
+    int ok = conn_wide(c) ? user_read_v3_decode(&ur3, buffer, plen) >= 0
+                          : user_read_decode(&ur, buffer, plen) >= 0;
+    if (!ok) {
+        conn_error(c, RES_USER, CRUD_READ, STATUS_MALFORMED_REQUEST);
+        return;
+    }
+    const char *username = conn_wide(c) ? ur3.username : ur.username;
+    const char *lookup   = conn_wide(c) ? ur3.username_for_user_id
+                                        : ur.username_for_user_id;
+    client_log("[USER READ] Auth: %.16s  Lookup: %.16s", username, lookup);
+
+    uint32_t id;
+    if (!directory_lookup_user(lookup, &id) || id > conn_max_id(c)) {
+        conn_error(c, RES_USER, CRUD_READ, STATUS_NOT_FOUND);
+        return;
+    }
 
-    send_binary_msg(sock, RES_USER, CRUD_READ, IS_ACK,
-                    buffer, sizeof(UserReadPayload));
+    uint32_t n;
+    if (conn_wide(c)) {
+        ur3.user_id = id;
+        n = user_read_v3_encode(&ur3, buffer);
+    } else {
+        ur.user_id = (uint8_t)id;
+        n = user_read_encode(&ur, buffer);
+    }
+    conn_send(c, RES_USER, CRUD_READ, IS_ACK, buffer, n);
 }
 
 // spec row 15/16 — Channel Read
 // RECV: res=00100  crud=01  ack=0
 // SEND: res=00100  crud=01  ack=1
-void handle_channel_read(int sock, uint8_t *buffer, uint32_t plen) {
-    ChannelReadHeader *cr = (ChannelReadHeader *)buffer;
-    client_log("[CHANNEL READ] Auth: %.16s  Channel: %.16s  ID: %d",
-               cr->username, cr->channel_name, cr->channel_id);
+// A v0.2 client only sees channels and members with IDs up to 255.
+void handle_channel_read(ClientConn *c, uint8_t *buffer, uint32_t plen) {
+    ChannelReadHeader   cr;
+    ChannelReadHeaderV3 cr3;
+    int ok = conn_wide(c) ? channel_read_v3_decode(&cr3, buffer, plen) >= 0
+                          : channel_read_decode(&cr, buffer, plen) >= 0;
+    if (!ok) {
+        conn_error(c, RES_CHANNEL, CRUD_READ, STATUS_MALFORMED_REQUEST);
+        return;
+    }
+    const char *name = conn_wide(c) ? cr3.channel_name : cr.channel_name;
+    client_log("[CHANNEL READ] Auth: %.16s  Channel: %.16s",
+               conn_wide(c) ? cr3.username : cr.username, name);
+
+    uint32_t id;
+    if (!directory_find_channel(name, &id) || id > conn_max_id(c)) {
+        conn_error(c, RES_CHANNEL, CRUD_READ, STATUS_NOT_FOUND);
+        return;
+    }
 
-    // TODO: fill in user_id_array_length and user_id_array
+    // Member list is written in place after the header; buffer is BUFFER_SIZE
+    uint32_t hdr = conn_wide(c) ? CHANNEL_READ_V3_SIZE : CHANNEL_READ_SIZE;
+    uint32_t cap = id_list_cap(c, hdr);
+    uint32_t *ids = malloc(cap * sizeof(uint32_t));
+    if (!ids) {
+        conn_error(c, RES_CHANNEL, CRUD_READ, STATUS_INTERNAL_ERROR);
+        return;
+    }
+    uint32_t n    = directory_channel_members(id, conn_max_id(c), ids, cap);
+    uint32_t used = put_id_list(c, buffer + hdr, ids, n);
+    free(ids);
+
+    if (conn_wide(c)) {
+        cr3.channel_id           = id;
+        cr3.user_id_array_length = n;
+        channel_read_v3_encode(&cr3, buffer);
+    } else {
+        cr.channel_id           = (uint8_t)id;
+        cr.user_id_array_length = (uint8_t)n;
+        channel_read_encode(&cr, buffer);
+    }
 
-    send_binary_msg(sock, RES_CHANNEL, CRUD_READ, IS_ACK, buffer, plen);
+    conn_send(c, RES_CHANNEL, CRUD_READ, IS_ACK, buffer, hdr + used);
 }
 
 // spec row 22/23 — Channels Read
 // RECV: res=00101  crud=10  ack=0
 // SEND: res=00101  crud=10  ack=1
-void handle_channels_read(int sock, uint8_t *buffer, uint32_t plen) {
-    ChannelsReadHeader *cr = (ChannelsReadHeader *)buffer;
-    client_log("[CHANNELS READ] Auth: %.16s", cr->username);
+void handle_channels_read(ClientConn *c, uint8_t *buffer, uint32_t plen) {
+    ChannelsReadHeader   cr;
+    ChannelsReadHeaderV3 cr3;
+    int ok = conn_wide(c) ? channels_read_v3_decode(&cr3, buffer, plen) >= 0
+                          : channels_read_decode(&cr, buffer, plen) >= 0;
+    if (!ok) {
+        conn_error(c, RES_CHANNELS, CRUD_UPDATE, STATUS_MALFORMED_REQUEST);
+        return;
+    }
+    client_log("[CHANNELS READ] Auth: %.16s", conn_wide(c) ? cr3.username : cr.username);
+
+    uint32_t user   = conn_user_id(c);
+    int      unread = user && (c->req_flags & HDR_FLAG_UNREAD);
+
+    // With unread counts each channel costs 4 more bytes
+    uint32_t hdr = conn_wide(c) ? CHANNELS_READ_V3_SIZE : CHANNELS_READ_SIZE;
+    uint32_t cap = unread ? (BUFFER_SIZE - hdr) / (conn_wide(c) ? 8 : 5) : id_list_cap(c, hdr);
+    if (!conn_wide(c) && cap > PROTO_V2_MAX_ID) cap = PROTO_V2_MAX_ID;
+    uint32_t *ids   = malloc(cap * sizeof(uint32_t));
+    uint64_t *marks = unread ? malloc(cap * sizeof(uint64_t)) : NULL;
+    if (!ids || (unread && !marks)) {
+        free(ids);
+        free(marks);
+        conn_error(c, RES_CHANNELS, CRUD_UPDATE, STATUS_INTERNAL_ERROR);
+        return;
+    }
+    uint32_t n    = directory_channel_list(conn_max_id(c), ids, cap);
+    uint32_t used = put_id_list(c, buffer + hdr, ids, n);
+
+    if (unread) {
+        readmark_fill(user, ids, n, marks);
+        for (uint32_t i = 0; i < n; i++) {
+            uint64_t count = store_count_since(ids[i], marks[i]);
+            store_be32(buffer + hdr + used, count > UINT32_MAX ? UINT32_MAX : (uint32_t)count);
+            used += 4;
+        }
+    }
+    free(ids);
+    free(marks);
 
-    // TODO: fill cr->channel_list_length and channel list bytes
+    if (conn_wide(c)) {
+        cr3.channel_list_length = n;
+        channels_read_v3_encode(&cr3, buffer);
+    } else {
+        cr.channel_list_length = (uint8_t)n;
+        channels_read_encode(&cr, buffer);
+    }
 
-    send_binary_msg(sock, RES_CHANNELS, CRUD_UPDATE, IS_ACK, buffer, plen);
+    conn_send_flags(c, RES_CHANNELS, CRUD_UPDATE, IS_ACK, unread ? HDR_FLAG_UNREAD : 0,
+                    buffer, hdr + used);
 }
 
 // spec row 17 — Message Create  (no ACK)
 // RECV: res=00110  crud=00  ack=0
-void handle_message_create(int sock, uint8_t *buffer) {
-    (void)sock;
-    MessageCreateHeader *mc = (MessageCreateHeader *)buffer;
-    client_log("[MSG CREATE] Auth: %.16s  Channel: %d  MsgLen: %d",
-               mc->username, mc->channel_id, mc->message_length);
+void handle_message_create(ClientConn *c, uint8_t *buffer, uint32_t plen) {
+    MessageCreateHeaderV3 mc;   // v0.2 is widened into it
+    int hdr;
+
+    if (conn_wide(c)) {
+        hdr = message_create_v3_decode(&mc, buffer, plen);
+    } else {
+        MessageCreateHeader v2;
+        hdr = message_create_decode(&v2, buffer, plen);
+        if (hdr >= 0) {
+            memcpy(mc.username, v2.username, sizeof(mc.username));
+            mc.timestamp      = v2.timestamp;
+            mc.message_length = v2.message_length;
+            mc.channel_id     = v2.channel_id;
+        }
+    }
+
+    if (hdr < 0 || mc.message_length > plen - (uint32_t)hdr) {
+        client_log("[MSG CREATE] bad length in %u-byte payload", plen);
+        conn_error(c, RES_MESSAGE, CRUD_CREATE, STATUS_MALFORMED_REQUEST);
+        return;
+    }
+    if (mc.message_length > STORE_MAX_TEXT) {
+        client_log("[MSG CREATE] %u-byte message is over %u, refused",
+                   mc.message_length, (unsigned)STORE_MAX_TEXT);
+        conn_error(c, RES_MESSAGE, CRUD_CREATE, STATUS_MESSAGE_TOO_LARGE);
+        return;
+    }
+
+    uint32_t sender_id = 0;
+    directory_lookup_user(mc.username, &sender_id);
+    if (directory_touch_channel(mc.channel_id, sender_id) != DIR_OK) {
+        client_log("[MSG CREATE] Channel %u refused: channel limit reached", mc.channel_id);
+        conn_error(c, RES_MESSAGE, CRUD_CREATE, STATUS_RESOURCE_EXHAUSTED);
+        return;
+    }
+    persist_commit_dir();   // only waits if the channel or its members changed
+
+    uint64_t seq = store_append(mc.channel_id, mc.username, sender_id, mc.timestamp,
+                                (const char *)(buffer + hdr), mc.message_length);
+    if (seq == 0) {
+        conn_error(c, RES_MESSAGE, CRUD_CREATE, STATUS_RESOURCE_EXHAUSTED);
+        return;
+    }
+    // Posting into a channel one has read up to the end keeps it read
+    readmark_advance_from(conn_user_id(c), mc.channel_id, seq - 1, seq);
 
-    // TODO: store message
+    client_log("[MSG CREATE] Auth: %.16s  Channel: %u  MsgLen: %u  Seq: %llu",
+               mc.username, mc.channel_id, mc.message_length, (unsigned long long)seq);
 }
 
 // spec row 18/19 — Message Read
 // RECV: res=00110  crud=01  ack=0
 // SEND: res=00110  crud=01  ack=1
-void handle_message_read(int sock, uint8_t *buffer, uint32_t plen) {
-    MessageReadHeader *mr = (MessageReadHeader *)buffer;
-    client_log("[MSG READ] Auth: %.16s  Channel: %d  Sender: %d",
-               mr->username, mr->channel_id, mr->user_id_of_sender);
+void handle_message_read(ClientConn *c, uint8_t *buffer, uint32_t plen) {
+    if (conn_wide(c)) {
+        MessageReadHeaderV3 mr;
+        if (message_read_v3_decode(&mr, buffer, plen) < 0) {
+            conn_error(c, RES_MESSAGE, CRUD_READ, STATUS_MALFORMED_REQUEST);
+            return;
+        }
+        client_log("[MSG READ] Auth: %.16s  Channel: %u  Sender: %u",
+                   mr.username, mr.channel_id, mr.user_id_of_sender);
+    } else {
+        MessageReadHeader mr;
+        if (message_read_decode(&mr, buffer, plen) < 0) {
+            conn_error(c, RES_MESSAGE, CRUD_READ, STATUS_MALFORMED_REQUEST);
+            return;
+        }
+        client_log("[MSG READ] Auth: %.16s  Channel: %d  Sender: %d",
+                   mr.username, mr.channel_id, mr.user_id_of_sender);
+    }
 
     // TODO: retrieve message from store and fill buffer
 
-    send_binary_msg(sock, RES_MESSAGE, CRUD_READ, IS_ACK, buffer, plen);
+    conn_send(c, RES_MESSAGE, CRUD_READ, IS_ACK, buffer, plen);
+}
+
+// Message Sync — everything in a channel after the client's cursor
+// RECV: res=00111  crud=01  ack=0
+// SEND: res=00111  crud=01  ack=1
+// v0.2 and v0.3 headers differ only in the width of channel_id: a v0.2
+// request is widened on the way in and narrowed again for the reply.
+void handle_message_sync(ClientConn *c, uint8_t *buffer, uint32_t plen) {
+    int                 wide = conn_wide(c);
+    MessageSyncHeader   v2;
+    MessageSyncHeaderV3 req;
+    int                 hdr;
+
+    if (wide) {
+        hdr = message_sync_v3_decode(&req, buffer, plen);
+    } else {
+        hdr = message_sync_decode(&v2, buffer, plen);
+        if (hdr >= 0) {
+            memcpy(req.username, v2.username, sizeof(req.username));
+            req.channel_id  = v2.channel_id;
+            req.since_seq   = v2.since_seq;
+            req.max_records = v2.max_records;
+        }
+    }
+    if (hdr < 0) {
+        conn_error(c, RES_MESSAGES, CRUD_READ, STATUS_MALFORMED_REQUEST);
+        return;
+    }
+
+    uint64_t since = req.since_seq;
+    uint32_t max   = req.max_records;
+    if (max == 0)                max = SYNC_DEFAULT_RECORDS;
+    if (max > SYNC_MAX_RECORDS)  max = SYNC_MAX_RECORDS;
+
+    uint8_t *resp = malloc(SYNC_RESPONSE_MAX);
+    if (!resp) {
+        conn_error(c, RES_MESSAGES, CRUD_READ, STATUS_INTERNAL_ERROR);
+        return;
+    }
+
+    uint16_t count = 0;
+    uint32_t used  = store_read_since(req.channel_id, since, max, wide,
+                                      resp + hdr, SYNC_RESPONSE_MAX - (uint32_t)hdr,
+                                      &count);
+    uint64_t head  = store_head_seq(req.channel_id);
+
+    // Records come back in consecutive seq order, the first one leading.
+    // since is the client's word, so it never marks past the head, and a
+    // channel with nothing in it (or none at all) gets no marker.
+    uint64_t read = since;
+    if (count > 0) read = load_be64(resp + hdr) + count - 1;
+    if (read > head) read = head;
+    if (head > 0) readmark_advance(conn_user_id(c), req.channel_id, read);
+
+    if (wide) {
+        req.record_count = count;
+        req.head_seq     = head;
+        message_sync_v3_encode(&req, resp);
+    } else {
+        v2.record_count = count;
+        v2.head_seq     = head;
+        message_sync_encode(&v2, resp);
+    }
+
+    client_log("[MSG SYNC] Auth: %.16s  Channel: %u  Since: %llu  Records: %u",
+               req.username, req.channel_id, (unsigned long long)since, count);
+
+    conn_send(c, RES_MESSAGES, CRUD_READ, IS_ACK, resp, (uint32_t)hdr + used);
+    free(resp);
+}
+
+// Presence Read — which members of a channel are online
+// RECV: res=01001  crud=01  ack=0
+// SEND: res=01001  crud=01  ack=1
+// Same payload as Channel Read; the member list holds online users only.
+void handle_presence_read(ClientConn *c, uint8_t *buffer, uint32_t plen) {
+    ChannelReadHeader   cr;
+    ChannelReadHeaderV3 cr3;
+    int ok = conn_wide(c) ? channel_read_v3_decode(&cr3, buffer, plen) >= 0
+                          : channel_read_decode(&cr, buffer, plen) >= 0;
+    if (!ok) {
+        conn_error(c, RES_PRESENCE, CRUD_READ, STATUS_MALFORMED_REQUEST);
+        return;
+    }
+    const char *name = conn_wide(c) ? cr3.channel_name : cr.channel_name;
+    client_log("[PRESENCE READ] Auth: %.16s  Channel: %.16s",
+               conn_wide(c) ? cr3.username : cr.username, name);
+
+    uint32_t id;
+    if (!directory_find_channel(name, &id) || id > conn_max_id(c)) {
+        conn_error(c, RES_PRESENCE, CRUD_READ, STATUS_NOT_FOUND);
+        return;
+    }
+
+    uint32_t hdr = conn_wide(c) ? CHANNEL_READ_V3_SIZE : CHANNEL_READ_SIZE;
+    uint32_t cap = id_list_cap(c, hdr);
+    uint32_t *ids = malloc(cap * sizeof(uint32_t));
+    if (!ids) {
+        conn_error(c, RES_PRESENCE, CRUD_READ, STATUS_INTERNAL_ERROR);
+        return;
+    }
+    uint32_t total = directory_channel_members(id, conn_max_id(c), ids, cap);
+    uint32_t n     = 0;
+    for (uint32_t i = 0; i < total; i++)
+        if (presence_online(ids[i])) ids[n++] = ids[i];
+    uint32_t used = put_id_list(c, buffer + hdr, ids, n);
+    free(ids);
+
+    if (conn_wide(c)) {
+        cr3.channel_id           = id;
+        cr3.user_id_array_length = n;
+        channel_read_v3_encode(&cr3, buffer);
+    } else {
+        cr.channel_id           = (uint8_t)id;
+        cr.user_id_array_length = (uint8_t)n;
+        channel_read_encode(&cr, buffer);
+    }
+
+    conn_send(c, RES_PRESENCE, CRUD_READ, IS_ACK, buffer, hdr + used);
+}
+
+// Search — messages of a channel containing every word of a query
+// RECV: res=01010  crud=01  ack=0
+// SEND: res=01010  crud=01  ack=1
+// Like Message Sync, a v0.2 request is widened on the way in and narrowed
+// again for the reply.
+void handle_search(ClientConn *c, uint8_t *buffer, uint32_t plen) {
+    int            wide = conn_wide(c);
+    SearchHeader   v2;
+    SearchHeaderV3 req;
+    int            hdr;
+
+    if (wide) {
+        hdr = search_v3_decode(&req, buffer, plen);
+    } else {
+        hdr = search_decode(&v2, buffer, plen);
+        if (hdr >= 0) {
+            memcpy(req.username, v2.username, sizeof(req.username));
+            req.channel_id   = v2.channel_id;
+            req.before_seq   = v2.before_seq;
+            req.max_results  = v2.max_results;
+            req.query_length = v2.query_length;
+        }
+    }
+    if (hdr < 0 || req.query_length > plen - (uint32_t)hdr) {
+        conn_error(c, RES_SEARCH, CRUD_READ, STATUS_MALFORMED_REQUEST);
+        return;
+    }
+
+    uint32_t max = req.max_results;
+    if (max == 0)                  max = SEARCH_DEFAULT_RESULTS;
+    if (max > SEARCH_MAX_RESULTS)  max = SEARCH_MAX_RESULTS;
+
+    uint64_t hits[SEARCH_MAX_RESULTS];
+    uint64_t indexed;
+    uint32_t n = search_query(req.channel_id, (const char *)buffer + hdr, req.query_length,
+                              req.before_seq, hits, max, &indexed);
+
+    client_log("[SEARCH] Auth: %.16s  Channel: %u  Query: %.*s  Hits: %u",
+               req.username, req.channel_id, (int)(req.query_length < 64 ? req.query_length : 64),
+               (const char *)buffer + hdr, n);
+
+    // The hits overwrite the query, which is no longer needed
+    for (uint32_t i = 0; i < n; i++)
+        store_be64(buffer + hdr + (size_t)i * 8, hits[i]);
+
+    if (wide) {
+        req.query_length = 0;
+        req.result_count = (uint16_t)n;
+        req.indexed_seq  = indexed;
+        search_v3_encode(&req, buffer);
+    } else {
+        v2.query_length = 0;
+        v2.result_count = (uint16_t)n;
+        v2.indexed_seq  = indexed;
+        search_encode(&v2, buffer);
+    }
+    conn_send(c, RES_SEARCH, CRUD_READ, IS_ACK, buffer, (uint32_t)hdr + n * 8);
+}
+
+// Drains the presence inbox into one unsolicited Presence Update
+static void conn_flush_presence(ClientConn *c) {
+    PresenceChange changes[PRESENCE_MAX_RECORDS];
+    uint8_t        truncated;
+    uint32_t       n = presence_take(c, changes, &truncated);
+
+    uint8_t  out[PRESENCE_UPDATE_SIZE + PRESENCE_MAX_RECORDS * PRESENCE_RECORD_V3_SIZE];
+    uint32_t used  = PRESENCE_UPDATE_SIZE;
+    uint16_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (conn_wide(c)) {
+            PresenceRecordV3 r = { .user_id = changes[i].user_id, .online = changes[i].online };
+            used += presence_record_v3_encode(&r, out + used);
+        } else if (changes[i].user_id <= PROTO_V2_MAX_ID) {
+            PresenceRecord r = { .user_id = (uint8_t)changes[i].user_id, .online = changes[i].online };
+            used += presence_record_encode(&r, out + used);
+        } else {
+            continue;
+        }
+        count++;
+    }
+    if (count == 0 && !truncated) return;
+
+    PresenceUpdateHeader ph = {
+        .flags        = truncated ? PRESENCE_TRUNCATED : 0,
+        .record_count = count
+    };
+    presence_update_encode(&ph, out);
+    conn_send(c, RES_PRESENCE, CRUD_UPDATE, IS_ACK, out, used);
+}
+
+// ===========================================================================
+// Rate limiting
+// ===========================================================================
+
+// Checks the per-connection bucket, then the per-user bucket once the
+// connection has logged in. Rejections are logged sparsely (1st, 10th,
+// 100th, ...) so a flood costs no UI or manager traffic of its own.
+static int conn_admit(ClientConn *c, uint8_t res_type, uint8_t crud) {
+    int op = rate_op_for(res_type, crud);
+    if (op < 0) return 1;
+
+    const char *scope = NULL;
+    if (!rate_admit_conn(&c->limits, op))
+        scope = "connection";
+    else if (c->user[0] && !rate_admit_user(c->user, op))
+        scope = "user";
+    if (!scope) return 1;
+
+    uint32_t n = ++c->rl_dropped;
+    uint32_t p = 1;
+    while (p < n && p <= UINT32_MAX / 10) p *= 10;
+    if (p == n)
+        client_log("[RATE LIMIT] %s — %s limit on res=%d crud=%d (%u refused)",
+                   c->peer, scope, res_type, crud, n);
+    return 0;
+}
+
+// ===========================================================================
+// Framing with read deadlines
+// ===========================================================================
+
+static const char *stage_name(DeadlineStage s) {
+    switch (s) {
+        case DEADLINE_IDLE:    return "idle";
+        case DEADLINE_HEADER:  return "header-read";
+        case DEADLINE_PAYLOAD: return "payload-read";
+        default:               return "none";
+    }
+}
+
+// Timer thread: the owning thread is blocked in recv. Only the read side
+// is shut down, so recv returns and the owning thread, which does every
+// send on the socket, tells the peer why before it closes.
+static void conn_deadline_fired(TimerEntry *t) {
+    ClientConn *c = t->arg;
+    atomic_store(&c->timed_out, 1);
+    shutdown(c->sock, SHUT_RD);
+}
+
+static void conn_deadline(ClientConn *c, DeadlineStage stage, uint32_t ms) {
+    c->stage = stage;
+    timer_arm(&c->deadline, ms);
+}
+
+// Idle, subscribed to presence: 1 when the presence inbox has news, 0 once
+// the socket is readable (or closed, or shut down by the deadline).
+static int conn_wait_idle(ClientConn *c) {
+    struct pollfd fds[2] = {
+        { .fd = c->sock,          .events = POLLIN },
+        { .fd = c->presence.fd,   .events = POLLIN }
+    };
+    while (poll(fds, 2, -1) < 0)
+        if (errno != EINTR) return 0;
+    return (fds[1].revents & POLLIN) && !(fds[0].revents & (POLLIN | POLLHUP | POLLERR));
+}
+
+// Same contract as recv_binary_msg, with one deadline per phase of the
+// frame. Re-arming moves the entry within the wheel, so each phase costs
+// O(1) regardless of how many connections are open.
+static int conn_recv_frame(ClientConn *c, GlobalHeader *h, void *pay, uint32_t max) {
+    uint8_t raw[HEADER_SIZE];
+    ssize_t n;
+
+    conn_deadline(c, DEADLINE_IDLE, conn_idle_timeout_ms);
+    while (c->presence.fd >= 0 && conn_wait_idle(c) > 0)
+        conn_flush_presence(c);
+    if (recv(c->sock, raw, 1, 0) <= 0) return -1;
+    if (trace_sample) c->first_tick = trace_ticks();
+
+    conn_deadline(c, DEADLINE_HEADER, conn_header_timeout_ms);
+    n = recv(c->sock, raw + 1, HEADER_SIZE - 1, MSG_WAITALL);
+    if (n != HEADER_SIZE - 1) return -1;
+
+    header_decode(h, raw);
+    uint32_t len = h->message_length;
+    if (len > max) return -2;
+
+    if (len > 0) {
+        conn_deadline(c, DEADLINE_PAYLOAD, conn_payload_timeout_ms);
+        n = recv(c->sock, pay, len, MSG_WAITALL);
+        if (n != (ssize_t)len) return -1;
+    }
+    capture_frame(c->capture, raw, pay, len);
+
+    // The deadline may have fired just as the frame completed; the read
+    // side is gone then, so the connection ends as timed out in this stage
+    timer_cancel_sync(&c->deadline);
+    if (atomic_load(&c->timed_out)) return -1;
+    c->stage = DEADLINE_NONE;
+    return (int)len;
+}
+
+// ===========================================================================
+// Live connections — so server_stop can close them
+// ===========================================================================
+
+static ClientConn     *live_conns;
+static int             live_closing;
+static pthread_mutex_t live_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int conn_register(ClientConn *c) {
+    pthread_mutex_lock(&live_mutex);
+    int ok = !live_closing;
+    if (ok) {
+        c->prev = NULL;
+        c->next = live_conns;
+        if (live_conns) live_conns->prev = c;
+        live_conns = c;
+    }
+    pthread_mutex_unlock(&live_mutex);
+    return ok ? 0 : -1;
+}
+
+static void conn_unregister(ClientConn *c) {
+    pthread_mutex_lock(&live_mutex);
+    if (c->prev) c->prev->next = c->next;
+    else         live_conns    = c->next;
+    if (c->next) c->next->prev = c->prev;
+    pthread_mutex_unlock(&live_mutex);
+}
+
+void client_set_closing(int closing) {
+    pthread_mutex_lock(&live_mutex);
+    live_closing = closing;
+    if (closing)
+        for (ClientConn *c = live_conns; c; c = c->next)
+            shutdown(c->sock, SHUT_RDWR);   // its recv / send returns
+    pthread_mutex_unlock(&live_mutex);
 }
 
 // ===========================================================================
 // Dispatch loop — reads header, routes to the correct handler above
 // ===========================================================================
+
+// Checks 1–7 on a received frame. Returns 1 with *buffer / *plen pointing
+// at the (inflated) payload to dispatch, or 0 once it has been refused.
+static int conn_check_frame(ClientConn *c, const GlobalHeader *h, uint8_t *wire,
+                            uint8_t *inflated, uint8_t **buffer, uint32_t *plen)
+{
+    const char *peer = c->peer;
+
+    // ------------------------------------------------------------------
+    // Checks 1–2 (frame.c): version, pinned on the first valid frame,
+    // and REQ frames only
+    // ------------------------------------------------------------------
+    uint8_t st = frame_check_header(h, c->minor);
+    if (st != STATUS_OK) {
+        if (st == STATUS_INVALID_VERSION)
+            client_log("[REJECT] %s — wrong version %d.%d",
+                       peer, h->version_major, h->version_minor);
+        else
+            client_log("[REJECT] %s — client sent an ACK frame", peer);
+        conn_error(c, h->resource_type, h->crud, st);
+        return 0;
+    }
+    c->minor = h->version_minor;
+
+    // ------------------------------------------------------------------
+    // Compressed payload: only after negotiation, inflated in place of
+    // the wire bytes so the checks below see the real size
+    // ------------------------------------------------------------------
+    if (h->flags & HDR_FLAG_COMPRESSED) {
+        int n = c->compress ? decompress_payload(wire, *plen, inflated, BUFFER_SIZE) : -1;
+        if (n < 0) {
+            client_log("[REJECT] %s — bad compressed payload", peer);
+            conn_error(c, h->resource_type, h->crud, STATUS_MALFORMED_REQUEST);
+            return 0;
+        }
+        *buffer = inflated;
+        *plen   = (uint32_t)n;
+    }
+
+    // ------------------------------------------------------------------
+    // Checks 3–5 (frame.c): payload size, message size, known opcode
+    // ------------------------------------------------------------------
+    st = frame_check_payload(h, *plen);
+    if (st != STATUS_OK) {
+        if (st == STATUS_INVALID_TYPE)
+            client_log("[REJECT] %s — unknown type: res=%d crud=%d",
+                       peer, h->resource_type, h->crud);
+        else
+            client_log("[REJECT] %s — %spayload too large: %u bytes", peer,
+                       st == STATUS_MESSAGE_TOO_LARGE ? "message " : "", *plen);
+        conn_error(c, h->resource_type, h->crud, st);
+        return 0;
+    }
+
+    // ------------------------------------------------------------------
+    // Check 6: standby / load shedding — a standby serves nobody until
+    // activated; while saturated only logged-in sessions are served
+    // (status 0x81 ReceiverServiceUnavailable)
+    // ------------------------------------------------------------------
+    if (server_standby || (!c->user[0] && admission_saturated())) {
+        conn_error(c, h->resource_type, h->crud, STATUS_SERVICE_UNAVAILABLE);
+        return 0;
+    }
+
+    // ------------------------------------------------------------------
+    // Check 7: per-connection / per-user rate  (status 0x82 ReceiverResourceExhausted)
+    // ------------------------------------------------------------------
+    if (!conn_admit(c, h->resource_type, h->crud)) {
+        conn_error(c, h->resource_type, h->crud, STATUS_RESOURCE_EXHAUSTED);
+        return 0;
+    }
+    return 1;
+}
+
+static void conn_dispatch(ClientConn *c, const GlobalHeader *h,
+                          uint8_t *buffer, uint32_t plen)
+{
+    if      (h->resource_type == RES_USER     && h->crud == CRUD_CREATE)
+        handle_create_account(c, buffer, plen);
+    else if (h->resource_type == RES_USER     && h->crud == CRUD_UPDATE)
+        handle_login_logout(c, buffer, plen);
+    else if (h->resource_type == RES_USER     && h->crud == CRUD_READ)
+        handle_user_read(c, buffer, plen);
+    else if (h->resource_type == RES_CHANNEL  && h->crud == CRUD_READ)
+        handle_channel_read(c, buffer, plen);
+    else if (h->resource_type == RES_CHANNELS && h->crud == CRUD_UPDATE)
+        handle_channels_read(c, buffer, plen);
+    else if (h->resource_type == RES_MESSAGE  && h->crud == CRUD_CREATE)
+        handle_message_create(c, buffer, plen);
+    else if (h->resource_type == RES_MESSAGE  && h->crud == CRUD_READ)
+        handle_message_read(c, buffer, plen);
+    else if (h->resource_type == RES_MESSAGES && h->crud == CRUD_READ)
+        handle_message_sync(c, buffer, plen);
+    else if (h->resource_type == RES_PRESENCE && h->crud == CRUD_READ)
+        handle_presence_read(c, buffer, plen);
+    else if (h->resource_type == RES_SEARCH   && h->crud == CRUD_READ)
+        handle_search(c, buffer, plen);
+}
+
 void* handle_client(void *arg) {
-    int sock = *(int *)arg;
+    ClientConn conn = { .sock = *(int *)arg };
+    ClientConn *c   = &conn;
+    int sock        = c->sock;
     free(arg);
 
+    c->deadline.fire = conn_deadline_fired;
+    c->deadline.arg  = c;
+    offload_queue_init(&c->offload);   // without an eventfd work runs inline
+    presence_init(&c->presence);
+
     struct sockaddr_in addr;
     socklen_t alen = sizeof(addr);
     getpeername(sock, (struct sockaddr *)&addr, &alen);
-    char peer[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &addr.sin_addr, peer, sizeof(peer));
+    char *peer = c->peer;
+    inet_ntop(AF_INET, &addr.sin_addr, peer, sizeof(c->peer));
     client_log("[CONNECT] %s", peer);
+    c->capture = capture_session_open();
 
     GlobalHeader h;
-    uint8_t buffer[BUFFER_SIZE];
-
-    while (recv_binary_msg(sock, &h, buffer, BUFFER_SIZE) >= 0) {
-        uint32_t plen = ntohl(h.message_length);
-
-        // ------------------------------------------------------------------
-        // Check 1: version must be v0.2  (status 0x40 SenderInvalidVersion)
-        // ------------------------------------------------------------------
-        if (h.version_major != PROTO_VER_MAJOR || h.version_minor != PROTO_VER_MINOR) {
-            client_log("[REJECT] %s — wrong version %d.%d",
-                       peer, h.version_major, h.version_minor);
-            send_error_response(sock, h.resource_type, h.crud, STATUS_INVALID_VERSION);
-            continue;
+    uint8_t wire[BUFFER_SIZE];
+    uint8_t inflated[BUFFER_SIZE];
+
+    int live = conn_register(c) == 0;
+    while (live && conn_recv_frame(c, &h, wire, BUFFER_SIZE) >= 0) {
+        uint64_t t0     = stats_now_us();
+        uint32_t plen   = h.message_length;
+        uint8_t *buffer = wire;
+        c->req_flags    = h.flags;
+
+        if (trace_sample) {
+            trace_begin(&c->trace, c->first_tick);
+            trace_span(TRACE_READ, c->first_tick, trace_ticks());
         }
 
-        // ------------------------------------------------------------------
-        // Check 2: server only accepts REQ frames from clients  (status 0x41 SenderInvalidType)
-        // ------------------------------------------------------------------
-        if (h.ack != IS_REQ) {
-            client_log("[REJECT] %s — client sent an ACK frame", peer);
-            send_error_response(sock, h.resource_type, h.crud, STATUS_INVALID_TYPE);
-            continue;
-        }
+        uint64_t tv = trace_enter();
+        int ok = conn_check_frame(c, &h, wire, inflated, &buffer, &plen);
+        trace_leave(TRACE_VALIDATE, tv);
 
-        // ------------------------------------------------------------------
-        // Check 3: payload must not exceed buffer  (status 0x42 SenderInvalidSize)
-        // ------------------------------------------------------------------
-        if (plen > BUFFER_SIZE) {
-            client_log("[REJECT] %s — payload too large: %u bytes", peer, plen);
-            send_error_response(sock, h.resource_type, h.crud, STATUS_INVALID_SIZE);
-            continue;
-        }
+        if (ok) {
+            uint64_t th = trace_enter();
+            conn_dispatch(c, &h, buffer, plen);
+            trace_leave(TRACE_HANDLER, th);
 
-        // ------------------------------------------------------------------
-        // Check 4: total payload must not exceed BUFFER_SIZE  (status 0x83 ReceiverMessageTooLarge)
-        // plen already covers the full payload including variable message bytes
-        // ------------------------------------------------------------------
-        if (h.resource_type == RES_MESSAGE && plen > MAX_MESSAGE_SIZE) {
-            client_log("[REJECT] %s — message payload too large: %u bytes", peer, plen);
-            send_error_response(sock, h.resource_type, h.crud, STATUS_MESSAGE_TOO_LARGE);
-            continue;
+            uint64_t took = stats_now_us() - t0;
+            stats_record(took > UINT32_MAX ? UINT32_MAX : (uint32_t)took,
+                         h.resource_type == RES_MESSAGE && h.crud == CRUD_CREATE);
         }
-
-        // ------------------------------------------------------------------
-        // Check 5: unknown resource_type+crud combination  (status 0x41 SenderInvalidType)
-        // ------------------------------------------------------------------
-        int known = (h.resource_type == RES_USER     && h.crud == CRUD_CREATE) ||
-                    (h.resource_type == RES_USER     && h.crud == CRUD_UPDATE) ||
-                    (h.resource_type == RES_USER     && h.crud == CRUD_READ)   ||
-                    (h.resource_type == RES_CHANNEL  && h.crud == CRUD_READ)   ||
-                    (h.resource_type == RES_CHANNELS && h.crud == CRUD_UPDATE) ||
-                    (h.resource_type == RES_MESSAGE  && h.crud == CRUD_CREATE) ||
-                    (h.resource_type == RES_MESSAGE  && h.crud == CRUD_READ);
-        if (!known) {
-            client_log("[REJECT] %s — unknown type: res=%d crud=%d",
-                       peer, h.resource_type, h.crud);
-            send_error_response(sock, h.resource_type, h.crud, STATUS_INVALID_TYPE);
-            continue;
-        }
-
-        // ------------------------------------------------------------------
-        // Dispatch
-        // ------------------------------------------------------------------
-        if      (h.resource_type == RES_USER     && h.crud == CRUD_CREATE)
-            handle_create_account(sock, buffer);
-        else if (h.resource_type == RES_USER     && h.crud == CRUD_UPDATE)
-            handle_login_logout(sock, buffer);
-        else if (h.resource_type == RES_USER     && h.crud == CRUD_READ)
-            handle_user_read(sock, buffer);
-        else if (h.resource_type == RES_CHANNEL  && h.crud == CRUD_READ)
-            handle_channel_read(sock, buffer, plen);
-        else if (h.resource_type == RES_CHANNELS && h.crud == CRUD_UPDATE)
-            handle_channels_read(sock, buffer, plen);
-        else if (h.resource_type == RES_MESSAGE  && h.crud == CRUD_CREATE)
-            handle_message_create(sock, buffer);
-        else if (h.resource_type == RES_MESSAGE  && h.crud == CRUD_READ)
-            handle_message_read(sock, buffer, plen);
+        if (trace_sample) trace_end(&c->trace, h.resource_type, h.crud);
     }
 
+    if (live) conn_unregister(c);
+    timer_cancel_sync(&c->deadline);
+    if (atomic_load(&c->timed_out))
+        send_error_response_nowait(sock, RES_SYSTEM, CRUD_CREATE, STATUS_TIMEOUT);
+    offload_queue_close(&c->offload);
+    presence_release(c);
+    capture_session_close(c->capture);
+    if (atomic_load(&c->timed_out))
+        client_log("[TIMEOUT] %s — %s deadline expired", peer, stage_name(c->stage));
+    if (c->rl_dropped)
+        client_log("[RATE LIMIT] %s — %u requests refused in total", peer, c->rl_dropped);
+
     client_log("[DISCONNECT] %s", peer);
     close(sock);
+    admission_release();
     return NULL;
 }
\ No newline at end of file
@@ -6,37 +6,111 @@
 #define COMP4985_CLIENT_H
 
 #include "protocol.h"
+#include "timer.h"
+#include "ratelimit.h"
+#include "offload.h"
+#include "presence.h"
+#include "trace.h"
+
+// ---------------------------------------------------------------------------
+// Read deadlines — a connection that misses one gets STATUS_TIMEOUT and is
+// closed. Idle covers the wait for the first byte of the next frame; header
+// and payload cover a frame that has started arriving. Defaults below; the
+// config file can change them before the first client connects.
+// ---------------------------------------------------------------------------
+#define CONN_IDLE_TIMEOUT_MS     300000
+#define CONN_HEADER_TIMEOUT_MS   10000
+#define CONN_PAYLOAD_TIMEOUT_MS  30000
+
+extern uint32_t conn_idle_timeout_ms;
+extern uint32_t conn_header_timeout_ms;
+extern uint32_t conn_payload_timeout_ms;
+
+typedef enum {
+    DEADLINE_NONE = 0,
+    DEADLINE_IDLE,
+    DEADLINE_HEADER,
+    DEADLINE_PAYLOAD
+} DeadlineStage;
+
+// ---------------------------------------------------------------------------
+// Per-connection state — lives on handle_client's stack for the lifetime of
+// the socket and is passed to every handler.
+// ---------------------------------------------------------------------------
+typedef struct ClientConn {
+    int     sock;
+    char    peer[INET_ADDRSTRLEN];
+    uint8_t minor;       // protocol minor pinned by the first frame, 0 before
+    uint8_t req_flags;   // flags byte of the request being handled
+    int     compress;    // payload compression negotiated at login
+    char    user[16];    // username of the last successful login, or empty
+
+    RateBuckets limits;        // per-connection token buckets
+    uint32_t    rl_dropped;    // requests refused with STATUS_RESOURCE_EXHAUSTED
+
+    TimerEntry    deadline;
+    DeadlineStage stage;       // what the armed deadline is guarding
+    _Atomic int   timed_out;   // set by the timer thread when it fires
+
+    OffloadQueue  offload;     // completions of work handed to the pool
+    PresenceInbox presence;    // online state and pending Presence Update
+    uint32_t      capture;     // capture session, 0 while capture is off
+    TraceRequest  trace;       // stage timestamps of the request in hand
+    uint64_t      first_tick;  // when its first byte arrived (tracing on)
+
+    struct ClientConn *prev, *next;   // live connection list
+} ClientConn;
+
+// Sends a reply on c, compressing the payload when negotiated and large
+// enough to be worth it.
+int conn_send(ClientConn *c, uint8_t res_type, uint8_t crud, uint8_t ack,
+              const void *pay, uint32_t len);
 
 // ---------------------------------------------------------------------------
 // Per-interaction handlers  (spec rows 8–23, Client ↔ Server)
-// Each function receives the already-read payload in buffer and replies.
+// Each function receives the already-read payload in buffer (BUFFER_SIZE
+// bytes, plen of them valid) and replies; short payloads are refused with
+// STATUS_MALFORMED_REQUEST.
 // ---------------------------------------------------------------------------
 
 // spec row  8/9  — res=00010 crud=00 ack=0  →  ack=1
-void handle_create_account(int sock, uint8_t *buffer);
+void handle_create_account(ClientConn *c, uint8_t *buffer, uint32_t plen);
 
 // spec row 10/11 — res=00010 crud=10 ack=0  status=0x00  →  ack=1
 // spec row 12/13 — res=00010 crud=10 ack=0  status=0x01  →  ack=1
-void handle_login_logout(int sock, uint8_t *buffer);
+void handle_login_logout(ClientConn *c, uint8_t *buffer, uint32_t plen);
 
 // spec row 20/21 — res=00010 crud=01 ack=0  →  ack=1
-void handle_user_read(int sock, uint8_t *buffer);
+void handle_user_read(ClientConn *c, uint8_t *buffer, uint32_t plen);
 
 // spec row 15/16 — res=00100 crud=01 ack=0  →  ack=1
-void handle_channel_read(int sock, uint8_t *buffer, uint32_t plen);
+void handle_channel_read(ClientConn *c, uint8_t *buffer, uint32_t plen);
 
 // spec row 22/23 — res=00101 crud=10 ack=0  →  ack=1
-void handle_channels_read(int sock, uint8_t *buffer, uint32_t plen);
+void handle_channels_read(ClientConn *c, uint8_t *buffer, uint32_t plen);
 
 // spec row 17   — res=00110 crud=00 ack=0  (no ACK)
-void handle_message_create(int sock, uint8_t *buffer);
+void handle_message_create(ClientConn *c, uint8_t *buffer, uint32_t plen);
 
 // spec row 18/19 — res=00110 crud=01 ack=0  →  ack=1
-void handle_message_read(int sock, uint8_t *buffer, uint32_t plen);
+void handle_message_read(ClientConn *c, uint8_t *buffer, uint32_t plen);
+
+// Message Sync   — res=00111 crud=01 ack=0  →  ack=1
+void handle_message_sync(ClientConn *c, uint8_t *buffer, uint32_t plen);
+
+// Presence Read — res=01001 crud=01
+void handle_presence_read(ClientConn *c, uint8_t *buffer, uint32_t plen);
+
+// Search        — res=01010 crud=01 ack=0  →  ack=1
+void handle_search(ClientConn *c, uint8_t *buffer, uint32_t plen);
 
 // ---------------------------------------------------------------------------
 // Dispatch loop — called once per accepted client socket
 // ---------------------------------------------------------------------------
 void* handle_client(void *arg);
 
+// closing = 1 shuts down every live connection and makes new ones close
+// straight away; 0 lets connections in again.
+void client_set_closing(int closing);
+
 #endif //COMP4985_CLIENT_H
\ No newline at end of file
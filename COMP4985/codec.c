@@ -0,0 +1,49 @@
+#include "protocol.h"
+
+// ===========================================================================
+// Generated payload codecs
+// ===========================================================================
+
+#define CODEC_FIELD_GET(enc, name)                                          \
+    CODEC_GET_##enc(m->name, p);                                            \
+    p += CODEC_SIZE_##enc;
+
+#define CODEC_FIELD_PUT(enc, name)                                          \
+    CODEC_PUT_##enc(m->name, p);                                            \
+    p += CODEC_SIZE_##enc;
+
+#define CODEC_DEFINE(Type, prefix, SIZE, FIELDS)                            \
+    int prefix##_decode(Type *m, const uint8_t *p, uint32_t len) {          \
+        if (len < SIZE) return -1;                                          \
+        FIELDS(CODEC_FIELD_GET)                                             \
+        return SIZE;                                                        \
+    }                                                                       \
+    uint32_t prefix##_encode(const Type *m, uint8_t *p) {                   \
+        FIELDS(CODEC_FIELD_PUT)                                             \
+        return SIZE;                                                        \
+    }
+
+PROTOCOL_MESSAGES(CODEC_DEFINE)
+
+// ===========================================================================
+// GlobalHeader
+// ===========================================================================
+
+void header_decode(GlobalHeader *h, const uint8_t p[HEADER_SIZE]) {
+    h->version_major  = p[0] & 0x0F;
+    h->version_minor  = p[0] >> 4;
+    h->resource_type  = p[1] & 0x1F;
+    h->crud           = (p[1] >> 5) & 0x03;
+    h->ack            = p[1] >> 7;
+    h->status         = (uint8_t)(p[2] << 4 | p[2] >> 4);
+    h->flags          = p[3];
+    h->message_length = load_be32(p + 4);
+}
+
+void header_encode(const GlobalHeader *h, uint8_t p[HEADER_SIZE]) {
+    p[0] = (uint8_t)((h->version_minor & 0x0F) << 4 | (h->version_major & 0x0F));
+    p[1] = (uint8_t)((h->ack & 0x01) << 7 | (h->crud & 0x03) << 5 | (h->resource_type & 0x1F));
+    p[2] = (uint8_t)(h->status << 4 | h->status >> 4);
+    p[3] = h->flags;
+    store_be32(p + 4, h->message_length);
+}
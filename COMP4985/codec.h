@@ -0,0 +1,124 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_CODEC_H
+#define COMP4985_CODEC_H
+
+// Included at the end of protocol.h: expands the wire schema declared
+// there into structs, size constants and codec prototypes.
+
+// ---------------------------------------------------------------------------
+// Byte-order helpers
+//
+// Assembled byte by byte, so any buffer offset is fine and the result does
+// not depend on host endianness or struct packing; compilers fold each one
+// into a single (unaligned) load or store plus a byte swap where needed.
+// ---------------------------------------------------------------------------
+
+static inline uint16_t load_be16(const uint8_t *p) {
+    return (uint16_t)((uint16_t)p[0] << 8 | p[1]);
+}
+static inline uint16_t load_le16(const uint8_t *p) {
+    return (uint16_t)((uint16_t)p[1] << 8 | p[0]);
+}
+static inline uint32_t load_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+           (uint32_t)p[2] << 8  | (uint32_t)p[3];
+}
+static inline uint64_t load_be64(const uint8_t *p) {
+    return (uint64_t)load_be32(p) << 32 | load_be32(p + 4);
+}
+
+static inline void store_be16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+static inline void store_le16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+static inline void store_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+static inline void store_be64(uint8_t *p, uint64_t v) {
+    store_be32(p, (uint32_t)(v >> 32));
+    store_be32(p + 4, (uint32_t)v);
+}
+
+// ---------------------------------------------------------------------------
+// Per-encoding expansions: C declaration, wire size, load, store
+// ---------------------------------------------------------------------------
+#define CODEC_DECL_U8(name)        uint8_t  name;
+#define CODEC_DECL_U16(name)       uint16_t name;
+#define CODEC_DECL_U16LE(name)     uint16_t name;
+#define CODEC_DECL_U32(name)       uint32_t name;
+#define CODEC_DECL_U64(name)       uint64_t name;
+#define CODEC_DECL_ADDR(name)      uint32_t name;
+#define CODEC_DECL_OPAQUE64(name)  uint64_t name;
+#define CODEC_DECL_STR16(name)     char     name[16];
+#define CODEC_DECL_BYTES16(name)   uint8_t  name[16];
+#define CODEC_DECL_BYTES32(name)   uint8_t  name[32];
+
+#define CODEC_SIZE_U8        1
+#define CODEC_SIZE_U16       2
+#define CODEC_SIZE_U16LE     2
+#define CODEC_SIZE_U32       4
+#define CODEC_SIZE_U64       8
+#define CODEC_SIZE_ADDR      4
+#define CODEC_SIZE_OPAQUE64  8
+#define CODEC_SIZE_STR16     16
+#define CODEC_SIZE_BYTES16   16
+#define CODEC_SIZE_BYTES32   32
+
+#define CODEC_GET_U8(v, p)         ((v) = (p)[0])
+#define CODEC_GET_U16(v, p)        ((v) = load_be16(p))
+#define CODEC_GET_U16LE(v, p)      ((v) = load_le16(p))
+#define CODEC_GET_U32(v, p)        ((v) = load_be32(p))
+#define CODEC_GET_U64(v, p)        ((v) = load_be64(p))
+#define CODEC_GET_ADDR(v, p)       memcpy(&(v), (p), 4)
+#define CODEC_GET_OPAQUE64(v, p)   memcpy(&(v), (p), 8)
+#define CODEC_GET_STR16(v, p)      memcpy((v), (p), 16)
+#define CODEC_GET_BYTES16(v, p)    memcpy((v), (p), 16)
+#define CODEC_GET_BYTES32(v, p)    memcpy((v), (p), 32)
+
+#define CODEC_PUT_U8(v, p)         ((p)[0] = (v))
+#define CODEC_PUT_U16(v, p)        store_be16((p), (v))
+#define CODEC_PUT_U16LE(v, p)      store_le16((p), (v))
+#define CODEC_PUT_U32(v, p)        store_be32((p), (v))
+#define CODEC_PUT_U64(v, p)        store_be64((p), (v))
+#define CODEC_PUT_ADDR(v, p)       memcpy((p), &(v), 4)
+#define CODEC_PUT_OPAQUE64(v, p)   memcpy((p), &(v), 8)
+#define CODEC_PUT_STR16(v, p)      memcpy((p), (v), 16)
+#define CODEC_PUT_BYTES16(v, p)    memcpy((p), (v), 16)
+#define CODEC_PUT_BYTES32(v, p)    memcpy((p), (v), 32)
+
+#define CODEC_FIELD_DECL(enc, name)  CODEC_DECL_##enc(name)
+#define CODEC_FIELD_SIZE(enc, name)  + CODEC_SIZE_##enc
+
+// ---------------------------------------------------------------------------
+// Generated declarations, for every entry of PROTOCOL_MESSAGES:
+//
+//   typedef struct { ... } Type;        fields in host byte order
+//   enum { NAME_SIZE = ... };           bytes on the wire
+//   int      prefix_decode(Type *m, const uint8_t *p, uint32_t len);
+//                                       NAME_SIZE, or -1 if len is short
+//   uint32_t prefix_encode(const Type *m, uint8_t *p);
+//                                       writes and returns NAME_SIZE bytes
+// ---------------------------------------------------------------------------
+#define CODEC_DECLARE(Type, prefix, SIZE, FIELDS)                           \
+    typedef struct { FIELDS(CODEC_FIELD_DECL) } Type;                       \
+    enum { SIZE = 0 FIELDS(CODEC_FIELD_SIZE) };                             \
+    int      prefix##_decode(Type *m, const uint8_t *p, uint32_t len);      \
+    uint32_t prefix##_encode(const Type *m, uint8_t *p);
+
+PROTOCOL_MESSAGES(CODEC_DECLARE)
+
+// GlobalHeader (see protocol.h for the bit layout)
+void header_decode(GlobalHeader *h, const uint8_t p[HEADER_SIZE]);
+void header_encode(const GlobalHeader *h, uint8_t p[HEADER_SIZE]);
+
+#endif //COMP4985_CODEC_H
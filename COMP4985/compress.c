@@ -0,0 +1,239 @@
+#include "protocol.h"
+#include "compress.h"
+
+// ===========================================================================
+// Preset dictionary
+//
+// Built from the most frequent words and fragments in chat transcripts.
+// Matches may reach back into it exactly as if it preceded the payload, so
+// it has to be byte-identical on both ends — change it only together with
+// COMPRESS_DICT_ID. Most common fragments sit at the end, closest to the
+// data.
+// ===========================================================================
+
+static const char chat_dict[] =
+    "https://www.http://.com/.org/.html"
+    "tomorrow yesterday tonight morning afternoon evening weekend "
+    "meeting meet call calling later soon today right now already "
+    "probably actually really pretty maybe sure sorry thanks thank you "
+    "please could you would you can you do you are you have you "
+    "what do you think I think I don't know I'm not sure "
+    "let me know let's see sounds good no problem of course "
+    "never mind by the way as well at least in the "
+    "haha lol lmao omg btw idk imo tbh brb np ty thx "
+    "hello hi hey good morning good night see you bye "
+    "because about after again also and any back been before "
+    "but come could did does doing done down even from get going "
+    "gonna good got had has have here how into just know like look "
+    "make more much need only other over people said should some "
+    "something still than that the their them then there these they "
+    "thing think this time very want was we're well were what when "
+    "where which while who why will with work would yeah yes you're "
+    "your I'll I'm it's that's don't can't didn't isn't won't "
+    "the message channel server user ";
+
+#define DICT_LEN ((uint32_t)(sizeof(chat_dict) - 1))
+
+// ===========================================================================
+// Match finder
+// ===========================================================================
+
+#define LZ_MIN_MATCH   4
+#define LZ_MAX_OFFSET  65535
+#define LZ_HASH_BITS   12
+#define LZ_HASH_SIZE   (1u << LZ_HASH_BITS)
+
+// Hash table entries are window positions + 1 (0 = empty). The window is
+// the dictionary followed by the input, so input byte i sits at DICT_LEN+i.
+static uint32_t dict_table[LZ_HASH_SIZE];
+static pthread_once_t dict_once = PTHREAD_ONCE_INIT;
+
+static inline uint32_t hash4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void dict_prime(void) {
+    const uint8_t *d = (const uint8_t *)chat_dict;
+    for (uint32_t i = 0; i + LZ_MIN_MATCH <= DICT_LEN; i++)
+        dict_table[hash4(d + i)] = i + 1;
+}
+
+static inline uint8_t window_at(const uint8_t *src, uint32_t pos) {
+    return pos < DICT_LEN ? (uint8_t)chat_dict[pos] : src[pos - DICT_LEN];
+}
+
+// Writes a 15+255+255+... length continuation; returns bytes written or 0.
+static uint32_t put_length(uint8_t *dst, uint32_t cap, uint32_t len) {
+    uint32_t n = 0;
+    while (len >= 255) {
+        if (n >= cap) return 0;
+        dst[n++] = 255;
+        len -= 255;
+    }
+    if (n >= cap) return 0;
+    dst[n++] = (uint8_t)len;
+    return n;
+}
+
+// Emits one sequence: token | [lit len] | literals | [offset | match len].
+// match_len == 0 marks the final, literal-only sequence.
+static uint32_t put_sequence(uint8_t *dst, uint32_t cap,
+                             const uint8_t *lit, uint32_t lit_len,
+                             uint32_t offset, uint32_t match_len)
+{
+    uint32_t o = 0, n;
+    uint32_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+    if (cap < 1) return 0;
+    dst[o++] = (uint8_t)(((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15));
+
+    if (lit_len >= 15) {
+        if (!(n = put_length(dst + o, cap - o, lit_len - 15))) return 0;
+        o += n;
+    }
+    if (cap - o < lit_len) return 0;
+    memcpy(dst + o, lit, lit_len);
+    o += lit_len;
+
+    if (match_len) {
+        if (cap - o < 2) return 0;
+        dst[o++] = (uint8_t)(offset & 0xFF);
+        dst[o++] = (uint8_t)(offset >> 8);
+        if (ml >= 15) {
+            if (!(n = put_length(dst + o, cap - o, ml - 15))) return 0;
+            o += n;
+        }
+    }
+    return o;
+}
+
+// ===========================================================================
+// Block codec
+// ===========================================================================
+
+static uint32_t lz_compress(const uint8_t *src, uint32_t len,
+                            uint8_t *dst, uint32_t cap)
+{
+    uint32_t table[LZ_HASH_SIZE];
+    memcpy(table, dict_table, sizeof(table));
+
+    uint32_t i = 0, anchor = 0, o = 0, n;
+
+    while (i + LZ_MIN_MATCH <= len) {
+        uint32_t h    = hash4(src + i);
+        uint32_t cand = table[h];
+        uint32_t here = DICT_LEN + i;
+        table[h] = here + 1;
+
+        if (cand && here - (cand - 1) <= LZ_MAX_OFFSET) {
+            uint32_t from = cand - 1;
+            uint32_t m    = 0;
+            while (i + m < len && window_at(src, from + m) == src[i + m])
+                m++;
+
+            if (m >= LZ_MIN_MATCH) {
+                if (!(n = put_sequence(dst + o, cap - o, src + anchor, i - anchor,
+                                       here - from, m)))
+                    return 0;
+                o += n;
+                i += m;
+                anchor = i;
+                continue;
+            }
+        }
+        i++;
+    }
+
+    if (!(n = put_sequence(dst + o, cap - o, src + anchor, len - anchor, 0, 0)))
+        return 0;
+    return o + n;
+}
+
+// Reads a length continuation; returns 0 on truncated input.
+static int get_length(const uint8_t *src, uint32_t len, uint32_t *ip, uint32_t *out) {
+    uint8_t b;
+    do {
+        if (*ip >= len) return 0;
+        b = src[(*ip)++];
+        *out += b;
+    } while (b == 255);
+    return 1;
+}
+
+static int lz_decompress(const uint8_t *src, uint32_t len,
+                         uint8_t *dst, uint32_t cap)
+{
+    uint32_t ip = 0, op = 0;
+
+    while (ip < len) {
+        uint8_t  token = src[ip++];
+        uint32_t lit   = token >> 4;
+        if (lit == 15 && !get_length(src, len, &ip, &lit)) return -1;
+        if (lit > len - ip || lit > cap - op) return -1;
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+
+        if (ip == len) break;   // final literal-only sequence
+
+        if (len - ip < 2) return -1;
+        uint32_t offset = src[ip] | ((uint32_t)src[ip + 1] << 8);
+        ip += 2;
+
+        uint32_t mlen = token & 0x0F;
+        if (mlen == 15 && !get_length(src, len, &ip, &mlen)) return -1;
+        mlen += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > op + DICT_LEN) return -1;
+        if (mlen > cap - op) return -1;
+
+        if (offset <= op && offset >= mlen) {
+            memcpy(dst + op, dst + op - offset, mlen);
+            op += mlen;
+        } else {
+            // Overlapping or dictionary-backed match: byte at a time
+            for (uint32_t k = 0; k < mlen; k++, op++) {
+                dst[op] = offset <= op ? dst[op - offset]
+                                       : (uint8_t)chat_dict[DICT_LEN + op - offset];
+            }
+        }
+    }
+    return (int)op;
+}
+
+// ===========================================================================
+// Framed payloads
+// ===========================================================================
+
+uint32_t compress_payload(const uint8_t *src, uint32_t len,
+                          uint8_t *dst, uint32_t cap)
+{
+    pthread_once(&dict_once, dict_prime);
+
+    if (len == 0 || cap <= COMPRESSED_PREFIX_SIZE) return 0;
+    uint32_t limit = cap - COMPRESSED_PREFIX_SIZE;
+    if (limit >= len) limit = len - 1;   // must come out smaller than the input
+
+    uint32_t n = lz_compress(src, len, dst + COMPRESSED_PREFIX_SIZE, limit);
+    if (n == 0) return 0;
+
+    CompressedPrefix pre = {
+        .dict_id    = COMPRESS_DICT_ID,
+        .raw_length = len
+    };
+    return compressed_prefix_encode(&pre, dst) + n;
+}
+
+int decompress_payload(const uint8_t *src, uint32_t len,
+                       uint8_t *dst, uint32_t cap)
+{
+    CompressedPrefix pre;
+    if (compressed_prefix_decode(&pre, src, len) < 0) return -1;
+    uint32_t raw = pre.raw_length;
+    if (pre.dict_id != COMPRESS_DICT_ID || raw > cap) return -1;
+
+    int n = lz_decompress(src + COMPRESSED_PREFIX_SIZE, len - COMPRESSED_PREFIX_SIZE, dst, raw);
+    return n == (int)raw ? n : -1;
+}
@@ -0,0 +1,34 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_COMPRESS_H
+#define COMP4985_COMPRESS_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Payload compression
+//
+// LZ77 block codec (LZ4-style token/literal/offset sequences) whose match
+// window is primed with a preset dictionary of common chat text, so even a
+// short message can reference words it never contained.
+// ---------------------------------------------------------------------------
+#define COMPRESS_THRESHOLD  512   // payloads below this always go out raw
+#define COMPRESS_DICT_ID    1     // bump whenever the preset dictionary changes
+
+// Worst case output for n input bytes, including the CompressedPrefix
+#define COMPRESS_BOUND(n)   (COMPRESSED_PREFIX_SIZE + (n) + (n) / 255 + 16)
+
+// Compresses src into dst as CompressedPrefix + block. Returns the number of
+// bytes written, or 0 if the result would not fit in cap or would not be
+// smaller than the input (caller then sends the payload raw).
+uint32_t compress_payload(const uint8_t *src, uint32_t len,
+                          uint8_t *dst, uint32_t cap);
+
+// Inverse of compress_payload. Returns the decompressed length, or -1 if the
+// frame is malformed, uses an unknown dictionary, or exceeds cap.
+int decompress_payload(const uint8_t *src, uint32_t len,
+                       uint8_t *dst, uint32_t cap);
+
+#endif //COMP4985_COMPRESS_H
@@ -0,0 +1,228 @@
+#include "protocol.h"
+#include "config.h"
+#include "admission.h"
+#include "client.h"
+#include "manager.h"
+#include "persist.h"
+#include "directory.h"
+#include "ratelimit.h"
+#include "affinity.h"
+#include "offload.h"
+#include "credential.h"
+#include "capture.h"
+#include "trace.h"
+
+#include <ctype.h>
+#include <strings.h>
+
+ServerConfig server_config = {
+    .listen_backlog = 10,
+    .logging        = 1
+};
+
+// ===========================================================================
+// Key table
+// ===========================================================================
+
+typedef enum {
+    CFG_U32,
+    CFG_U64,
+    CFG_BOOL,   // int
+    CFG_STR,    // char[size]
+    CFG_CPUS    // CpuSet
+} ConfigType;
+
+typedef struct {
+    const char *key;
+    ConfigType  type;
+    void       *ptr;
+    size_t      size;   // CFG_STR capacity, or the largest CFG_U32 value
+} ConfigKey;
+
+static const ConfigKey config_keys[] = {
+    { "port",               CFG_U32,  &server_config.port,           65535 },
+    { "listen_backlog",     CFG_U32,  &server_config.listen_backlog, 65535 },
+    { "advertise_ip",       CFG_STR,  server_config.advertise_ip,    sizeof(server_config.advertise_ip) },
+    { "manager_ip",         CFG_STR,  server_config.manager_ip,      sizeof(server_config.manager_ip) },
+    { "manager_port",       CFG_U32,  &server_config.manager_port,   65535 },
+    { "standby",            CFG_BOOL, &server_standby,               0 },
+    { "data_dir",           CFG_STR,  server_config.data_dir,        sizeof(server_config.data_dir) },
+    { "headless",           CFG_BOOL, &server_config.headless,       0 },
+    { "log_file",           CFG_STR,  server_config.log_file,        sizeof(server_config.log_file) },
+    { "logging",            CFG_BOOL, &server_config.logging,        0 },
+    { "capture_file",       CFG_STR,  server_config.capture_file,    sizeof(server_config.capture_file) },
+    { "trace_file",         CFG_STR,  server_config.trace_file,      sizeof(server_config.trace_file) },
+
+    { "max_connections",    CFG_U32,  &admission_max_connections,    UINT32_MAX },
+    { "max_outbound_bytes", CFG_U64,  &admission_max_outbound_bytes, 0 },
+    { "max_rss_mb",         CFG_U32,  &admission_max_rss_mb,         UINT32_MAX },
+    { "max_lag_ms",         CFG_U32,  &admission_max_lag_ms,         UINT32_MAX },
+    { "idle_timeout_ms",    CFG_U32,  &conn_idle_timeout_ms,         UINT32_MAX },
+    { "header_timeout_ms",  CFG_U32,  &conn_header_timeout_ms,       UINT32_MAX },
+    { "payload_timeout_ms", CFG_U32,  &conn_payload_timeout_ms,      UINT32_MAX },
+    { "retention_secs",     CFG_U32,  &persist_retention_secs,       UINT32_MAX },
+    { "max_channels",       CFG_U32,  &directory_max_channels,       UINT32_MAX },
+    { "offload_workers",    CFG_U32,  &offload_workers,              OFFLOAD_MAX_WORKERS },
+    { "hash_iterations",    CFG_U32,  &credential_iterations,        UINT32_MAX },
+    { "capture_max_mb",     CFG_U32,  &capture_max_mb,               UINT32_MAX },
+    { "trace_sample",       CFG_U32,  &trace_sample,                 UINT32_MAX },
+
+    { "cpu.acceptors",      CFG_CPUS, &affinity_sets[AFF_ACCEPTOR],    0 },
+    { "cpu.manager",        CFG_CPUS, &affinity_sets[AFF_MANAGER],     0 },
+    { "cpu.replication",    CFG_CPUS, &affinity_sets[AFF_REPLICATION], 0 },
+    { "cpu.storage",        CFG_CPUS, &affinity_sets[AFF_STORAGE],     0 },
+    { "cpu.timer",          CFG_CPUS, &affinity_sets[AFF_TIMER],       0 },
+    { "cpu.offload",        CFG_CPUS, &affinity_sets[AFF_OFFLOAD],     0 },
+};
+
+// Indexed by ConnPlacement
+static const char *const conn_placement_names[] = {
+    [CONN_PLACE_CORE] = "core",
+    [CONN_PLACE_NODE] = "node",
+    [CONN_PLACE_ANY]  = "any",
+};
+
+// Indexed by RateOp
+static const char *const rate_op_names[RL_OPS] = {
+    [RL_ACCOUNT_CREATE] = "account_create",
+    [RL_LOGIN_LOGOUT]   = "login_logout",
+    [RL_USER_READ]      = "user_read",
+    [RL_CHANNEL_READ]   = "channel_read",
+    [RL_CHANNELS_READ]  = "channels_read",
+    [RL_MESSAGE_CREATE] = "message_create",
+    [RL_MESSAGE_READ]   = "message_read",
+    [RL_MESSAGE_SYNC]   = "message_sync",
+    [RL_SEARCH]         = "search",
+};
+
+// ===========================================================================
+// Values
+// ===========================================================================
+
+// Whole string must be a decimal number no larger than max
+static int parse_u64(const char *s, uint64_t max, uint64_t *out) {
+    if (!isdigit((unsigned char)*s)) return -1;
+    errno = 0;
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (errno || *end || v > max) return -1;
+    *out = v;
+    return 0;
+}
+
+static int parse_bool(const char *s, int *out) {
+    static const char *const yes[] = { "true", "yes", "on", "1" };
+    static const char *const no[]  = { "false", "no", "off", "0" };
+    for (size_t i = 0; i < sizeof(yes) / sizeof(yes[0]); i++) {
+        if (strcasecmp(s, yes[i]) == 0) { *out = 1; return 0; }
+        if (strcasecmp(s, no[i])  == 0) { *out = 0; return 0; }
+    }
+    return -1;
+}
+
+// "<per_sec>/<burst>" or "<per_sec>"
+static const char *set_rate(RateRule *rules, const char *op, const char *value) {
+    int i = 0;
+    while (i < RL_OPS && strcmp(op, rate_op_names[i]) != 0) i++;
+    if (i == RL_OPS) return "unknown operation";
+
+    char     buf[32];
+    uint64_t per_sec, burst = rules[i].burst;
+    if (strlen(value) >= sizeof(buf)) return "expected <per_sec>/<burst>";
+    strcpy(buf, value);
+
+    char *slash = strchr(buf, '/');
+    if (slash) *slash = '\0';
+    if (parse_u64(buf, UINT32_MAX, &per_sec) < 0 ||
+        (slash && parse_u64(slash + 1, UINT32_MAX, &burst) < 0))
+        return "expected <per_sec>/<burst>";
+
+    rules[i].per_sec = (uint32_t)per_sec;
+    rules[i].burst   = (uint32_t)burst;
+    return NULL;
+}
+
+const char *config_set(const char *key, const char *value) {
+    if (strncmp(key, "rate.conn.", 10) == 0) return set_rate(rate_conn_rules, key + 10, value);
+    if (strncmp(key, "rate.user.", 10) == 0) return set_rate(rate_user_rules, key + 10, value);
+    if (strcmp(key, "cpu.connections") == 0) {
+        for (int i = 0; i <= CONN_PLACE_ANY; i++)
+            if (strcasecmp(value, conn_placement_names[i]) == 0) {
+                affinity_conn_placement = (ConnPlacement)i;
+                return NULL;
+            }
+        return "expected core, node or any";
+    }
+
+    const ConfigKey *k = NULL;
+    for (size_t i = 0; i < sizeof(config_keys) / sizeof(config_keys[0]); i++)
+        if (strcmp(key, config_keys[i].key) == 0) k = &config_keys[i];
+    if (!k) return "unknown key";
+
+    uint64_t v;
+    switch (k->type) {
+        case CFG_U32:
+            if (parse_u64(value, k->size, &v) < 0) return "expected a number in range";
+            *(uint32_t *)k->ptr = (uint32_t)v;
+            return NULL;
+        case CFG_U64:
+            if (parse_u64(value, UINT64_MAX, &v) < 0) return "expected a number";
+            *(uint64_t *)k->ptr = v;
+            return NULL;
+        case CFG_BOOL:
+            return parse_bool(value, k->ptr) < 0 ? "expected true or false" : NULL;
+        case CFG_STR:
+            if (strlen(value) >= k->size) return "value too long";
+            strcpy(k->ptr, value);
+            return NULL;
+        case CFG_CPUS:
+            return cpuset_parse(value, k->ptr) < 0 ? "expected a CPU list such as 0-3,8" : NULL;
+    }
+    return "unknown key";
+}
+
+// ===========================================================================
+// File
+// ===========================================================================
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+int config_load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char line[512];
+    int  lineno = 0, rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *s = trim(line);
+        if (!*s) continue;
+
+        char *eq = strchr(s, '=');
+        if (!eq) {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, lineno);
+            rc = -1;
+            break;
+        }
+        *eq = '\0';
+        const char *key = trim(s);
+        const char *err = config_set(key, trim(eq + 1));
+        if (err) {
+            fprintf(stderr, "%s:%d: %s: %s\n", path, lineno, key, err);
+            rc = -1;
+        }
+    }
+    fclose(f);
+    return rc;
+}
@@ -0,0 +1,73 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_CONFIG_H
+#define COMP4985_CONFIG_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Server configuration
+//
+// Read from the file given with --config, then overridden by the command
+// line. One "key = value" per line, '#' starts a comment, booleans are
+// true/false, yes/no, on/off or 1/0. Unknown keys and bad values are
+// errors, reported with their line number.
+//
+//   port                listen port, 0 = ephemeral               required
+//   listen_backlog      accept queue length                      [10]
+//   advertise_ip        address registered with the manager      [detected]
+//   manager_ip          manager address                          [none:
+//   manager_port        manager port                              standalone]
+//   standby             start as a standby                       [false]
+//   data_dir            persistence directory                    [in memory]
+//   headless            never start the terminal UI              [false]
+//   log_file            structured log, appended to              [stderr
+//                                                                 when headless]
+//   logging             false = no log output or forwarding      [true]
+//   capture_file        record client traffic here (capture.h)   [off]
+//   trace_file          Chrome trace of sampled requests         [off]
+//                       (trace.h)
+//
+// Limits, written straight into the module that owns them:
+//   max_connections  max_outbound_bytes  max_rss_mb  max_lag_ms   admission.h
+//   idle_timeout_ms  header_timeout_ms  payload_timeout_ms         client.h
+//   retention_secs   (0 = keep everything)                         persist.h
+//   max_channels     (0 = no limit)                                directory.h
+//   offload_workers  (0 = half the CPUs)                           offload.h
+//   hash_iterations  PBKDF2 rounds for new password verifiers      credential.h
+//   capture_max_mb   (0 = no limit)                                capture.h
+//   trace_sample     keep 1 request in N                           trace.h
+//   rate.conn.<op>  rate.user.<op>  = <per_sec>/<burst>            ratelimit.h
+//     <op>: account_create login_logout user_read channel_read
+//           channels_read message_create message_read message_sync search
+//     "0" disables the limit; a missing burst keeps the current one
+//   cpu.acceptors  cpu.manager  cpu.replication  cpu.storage       affinity.h
+//   cpu.timer  cpu.offload  = CPU list, e.g. 0-3,8 (empty = unpinned)
+//   cpu.connections = core | node | any                           [core]
+// ---------------------------------------------------------------------------
+typedef struct {
+    uint32_t port;
+    uint32_t listen_backlog;
+    char     advertise_ip[INET_ADDRSTRLEN];
+    char     manager_ip[20];
+    uint32_t manager_port;
+    char     data_dir[256];
+    int      headless;
+    char     log_file[256];
+    int      logging;
+    char     capture_file[256];
+    char     trace_file[256];
+} ServerConfig;
+
+extern ServerConfig server_config;
+
+// Applies one setting. Returns NULL, or why the key or value was refused.
+const char *config_set(const char *key, const char *value);
+
+// Applies every setting in path. Returns 0, or -1 after printing
+// "path:line: reason" to stderr.
+int config_load(const char *path);
+
+#endif //COMP4985_CONFIG_H
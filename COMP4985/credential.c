@@ -0,0 +1,181 @@
+#include "protocol.h"
+#include "credential.h"
+
+#include <fcntl.h>
+
+uint32_t credential_iterations = CREDENTIAL_ITERATIONS;
+
+// ===========================================================================
+// SHA-256 (FIPS 180-4)
+// ===========================================================================
+
+typedef struct {
+    uint32_t h[8];
+    uint8_t  block[64];
+    uint32_t used;
+    uint64_t total;
+} Sha256;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR32(x, n)  ((x) >> (n) | (x) << (32 - (n)))
+
+static void sha256_compress(uint32_t h[8], const uint8_t p[64]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = load_be32(p + 4 * i);
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19)  ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+    uint32_t e = h[4], f = h[5], g = h[6], k = h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = k + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) +
+                      ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) +
+                      ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+static void sha256_init(Sha256 *s) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(s->h, iv, sizeof(iv));
+    s->used  = 0;
+    s->total = 0;
+}
+
+static void sha256_update(Sha256 *s, const uint8_t *p, size_t n) {
+    s->total += n;
+    while (n > 0) {
+        size_t take = 64 - s->used < n ? 64 - s->used : n;
+        memcpy(s->block + s->used, p, take);
+        s->used += (uint32_t)take;
+        p += take;
+        n -= take;
+        if (s->used == 64) {
+            sha256_compress(s->h, s->block);
+            s->used = 0;
+        }
+    }
+}
+
+static void sha256_final(Sha256 *s, uint8_t out[32]) {
+    uint64_t bits = s->total * 8;
+    uint8_t  pad  = 0x80;
+    sha256_update(s, &pad, 1);
+    pad = 0;
+    while (s->used != 56) sha256_update(s, &pad, 1);
+    uint8_t len[8];
+    store_be64(len, bits);
+    sha256_update(s, len, 8);
+    for (int i = 0; i < 8; i++)
+        store_be32(out + 4 * i, s->h[i]);
+}
+
+// ===========================================================================
+// PBKDF2-HMAC-SHA256 (RFC 8018), one 32-byte block
+// ===========================================================================
+
+// The inner and outer keyed states are computed once; every iteration then
+// costs two compressions instead of four.
+typedef struct {
+    Sha256 inner, outer;
+} Hmac;
+
+static void hmac_init(Hmac *m, const uint8_t *key, size_t klen) {
+    uint8_t k[64] = {0}, pad[64];
+    if (klen > 64) {
+        Sha256 s;
+        sha256_init(&s);
+        sha256_update(&s, key, klen);
+        sha256_final(&s, k);
+    } else {
+        memcpy(k, key, klen);
+    }
+    for (int i = 0; i < 64; i++) pad[i] = k[i] ^ 0x36;
+    sha256_init(&m->inner);
+    sha256_update(&m->inner, pad, 64);
+    for (int i = 0; i < 64; i++) pad[i] = k[i] ^ 0x5c;
+    sha256_init(&m->outer);
+    sha256_update(&m->outer, pad, 64);
+}
+
+static void hmac(const Hmac *m, const uint8_t *p, size_t n, uint8_t out[32]) {
+    Sha256 s = m->inner;
+    sha256_update(&s, p, n);
+    sha256_final(&s, out);
+    s = m->outer;
+    sha256_update(&s, out, 32);
+    sha256_final(&s, out);
+}
+
+static void pbkdf2_sha256(const char password[16], const uint8_t salt[16],
+                          uint32_t iterations, uint8_t out[32])
+{
+    Hmac m;
+    hmac_init(&m, (const uint8_t *)password, strnlen(password, 16));
+
+    uint8_t first[20], u[32];
+    memcpy(first, salt, 16);
+    store_be32(first + 16, 1);   // block index
+    hmac(&m, first, sizeof(first), u);
+    memcpy(out, u, 32);
+
+    for (uint32_t i = 1; i < iterations; i++) {
+        hmac(&m, u, 32, u);
+        for (int j = 0; j < 32; j++) out[j] ^= u[j];
+    }
+}
+
+// ===========================================================================
+// Verifiers
+// ===========================================================================
+
+static void random_salt(uint8_t salt[16]) {
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && read(fd, salt, 16) == 16) {
+        close(fd);
+        return;
+    }
+    if (fd >= 0) close(fd);
+
+    // No urandom (chroot): still unique per account, just predictable
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    store_be64(salt, (uint64_t)ts.tv_sec ^ (uint64_t)(uintptr_t)salt);
+    store_be64(salt + 8, (uint64_t)ts.tv_nsec ^ (uint64_t)getpid());
+}
+
+void credential_derive(Credential *out, const char password[16]) {
+    random_salt(out->salt);
+    out->iterations = credential_iterations ? credential_iterations : 1;
+    pbkdf2_sha256(password, out->salt, out->iterations, out->hash);
+}
+
+int credential_verify(const Credential *cred, const char password[16]) {
+    uint8_t h[32];
+    pbkdf2_sha256(password, cred->salt, cred->iterations, h);
+
+    uint8_t diff = 0;
+    for (int i = 0; i < 32; i++) diff |= h[i] ^ cred->hash[i];
+    return diff == 0;
+}
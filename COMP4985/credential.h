@@ -0,0 +1,34 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_CREDENTIAL_H
+#define COMP4985_CREDENTIAL_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Password verifiers
+//
+// A password is never stored: the directory keeps a random salt and
+// PBKDF2-HMAC-SHA256(password, salt, credential_iterations). Deriving one
+// is deliberately slow (milliseconds at the default), so account creation
+// and login run it on the offload pool rather than on a connection thread.
+// ---------------------------------------------------------------------------
+#define CREDENTIAL_ITERATIONS  20000
+
+extern uint32_t credential_iterations;
+
+typedef struct {
+    uint8_t  salt[16];
+    uint8_t  hash[32];
+    uint32_t iterations;   // 0 = no verifier set
+} Credential;
+
+// Fresh salt and verifier for password (16-byte wire field, NUL padded).
+void credential_derive(Credential *out, const char password[16]);
+
+// 1 if password matches cred, in time independent of where they differ.
+int  credential_verify(const Credential *cred, const char password[16]);
+
+#endif //COMP4985_CREDENTIAL_H
@@ -0,0 +1,706 @@
+#include "protocol.h"
+#include "directory.h"
+#include "persist.h"
+#include "idmap.h"
+#include "bloom.h"
+#include "metrics.h"
+#include "manager.h"
+
+// ===========================================================================
+// Tables
+// ===========================================================================
+
+typedef struct {
+    int        used;
+    char       name[16];
+    Credential cred;          // iterations == 0: none (restored from an old log)
+    uint32_t  *channels;      // channels this id is a member of, join order
+    uint32_t   channel_count;
+    uint32_t   channel_cap;
+} UserEntry;
+
+typedef struct {
+    uint32_t  id;
+    char      name[16];
+    IdSet     member_set;
+    uint32_t *members;       // join order
+    uint32_t  member_count;
+    uint32_t  member_cap;
+} ChannelEntry;
+
+// Journal entry: the record plus where it came from
+typedef struct {
+    DirectoryRecord rec;
+    int             local;
+    uint8_t         origin_id;
+} JournalEntry;
+
+uint32_t directory_max_channels = DIR_MAX_CHANNELS;
+
+static TrackedMutex dir_mutex = TRACKED_MUTEX_INITIALIZER(LOCK_DIRECTORY);
+
+static IdMap      users;          // user_id → UserEntry *
+static uint32_t  *user_index;     // name hash → user_id (0 = empty)
+static uint32_t   user_index_cap;
+static uint32_t   user_count;     // names in user_index
+static uint32_t   partition_next[256];   // next low bits to try, under acc_id_mutex
+
+static IdMap          channels;           // channel_id → ChannelEntry *
+static ChannelEntry **channel_order;      // registration order
+static uint32_t       channel_order_cap;
+static uint32_t      *channel_name_index; // name hash → order index + 1
+static uint32_t       channel_name_cap;
+static uint32_t       channel_count;
+
+// Negative-lookup filters in front of the two name indexes, read without
+// dir_mutex: a name never added cannot be in the index, so most lookups of
+// unknown names cost one cache line and no lock. Added to under dir_mutex;
+// when one fills up it is rebuilt 4x larger and swapped in. Readers may
+// still be using the old one, so it is never freed (all retired filters
+// together are smaller than the live one).
+static _Atomic(BloomFilter *) user_filter;
+static _Atomic(BloomFilter *) channel_filter;
+
+static JournalEntry *journal;
+static uint64_t      journal_len, journal_cap;
+static uint64_t      applied[256];   // per origin server
+static uint64_t      local_last;     // origin_seq of the newest local entry
+
+// Names on the wire are fixed 16-byte fields that may or may not be NUL
+// terminated; compare them with everything after the first NUL zeroed.
+static void name_norm(char out[16], const char in[16]) {
+    size_t n = strnlen(in, 16);
+    memcpy(out, in, n);
+    memset(out + n, 0, 16 - n);
+}
+
+static uint32_t name_hash(const char name[16]) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 16 && name[i]; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Filter key: FNV-1a 64 plus a finalizer, so both halves are well mixed
+static uint64_t name_hash64(const char name[16]) {
+    uint64_t h = 14695981039346656037ull;
+    for (int i = 0; i < 16 && name[i]; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 1099511628211ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Grows a zeroed array to hold at least `need` elements of `size` bytes.
+static int grow_array(void **arr, uint32_t *cap, uint64_t need, size_t size) {
+    if (need <= *cap) return 0;
+    uint64_t ncap = *cap ? *cap : 64;
+    while (ncap < need) ncap *= 2;
+    if (ncap > UINT32_MAX) ncap = UINT32_MAX;
+    if (ncap < need) return -1;
+
+    void *n = realloc(*arr, ncap * size);
+    if (!n) return -1;
+    memset((uint8_t *)n + (size_t)*cap * size, 0, (size_t)(ncap - *cap) * size);
+    *arr = n;
+    *cap = (uint32_t)ncap;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Name indexes: open addressing on name_hash, grown ×2 at half load.
+// Both hold a non-zero value that resolves back to an entry with a name.
+// ---------------------------------------------------------------------------
+
+static const char *user_name_of(uint32_t v)    { return ((UserEntry *)idmap_get(&users, v))->name; }
+static const char *channel_name_of(uint32_t v) { return channel_order[v - 1]->name; }
+
+// Slot holding name, or the empty slot where it would go.
+static uint32_t *name_slot(uint32_t *index, uint32_t cap, const char name[16],
+                           const char *(*name_of)(uint32_t))
+{
+    uint32_t i = name_hash(name) & (cap - 1);
+    while (index[i] && memcmp(name_of(index[i]), name, 16) != 0)
+        i = (i + 1) & (cap - 1);
+    return &index[i];
+}
+
+static int name_index_insert(uint32_t **index, uint32_t *cap, uint32_t count,
+                             const char name[16], uint32_t v,
+                             const char *(*name_of)(uint32_t))
+{
+    if ((uint64_t)(count + 1) * 2 > *cap) {
+        uint32_t  ncap = *cap ? *cap * 2 : 64;
+        uint32_t *n    = calloc(ncap, sizeof(uint32_t));
+        if (!n) return -1;
+        for (uint32_t i = 0; i < *cap; i++)
+            if ((*index)[i])
+                *name_slot(n, ncap, name_of((*index)[i]), name_of) = (*index)[i];
+        free(*index);
+        *index = n;
+        *cap   = ncap;
+    }
+    *name_slot(*index, *cap, name, name_of) = v;
+    return 0;
+}
+
+static uint32_t user_find(const char name[16]) {
+    if (user_index_cap == 0) return 0;
+    return *name_slot(user_index, user_index_cap, name, user_name_of);
+}
+
+static ChannelEntry *channel_find_name(const char name[16]) {
+    if (channel_name_cap == 0) return NULL;
+    uint32_t v = *name_slot(channel_name_index, channel_name_cap, name, channel_name_of);
+    return v ? channel_order[v - 1] : NULL;
+}
+
+static PersistDir persist_dir_of(const JournalEntry *e) {
+    PersistDir pd = {
+        .kind       = e->rec.kind,
+        .origin_seq = e->rec.origin_seq,
+        .id         = e->rec.id,
+        .member_id  = e->rec.member_id,
+        .local      = (uint8_t)e->local,
+        .origin_id  = e->origin_id,
+        .iterations = e->rec.iterations
+    };
+    memcpy(pd.name, e->rec.name, sizeof(pd.name));
+    memcpy(pd.salt, e->rec.salt, sizeof(pd.salt));
+    memcpy(pd.hash, e->rec.hash, sizeof(pd.hash));
+    return pd;
+}
+
+// The verifier a user record carries (iterations 0 if none)
+static Credential record_cred(const DirectoryRecord *rec) {
+    Credential c = { .iterations = rec->iterations };
+    memcpy(c.salt, rec->salt, sizeof(c.salt));
+    memcpy(c.hash, rec->hash, sizeof(c.hash));
+    return c;
+}
+
+// Appends a mutation to the journal; cred only for DIR_REC_USER, NULL
+// otherwise. Records where its stream (local, or origin_id's) stood before
+// it as prev_seq, and advances applied[] for a peer's. Caller holds
+// dir_mutex.
+static void journal_append(uint8_t kind, uint32_t id, uint32_t member_id,
+                           const char name[16], const Credential *cred,
+                           int local, uint8_t origin_id, uint64_t origin_seq)
+{
+    if (journal_len == journal_cap) {
+        uint64_t ncap = journal_cap ? journal_cap * 2 : 256;
+        JournalEntry *n = realloc(journal, ncap * sizeof(JournalEntry));
+        if (!n) return;
+        journal     = n;
+        journal_cap = ncap;
+    }
+    JournalEntry *e = &journal[journal_len++];
+    memset(e, 0, sizeof(*e));
+    e->rec.kind       = kind;
+    e->rec.id         = id;
+    e->rec.member_id  = member_id;
+    e->rec.origin_seq = local ? journal_len : origin_seq;
+    if (local) {
+        e->rec.prev_seq = local_last;
+        local_last      = e->rec.origin_seq;
+    } else {
+        e->rec.prev_seq    = applied[origin_id];
+        applied[origin_id] = origin_seq;
+    }
+    if (name) memcpy(e->rec.name, name, 16);
+    if (cred) {
+        memcpy(e->rec.salt, cred->salt, sizeof(e->rec.salt));
+        memcpy(e->rec.hash, cred->hash, sizeof(e->rec.hash));
+        e->rec.iterations = cred->iterations;
+    }
+    e->local     = local;
+    e->origin_id = origin_id;
+
+    PersistDir pd = persist_dir_of(e);
+    persist_log_dir(&pd);
+}
+
+// ===========================================================================
+// Mutations (caller holds dir_mutex)
+// ===========================================================================
+
+// ---------------------------------------------------------------------------
+// Negative-lookup filters
+// ---------------------------------------------------------------------------
+
+#define FILTER_MIN_CAPACITY 1024
+
+static void user_filter_fill(BloomFilter *f) {
+    for (uint32_t i = 0; i < users.cap; i++) {
+        const UserEntry *u = users.slots[i].val;
+        if (u && u->used) bloom_add(f, name_hash64(u->name));
+    }
+}
+
+static void channel_filter_fill(BloomFilter *f) {
+    for (uint32_t i = 0; i < channel_count; i++)
+        bloom_add(f, name_hash64(channel_order[i]->name));
+}
+
+// Caller holds dir_mutex; count includes the name being added. If a bigger
+// filter cannot be allocated the old one keeps going, just less selective.
+static void filter_add(_Atomic(BloomFilter *) *slot, uint32_t count,
+                       const char name[16], void (*fill)(BloomFilter *))
+{
+    BloomFilter *f = atomic_load(slot);
+    if (!f || count > f->capacity) {
+        uint64_t cap = f ? (uint64_t)f->capacity * 4 : FILTER_MIN_CAPACITY;
+        while (cap < count) cap *= 4;
+        BloomFilter *n = cap <= UINT32_MAX ? bloom_create((uint32_t)cap) : NULL;
+        if (n) {
+            fill(n);
+            atomic_store(slot, n);
+            f = n;
+        }
+    }
+    if (f) bloom_add(f, name_hash64(name));
+}
+
+// 0 only if the name is certainly absent. Without a filter (nothing added
+// yet, or the first allocation failed) the index has to be asked.
+static int filter_maybe(_Atomic(BloomFilter *) *slot, const char name[16]) {
+    BloomFilter *f = atomic_load(slot);
+    if (!f || bloom_maybe(f, name_hash64(name))) return 1;
+    metric_add(METRIC_DIR_FILTER_REJECTS, 1);
+    return 0;
+}
+
+// Account id, NULL if it does not exist
+static UserEntry *user_get(uint32_t id) {
+    UserEntry *u = idmap_get(&users, id);
+    return u && u->used ? u : NULL;
+}
+
+static int user_used(uint32_t id) {
+    return user_get(id) != NULL;
+}
+
+// Entry for id, created unused if new; NULL if out of memory
+static UserEntry *user_entry(uint32_t id) {
+    UserEntry *u = idmap_get(&users, id);
+    if (u) return u;
+    if (!(u = calloc(1, sizeof(UserEntry)))) return NULL;
+    if (idmap_put(&users, id, u) < 0) {
+        free(u);
+        return NULL;
+    }
+    return u;
+}
+
+static int put_user(uint32_t id, const char name[16]) {
+    if (id == 0 || user_used(id)) return 0;
+    UserEntry *u = user_entry(id);
+    if (!u) return -1;
+    u->used = 1;
+    memcpy(u->name, name, 16);
+
+    // The same name created on two servers: the lower id keeps it, here
+    // and on every peer, whichever record arrives first
+    uint32_t *slot = user_index_cap ? name_slot(user_index, user_index_cap, name, user_name_of)
+                                    : NULL;
+    if (slot && *slot) {
+        if (id < *slot) *slot = id;
+        return 1;
+    }
+    if (name_index_insert(&user_index, &user_index_cap, user_count, name, id,
+                          user_name_of) < 0) {
+        u->used = 0;
+        return -1;
+    }
+    user_count++;
+    filter_add(&user_filter, user_count, name, user_filter_fill);
+    return 1;
+}
+
+static ChannelEntry *put_channel(uint32_t id, const char name[16]) {
+    ChannelEntry *ch = idmap_get(&channels, id);
+    if (ch) return ch;
+
+    if (grow_array((void **)&channel_order, &channel_order_cap,
+                   (uint64_t)channel_count + 1, sizeof(ChannelEntry *)) < 0)
+        return NULL;
+    ch = calloc(1, sizeof(ChannelEntry));
+    if (!ch) return NULL;
+    ch->id = id;
+    memcpy(ch->name, name, 16);
+
+    if (idmap_put(&channels, id, ch) < 0) {
+        free(ch);
+        return NULL;
+    }
+    channel_order[channel_count] = ch;
+    // A replicated name may clash with one of ours: the first one keeps it
+    if (!channel_find_name(name))
+        name_index_insert(&channel_name_index, &channel_name_cap, channel_count,
+                          name, channel_count + 1, channel_name_of);
+    channel_count++;
+    filter_add(&channel_filter, channel_count, name, channel_filter_fill);
+    return ch;
+}
+
+// Reverse index for presence fan-out. A member id may be known before its
+// account record has been replicated, so the entry need not be used yet.
+static int user_join(uint32_t user_id, uint32_t channel_id) {
+    UserEntry *u = user_entry(user_id);
+    if (!u) return -1;
+    if (grow_array((void **)&u->channels, &u->channel_cap,
+                   (uint64_t)u->channel_count + 1, sizeof(uint32_t)) < 0)
+        return -1;
+    u->channels[u->channel_count++] = channel_id;
+    return 0;
+}
+
+static int put_member(ChannelEntry *ch, uint32_t member_id) {
+    if (!ch || member_id == 0) return 0;
+    if (idset_has(&ch->member_set, member_id)) return 0;
+    if (grow_array((void **)&ch->members, &ch->member_cap,
+                   (uint64_t)ch->member_count + 1, sizeof(uint32_t)) < 0)
+        return -1;
+    if (user_join(member_id, ch->id) < 0) return -1;
+    if (idset_add(&ch->member_set, member_id) < 0) return -1;
+    ch->members[ch->member_count++] = member_id;
+    return 1;
+}
+
+static void default_channel_name(char name[16], uint32_t id) {
+    memset(name, 0, 16);
+    if (id < 10000000u) snprintf(name, 16, "channel-%u", id);   // fits 16 bytes
+    else                snprintf(name, 16, "ch-%u", id);
+}
+
+// ===========================================================================
+// Users
+// ===========================================================================
+
+#define PARTITION_MAX_LOW     ((1u << DIR_PARTITION_SHIFT) - 1)
+#define V2_PARTITION_MAX_LOW  ((1u << DIR_V2_PARTITION_SHIFT) - 1)
+
+// Partition this server issues user ids from, -1 until it has one
+static int local_partition(void) {
+    if (!manager_enabled) return 0;
+    uint8_t id = atomic_load(&my_server_id);
+    return id ? id : -1;
+}
+
+// Next free id of partition part that is <= max_id, 0 if there is none.
+// Ids already taken (restored, or issued under this server_id before a
+// restart) are skipped. Caller holds dir_mutex.
+static uint32_t issue_id(int part, uint32_t max_id) {
+    uint32_t next = 0;
+
+    if (max_id <= PROTO_V2_MAX_ID) {
+        // At most 255 ids, so a scan is as cheap as a counter. Without a
+        // manager nothing else issues from the 8-bit range: use all of it.
+        uint32_t first = part ? (uint32_t)part << DIR_V2_PARTITION_SHIFT : 1;
+        uint32_t last  = part ? first | V2_PARTITION_MAX_LOW : PROTO_V2_MAX_ID;
+        for (uint32_t id = first; id <= last && id <= max_id && !next; id++)
+            if (!user_used(id)) next = id;
+        return next;
+    }
+
+    // Partition 0 starts above the 8-bit range, which v0.2 accounts keep
+    uint32_t base   = (uint32_t)part << DIR_PARTITION_SHIFT;
+    uint32_t lowest = part ? 1 : PROTO_V2_MAX_ID + 1;
+    tracked_lock(&acc_id_mutex);
+    uint32_t low = partition_next[part] > lowest ? partition_next[part] : lowest;
+    while (low <= PARTITION_MAX_LOW && user_used(base | low)) low++;
+    if (low <= PARTITION_MAX_LOW && (base | low) <= DIR_MAX_USER_ID && (base | low) <= max_id) {
+        next = base | low;
+        partition_next[part] = low + 1;
+    }
+    tracked_unlock(&acc_id_mutex);
+    return next;
+}
+
+int directory_add_user(const char username[16], uint32_t max_id,
+                       const Credential *cred, uint32_t *id)
+{
+    char name[16];
+    name_norm(name, username);
+
+    tracked_lock(&dir_mutex);
+    if (user_find(name)) {
+        tracked_unlock(&dir_mutex);
+        return DIR_EXISTS;
+    }
+
+    int part = local_partition();
+    if (part < 0) {
+        tracked_unlock(&dir_mutex);
+        return DIR_UNASSIGNED;
+    }
+
+    uint32_t next = issue_id(part, max_id);
+    if (next == 0 || put_user(next, name) < 0) {
+        tracked_unlock(&dir_mutex);
+        return DIR_FULL;
+    }
+    user_get(next)->cred = *cred;
+    journal_append(DIR_REC_USER, next, 0, name, cred, 1, 0, 0);
+    tracked_unlock(&dir_mutex);
+
+    *id = next;
+    return DIR_OK;
+}
+
+int directory_lookup_user(const char username[16], uint32_t *id) {
+    char name[16];
+    name_norm(name, username);
+    if (!filter_maybe(&user_filter, name)) return 0;
+
+    tracked_lock(&dir_mutex);
+    uint32_t found = user_find(name);
+    tracked_unlock(&dir_mutex);
+
+    if (!found) {
+        metric_add(METRIC_DIR_FILTER_FALSE_POSITIVES, 1);
+        return 0;
+    }
+    *id = found;
+    return 1;
+}
+
+int directory_user_credential(uint32_t id, Credential *out) {
+    tracked_lock(&dir_mutex);
+    UserEntry *u   = user_get(id);
+    int        set = u && u->cred.iterations != 0;
+    if (set) *out = u->cred;
+    tracked_unlock(&dir_mutex);
+    return set;
+}
+
+// ===========================================================================
+// Channels
+// ===========================================================================
+
+int directory_touch_channel(uint32_t channel_id, uint32_t member_id) {
+    tracked_lock(&dir_mutex);
+    ChannelEntry *ch = idmap_get(&channels, channel_id);
+    if (!ch) {
+        char name[16];
+        default_channel_name(name, channel_id);
+        if (directory_max_channels == 0 || channel_count < directory_max_channels)
+            ch = put_channel(channel_id, name);
+        if (!ch) {
+            tracked_unlock(&dir_mutex);
+            return DIR_FULL;
+        }
+        journal_append(DIR_REC_CHANNEL, channel_id, 0, name, NULL, 1, 0, 0);
+    }
+    if (put_member(ch, member_id) > 0)
+        journal_append(DIR_REC_MEMBER, channel_id, member_id, NULL, NULL, 1, 0, 0);
+    tracked_unlock(&dir_mutex);
+    return DIR_OK;
+}
+
+int directory_find_channel(const char name_in[16], uint32_t *id) {
+    char name[16];
+    name_norm(name, name_in);
+    if (!filter_maybe(&channel_filter, name)) return 0;
+
+    tracked_lock(&dir_mutex);
+    ChannelEntry *ch = channel_find_name(name);
+    if (ch) *id = ch->id;
+    tracked_unlock(&dir_mutex);
+
+    if (!ch) metric_add(METRIC_DIR_FILTER_FALSE_POSITIVES, 1);
+    return ch != NULL;
+}
+
+uint32_t directory_channel_members(uint32_t channel_id, uint32_t max_id,
+                                   uint32_t *out, uint32_t cap)
+{
+    uint32_t n = 0;
+    tracked_lock(&dir_mutex);
+    ChannelEntry *ch = idmap_get(&channels, channel_id);
+    for (uint32_t i = 0; ch && i < ch->member_count && n < cap; i++)
+        if (ch->members[i] <= max_id) out[n++] = ch->members[i];
+    tracked_unlock(&dir_mutex);
+    return n;
+}
+
+uint32_t directory_user_channels(uint32_t user_id, uint32_t *out, uint32_t cap) {
+    uint32_t n = 0;
+    tracked_lock(&dir_mutex);
+    UserEntry *u = idmap_get(&users, user_id);
+    for (; u && n < u->channel_count && n < cap; n++)
+        out[n] = u->channels[n];
+    tracked_unlock(&dir_mutex);
+    return n;
+}
+
+uint32_t directory_channel_list(uint32_t max_id, uint32_t *out, uint32_t cap) {
+    uint32_t n = 0;
+    tracked_lock(&dir_mutex);
+    for (uint32_t i = 0; i < channel_count && n < cap; i++)
+        if (channel_order[i]->id <= max_id) out[n++] = channel_order[i]->id;
+    tracked_unlock(&dir_mutex);
+    return n;
+}
+
+void directory_counts(uint32_t *nusers, uint32_t *nchannels) {
+    tracked_lock(&dir_mutex);
+    *nusers    = user_count;
+    *nchannels = channel_count;
+    tracked_unlock(&dir_mutex);
+}
+
+// ===========================================================================
+// Replication
+// ===========================================================================
+
+uint64_t directory_journal_head(void) {
+    tracked_lock(&dir_mutex);
+    uint64_t n = journal_len;
+    tracked_unlock(&dir_mutex);
+    return n;
+}
+
+uint32_t directory_collect(int origin, uint64_t since, uint64_t *pos,
+                           DirectoryRecord *out, uint32_t max)
+{
+    uint32_t n = 0;
+    tracked_lock(&dir_mutex);
+    for (; *pos < journal_len && n < max; (*pos)++) {
+        JournalEntry *e = &journal[*pos];
+        int match = origin == DIR_ORIGIN_LOCAL ? e->local
+                                               : (!e->local && e->origin_id == origin);
+        if (!match || e->rec.origin_seq <= since) continue;
+
+        out[n++] = e->rec;
+    }
+    tracked_unlock(&dir_mutex);
+    return n;
+}
+
+// Keep allocating above every id seen in its partition, so a server that
+// is handed a server_id used before (a restart, or a standby taking over)
+// does not reissue one. Caller holds dir_mutex.
+static void claim_user_id(uint32_t id) {
+    uint32_t part = DIR_PARTITION_OF(id), low = id & PARTITION_MAX_LOW;
+    tracked_lock(&acc_id_mutex);
+    if (low >= partition_next[part]) partition_next[part] = low + 1;
+    tracked_unlock(&acc_id_mutex);
+}
+
+// Applies a record to the tables, not the journal. Caller holds dir_mutex.
+static void apply_record(const DirectoryRecord *rec, const char name[16]) {
+    char chname[16];
+    switch (rec->kind) {
+        case DIR_REC_USER:
+            if (put_user(rec->id, name) > 0) user_get(rec->id)->cred = record_cred(rec);
+            claim_user_id(rec->id);
+            break;
+        case DIR_REC_CHANNEL:
+            put_channel(rec->id, name);
+            break;
+        case DIR_REC_MEMBER:
+            // Channel records always come first from one origin, but a
+            // member may join a channel first seen through another origin
+            default_channel_name(chname, rec->id);
+            put_member(put_channel(rec->id, chname), rec->member_id);
+            break;
+        default:
+            break;
+    }
+}
+
+int directory_apply_replica(uint8_t origin_id, const DirectoryRecord *rec) {
+    uint64_t seq = rec->origin_seq;
+    char name[16];
+    name_norm(name, rec->name);
+
+    tracked_lock(&dir_mutex);
+    if (seq <= applied[origin_id]) {
+        tracked_unlock(&dir_mutex);
+        return 0;
+    }
+    if (rec->prev_seq > applied[origin_id]) {
+        tracked_unlock(&dir_mutex);   // something before it is missing
+        return -1;
+    }
+
+    Credential cred = record_cred(rec);
+    apply_record(rec, name);
+    journal_append(rec->kind, rec->id, rec->member_id, name,
+                   rec->kind == DIR_REC_USER ? &cred : NULL, 0, origin_id, seq);
+    tracked_unlock(&dir_mutex);
+    return 1;
+}
+
+uint64_t directory_applied_seq(uint8_t origin_id) {
+    tracked_lock(&dir_mutex);
+    uint64_t seq = applied[origin_id];
+    tracked_unlock(&dir_mutex);
+    return seq;
+}
+
+// ===========================================================================
+// Persistence
+// ===========================================================================
+
+void directory_lock(void)   { tracked_lock(&dir_mutex); }
+void directory_unlock(void) { tracked_unlock(&dir_mutex); }
+
+// The tables are a pure function of the journal, so the journal is the
+// whole snapshot: uint64_t count, then count × PersistDir.
+int directory_snapshot(SnapWriter *w) {
+    snap_write(w, &journal_len, sizeof(journal_len));
+    for (uint64_t i = 0; i < journal_len; i++) {
+        PersistDir pd = persist_dir_of(&journal[i]);
+        if (snap_write(w, &pd, sizeof(pd)) < 0) return -1;
+    }
+    return 0;
+}
+
+int directory_load_snapshot(SnapReader *r) {
+    uint64_t n;
+    size_t   size = r->version >= 3 ? sizeof(PersistDir) : PERSIST_DIR_V2_SIZE;
+    if (snap_read(r, &n, sizeof(n)) < 0) return -1;
+    for (uint64_t i = 0; i < n; i++) {
+        PersistDir pd = {0};
+        if (snap_read(r, &pd, size) < 0) return -1;
+        directory_restore(&pd);
+    }
+    return 0;
+}
+
+void directory_restore(const PersistDir *pd) {
+    DirectoryRecord rec = {
+        .kind       = pd->kind,
+        .origin_seq = pd->origin_seq,
+        .id         = pd->id,
+        .member_id  = pd->member_id,
+        .iterations = pd->iterations
+    };
+    name_norm(rec.name, pd->name);
+    memcpy(rec.salt, pd->salt, sizeof(rec.salt));
+    memcpy(rec.hash, pd->hash, sizeof(rec.hash));
+
+    tracked_lock(&dir_mutex);
+    if (!pd->local) {
+        if (rec.origin_seq <= applied[pd->origin_id]) {
+            tracked_unlock(&dir_mutex);
+            return;
+        }
+    } else if (rec.origin_seq <= journal_len) {
+        tracked_unlock(&dir_mutex);   // already in the snapshot
+        return;
+    }
+    Credential cred = record_cred(&rec);
+    apply_record(&rec, rec.name);
+    journal_append(rec.kind, rec.id, rec.member_id, rec.name,
+                   rec.kind == DIR_REC_USER ? &cred : NULL,
+                   pd->local, pd->origin_id, rec.origin_seq);
+    tracked_unlock(&dir_mutex);
+}
@@ -0,0 +1,139 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_DIRECTORY_H
+#define COMP4985_DIRECTORY_H
+
+#include "protocol.h"
+#include "persist.h"
+#include "credential.h"
+
+// ---------------------------------------------------------------------------
+// User directory and channel registry
+//
+// Users are keyed by username and get the next client_id on creation.
+// Channels are registered the first time a message is posted to them and
+// remember which users have posted there. Every mutation is also appended
+// to an in-memory journal (DirectoryRecord, seq = index + 1) which the
+// replicator ships to peers so a standby holds the same state.
+//
+// IDs are 32-bit. Users, channels and both name indexes live in hash
+// tables that grow with the data, so lookups stay O(1) from a few entries
+// to millions.
+//
+// User IDs are partitioned by the server that issues them, so two servers
+// never issue the same ID: the top 8 bits are its server_id. Partition 0
+// belongs to a server without a manager, which never replicates.
+//
+// A v0.2 client only carries 8-bit IDs, which no v0.3 account is given
+// (partition 0 starts at 256). A server without a manager issues v0.2
+// accounts from all of 1-255. With a manager the range is split by the
+// high nibble (server 1 issues 16-31, server 2 32-47, ...), so servers
+// above 15 cannot create v0.2 accounts. A server with a manager issues
+// nothing until the manager has assigned its server_id.
+//
+// If two servers create the same username at once, the account with the
+// lower ID keeps the name on every server; the other keeps its ID (so
+// messages sent from it still resolve) but can no longer be looked up.
+// ---------------------------------------------------------------------------
+#define DIR_MAX_USER_ID  (UINT32_MAX - 1)   // UINT32_MAX is never issued
+
+#define DIR_PARTITION_SHIFT      24
+#define DIR_V2_PARTITION_SHIFT   4
+#define DIR_PARTITION_OF(id)     ((uint32_t)(id) >> DIR_PARTITION_SHIFT)
+
+// Results of directory_add_user
+#define DIR_OK           0
+#define DIR_EXISTS       1
+#define DIR_FULL        -1
+#define DIR_UNASSIGNED  -2   // no server_id from the manager yet
+
+// There is no Create Channel request: posting to an unknown channel ID
+// opens it. Clients may open channels until this many exist (0 = no
+// limit); channels replicated from peers are always taken, so every server
+// holds the same set.
+#define DIR_MAX_CHANNELS  (1u << 20)
+extern uint32_t directory_max_channels;
+
+// Creates an account whose id must not exceed max_id (PROTO_V2_MAX_ID for
+// a v0.2 client, DIR_MAX_USER_ID otherwise), with cred as its password
+// verifier. On DIR_OK *id receives it.
+int directory_add_user(const char username[16], uint32_t max_id,
+                       const Credential *cred, uint32_t *id);
+
+// 1 and *id filled if the user exists, 0 otherwise.
+int directory_lookup_user(const char username[16], uint32_t *id);
+
+// Verifiers are journaled with the account, so they survive a restart and
+// reach every peer. Only accounts restored from a log written before that
+// have none, and those cannot log in.
+//
+// 1 and *out filled if user id has a verifier, 0 otherwise.
+int directory_user_credential(uint32_t id, Credential *out);
+
+// Registers channel_id if new (named "channel-<id>") and adds member_id to
+// it. A member_id of 0 (unknown sender) only registers the channel.
+// Returns DIR_OK, or DIR_FULL if channel_id is new and directory_max_channels
+// are already open (or memory ran out).
+int directory_touch_channel(uint32_t channel_id, uint32_t member_id);
+
+// 1 and *id filled if a channel with that name exists, 0 otherwise.
+int directory_find_channel(const char name[16], uint32_t *id);
+
+// Member user_ids of channel_id, in join order, that are <= max_id into
+// out (at most cap). Returns the count.
+uint32_t directory_channel_members(uint32_t channel_id, uint32_t max_id,
+                                   uint32_t *out, uint32_t cap);
+
+// Channels user_id is a member of, in join order, into out (at most cap).
+// Returns the count.
+uint32_t directory_user_channels(uint32_t user_id, uint32_t *out, uint32_t cap);
+
+// Registered channel_ids <= max_id, in registration order, into out (at
+// most cap). Returns the count.
+uint32_t directory_channel_list(uint32_t max_id, uint32_t *out, uint32_t cap);
+
+void directory_counts(uint32_t *users, uint32_t *channels);
+
+// ---------------------------------------------------------------------------
+// Replication
+// ---------------------------------------------------------------------------
+
+// Origin filter for directory_collect: this server's own records
+#define DIR_ORIGIN_LOCAL  (-1)
+
+// Newest journal position (0 if nothing has happened yet).
+uint64_t directory_journal_head(void);
+
+// Copies journal records that came from `origin` (DIR_ORIGIN_LOCAL for this
+// server's own) with origin_seq > since into out, at most max, scanning
+// forward from journal position *pos. *pos is advanced past everything
+// examined. Returns the count.
+uint32_t directory_collect(int origin, uint64_t since, uint64_t *pos,
+                           DirectoryRecord *out, uint32_t max);
+
+// Applies a peer's record unless already applied. Returns 1 if applied,
+// 0 if a duplicate, -1 if there is a gap before it (rec->prev_seq is not
+// held yet).
+int directory_apply_replica(uint8_t origin_id, const DirectoryRecord *rec);
+
+// Highest journal seq applied from origin_id.
+uint64_t directory_applied_seq(uint8_t origin_id);
+
+// ---------------------------------------------------------------------------
+// Persistence (see persist.h)
+// ---------------------------------------------------------------------------
+void directory_lock(void);
+void directory_unlock(void);
+
+// Writes the journal to w. Caller holds directory_lock, or is the
+// snapshot child.
+int directory_snapshot(SnapWriter *w);
+int directory_load_snapshot(SnapReader *r);
+
+// Re-applies a logged journal entry during restore (not logged again).
+// Entries already present are skipped.
+void directory_restore(const PersistDir *pd);
+
+#endif //COMP4985_DIRECTORY_H
@@ -0,0 +1,46 @@
+#include "protocol.h"
+#include "frame.h"
+
+// ---------------------------------------------------------------------------
+// Check 1: version must be v0.2 or v0.3, and the one the first frame used
+//          (status 0x40 SenderInvalidVersion)
+// Check 2: server only accepts REQ frames from clients
+//          (status 0x41 SenderInvalidType)
+// ---------------------------------------------------------------------------
+uint8_t frame_check_header(const GlobalHeader *h, uint8_t pinned) {
+    int ver_ok = h->version_major == PROTO_VER_MAJOR &&
+                 (h->version_minor == PROTO_VER_MINOR ||
+                  h->version_minor == PROTO_VER_MINOR_WIDE) &&
+                 (!pinned || h->version_minor == pinned);
+    if (!ver_ok)            return STATUS_INVALID_VERSION;
+    if (h->ack != IS_REQ)   return STATUS_INVALID_TYPE;
+    return STATUS_OK;
+}
+
+// ---------------------------------------------------------------------------
+// Check 3: payload must not exceed buffer  (status 0x42 SenderInvalidSize)
+// Check 4: message payload must not exceed MAX_MESSAGE_SIZE
+//          (status 0x83 ReceiverMessageTooLarge); plen already covers the
+//          full payload including variable message bytes
+// Check 5: unknown resource_type+crud combination
+//          (status 0x41 SenderInvalidType)
+// ---------------------------------------------------------------------------
+uint8_t frame_check_payload(const GlobalHeader *h, uint32_t plen) {
+    if (plen > BUFFER_SIZE)
+        return STATUS_INVALID_SIZE;
+    if (h->resource_type == RES_MESSAGE && plen > MAX_MESSAGE_SIZE)
+        return STATUS_MESSAGE_TOO_LARGE;
+
+    int known = (h->resource_type == RES_USER     && h->crud == CRUD_CREATE) ||
+                (h->resource_type == RES_USER     && h->crud == CRUD_UPDATE) ||
+                (h->resource_type == RES_USER     && h->crud == CRUD_READ)   ||
+                (h->resource_type == RES_CHANNEL  && h->crud == CRUD_READ)   ||
+                (h->resource_type == RES_CHANNELS && h->crud == CRUD_UPDATE) ||
+                (h->resource_type == RES_MESSAGE  && h->crud == CRUD_CREATE) ||
+                (h->resource_type == RES_MESSAGE  && h->crud == CRUD_READ)   ||
+                (h->resource_type == RES_MESSAGES && h->crud == CRUD_READ)   ||
+                (h->resource_type == RES_PRESENCE && h->crud == CRUD_READ)   ||
+                (h->resource_type == RES_SEARCH   && h->crud == CRUD_READ);
+    if (!known) return STATUS_INVALID_TYPE;
+    return STATUS_OK;
+}
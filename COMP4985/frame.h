@@ -0,0 +1,26 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_FRAME_H
+#define COMP4985_FRAME_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Client frame validation
+//
+// The stateless checks handle_client runs on every frame, kept apart from
+// the socket loop so the fuzz harnesses in fuzz/ exercise exactly the code
+// the server runs. Each returns STATUS_OK or the status to reject with.
+// ---------------------------------------------------------------------------
+
+// Checks 1–2: v0.2 or v0.3, matching pinned (the minor the connection
+// settled on, 0 before its first valid frame); REQ frames only.
+uint8_t frame_check_header(const GlobalHeader *h, uint8_t pinned);
+
+// Checks 3–5, on the payload length after any decompression: fits the
+// buffer, message payloads fit MAX_MESSAGE_SIZE, known res/crud pair.
+uint8_t frame_check_payload(const GlobalHeader *h, uint32_t plen);
+
+#endif //COMP4985_FRAME_H
@@ -0,0 +1,78 @@
+#include "protocol.h"
+#include "frame.h"
+#include "compress.h"
+#include "reference.h"
+
+// ---------------------------------------------------------------------------
+// Fuzz target: a client byte stream, as handle_client sees it
+//
+// The input is split into frames. Each header goes through both decoders
+// and the server's own frame checks; accepted payloads are inflated if
+// flagged (compression counts as negotiated) and decoded with the codec
+// the handler for that opcode uses, v0.2 or v0.3 as pinned by the first
+// valid frame. Like the server, a frame that claims more than BUFFER_SIZE
+// or more bytes than remain ends the stream.
+//
+//   clang:  cmake -DCOMP4985_FUZZ=ON -DCMAKE_C_COMPILER=clang
+//           ./fuzz_frame -max_len=70000 corpus/
+//   AFL:    ./fuzz_frame @@   (standalone driver, see CMakeLists.txt)
+// ---------------------------------------------------------------------------
+
+// Request payload for each opcode frame_check_payload accepts
+static unsigned payload_codec(uint8_t res, uint8_t crud, int wide) {
+    switch (res << 2 | crud) {
+        case RES_USER     << 2 | CRUD_CREATE:
+            return wide ? REF_MSG_account_create_v3 : REF_MSG_account_create;
+        case RES_USER     << 2 | CRUD_UPDATE:
+            return REF_MSG_login_logout;
+        case RES_USER     << 2 | CRUD_READ:
+            return wide ? REF_MSG_user_read_v3 : REF_MSG_user_read;
+        case RES_CHANNEL  << 2 | CRUD_READ:
+        case RES_PRESENCE << 2 | CRUD_READ:
+            return wide ? REF_MSG_channel_read_v3 : REF_MSG_channel_read;
+        case RES_CHANNELS << 2 | CRUD_UPDATE:
+            return wide ? REF_MSG_channels_read_v3 : REF_MSG_channels_read;
+        case RES_MESSAGE  << 2 | CRUD_CREATE:
+            return wide ? REF_MSG_message_create_v3 : REF_MSG_message_create;
+        case RES_MESSAGE  << 2 | CRUD_READ:
+            return wide ? REF_MSG_message_read_v3 : REF_MSG_message_read;
+        case RES_SEARCH   << 2 | CRUD_READ:
+            return wide ? REF_MSG_search_v3 : REF_MSG_search;
+        default:
+            return wide ? REF_MSG_message_sync_v3 : REF_MSG_message_sync;
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static uint8_t inflated[BUFFER_SIZE];
+    uint8_t pinned = 0;
+
+    while (size >= HEADER_SIZE) {
+        GlobalHeader h;
+        ref_diff_header(data);
+        header_decode(&h, data);
+        data += HEADER_SIZE;
+        size -= HEADER_SIZE;
+
+        if (h.message_length > BUFFER_SIZE || h.message_length > size) break;
+        const uint8_t *pay  = data;
+        uint32_t       plen = h.message_length;
+        data += plen;
+        size -= plen;
+
+        if (frame_check_header(&h, pinned) != STATUS_OK) continue;
+        pinned = h.version_minor;
+
+        if (h.flags & HDR_FLAG_COMPRESSED) {
+            int n = decompress_payload(pay, plen, inflated, BUFFER_SIZE);
+            if (n < 0) continue;
+            pay  = inflated;
+            plen = (uint32_t)n;
+        }
+        if (frame_check_payload(&h, plen) != STATUS_OK) continue;
+
+        ref_diff_message(payload_codec(h.resource_type, h.crud,
+                                       pinned == PROTO_VER_MINOR_WIDE), pay, plen);
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "protocol.h"
+#include "client.h"
+#include "replicate.h"
+#include "store.h"
+#include "logsink.h"
+
+#include <sys/socket.h>
+
+// ---------------------------------------------------------------------------
+// Fuzz target: the request handlers themselves, on payloads the frame
+// checks have let through
+//
+// The codec harnesses stop at the fixed-size headers; the length fields
+// inside them (Message Create text, Search query, ID lists written back
+// into the request buffer, the records of Replica / Directory Batch and
+// Replica Sync) are only checked by the handlers. This target calls them.
+//
+// The input is a sequence of operations: one byte picking the handler
+// (bit 7: v0.3 connection), a big-endian U16 length, then that many
+// payload bytes, copied into a BUFFER_SIZE heap buffer as handle_client
+// would pass it. State (store, directory, read markers) carries from one
+// operation and one input to the next, as in a live server; stored
+// messages are trimmed after every input so the store stays small.
+// Replies go to a socketpair that is drained after each call.
+//
+// Account creation and login are left out: they hash on the offload pool,
+// which is far too slow to fuzz through.
+// ---------------------------------------------------------------------------
+
+typedef enum {
+    OP_CHANNEL_READ,
+    OP_CHANNELS_READ,
+    OP_MESSAGE_CREATE,
+    OP_MESSAGE_READ,
+    OP_MESSAGE_SYNC,
+    OP_PRESENCE_READ,
+    OP_SEARCH,
+    OP_REPLICA_BATCH,
+    OP_DIRECTORY_BATCH,
+    OP_REPLICA_SYNC,
+    OP_COUNT
+} FuzzOp;
+
+static ClientConn conn;
+static int        peer = -1;
+static uint8_t   *buffer;
+
+static void setup(void) {
+    int sv[2];
+    log_mute();
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) abort();
+    presence_init(&conn.presence);
+    conn.sock = sv[0];
+    peer      = sv[1];
+    if (!(buffer = malloc(BUFFER_SIZE))) abort();
+}
+
+static void drain(void) {
+    static uint8_t sink[1 << 16];
+    while (recv(peer, sink, sizeof(sink), MSG_DONTWAIT) > 0) {}
+}
+
+static void run(uint8_t op, uint32_t plen) {
+    conn.minor = op & 0x80 ? PROTO_VER_MINOR_WIDE : PROTO_VER_MINOR;
+    switch ((op & 0x7F) % OP_COUNT) {
+        case OP_CHANNEL_READ:     handle_channel_read(&conn, buffer, plen);    break;
+        case OP_CHANNELS_READ:    handle_channels_read(&conn, buffer, plen);   break;
+        case OP_MESSAGE_CREATE:   handle_message_create(&conn, buffer, plen);  break;
+        case OP_MESSAGE_READ:     handle_message_read(&conn, buffer, plen);    break;
+        case OP_MESSAGE_SYNC:     handle_message_sync(&conn, buffer, plen);    break;
+        case OP_PRESENCE_READ:    handle_presence_read(&conn, buffer, plen);   break;
+        case OP_SEARCH:           handle_search(&conn, buffer, plen);          break;
+        case OP_REPLICA_BATCH:    handle_replica_batch(buffer, plen);          break;
+        case OP_DIRECTORY_BATCH:  handle_directory_batch(buffer, plen);        break;
+        case OP_REPLICA_SYNC:     handle_replica_sync(buffer, plen);           break;
+    }
+    drain();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (peer < 0) setup();
+
+    while (size >= 3) {
+        uint8_t  op   = data[0];
+        uint32_t plen = (uint32_t)data[1] << 8 | data[2];
+        data += 3;
+        size -= 3;
+        if (plen > size) plen = (uint32_t)size;
+
+        // Fresh copy each time: handlers write their reply over the request
+        memcpy(buffer, data, plen);
+        run(op, plen);
+        data += plen;
+        size -= plen;
+    }
+    store_trim_before(UINT32_MAX);
+    return 0;
+}
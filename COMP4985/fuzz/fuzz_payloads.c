@@ -0,0 +1,34 @@
+#include "protocol.h"
+#include "compress.h"
+#include "reference.h"
+
+// ---------------------------------------------------------------------------
+// Fuzz target: every payload codec in PROTOCOL_MESSAGES, server ↔ client
+// and server ↔ manager alike
+//
+// The first byte picks the message (modulo the number of entries), the rest
+// is its payload, decoded by both the generated codec and the reference
+// walker. The same bytes then go through compress_payload, and whatever it
+// produces must inflate back to them.
+// ---------------------------------------------------------------------------
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static uint8_t packed[COMPRESS_BOUND(BUFFER_SIZE)];
+    static uint8_t back[BUFFER_SIZE];
+
+    if (size < 1 || size - 1 > BUFFER_SIZE) return 0;
+    const uint8_t *pay  = data + 1;
+    uint32_t       plen = (uint32_t)(size - 1);
+
+    ref_diff_message(data[0], pay, plen);
+
+    uint32_t n = compress_payload(pay, plen, packed, sizeof(packed));
+    if (n > 0) {
+        int m = decompress_payload(packed, n, back, sizeof(back));
+        if (m != (int)plen || memcmp(back, pay, plen) != 0) {
+            fprintf(stderr, "[DIFF] compress round trip lost %u bytes\n", plen);
+            abort();
+        }
+    }
+    return 0;
+}
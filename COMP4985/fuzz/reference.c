@@ -0,0 +1,484 @@
+#include "protocol.h"
+#include "reference.h"
+
+#define REF_FAIL(...)                                                       \
+    do {                                                                    \
+        fprintf(stderr, "[DIFF] " __VA_ARGS__);                             \
+        fputc('\n', stderr);                                                \
+        abort();                                                            \
+    } while (0)
+
+// ===========================================================================
+// GlobalHeader
+// ===========================================================================
+
+// The v0.2 definition, kept verbatim: GCC and Clang allocate bit-fields
+// from the low bits, which is the layout header_decode spells out by hand.
+typedef struct __attribute__((packed)) {
+    uint8_t  version_major : 4;
+    uint8_t  version_minor : 4;
+
+    uint8_t  resource_type : 5;
+    uint8_t  crud          : 2;
+    uint8_t  ack           : 1;
+
+    uint8_t  status_major  : 4;
+    uint8_t  status_minor  : 4;
+
+    uint8_t  flags;
+
+    uint32_t message_length;   // network byte order
+} RefHeader;
+
+void ref_header_decode(GlobalHeader *h, const uint8_t p[HEADER_SIZE]) {
+    RefHeader r;
+    memcpy(&r, p, sizeof(r));
+    memset(h, 0, sizeof(*h));
+    h->version_major  = r.version_major;
+    h->version_minor  = r.version_minor;
+    h->resource_type  = r.resource_type;
+    h->crud           = r.crud;
+    h->ack            = r.ack;
+    h->status         = (uint8_t)(r.status_major << 4 | r.status_minor);
+    h->flags          = r.flags;
+    h->message_length = ntohl(r.message_length);
+}
+
+void ref_diff_header(const uint8_t p[HEADER_SIZE]) {
+    GlobalHeader fast, ref;
+    header_decode(&fast, p);
+    ref_header_decode(&ref, p);
+
+    if (fast.version_major  != ref.version_major  ||
+        fast.version_minor  != ref.version_minor  ||
+        fast.resource_type  != ref.resource_type  ||
+        fast.crud           != ref.crud           ||
+        fast.ack            != ref.ack            ||
+        fast.status         != ref.status         ||
+        fast.flags          != ref.flags          ||
+        fast.message_length != ref.message_length)
+        REF_FAIL("header: fast and reference decoders disagree");
+
+    uint8_t back[HEADER_SIZE];
+    header_encode(&fast, back);
+    if (memcmp(back, p, HEADER_SIZE) != 0)
+        REF_FAIL("header: encode does not reproduce the input");
+}
+
+// ===========================================================================
+// Payloads
+// ===========================================================================
+
+typedef enum {
+    REF_U8, REF_U16, REF_U16LE, REF_U32, REF_U64, REF_ADDR, REF_OPAQUE64, REF_STR16,
+    REF_BYTES16, REF_BYTES32
+} RefEnc;
+
+static const uint8_t ref_width[] = {
+    [REF_U8] = 1, [REF_U16] = 2, [REF_U16LE] = 2, [REF_U32] = 4, [REF_U64] = 8,
+    [REF_ADDR] = 4, [REF_OPAQUE64] = 8, [REF_STR16] = 16,
+    [REF_BYTES16] = 16, [REF_BYTES32] = 32
+};
+
+typedef struct {
+    const char    *msg;
+    const uint8_t *p;
+    uint32_t       len;
+    uint32_t       off;    // wire offset of the next field
+    int            check;  // fast path accepted: compare values too
+} RefCursor;
+
+// Value of a native integer field of the given size
+static uint64_t ref_native(const void *v, size_t size) {
+    switch (size) {
+        case 1:  return *(const uint8_t  *)v;
+        case 2:  return *(const uint16_t *)v;
+        case 4:  return *(const uint32_t *)v;
+        default: return *(const uint64_t *)v;
+    }
+}
+
+static void ref_field(RefCursor *r, RefEnc enc, const char *name,
+                      const void *fast, size_t fast_size)
+{
+    uint32_t w   = ref_width[enc];
+    uint32_t off = r->off;
+    r->off += w;
+    if (!r->check) return;
+    if (r->off > r->len)
+        REF_FAIL("%s: fast path accepted %u bytes, %s needs %u", r->msg, r->len, name, r->off);
+
+    const uint8_t *f = r->p + off;
+    if (enc == REF_ADDR || enc == REF_OPAQUE64 || enc == REF_STR16 ||
+        enc == REF_BYTES16 || enc == REF_BYTES32) {
+        if (fast_size != w || memcmp(fast, f, w) != 0)
+            REF_FAIL("%s.%s: raw bytes differ", r->msg, name);
+        return;
+    }
+
+    uint64_t v = 0;
+    if (enc == REF_U16LE)
+        v = (uint64_t)f[1] << 8 | f[0];
+    else
+        for (uint32_t i = 0; i < w; i++) v = v << 8 | f[i];
+
+    uint64_t got = ref_native(fast, fast_size);
+    if (got != v)
+        REF_FAIL("%s.%s: fast %llu, reference %llu", r->msg, name,
+                 (unsigned long long)got, (unsigned long long)v);
+}
+
+// Both sides must agree on whether len holds the message and how long it is
+static void ref_finish(const RefCursor *r, int fast, uint32_t size) {
+    int ref_ok = r->len >= r->off;
+    if ((fast >= 0) != ref_ok)
+        REF_FAIL("%s: fast %s %u bytes, reference needs %u", r->msg,
+                 fast >= 0 ? "accepted" : "rejected", r->len, r->off);
+    if (r->off != size)
+        REF_FAIL("%s: size constant %u, reference walked %u", r->msg, size, r->off);
+    if (fast >= 0 && (uint32_t)fast != size)
+        REF_FAIL("%s: decode returned %d, expected %u", r->msg, fast, size);
+}
+
+// ---------------------------------------------------------------------------
+// Field lists, written out from the wire spec rather than generated from
+// the *_FIELDS macros: a field missing, reordered or given the wrong
+// encoding there disagrees with the list here.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    RefEnc      enc;
+    const char *name;
+} RefField;
+
+#define REF_END  { 0, NULL }
+
+static const RefField ref_compressed_prefix[] = {
+    { REF_U8,       "dict_id" },
+    { REF_U32,      "raw_length" },
+    REF_END
+};
+static const RefField ref_register_payload[] = {
+    { REF_ADDR,     "server_ip" },
+    { REF_U8,       "server_id" },
+    REF_END
+};
+static const RefField ref_heartbeat[] = {
+    { REF_U8,       "server_id" },
+    { REF_U8,       "flags" },
+    { REF_U16,      "interval_ms" },
+    { REF_U32,      "connections" },
+    { REF_U32,      "requests_per_sec" },
+    { REF_U32,      "messages_per_sec" },
+    { REF_U32,      "p99_us" },
+    { REF_U32,      "outbound_kib" },
+    { REF_U32,      "spool_records" },
+    { REF_U32,      "repl_backlog" },
+    REF_END
+};
+static const RefField ref_account_create[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_U8,       "client_id" },
+    REF_END
+};
+static const RefField ref_account_create_v3[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_U32,      "client_id" },
+    REF_END
+};
+static const RefField ref_login_logout[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_ADDR,     "client_ip" },
+    { REF_U8,       "status" },
+    REF_END
+};
+static const RefField ref_user_read[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_STR16,    "username_for_user_id" },
+    { REF_U8,       "user_id" },
+    REF_END
+};
+static const RefField ref_user_read_v3[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_STR16,    "username_for_user_id" },
+    { REF_U32,      "user_id" },
+    REF_END
+};
+static const RefField ref_log_payload[] = {
+    { REF_U8,       "server_id" },
+    { REF_U16LE,    "log_length" },
+    REF_END
+};
+static const RefField ref_channel_read[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_STR16,    "channel_name" },
+    { REF_U8,       "channel_id" },
+    { REF_U8,       "user_id_array_length" },
+    REF_END
+};
+static const RefField ref_channel_read_v3[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_STR16,    "channel_name" },
+    { REF_U32,      "channel_id" },
+    { REF_U32,      "user_id_array_length" },
+    REF_END
+};
+static const RefField ref_channels_read[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_U8,       "channel_list_length" },
+    REF_END
+};
+static const RefField ref_channels_read_v3[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_U32,      "channel_list_length" },
+    REF_END
+};
+static const RefField ref_message_create[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_OPAQUE64, "timestamp" },
+    { REF_U16,      "message_length" },
+    { REF_U8,       "channel_id" },
+    REF_END
+};
+static const RefField ref_message_create_v3[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_OPAQUE64, "timestamp" },
+    { REF_U16,      "message_length" },
+    { REF_U32,      "channel_id" },
+    REF_END
+};
+static const RefField ref_message_read[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_OPAQUE64, "timestamp" },
+    { REF_U16,      "message_length" },
+    { REF_U8,       "channel_id" },
+    { REF_U8,       "user_id_of_sender" },
+    REF_END
+};
+static const RefField ref_message_read_v3[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_OPAQUE64, "timestamp" },
+    { REF_U16,      "message_length" },
+    { REF_U32,      "channel_id" },
+    { REF_U32,      "user_id_of_sender" },
+    REF_END
+};
+static const RefField ref_message_sync[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_U8,       "channel_id" },
+    { REF_U64,      "since_seq" },
+    { REF_U16,      "max_records" },
+    { REF_U16,      "record_count" },
+    { REF_U64,      "head_seq" },
+    REF_END
+};
+static const RefField ref_sync_record[] = {
+    { REF_U64,      "seq" },
+    { REF_OPAQUE64, "timestamp" },
+    { REF_U8,       "user_id_of_sender" },
+    { REF_U16,      "message_length" },
+    REF_END
+};
+static const RefField ref_message_sync_v3[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_U32,      "channel_id" },
+    { REF_U64,      "since_seq" },
+    { REF_U16,      "max_records" },
+    { REF_U16,      "record_count" },
+    { REF_U64,      "head_seq" },
+    REF_END
+};
+static const RefField ref_sync_record_v3[] = {
+    { REF_U64,      "seq" },
+    { REF_OPAQUE64, "timestamp" },
+    { REF_U32,      "user_id_of_sender" },
+    { REF_U16,      "message_length" },
+    REF_END
+};
+static const RefField ref_replica_batch[] = {
+    { REF_U8,       "origin_server_id" },
+    { REF_U16,      "record_count" },
+    REF_END
+};
+static const RefField ref_replica_record[] = {
+    { REF_U32,      "channel_id" },
+    { REF_U64,      "origin_seq" },
+    { REF_U64,      "prev_seq" },
+    { REF_OPAQUE64, "timestamp" },
+    { REF_U32,      "user_id_of_sender" },
+    { REF_STR16,    "sender" },
+    { REF_U16,      "message_length" },
+    REF_END
+};
+static const RefField ref_directory_record[] = {
+    { REF_U8,       "kind" },
+    { REF_U64,      "origin_seq" },
+    { REF_U64,      "prev_seq" },
+    { REF_U32,      "id" },
+    { REF_U32,      "member_id" },
+    { REF_STR16,    "name" },
+    { REF_BYTES16,  "salt" },
+    { REF_BYTES32,  "hash" },
+    { REF_U32,      "iterations" },
+    REF_END
+};
+static const RefField ref_replica_sync[] = {
+    { REF_U8,       "requester_id" },
+    { REF_U16,      "mark_count" },
+    REF_END
+};
+static const RefField ref_replica_mark[] = {
+    { REF_U8,       "origin_server_id" },
+    { REF_U8,       "stream" },
+    { REF_U32,      "channel_id" },
+    { REF_U64,      "applied_seq" },
+    REF_END
+};
+static const RefField ref_presence_update[] = {
+    { REF_U8,       "flags" },
+    { REF_U16,      "record_count" },
+    REF_END
+};
+static const RefField ref_presence_record[] = {
+    { REF_U8,       "user_id" },
+    { REF_U8,       "online" },
+    REF_END
+};
+static const RefField ref_presence_record_v3[] = {
+    { REF_U32,      "user_id" },
+    { REF_U8,       "online" },
+    REF_END
+};
+static const RefField ref_search[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_U8,       "channel_id" },
+    { REF_U64,      "before_seq" },
+    { REF_U16,      "max_results" },
+    { REF_U16,      "query_length" },
+    { REF_U16,      "result_count" },
+    { REF_U64,      "indexed_seq" },
+    REF_END
+};
+static const RefField ref_search_v3[] = {
+    { REF_STR16,    "username" },
+    { REF_STR16,    "password" },
+    { REF_U32,      "channel_id" },
+    { REF_U64,      "before_seq" },
+    { REF_U16,      "max_results" },
+    { REF_U16,      "query_length" },
+    { REF_U16,      "result_count" },
+    { REF_U64,      "indexed_seq" },
+    REF_END
+};
+
+// A message added to PROTOCOL_MESSAGES without a list here is NULL and
+// fails on first use
+static const RefField *const ref_specs[REF_MSG_COUNT] = {
+    [REF_MSG_compressed_prefix]  = ref_compressed_prefix,
+    [REF_MSG_register_payload]   = ref_register_payload,
+    [REF_MSG_heartbeat]          = ref_heartbeat,
+    [REF_MSG_account_create]     = ref_account_create,
+    [REF_MSG_account_create_v3]  = ref_account_create_v3,
+    [REF_MSG_login_logout]       = ref_login_logout,
+    [REF_MSG_user_read]          = ref_user_read,
+    [REF_MSG_user_read_v3]       = ref_user_read_v3,
+    [REF_MSG_log_payload]        = ref_log_payload,
+    [REF_MSG_channel_read]       = ref_channel_read,
+    [REF_MSG_channel_read_v3]    = ref_channel_read_v3,
+    [REF_MSG_channels_read]      = ref_channels_read,
+    [REF_MSG_channels_read_v3]   = ref_channels_read_v3,
+    [REF_MSG_message_create]     = ref_message_create,
+    [REF_MSG_message_create_v3]  = ref_message_create_v3,
+    [REF_MSG_message_read]       = ref_message_read,
+    [REF_MSG_message_read_v3]    = ref_message_read_v3,
+    [REF_MSG_message_sync]       = ref_message_sync,
+    [REF_MSG_sync_record]        = ref_sync_record,
+    [REF_MSG_message_sync_v3]    = ref_message_sync_v3,
+    [REF_MSG_sync_record_v3]     = ref_sync_record_v3,
+    [REF_MSG_replica_batch]      = ref_replica_batch,
+    [REF_MSG_replica_record]     = ref_replica_record,
+    [REF_MSG_directory_record]   = ref_directory_record,
+    [REF_MSG_replica_sync]       = ref_replica_sync,
+    [REF_MSG_replica_mark]       = ref_replica_mark,
+    [REF_MSG_presence_update]    = ref_presence_update,
+    [REF_MSG_presence_record]    = ref_presence_record,
+    [REF_MSG_presence_record_v3] = ref_presence_record_v3,
+    [REF_MSG_search]             = ref_search,
+    [REF_MSG_search_v3]          = ref_search_v3,
+};
+
+// What the generated codec decoded, field by field
+typedef struct {
+    RefEnc      enc;
+    const char *name;
+    const void *value;
+    size_t      size;
+} RefDecoded;
+
+// Checks the decoded fields against the spec list: same names, same
+// encodings, in the same order, with the values the list reads off p
+static void ref_walk(const char *msg, unsigned idx, const RefDecoded *got, size_t ngot,
+                     const uint8_t *p, uint32_t len, int fast, uint32_t size)
+{
+    const RefField *spec = ref_specs[idx];
+    if (!spec)
+        REF_FAIL("%s: no reference field list", msg);
+
+    RefCursor r = { msg, p, len, 0, fast >= 0 };
+    size_t    i = 0;
+    for (; spec[i].name; i++) {
+        if (i >= ngot)
+            REF_FAIL("%s: codec has %zu fields, spec lists %s next", msg, ngot, spec[i].name);
+        if (got[i].enc != spec[i].enc || strcmp(got[i].name, spec[i].name) != 0)
+            REF_FAIL("%s: field %zu is %s, spec says %s", msg, i, got[i].name, spec[i].name);
+        ref_field(&r, spec[i].enc, spec[i].name, got[i].value, got[i].size);
+    }
+    if (i != ngot)
+        REF_FAIL("%s: codec has %zu fields, spec lists %zu", msg, ngot, i);
+    ref_finish(&r, fast, size);
+}
+
+#define REF_DECODED(enc, name)  { REF_##enc, #name, &m.name, sizeof(m.name) },
+
+#define REF_DIFF(Type, prefix, SIZE, FIELDS)                                \
+    static int diff_##prefix(const uint8_t *p, uint32_t len) {              \
+        Type             m;                                                 \
+        int              n     = prefix##_decode(&m, p, len);               \
+        const RefDecoded got[] = { FIELDS(REF_DECODED) };                   \
+        ref_walk(#prefix, REF_MSG_##prefix,                                 \
+                 got, sizeof(got) / sizeof(got[0]), p, len, n, SIZE);       \
+        if (n >= 0) {                                                       \
+            uint8_t out[SIZE];                                              \
+            if (prefix##_encode(&m, out) != SIZE || memcmp(out, p, SIZE))   \
+                REF_FAIL(#prefix ": encode does not reproduce the input");  \
+        }                                                                   \
+        return n;                                                           \
+    }
+
+PROTOCOL_MESSAGES(REF_DIFF)
+
+#define REF_ENTRY(Type, prefix, SIZE, FIELDS)  diff_##prefix,
+
+static int (*const ref_messages[REF_MSG_COUNT])(const uint8_t *p, uint32_t len) = {
+    PROTOCOL_MESSAGES(REF_ENTRY)
+};
+
+int ref_diff_message(unsigned idx, const uint8_t *p, uint32_t len) {
+    return ref_messages[idx % REF_MSG_COUNT](p, len);
+}
@@ -0,0 +1,36 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_REFERENCE_H
+#define COMP4985_REFERENCE_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Reference decoders for differential fuzzing
+//
+// Deliberately naive and independent of codec.c: the header goes through
+// the original packed bit-field struct, payloads through a field walker
+// that assembles every integer one byte at a time. The walker follows
+// field lists written out by hand from the wire spec, not the *_FIELDS
+// macros codec.c is generated from. Any disagreement with the fast path
+// (field list, value, accepted length, or encode round trip) aborts, so a
+// fuzzer reports it as a crash with the offending input.
+// ---------------------------------------------------------------------------
+
+// Index of every PROTOCOL_MESSAGES entry: REF_MSG_account_create, ...
+#define REF_MSG_INDEX(Type, prefix, SIZE, FIELDS)  REF_MSG_##prefix,
+enum { PROTOCOL_MESSAGES(REF_MSG_INDEX) REF_MSG_COUNT };
+
+// Decodes p the way the packed bit-field GlobalHeader did before codec.c
+void ref_header_decode(GlobalHeader *h, const uint8_t p[HEADER_SIZE]);
+
+// header_decode against ref_header_decode, plus an encode round trip
+void ref_diff_header(const uint8_t p[HEADER_SIZE]);
+
+// prefix_decode for message idx against the reference walker, plus an
+// encode round trip. Returns the fast path's result.
+int  ref_diff_message(unsigned idx, const uint8_t *p, uint32_t len);
+
+#endif //COMP4985_REFERENCE_H
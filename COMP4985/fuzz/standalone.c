@@ -0,0 +1,42 @@
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// main() for builds without libFuzzer (GCC, afl-gcc, replaying a crash):
+// runs the target once per file named on the command line, or once on
+// stdin, so `afl-fuzz -i seeds -o out -- ./fuzz_frame @@` works as is.
+// ---------------------------------------------------------------------------
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static int run_file(FILE *f, const char *name) {
+    size_t   cap = 1 << 16, len = 0, n;
+    uint8_t *buf = malloc(cap);
+    if (!buf) return -1;
+
+    while ((n = fread(buf + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if (len == cap) {
+            uint8_t *grown = realloc(buf, cap * 2);
+            if (!grown) { free(buf); return -1; }
+            buf  = grown;
+            cap *= 2;
+        }
+    }
+    fprintf(stderr, "running %s (%zu bytes)\n", name, len);
+    LLVMFuzzerTestOneInput(buf, len);
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) return run_file(stdin, "<stdin>") < 0;
+
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (!f) { perror(argv[i]); return 1; }
+        int rc = run_file(f, argv[i]);
+        fclose(f);
+        if (rc < 0) return 1;
+    }
+    return 0;
+}
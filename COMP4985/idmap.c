@@ -0,0 +1,87 @@
+#include "protocol.h"
+#include "idmap.h"
+
+#define IDMAP_MIN_CAP  16
+
+// ===========================================================================
+// IdMap
+// ===========================================================================
+
+static IdMapSlot *map_find(IdMapSlot *slots, uint32_t cap, uint32_t key) {
+    uint32_t i = id_hash(key) & (cap - 1);
+    while (slots[i].val && slots[i].key != key)
+        i = (i + 1) & (cap - 1);
+    return &slots[i];
+}
+
+static int map_grow(IdMap *m) {
+    uint32_t   ncap  = m->cap ? m->cap * 2 : IDMAP_MIN_CAP;
+    IdMapSlot *slots = calloc(ncap, sizeof(IdMapSlot));
+    if (!slots) return -1;
+
+    for (uint32_t i = 0; i < m->cap; i++)
+        if (m->slots[i].val)
+            *map_find(slots, ncap, m->slots[i].key) = m->slots[i];
+
+    free(m->slots);
+    m->slots = slots;
+    m->cap   = ncap;
+    return 0;
+}
+
+void *idmap_get(const IdMap *m, uint32_t key) {
+    if (m->cap == 0) return NULL;
+    return map_find(m->slots, m->cap, key)->val;
+}
+
+int idmap_put(IdMap *m, uint32_t key, void *val) {
+    if ((m->count + 1) * 2 > m->cap && map_grow(m) < 0) return -1;
+
+    IdMapSlot *s = map_find(m->slots, m->cap, key);
+    if (!s->val) m->count++;
+    s->key = key;
+    s->val = val;
+    return 0;
+}
+
+// ===========================================================================
+// IdSet
+// ===========================================================================
+
+static uint32_t *set_find(uint32_t *slots, uint32_t cap, uint32_t id) {
+    uint32_t i = id_hash(id) & (cap - 1);
+    while (slots[i] && slots[i] != id)
+        i = (i + 1) & (cap - 1);
+    return &slots[i];
+}
+
+static int set_grow(IdSet *s) {
+    uint32_t  ncap  = s->cap ? s->cap * 2 : IDMAP_MIN_CAP;
+    uint32_t *slots = calloc(ncap, sizeof(uint32_t));
+    if (!slots) return -1;
+
+    for (uint32_t i = 0; i < s->cap; i++)
+        if (s->slots[i])
+            *set_find(slots, ncap, s->slots[i]) = s->slots[i];
+
+    free(s->slots);
+    s->slots = slots;
+    s->cap   = ncap;
+    return 0;
+}
+
+int idset_has(const IdSet *s, uint32_t id) {
+    if (s->cap == 0 || id == 0) return 0;
+    return *set_find(s->slots, s->cap, id) == id;
+}
+
+int idset_add(IdSet *s, uint32_t id) {
+    if (id == 0) return -1;
+    if ((s->count + 1) * 2 > s->cap && set_grow(s) < 0) return -1;
+
+    uint32_t *slot = set_find(s->slots, s->cap, id);
+    if (*slot) return 0;
+    *slot = id;
+    s->count++;
+    return 1;
+}
@@ -0,0 +1,52 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_IDMAP_H
+#define COMP4985_IDMAP_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Open-addressing tables keyed by 32-bit IDs
+//
+// Linear probing, power-of-two capacity, grown ×2 at half load, so lookups
+// stay at one or two probes from a handful of entries up to tens of
+// millions. Nothing is ever removed. Not thread-safe: the owner locks.
+// ---------------------------------------------------------------------------
+
+// ID → pointer. NULL values are not allowed (NULL means "absent").
+typedef struct {
+    uint32_t key;
+    void    *val;
+} IdMapSlot;
+
+typedef struct {
+    IdMapSlot *slots;
+    uint32_t   cap;     // 0 or a power of two
+    uint32_t   count;
+} IdMap;
+
+void *idmap_get(const IdMap *m, uint32_t key);
+
+// Inserts or replaces. Returns -1 if out of memory.
+int   idmap_put(IdMap *m, uint32_t key, void *val);
+
+// Set of non-zero IDs (0 marks an empty slot).
+typedef struct {
+    uint32_t *slots;
+    uint32_t  cap;
+    uint32_t  count;
+} IdSet;
+
+int idset_has(const IdSet *s, uint32_t id);
+
+// Returns 1 if added, 0 if already present, -1 if out of memory.
+int idset_add(IdSet *s, uint32_t id);
+
+// Fibonacci hashing: good spread for sequential IDs, one multiply
+static inline uint32_t id_hash(uint32_t id) {
+    return id * 2654435769u;
+}
+
+#endif //COMP4985_IDMAP_H
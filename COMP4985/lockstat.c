@@ -0,0 +1,103 @@
+#include "protocol.h"
+#include "lockstat.h"
+#include "metrics.h"
+
+typedef struct {
+    _Atomic uint64_t acquired, contended;
+    _Atomic uint64_t wait_ns, hold_ns;
+    _Atomic uint64_t wait_hist[LOCK_HIST_BUCKETS];
+    _Atomic uint64_t hold_hist[LOCK_HIST_BUCKETS];
+} __attribute__((aligned(64))) LockStats;
+
+static LockStats lock_stats[LOCK_COUNT];
+
+// First of each lock's six consecutive metrics (see LOCK_METRICS)
+static const MetricId metric_base[LOCK_COUNT] = {
+#define LOCK_BASE(X, id, name) METRIC_LOCK_##id##_ACQUIRED,
+    LOCK_LIST(LOCK_BASE, _)
+#undef LOCK_BASE
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Bucket b > 0 holds [2^(b-1), 2^b - 1] ns; bucket 0 holds 0
+static uint32_t hist_bucket(uint64_t ns) {
+    uint32_t b = ns ? 64 - (uint32_t)__builtin_clzll(ns) : 0;
+    return b < LOCK_HIST_BUCKETS ? b : LOCK_HIST_BUCKETS - 1;
+}
+
+static void bump(_Atomic uint64_t *v, uint64_t n) {
+    atomic_fetch_add_explicit(v, n, memory_order_relaxed);
+}
+
+// ===========================================================================
+// Lock / unlock
+// ===========================================================================
+
+void tracked_lock(TrackedMutex *m) {
+    LockStats *s    = &lock_stats[m->id];
+    uint64_t   wait = 0;
+
+    if (pthread_mutex_trylock(&m->mutex) == 0) {
+        m->held_since = now_ns();
+    } else {
+        uint64_t t0 = now_ns();
+        pthread_mutex_lock(&m->mutex);
+        m->held_since = now_ns();
+        wait = m->held_since - t0;
+        bump(&s->contended, 1);
+        bump(&s->wait_ns, wait);
+    }
+    bump(&s->acquired, 1);
+    bump(&s->wait_hist[hist_bucket(wait)], 1);
+}
+
+void tracked_unlock(TrackedMutex *m) {
+    LockStats *s    = &lock_stats[m->id];
+    uint64_t   hold = now_ns() - m->held_since;
+    bump(&s->hold_ns, hold);
+    bump(&s->hold_hist[hist_bucket(hold)], 1);
+    pthread_mutex_unlock(&m->mutex);
+}
+
+// ===========================================================================
+// Metrics
+// ===========================================================================
+
+// p99 of what hist gained since prev (then brought up to date), as the
+// upper bound of its bucket. 0 if nothing was recorded.
+static uint64_t interval_p99(_Atomic uint64_t *hist, uint64_t *prev) {
+    uint64_t delta[LOCK_HIST_BUCKETS], total = 0;
+    for (uint32_t b = 0; b < LOCK_HIST_BUCKETS; b++) {
+        uint64_t v = atomic_load_explicit(&hist[b], memory_order_relaxed);
+        delta[b] = v - prev[b];
+        prev[b]  = v;
+        total   += delta[b];
+    }
+    if (total == 0) return 0;
+
+    uint64_t rank = total - total / 100, seen = 0;
+    for (uint32_t b = 0; b < LOCK_HIST_BUCKETS; b++)
+        if ((seen += delta[b]) >= rank) return b ? (1ull << b) - 1 : 0;
+    return (1ull << (LOCK_HIST_BUCKETS - 1)) - 1;
+}
+
+void lockstat_publish(void) {
+    static uint64_t prev_wait[LOCK_COUNT][LOCK_HIST_BUCKETS];
+    static uint64_t prev_hold[LOCK_COUNT][LOCK_HIST_BUCKETS];
+
+    for (int i = 0; i < LOCK_COUNT; i++) {
+        LockStats *s    = &lock_stats[i];
+        MetricId   base = metric_base[i];
+        metric_set(base + 0, atomic_load(&s->acquired));
+        metric_set(base + 1, atomic_load(&s->contended));
+        metric_set(base + 2, atomic_load(&s->wait_ns) / 1000);
+        metric_set(base + 3, atomic_load(&s->hold_ns) / 1000);
+        metric_set(base + 4, interval_p99(s->wait_hist, prev_wait[i]));
+        metric_set(base + 5, interval_p99(s->hold_hist, prev_hold[i]));
+    }
+}
@@ -0,0 +1,64 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_LOCKSTAT_H
+#define COMP4985_LOCKSTAT_H
+
+#include "protocol.h"
+#include <stdatomic.h>
+
+// ---------------------------------------------------------------------------
+// Instrumented mutexes
+//
+// The global locks on the request path are TrackedMutexes: a plain mutex
+// that counts its acquisitions, how many had to wait, and histograms of
+// the time spent waiting for it and holding it (powers of two in ns).
+// An uncontended lock / unlock costs two extra clock reads; the counters
+// are only written by the holder, so they add no contention of their own.
+//
+// lockstat_publish copies them into the metrics (lock.<name>.*), with
+// the quantiles over the interval since the previous publish; the metrics
+// report calls it before each dump:
+//
+//   acquired  contended          counts since start
+//   wait_us   hold_us            total time since start
+//   wait_p99_ns  hold_p99_ns     over the last interval
+//
+// Add a lock by adding one L() line below and declaring it with
+// TRACKED_MUTEX_INITIALIZER. Not for mutexes used with a condition
+// variable.
+// ---------------------------------------------------------------------------
+#define LOCK_LIST(L, X)                                                     \
+    L(X, MANAGER,     "manager")      /* manager socket writes */           \
+    L(X, SPOOL,       "spool")        /* log forwarding / spool */          \
+    L(X, ACC_ID,      "acc_id")       /* user ID allocation */              \
+    L(X, DIRECTORY,   "dir")          /* users, channels, membership */     \
+    L(X, PERSIST_LOG, "persist_log")  /* log segment appends */             \
+    L(X, UI,          "ui")           /* curses panes */
+
+#define LOCK_HIST_BUCKETS  40   // 1 ns … ~9 min
+
+typedef enum {
+#define LOCK_ENUM(X, id, name) LOCK_##id,
+    LOCK_LIST(LOCK_ENUM, _)
+#undef LOCK_ENUM
+    LOCK_COUNT
+} LockId;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    LockId          id;
+    uint64_t        held_since;   // ns; written by the holder
+} TrackedMutex;
+
+#define TRACKED_MUTEX_INITIALIZER(lock_id) \
+    { .mutex = PTHREAD_MUTEX_INITIALIZER, .id = (lock_id) }
+
+void tracked_lock(TrackedMutex *m);
+void tracked_unlock(TrackedMutex *m);
+
+// Refreshes the lock.* metrics. One caller at a time (the metrics report).
+void lockstat_publish(void);
+
+#endif //COMP4985_LOCKSTAT_H
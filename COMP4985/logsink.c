@@ -0,0 +1,149 @@
+#include "protocol.h"
+#include "logsink.h"
+#include "manager.h"
+#include "trace.h"
+#ifdef COMP4985_HAVE_CURSES
+#include "Ui.h"
+#endif
+
+#include <fcntl.h>
+
+static int sink_fd   = STDERR_FILENO;   // structured sink, -1 = off
+static int ui_active = 0;
+static int muted     = 0;
+
+static const char *const source_names[] = {
+    [LOG_SERVER]  = "server",
+    [LOG_CLIENT]  = "client",
+    [LOG_MANAGER] = "manager"
+};
+
+// ===========================================================================
+// Structured sink
+// ===========================================================================
+
+// JSON string body: quotes, backslashes and control bytes escaped, the
+// rest (UTF-8 included) copied through. Returns the bytes written.
+static size_t json_escape(char *out, size_t cap, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    size_t n = 0;
+    for (; *s && n + 6 < cap; s++) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\') {
+            out[n++] = '\\';
+            out[n++] = (char)ch;
+        } else if (ch == '\n') {
+            out[n++] = '\\';
+            out[n++] = 'n';
+        } else if (ch < 0x20) {
+            memcpy(out + n, "\\u00", 4);
+            out[n + 4] = hex[ch >> 4];
+            out[n + 5] = hex[ch & 0xF];
+            n += 6;
+        } else {
+            out[n++] = (char)ch;
+        }
+    }
+    return n;
+}
+
+static void write_record(LogSource src, const char *msg) {
+    char line[LOG_MSG_MAX * 6 + 128];
+
+    struct timespec ts;
+    struct tm       t;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    gmtime_r(&ts.tv_sec, &t);
+
+    size_t n = (size_t)snprintf(line, sizeof(line),
+        "{\"ts\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03ldZ\",\"src\":\"%s\",\"server\":%u,\"msg\":\"",
+        t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec,
+        ts.tv_nsec / 1000000, source_names[src], my_server_id);
+    n += json_escape(line + n, sizeof(line) - n - 3, msg);
+    memcpy(line + n, "\"}\n", 3);
+    n += 3;
+
+    // One write per record: O_APPEND keeps concurrent lines whole
+    for (size_t off = 0; off < n; ) {
+        ssize_t w = write(sink_fd, line + off, n - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return;
+        off += (size_t)w;
+    }
+}
+
+// ===========================================================================
+// Setup
+// ===========================================================================
+
+int log_open(int use_ui, const char *path) {
+    int fd = -1;
+    if (path) {
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "Cannot open log file %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+
+#ifdef COMP4985_HAVE_CURSES
+    if (use_ui && ui_start() == 0) ui_active = 1;
+#else
+    (void)use_ui;
+#endif
+
+    // Without the UI the structured sink is the only output
+    sink_fd = fd >= 0 ? fd : ui_active ? -1 : STDERR_FILENO;
+    return 0;
+}
+
+void log_close(void) {
+#ifdef COMP4985_HAVE_CURSES
+    if (ui_active) ui_stop();
+#endif
+    ui_active = 0;
+    if (sink_fd > STDERR_FILENO) close(sink_fd);
+    sink_fd = STDERR_FILENO;
+}
+
+void log_mute(void) {
+    log_close();
+    sink_fd = -1;
+    muted   = 1;
+}
+
+void log_emit(LogSource src, const char *msg) {
+#ifdef COMP4985_HAVE_CURSES
+    if (ui_active) ui_write(src, msg);
+#endif
+    if (sink_fd >= 0) write_record(src, msg);
+}
+
+// ===========================================================================
+// printf-style front ends
+// ===========================================================================
+
+void server_log(const char *fmt, ...) {
+    if (muted) return;
+    char buf[LOG_MSG_MAX]; va_list a; va_start(a, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, a); va_end(a);
+    log_emit(LOG_SERVER, buf);
+}
+void manager_log(const char *fmt, ...) {
+    if (muted) return;
+    char buf[LOG_MSG_MAX]; va_list a; va_start(a, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, a); va_end(a);
+    log_emit(LOG_MANAGER, buf);
+}
+void client_log(const char *fmt, ...) {
+    if (muted) return;
+    uint64_t t = trace_enter();
+    char buf[LOG_MSG_MAX]; va_list a; va_start(a, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, a); va_end(a);
+    log_emit(LOG_CLIENT, buf);
+    trace_leave(TRACE_LOG, t);
+
+    t = trace_enter();
+    send_log_to_manager(buf);
+    trace_leave(TRACE_FORWARD, t);
+}
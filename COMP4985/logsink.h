@@ -0,0 +1,52 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_LOGSINK_H
+#define COMP4985_LOGSINK_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Log sinks
+//
+// Every line has a source (the pane it is drawn in) and goes to whichever
+// sinks are open:
+//
+//   terminal    the three-pane curses UI in Ui.c; only in builds with
+//               COMP4985_HAVE_CURSES, and only when the server is not
+//               headless and stdout is a terminal
+//   structured  one JSON object per line, appended with a single write()
+//               so concurrent lines never interleave:
+//                 {"ts":"2026-03-01T12:00:00.123Z","src":"client",
+//                  "server":1,"msg":"[LOGIN]  User: ..."}
+//               to the configured log file, or to stderr without the UI
+//
+// Until log_open runs, lines go to the structured sink on stderr.
+// ---------------------------------------------------------------------------
+typedef enum {
+    LOG_SERVER,
+    LOG_CLIENT,
+    LOG_MANAGER
+} LogSource;
+
+#define LOG_MSG_MAX  1024   // longer messages are truncated
+
+// use_ui asks for the terminal UI; falls back to stderr when the build or
+// the terminal cannot provide it. path (NULL = none) is opened for append.
+// Returns -1 if path cannot be opened.
+int  log_open(int use_ui, const char *path);
+void log_close(void);
+
+// Turns all logging off for good: the front ends below return before
+// formatting anything, and nothing is forwarded to the manager.
+void log_mute(void);
+
+void log_emit(LogSource src, const char *msg);
+
+// printf-style front ends; client_log also forwards the line to the manager
+void server_log(const char *fmt, ...);
+void manager_log(const char *fmt, ...);
+void client_log(const char *fmt, ...);
+
+#endif //COMP4985_LOGSINK_H
@@ -1,27 +1,66 @@
 #include "protocol.h"
-#include "ui.h"
-#include "manager.h"
-#include "client.h"
+#include "logsink.h"
+#include "config.h"
+#include "server.h"
 
-#include <ncurses.h>
+#include <signal.h>
 
 // ===========================================================================
-// Helpers
+// Command line
 // ===========================================================================
 
-uint32_t get_my_ip(void) {
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
-    struct sockaddr_in addr = {
-        .sin_family = AF_INET,
-        .sin_port   = htons(53)
-    };
-    inet_pton(AF_INET, "8.8.8.8", &addr.sin_addr);
-    connect(sock, (struct sockaddr *)&addr, sizeof(addr));
-    struct sockaddr_in local;
-    socklen_t len = sizeof(local);
-    getsockname(sock, (struct sockaddr *)&local, &len);
-    close(sock);
-    return local.sin_addr.s_addr;
+static void usage(const char *prog) {
+    printf("Usage: %s <Port> <Mgr_IP> <Mgr_Port> [options]\n"
+           "       %s --config <file> [options]\n"
+           "Options: --config <file>  --standby  --data <dir>  --headless  --log <file>\n"
+           "         --capture <file>  --trace <file>\n",
+           prog, prog);
+}
+
+// Command line on top of the config file: --config is applied first
+// wherever it appears, so every other argument overrides it.
+static int parse_args(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc &&
+            config_load(argv[i + 1]) < 0)
+            return -1;
+
+    int i = 1;
+    if (argc >= 4 && argv[1][0] != '-') {
+        const char *err = config_set("port", argv[1]);
+        if (!err) err = config_set("manager_ip", argv[2]);
+        if (!err) err = config_set("manager_port", argv[3]);
+        if (err) {
+            printf("Bad address or port: %s\n", err);
+            return -1;
+        }
+        i = 4;
+    }
+
+    for (; i < argc; i++) {
+        const char *err = NULL;
+        if      (strcmp(argv[i], "--config") == 0 && i + 1 < argc) i++;
+        else if (strcmp(argv[i], "--standby") == 0)                err = config_set("standby", "true");
+        else if (strcmp(argv[i], "--headless") == 0)               err = config_set("headless", "true");
+        else if (strcmp(argv[i], "--data") == 0 && i + 1 < argc)   err = config_set("data_dir", argv[++i]);
+        else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc)    err = config_set("log_file", argv[++i]);
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) err = config_set("capture_file", argv[++i]);
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)  err = config_set("trace_file", argv[++i]);
+        else {
+            printf("Unknown option: %s\n", argv[i]);
+            return -1;
+        }
+        if (err) {
+            printf("%s: %s\n", argv[i], err);
+            return -1;
+        }
+    }
+
+    if (!server_config.port || !server_config.manager_ip[0] || !server_config.manager_port) {
+        printf("Port, manager address and manager port are required\n");
+        return -1;
+    }
+    return 0;
 }
 
 // ===========================================================================
@@ -29,66 +68,29 @@ uint32_t get_my_ip(void) {
 // ===========================================================================
 
 int main(int argc, char *argv[]) {
-    if (argc < 4) {
-        printf("Usage: %s <Port> <Mgr_IP> <Mgr_Port>\n", argv[0]);
+    if (parse_args(argc, argv) < 0) {
+        usage(argv[0]);
         return 1;
     }
 
-    my_server_ip = get_my_ip();
-
-    initscr(); start_color(); cbreak(); noecho(); curs_set(0);
-    init_pair(1, COLOR_CYAN, COLOR_BLACK);
-
-    int cols = COLS / 3;
-    int rows = LINES - 2;
-    win_srv = newwin(rows, cols - 1, 1, 0);
-    win_cli = newwin(rows, cols - 1, 1, cols);
-    win_mgr = newwin(rows, cols - 1, 1, cols * 2);
-    scrollok(win_srv, TRUE);
-    scrollok(win_cli, TRUE);
-    scrollok(win_mgr, TRUE);
-
-    attron(A_REVERSE);
-    mvprintw(0, 1,            " SERVER  ");
-    mvprintw(0, cols + 1,     " CLIENTS ");
-    mvprintw(0, cols * 2 + 1, " MANAGER ");
-    attroff(A_REVERSE);
-    refresh();
-
-    ManagerInfo *info = malloc(sizeof(ManagerInfo));
-    strncpy(info->ip, argv[2], sizeof(info->ip) - 1);
-    info->port    = atoi(argv[3]);
-    info->my_port = atoi(argv[1]);
-
-    pthread_t mgr_tid;
-    pthread_create(&mgr_tid, NULL, manager_connection_thread, info);
+    // SIGINT / SIGTERM are taken synchronously below; block them before
+    // any thread exists so every thread inherits the mask
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
 
-    int srv_fd = socket(AF_INET, SOCK_STREAM, 0);
-    int opt = 1;
-    setsockopt(srv_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-    struct sockaddr_in saddr = {
-        .sin_family      = AF_INET,
-        .sin_port        = htons(info->my_port),
-        .sin_addr.s_addr = INADDR_ANY
-    };
-    bind(srv_fd, (struct sockaddr *)&saddr, sizeof(saddr));
-    listen(srv_fd, 10);
-
-    server_log("Server online — port %d  (Protocol v0.2)", info->my_port);
-
-    while (1) {
-        struct sockaddr_in caddr;
-        socklen_t clen = sizeof(caddr);
-        int csock = accept(srv_fd, (struct sockaddr *)&caddr, &clen);
-        if (csock >= 0) {
-            int *p = malloc(sizeof(int));
-            *p = csock;
-            pthread_t t;
-            pthread_create(&t, NULL, handle_client, p);
-            pthread_detach(t);
-        }
+    if (server_start() < 0) {
+        log_close();
+        fprintf(stderr, "Server failed to start\n");
+        return 1;
     }
 
-    endwin();
+    int sig;
+    sigwait(&sigs, &sig);
+    server_log("Signal %d — shutting down", sig);
+    server_stop();
+    log_close();
     return 0;
-}
\ No newline at end of file
+}
@@ -1,16 +1,28 @@
 #include "protocol.h"
-#include "ui.h"
+#include "logsink.h"
 #include "manager.h"
+#include "replicate.h"
+#include "store.h"
+#include "directory.h"
+#include "metrics.h"
+#include "stats.h"
+#include "admission.h"
+#include "affinity.h"
+
+#include <fcntl.h>
+#include <poll.h>
 
 // ===========================================================================
 // Globals
 // ===========================================================================
 
-uint8_t  my_server_id      = 0;
-uint32_t my_server_ip      = 0;
-int      manager_socket    = -1;
-int      manager_connected = 0;
-pthread_mutex_t manager_mutex = PTHREAD_MUTEX_INITIALIZER;
+_Atomic uint8_t my_server_id      = 0;
+uint32_t        my_server_ip      = 0;
+int             manager_socket    = -1;
+_Atomic int     manager_connected = 0;
+TrackedMutex    manager_mutex     = TRACKED_MUTEX_INITIALIZER(LOCK_MANAGER);
+int             server_standby    = 0;
+int             manager_enabled   = 0;
 
 // ===========================================================================
 // send_binary_msg / recv_binary_msg
@@ -19,19 +31,35 @@ pthread_mutex_t manager_mutex = PTHREAD_MUTEX_INITIALIZER;
 int send_binary_msg(int sock,
                     uint8_t res_type, uint8_t crud, uint8_t ack,
                     const void *pay, uint32_t len)
+{
+    return send_binary_msg_flags(sock, res_type, crud, ack, 0, pay, len);
+}
+
+int send_binary_msg_flags(int sock,
+                          uint8_t res_type, uint8_t crud, uint8_t ack,
+                          uint8_t flags, const void *pay, uint32_t len)
+{
+    return send_binary_msg_ver(sock, PROTO_VER_MINOR, res_type, crud, ack,
+                               flags, pay, len);
+}
+
+int send_binary_msg_ver(int sock, uint8_t minor,
+                        uint8_t res_type, uint8_t crud, uint8_t ack,
+                        uint8_t flags, const void *pay, uint32_t len)
 {
     GlobalHeader h = {
         .version_major  = PROTO_VER_MAJOR,
-        .version_minor  = PROTO_VER_MINOR,
+        .version_minor  = minor,
         .resource_type  = res_type,
         .crud           = crud,
         .ack            = ack,
-        .status_major   = 0,
-        .status_minor   = 0,
-        .padding        = 0,
-        .message_length = htonl(len)
+        .status         = STATUS_OK,
+        .flags          = flags,
+        .message_length = len
     };
-    if (send(sock, &h, sizeof(GlobalHeader), MSG_NOSIGNAL) <= 0) return -1;
+    uint8_t raw[HEADER_SIZE];
+    header_encode(&h, raw);
+    if (send(sock, raw, HEADER_SIZE, MSG_NOSIGNAL) <= 0) return -1;
     if (len > 0 && pay) {
         if (send(sock, pay, len, MSG_NOSIGNAL) <= 0) return -1;
     }
@@ -39,10 +67,12 @@ int send_binary_msg(int sock,
 }
 
 int recv_binary_msg(int sock, GlobalHeader *h, void *pay, uint32_t max) {
-    ssize_t n = recv(sock, h, sizeof(GlobalHeader), MSG_WAITALL);
-    if (n <= 0) return -1;
+    uint8_t raw[HEADER_SIZE];
+    ssize_t n = recv(sock, raw, HEADER_SIZE, MSG_WAITALL);
+    if (n != HEADER_SIZE) return -1;
+    header_decode(h, raw);
 
-    uint32_t len = ntohl(h->message_length);
+    uint32_t len = h->message_length;
     if (len > max) return -2;
 
     if (len > 0) {
@@ -52,24 +82,48 @@ int recv_binary_msg(int sock, GlobalHeader *h, void *pay, uint32_t max) {
     return (int)len;
 }
 
-// send_error_response — sends a header-only reply with the given status code
-// and no payload. Used to reject bad requests without crashing the connection.
-int send_error_response(int sock,
-                        uint8_t res_type, uint8_t crud,
-                        uint8_t status_code)
+static int send_status_frame(int sock, uint8_t minor,
+                             uint8_t res_type, uint8_t crud,
+                             uint8_t status_code, int send_flags)
 {
     GlobalHeader h = {
         .version_major  = PROTO_VER_MAJOR,
-        .version_minor  = PROTO_VER_MINOR,
+        .version_minor  = minor,
         .resource_type  = res_type,
         .crud           = crud,
         .ack            = IS_ACK,
-        .status_major   = (status_code >> 4) & 0xF,
-        .status_minor   = status_code & 0xF,
-        .padding        = 0,
+        .status         = status_code,
+        .flags          = 0,
         .message_length = 0
     };
-    return send(sock, &h, sizeof(GlobalHeader), MSG_NOSIGNAL) > 0 ? 0 : -1;
+    uint8_t raw[HEADER_SIZE];
+    header_encode(&h, raw);
+    return send(sock, raw, HEADER_SIZE, send_flags) > 0 ? 0 : -1;
+}
+
+// send_error_response — sends a header-only reply with the given status code
+// and no payload. Used to reject bad requests without crashing the connection.
+int send_error_response(int sock,
+                        uint8_t res_type, uint8_t crud,
+                        uint8_t status_code)
+{
+    return send_status_frame(sock, PROTO_VER_MINOR, res_type, crud, status_code,
+                             MSG_NOSIGNAL);
+}
+
+int send_error_response_ver(int sock, uint8_t minor,
+                            uint8_t res_type, uint8_t crud,
+                            uint8_t status_code)
+{
+    return send_status_frame(sock, minor, res_type, crud, status_code, MSG_NOSIGNAL);
+}
+
+int send_error_response_nowait(int sock,
+                               uint8_t res_type, uint8_t crud,
+                               uint8_t status_code)
+{
+    return send_status_frame(sock, PROTO_VER_MINOR, res_type, crud, status_code,
+                             MSG_NOSIGNAL | MSG_DONTWAIT);
 }
 
 // ===========================================================================
@@ -83,93 +137,390 @@ void send_server_register(int sock) {
         .server_ip = my_server_ip,
         .server_id = my_server_id
     };
+    uint8_t raw[REGISTER_SIZE];
     send_binary_msg(sock, RES_SYSTEM, CRUD_CREATE, IS_REQ,
-                    &reg, sizeof(reg));
+                    raw, register_payload_encode(&reg, raw));
 }
 
 // spec row 3 — Register ACK
 // RECV: res=00000  crud=00  ack=1
-void handle_register_ack(uint8_t *buf) {
-    my_server_id = ((RegisterPayload *)buf)->server_id;
+void handle_register_ack(uint8_t *buf, uint32_t len) {
+    RegisterPayload reg;
+    if (register_payload_decode(&reg, buf, len) < 0) {
+        manager_log("[REG ACK] Short payload: %u bytes", len);
+        return;
+    }
+    my_server_id = reg.server_id;
     manager_log("[REG ACK] Server ID: 0x%02X", my_server_id);
+
+    // Ask peers for anything written before we joined
+    replication_request_sync();
 }
 
 // spec row 4/5 — Activate Server / Activate Server ACK
 // RECV: res=00000  crud=10  ack=0
 // SEND: res=00000  crud=10  ack=1
 void handle_activate_server(int sock) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    int was_standby = server_standby;
+    server_standby  = 0;
+
     RegisterPayload act = {
         .server_ip = my_server_ip,
         .server_id = my_server_id
     };
+    uint8_t raw[REGISTER_SIZE];
     send_binary_msg(sock, RES_SYSTEM, CRUD_UPDATE, IS_ACK,
-                    &act, sizeof(act));
-    manager_log("[ACTIVATE ACK] Server is now Live!");
+                    raw, register_payload_encode(&act, raw));
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    long us = (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_nsec - t0.tv_nsec) / 1000;
+
+    uint32_t nusers, nchannels, nmsgs = 0;
+    directory_counts(&nusers, &nchannels);
+    nmsgs = (uint32_t)atomic_load(&store_head_total);
+
+    manager_log("[ACTIVATE ACK] Server is now Live!%s  %ld us  (%u users, %u channels, %u messages)",
+                was_standby ? " (from standby)" : "", us, nusers, nchannels, nmsgs);
+}
+
+int send_to_manager(uint8_t res_type, uint8_t crud, const void *pay, uint32_t len) {
+    int rc = -1;
+    tracked_lock(&manager_mutex);
+    if (manager_connected && manager_socket >= 0)
+        rc = send_binary_msg(manager_socket, res_type, crud, IS_REQ, pay, len);
+    tracked_unlock(&manager_mutex);
+    return rc;
+}
+
+// ===========================================================================
+// Log spool — Forward Logs produced while the link is down
+//
+// A bounded FIFO of ready-made LogPayload records. While the link is not
+// ready (disconnected, or connected but not yet registered) every log is
+// appended here; when full the oldest record is evicted and counted as
+// dropped. After Register ACK the whole spool is replayed in a few large
+// writes before live logs resume, so the manager sees logs in order.
+//
+// spool_mutex is never held across a send: replay copies a chunk out under
+// it, sends unlocked, then pops what went out. Records evicted meanwhile
+// are told apart by spool_popped, which counts every pop.
+// ===========================================================================
+
+typedef struct {
+    uint8_t *rec;   // LogPayload + text
+    uint16_t len;
+} SpoolEntry;
+
+static TrackedMutex spool_mutex = TRACKED_MUTEX_INITIALIZER(LOCK_SPOOL);
+static SpoolEntry spool[MANAGER_SPOOL_RECORDS];
+static uint32_t   spool_head, spool_count;
+static uint64_t   spool_popped;   // records ever popped, sent or evicted
+static size_t     spool_bytes;
+static int        link_ready;   // registered and spool drained; under spool_mutex
+
+// Caller holds spool_mutex.
+static void spool_pop(void) {
+    SpoolEntry *e = &spool[spool_head];
+    spool_bytes -= e->len;
+    free(e->rec);
+    e->rec      = NULL;
+    spool_head  = (spool_head + 1) % MANAGER_SPOOL_RECORDS;
+    spool_count--;
+    spool_popped++;
+}
+
+// Caller holds spool_mutex.
+static void spool_push(const uint8_t *rec, uint16_t len) {
+    while (spool_count > 0 &&
+           (spool_count == MANAGER_SPOOL_RECORDS ||
+            spool_bytes + len > MANAGER_SPOOL_BYTES)) {
+        spool_pop();
+        metric_add(METRIC_MGR_SPOOL_DROPPED, 1);
+    }
+
+    uint8_t *copy = malloc(len);
+    if (!copy) {
+        metric_add(METRIC_MGR_SPOOL_DROPPED, 1);
+        return;
+    }
+    memcpy(copy, rec, len);
+
+    uint32_t tail = (spool_head + spool_count) % MANAGER_SPOOL_RECORDS;
+    spool[tail] = (SpoolEntry){ .rec = copy, .len = len };
+    spool_count++;
+    spool_bytes += len;
+
+    metric_set(METRIC_MGR_SPOOL_RECORDS, spool_count);
+    metric_set(METRIC_MGR_SPOOL_BYTES,   spool_bytes);
+}
+
+// Sends the spool as back-to-back Forward Logs frames packed into
+// MANAGER_REPLAY_CHUNK-sized writes. Records spooled before the server had
+// an id are stamped with the current one. Returns the number replayed, or
+// -1 if the link dropped (unsent records stay spooled).
+static int spool_replay(int sock) {
+    uint8_t *chunk = malloc(MANAGER_REPLAY_CHUNK);
+    if (!chunk) return -1;
+
+    int replayed = 0;
+    tracked_lock(&spool_mutex);
+
+    while (spool_count > 0) {
+        size_t   used  = 0;
+        uint32_t taken = 0;
+        uint64_t first = spool_popped;
+
+        while (taken < spool_count) {
+            SpoolEntry *e = &spool[(spool_head + taken) % MANAGER_SPOOL_RECORDS];
+            if (used + HEADER_SIZE + e->len > MANAGER_REPLAY_CHUNK) break;
+
+            GlobalHeader h = {
+                .version_major  = PROTO_VER_MAJOR,
+                .version_minor  = PROTO_VER_MINOR,
+                .resource_type  = RES_LOG,
+                .crud           = CRUD_CREATE,
+                .ack            = IS_REQ,
+                .message_length = e->len
+            };
+            header_encode(&h, chunk + used);
+            uint8_t *rec = chunk + used + HEADER_SIZE;
+            memcpy(rec, e->rec, e->len);
+
+            LogPayload lp;
+            log_payload_decode(&lp, rec, e->len);
+            if (lp.server_id == 0) {
+                lp.server_id = my_server_id;
+                log_payload_encode(&lp, rec);
+            }
+            used += HEADER_SIZE + e->len;
+            taken++;
+        }
+
+        tracked_unlock(&spool_mutex);
+        tracked_lock(&manager_mutex);
+        ssize_t n = send(sock, chunk, used, MSG_NOSIGNAL);
+        tracked_unlock(&manager_mutex);
+        tracked_lock(&spool_mutex);
+        if (n != (ssize_t)used) {
+            replayed = -1;
+            break;
+        }
+
+        // Any of them evicted while unlocked have been popped already
+        while (spool_count > 0 && spool_popped < first + taken) spool_pop();
+        metric_add(METRIC_MGR_SPOOL_REPLAYED, taken);
+        replayed += (int)taken;
+    }
+
+    metric_set(METRIC_MGR_SPOOL_RECORDS, spool_count);
+    metric_set(METRIC_MGR_SPOOL_BYTES,   spool_bytes);
+    if (replayed >= 0) link_ready = 1;   // live logs may bypass the spool now
+    tracked_unlock(&spool_mutex);
+
+    free(chunk);
+    return replayed;
+}
+
+static void spool_link_down(void) {
+    tracked_lock(&spool_mutex);
+    link_ready = 0;
+    tracked_unlock(&spool_mutex);
 }
 
 // spec row 14 — Forward Logs
 // SEND: res=00011  crud=00  ack=0
 // Payload: server_id[1] | log_length[2 LE] | log text[variable]
 void send_log_to_manager(const char *log_msg) {
-    pthread_mutex_lock(&manager_mutex);
-    if (manager_connected && manager_socket >= 0) {
-        uint16_t msg_len = (uint16_t)strlen(log_msg);
-        uint8_t  buf[BUFFER_SIZE];
-
-        LogPayload *lp = (LogPayload *)buf;
-        lp->server_id  = my_server_id;
-        lp->log_length = htole16(msg_len);   // LITTLE-ENDIAN per spec
-        memcpy(buf + sizeof(LogPayload), log_msg, msg_len);
-
-        send_binary_msg(manager_socket, RES_LOG, CRUD_CREATE, IS_REQ,
-                        buf, sizeof(LogPayload) + msg_len);
+    if (!manager_enabled) return;
+    size_t   n       = strlen(log_msg);
+    uint16_t msg_len = (uint16_t)(n < BUFFER_SIZE - LOG_SIZE ? n : BUFFER_SIZE - LOG_SIZE);
+    uint8_t  buf[BUFFER_SIZE];
+
+    LogPayload lp = {
+        .server_id  = my_server_id,
+        .log_length = msg_len   // sent little-endian per spec
+    };
+    log_payload_encode(&lp, buf);
+    memcpy(buf + LOG_SIZE, log_msg, msg_len);
+    uint16_t len = (uint16_t)(LOG_SIZE + msg_len);
+
+    // link_ready is only set once the spool is empty, so a live send can
+    // never overtake a spooled record
+    tracked_lock(&spool_mutex);
+    int live = link_ready;
+    tracked_unlock(&spool_mutex);
+    if (live && send_to_manager(RES_LOG, CRUD_CREATE, buf, len) == 0) return;
+
+    tracked_lock(&spool_mutex);
+    link_ready = 0;
+    spool_push(buf, len);
+    tracked_unlock(&spool_mutex);
+}
+
+// ===========================================================================
+// Heartbeat — load report for the manager's server selection
+// ===========================================================================
+
+static uint32_t clamp32(uint64_t v) {
+    return v > UINT32_MAX ? UINT32_MAX : (uint32_t)v;
+}
+
+// SEND: res=00000  crud=11  ack=0
+void* heartbeat_thread(void *arg) {
+    (void)arg;
+    affinity_enter(AFF_MANAGER);
+    StatsSnapshot *prev = calloc(1, sizeof(StatsSnapshot));
+    StatsSnapshot *now  = calloc(1, sizeof(StatsSnapshot));
+    uint64_t prev_us = stats_now_us();
+
+    while (1) {
+        usleep(HEARTBEAT_INTERVAL_MS * 1000);
+
+        stats_snapshot(now);
+        uint64_t now_us = stats_now_us();
+        uint64_t span   = now_us - prev_us;
+        if (span == 0) span = 1;
+
+        HeartbeatPayload hb = {
+            .server_id        = my_server_id,
+            .flags            = server_standby ? HB_FLAG_STANDBY : 0,
+            .interval_ms      = (uint16_t)(span / 1000 > UINT16_MAX ? UINT16_MAX : span / 1000),
+            .connections      = atomic_load(&active_connections),
+            .requests_per_sec = clamp32((now->requests - prev->requests) * 1000000u / span),
+            .messages_per_sec = clamp32((now->messages - prev->messages) * 1000000u / span),
+            .p99_us           = stats_quantile_us(now, prev, 0.99),
+            .outbound_kib     = clamp32(atomic_load(&outbound_bytes) >> 10),
+            .spool_records    = clamp32(metric_get(METRIC_MGR_SPOOL_RECORDS)),
+            .repl_backlog     = clamp32(metric_get(METRIC_REPL_BACKLOG))
+        };
+        uint8_t raw[HEARTBEAT_SIZE];
+        heartbeat_encode(&hb, raw);
+
+        StatsSnapshot *t = prev; prev = now; now = t;
+        prev_us = now_us;
+
+        if (my_server_id != 0 &&
+            send_to_manager(RES_SYSTEM, CRUD_DELETE, raw, sizeof(raw)) == 0)
+            metric_add(METRIC_MGR_HEARTBEATS, 1);
     }
-    pthread_mutex_unlock(&manager_mutex);
+    return NULL;
 }
 
 // ===========================================================================
 // Connection loop — connects to manager and dispatches the above handlers
 // ===========================================================================
+
+// Non-blocking connect bounded by MANAGER_CONNECT_TIMEOUT_MS. Returns a
+// connected blocking socket, or -1.
+static int manager_connect(const ManagerInfo *info) {
+    struct sockaddr_in mgr_addr = {
+        .sin_family = AF_INET,
+        .sin_port   = htons(info->port)
+    };
+    if (inet_pton(AF_INET, info->ip, &mgr_addr.sin_addr) != 1) return -1;
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    int fl = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, fl | O_NONBLOCK);
+
+    int rc = connect(sock, (struct sockaddr *)&mgr_addr, sizeof(mgr_addr));
+    if (rc < 0 && errno == EINPROGRESS) {
+        struct pollfd pfd = { .fd = sock, .events = POLLOUT };
+        int err = 0;
+        socklen_t elen = sizeof(err);
+        rc = -1;
+        if (poll(&pfd, 1, MANAGER_CONNECT_TIMEOUT_MS) == 1 &&
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &elen) == 0 && err == 0)
+            rc = 0;
+    }
+    if (rc < 0) {
+        close(sock);
+        return -1;
+    }
+
+    fcntl(sock, F_SETFL, fl);
+    return sock;
+}
+
+// Full-jitter exponential backoff: uniform in [0, min(cap, base·2^attempt)],
+// never below the base so a dead manager is not hammered.
+static unsigned backoff_ms(unsigned attempt, unsigned *seed) {
+    unsigned ceiling = MANAGER_BACKOFF_MAX_MS;
+    if (attempt < 16 && ((unsigned)MANAGER_BACKOFF_BASE_MS << attempt) < ceiling)
+        ceiling = (unsigned)MANAGER_BACKOFF_BASE_MS << attempt;
+    unsigned ms = (unsigned)rand_r(seed) % (ceiling + 1);
+    return ms < MANAGER_BACKOFF_BASE_MS ? MANAGER_BACKOFF_BASE_MS : ms;
+}
+
 void* manager_connection_thread(void *arg) {
     ManagerInfo *info = (ManagerInfo *)arg;
+    affinity_enter(AFF_MANAGER);
+    unsigned seed    = (unsigned)time(NULL) ^ (unsigned)getpid() ^ (unsigned)info->my_port;
+    unsigned attempt = 0;
+
     while (1) {
-        manager_log(">>> Connecting to Manager %s:%d", info->ip, info->port);
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        struct sockaddr_in mgr_addr = {
-            .sin_family = AF_INET,
-            .sin_port   = htons(info->port)
-        };
-        inet_pton(AF_INET, info->ip, &mgr_addr.sin_addr);
+        if (attempt == 0)
+            manager_log(">>> Connecting to Manager %s:%d", info->ip, info->port);
+        int sock = manager_connect(info);
 
-        if (connect(sock, (struct sockaddr *)&mgr_addr, sizeof(mgr_addr)) == 0) {
+        if (sock >= 0) {
             manager_log(">>> Connected");
+            metric_add(METRIC_MGR_CONNECTS, 1);
+            attempt = 0;
 
             send_server_register(sock);
 
-            pthread_mutex_lock(&manager_mutex);
+            tracked_lock(&manager_mutex);
             manager_socket    = sock;
             manager_connected = 1;
-            pthread_mutex_unlock(&manager_mutex);
+            tracked_unlock(&manager_mutex);
 
             GlobalHeader h;
             uint8_t buf[BUFFER_SIZE];
 
-            while (recv_binary_msg(sock, &h, buf, BUFFER_SIZE) >= 0) {
-                if      (h.resource_type == RES_SYSTEM && h.crud == CRUD_CREATE && h.ack == IS_ACK)
-                    handle_register_ack(buf);
+            int len;
+            while ((len = recv_binary_msg(sock, &h, buf, BUFFER_SIZE)) >= 0) {
+                if (h.resource_type == RES_SYSTEM && h.crud == CRUD_CREATE && h.ack == IS_ACK) {
+                    handle_register_ack(buf, (uint32_t)len);
+                    uint64_t dropped = metric_get(METRIC_MGR_SPOOL_DROPPED);
+                    int n = spool_replay(sock);
+                    if (n > 0)
+                        manager_log("[LINK] Replayed %d spooled log(s), %llu dropped so far",
+                                    n, (unsigned long long)dropped);
+                }
                 else if (h.resource_type == RES_SYSTEM && h.crud == CRUD_UPDATE && h.ack == IS_REQ)
                     handle_activate_server(sock);
+                else if (h.resource_type == RES_REPLICATE && h.crud == CRUD_CREATE && h.ack == IS_REQ)
+                    handle_replica_batch(buf, (uint32_t)len);
+                else if (h.resource_type == RES_REPLICATE && h.crud == CRUD_UPDATE && h.ack == IS_REQ)
+                    handle_directory_batch(buf, (uint32_t)len);
+                else if (h.resource_type == RES_REPLICATE && h.crud == CRUD_READ && h.ack == IS_REQ)
+                    handle_replica_sync(buf, (uint32_t)len);
                 else
                     manager_log("[WARN] Unknown frame from Manager: res=%d crud=%d ack=%d",
                                 h.resource_type, h.crud, h.ack);
             }
+
+            spool_link_down();
+            tracked_lock(&manager_mutex);
+            manager_connected = 0;
+            manager_socket    = -1;
+            tracked_unlock(&manager_mutex);
+            close(sock);
+            manager_log(">>> Manager link lost");
+        } else {
+            metric_add(METRIC_MGR_CONNECT_FAILS, 1);
         }
 
-        pthread_mutex_lock(&manager_mutex);
-        manager_connected = 0;
-        pthread_mutex_unlock(&manager_mutex);
-        close(sock);
-        sleep(5);
+        unsigned ms = backoff_ms(attempt++, &seed);
+        if (attempt == 1 || attempt % 8 == 0)
+            manager_log(">>> Retrying in %u ms (attempt %u, %llu log(s) spooled)",
+                        ms, attempt, (unsigned long long)metric_get(METRIC_MGR_SPOOL_RECORDS));
+        usleep(ms * 1000);
     }
     return NULL;
-}
\ No newline at end of file
+}
@@ -17,16 +17,46 @@ void send_server_register(int sock);
 
 // spec row 3   — RECV Register ACK  →  saves assigned server_id
 // res=00000  crud=00  ack=1
-void handle_register_ack(uint8_t *buf);
+void handle_register_ack(uint8_t *buf, uint32_t len);
 
 // spec row 4/5 — RECV Activate Server  →  SEND Activate Server ACK
 // res=00000  crud=10  ack=0  →  ack=1
+// A standby already holds replicated state, so activation only flips
+// server_standby and the server starts answering clients immediately.
 void handle_activate_server(int sock);
 
+// 1 while this server is a hot standby: it tails replication from its
+// peers but refuses client requests with STATUS_SERVICE_UNAVAILABLE.
+extern int server_standby;
+
+// 0 when the server runs without a manager (none configured): nothing is
+// forwarded or spooled.
+extern int manager_enabled;
+
 // spec row 14  — SEND Forward Logs
 // res=00011  crud=00  ack=0
+// Never blocks on a dead link: until the server is registered the record
+// goes to the spool, which is replayed right after the next Register ACK.
 void send_log_to_manager(const char *log_msg);
 
+// ---------------------------------------------------------------------------
+// Link tuning
+// ---------------------------------------------------------------------------
+#define MANAGER_CONNECT_TIMEOUT_MS  3000
+#define MANAGER_BACKOFF_BASE_MS     250     // first retry delay
+#define MANAGER_BACKOFF_MAX_MS      30000   // backoff ceiling
+#define MANAGER_SPOOL_RECORDS       4096    // spooled logs kept while down
+#define MANAGER_SPOOL_BYTES         (1u << 20)
+#define MANAGER_REPLAY_CHUNK        (64u << 10)   // bytes per replay write
+
+// Sends one REQ frame on the manager link. Returns -1 if the link is down
+// or the send fails.
+int send_to_manager(uint8_t res_type, uint8_t crud, const void *pay, uint32_t len);
+
+// SEND Heartbeat every HEARTBEAT_INTERVAL_MS while registered
+// res=00000  crud=11  ack=0
+void* heartbeat_thread(void *arg);
+
 // ---------------------------------------------------------------------------
 // Connection loop — connects to manager and dispatches the above handlers
 // ---------------------------------------------------------------------------
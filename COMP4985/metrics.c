@@ -0,0 +1,63 @@
+#include "protocol.h"
+#include "metrics.h"
+#include "timer.h"
+#include "logsink.h"
+
+_Atomic uint64_t metrics[METRIC_COUNT];
+
+static const char *const metric_names[METRIC_COUNT] = {
+#define METRIC_NAME(id, name) name,
+    METRIC_LIST(METRIC_NAME)
+#undef METRIC_NAME
+};
+
+const char *metric_name(MetricId id) {
+    return (unsigned)id < METRIC_COUNT ? metric_names[id] : "?";
+}
+
+size_t metrics_format(char *out, size_t cap, int *from) {
+    size_t used = 0;
+    if (cap == 0) return 0;
+    out[0] = '\0';
+
+    for (; *from < METRIC_COUNT; (*from)++) {
+        int n = snprintf(out + used, cap - used, "%s%s=%llu",
+                         used ? " " : "", metric_names[*from],
+                         (unsigned long long)metric_get((MetricId)*from));
+        if (n < 0 || (size_t)n >= cap - used) {
+            out[used] = '\0';
+            break;
+        }
+        used += (size_t)n;
+    }
+    return used;
+}
+
+// ===========================================================================
+// Periodic report
+// ===========================================================================
+
+static TimerEntry reporter;
+static uint64_t   last[METRIC_COUNT];
+
+static void metrics_report(TimerEntry *t) {
+    lockstat_publish();
+
+    int changed = 0;
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        uint64_t v = metric_get((MetricId)i);
+        if (v != last[i]) changed = 1;
+        last[i] = v;
+    }
+    for (int from = 0; changed && from < METRIC_COUNT;) {
+        char buf[LOG_MSG_MAX - 16];
+        if (metrics_format(buf, sizeof(buf), &from) == 0) break;
+        server_log("[METRICS] %s", buf);
+    }
+    timer_arm(t, METRICS_REPORT_MS);
+}
+
+void metrics_start(void) {
+    reporter.fire = metrics_report;
+    timer_arm(&reporter, METRICS_REPORT_MS);
+}
@@ -0,0 +1,88 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_METRICS_H
+#define COMP4985_METRICS_H
+
+#include "protocol.h"
+#include "lockstat.h"
+#include <stdatomic.h>
+
+// ---------------------------------------------------------------------------
+// Process-wide counters and gauges
+//
+// One flat array of atomics indexed by MetricId. Updates are relaxed
+// atomic adds/stores, so any thread may bump a metric on its hot path.
+// Add a metric by adding one X() line below.
+// ---------------------------------------------------------------------------
+#define METRIC_LIST(X)                                                      \
+    X(MGR_CONNECTS,        "mgr.connects")        /* successful connects */ \
+    X(MGR_CONNECT_FAILS,   "mgr.connect_fails")                             \
+    X(MGR_SPOOL_RECORDS,   "mgr.spool.records")   /* gauge */               \
+    X(MGR_SPOOL_BYTES,     "mgr.spool.bytes")     /* gauge */               \
+    X(MGR_SPOOL_DROPPED,   "mgr.spool.dropped")   /* oldest evicted */      \
+    X(MGR_SPOOL_REPLAYED,  "mgr.spool.replayed")                            \
+    X(MGR_HEARTBEATS,      "mgr.heartbeats")                                \
+    X(REPL_BACKLOG,        "repl.backlog")        /* gauge */               \
+    X(PERSIST_SNAPSHOTS,   "persist.snapshots")                             \
+    X(PERSIST_SNAPSHOT_BYTES, "persist.snapshot_bytes") /* gauge */         \
+    X(PERSIST_PAUSE_US,    "persist.pause_us")    /* last fork pause */     \
+    X(PERSIST_LOG_BYTES,   "persist.log_bytes")   /* since last cut */      \
+    X(PERSIST_SEGMENTS_DROPPED, "persist.segments_dropped")                 \
+    X(STORE_TRIMMED,       "store.trimmed")       /* retention */           \
+    X(PERSIST_COMMITS,     "persist.commits")     /* durable mutations */   \
+    X(PERSIST_FSYNCS,      "persist.fsyncs")      /* syncs serving them */  \
+    X(DIR_FILTER_REJECTS,  "dir.filter.rejects")  /* lookups skipped */     \
+    X(DIR_FILTER_FALSE_POSITIVES, "dir.filter.false_positives")            \
+    X(SEARCH_INDEX_BYTES,  "search.index_bytes")  /* gauge */               \
+    X(CAPTURE_FRAMES,      "capture.frames")                                \
+    X(CAPTURE_BYTES,       "capture.bytes")       /* written to the file */ \
+    LOCK_LIST(LOCK_METRICS, X)                    /* lockstat_publish */
+
+// Six per TrackedMutex, in this order (lockstat.c relies on it)
+#define LOCK_METRICS(X, id, name)                                           \
+    X(LOCK_##id##_ACQUIRED,    "lock." name ".acquired")                    \
+    X(LOCK_##id##_CONTENDED,   "lock." name ".contended")                   \
+    X(LOCK_##id##_WAIT_US,     "lock." name ".wait_us")                     \
+    X(LOCK_##id##_HOLD_US,     "lock." name ".hold_us")                     \
+    X(LOCK_##id##_WAIT_P99_NS, "lock." name ".wait_p99_ns") /* gauge */     \
+    X(LOCK_##id##_HOLD_P99_NS, "lock." name ".hold_p99_ns") /* gauge */
+
+typedef enum {
+#define METRIC_ENUM(id, name) METRIC_##id,
+    METRIC_LIST(METRIC_ENUM)
+#undef METRIC_ENUM
+    METRIC_COUNT
+} MetricId;
+
+extern _Atomic uint64_t metrics[METRIC_COUNT];
+
+static inline void metric_add(MetricId id, uint64_t n) {
+    atomic_fetch_add_explicit(&metrics[id], n, memory_order_relaxed);
+}
+static inline void metric_sub(MetricId id, uint64_t n) {
+    atomic_fetch_sub_explicit(&metrics[id], n, memory_order_relaxed);
+}
+static inline void metric_set(MetricId id, uint64_t v) {
+    atomic_store_explicit(&metrics[id], v, memory_order_relaxed);
+}
+static inline uint64_t metric_get(MetricId id) {
+    return atomic_load_explicit(&metrics[id], memory_order_relaxed);
+}
+
+const char *metric_name(MetricId id);
+
+// Writes "name=value" pairs separated by spaces into out (always NUL
+// terminated), from metric *from up to the first that does not fit, and
+// leaves *from there (METRIC_COUNT once all are written). Returns the
+// length written.
+size_t metrics_format(char *out, size_t cap, int *from);
+
+#define METRICS_REPORT_MS  60000   // server log dump period
+
+// Starts the periodic dump on the timer wheel, as many lines as it takes.
+// A dump is skipped when nothing changed since the previous one.
+void metrics_start(void);
+
+#endif //COMP4985_METRICS_H
@@ -0,0 +1,303 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+// mock_manager — stand-in for the course manager, for running several
+// servers on one box:
+//
+//     ./mock_manager 9000
+//     ./untitled17 8001 127.0.0.1 9000      (one terminal each)
+//     ./untitled17 8002 127.0.0.1 9000
+//
+// It assigns server IDs on Register, prints forwarded logs, and relays
+// every Replica Batch to all other registered servers. Get Active Server
+// from a client is answered with the least-loaded live server according
+// to the heartbeats. Commands on stdin:
+//     list             registered servers and their last heartbeat
+//     activate <id>    send Activate Server and time the ACK
+//     standby <id>     activate <id> automatically when another server drops
+//
+#include "protocol.h"
+
+#include <poll.h>
+#include <sys/time.h>
+
+#define MAX_SERVERS 32
+
+typedef struct {
+    int      sock;
+    uint8_t  server_id;   // 0 until registered
+    uint32_t server_ip;
+    double   activate_sent_ms;
+    int      standby;     // failover target
+    HeartbeatPayload hb;  // last heartbeat, host byte order
+    double   hb_ms;       // when it arrived (0 = never)
+} Peer;
+
+static Peer    peers[MAX_SERVERS];
+static int     npeers     = 0;
+static uint8_t next_id    = 1;
+static int     stdin_open = 1;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// ===========================================================================
+// Framing (kept separate from manager.c so the tool needs no UI)
+// ===========================================================================
+
+static int send_frame(int sock, uint8_t res, uint8_t crud, uint8_t ack,
+                      const void *pay, uint32_t len)
+{
+    GlobalHeader h = {
+        .version_major  = PROTO_VER_MAJOR,
+        .version_minor  = PROTO_VER_MINOR,
+        .resource_type  = res,
+        .crud           = crud,
+        .ack            = ack,
+        .message_length = len
+    };
+    uint8_t raw[HEADER_SIZE];
+    header_encode(&h, raw);
+    if (send(sock, raw, HEADER_SIZE, MSG_NOSIGNAL) != HEADER_SIZE) return -1;
+    if (len && send(sock, pay, len, MSG_NOSIGNAL) != (ssize_t)len) return -1;
+    return 0;
+}
+
+static int recv_frame(int sock, GlobalHeader *h, uint8_t *buf) {
+    uint8_t raw[HEADER_SIZE];
+    if (recv(sock, raw, HEADER_SIZE, MSG_WAITALL) != HEADER_SIZE) return -1;
+    header_decode(h, raw);
+    uint32_t len = h->message_length;
+    if (len > BUFFER_SIZE) return -1;
+    if (len && recv(sock, buf, len, MSG_WAITALL) != (ssize_t)len) return -1;
+    return (int)len;
+}
+
+// ===========================================================================
+// Handlers
+// ===========================================================================
+
+static void activate(Peer *p) {
+    RegisterPayload act = { .server_ip = p->server_ip, .server_id = p->server_id };
+    uint8_t         raw[REGISTER_SIZE];
+    p->activate_sent_ms = now_ms();
+    send_frame(p->sock, RES_SYSTEM, CRUD_UPDATE, IS_REQ, raw, register_payload_encode(&act, raw));
+}
+
+static void drop_peer(int i) {
+    uint8_t id      = peers[i].server_id;
+    int was_standby = peers[i].standby;
+    close(peers[i].sock);
+    peers[i] = peers[--npeers];
+    if (id == 0) return;   // a client, not a server
+
+    printf("[-] server 0x%02X disconnected\n", id);
+    if (was_standby) return;
+
+    // Failover: the activate→ACK time printed by on_frame is the switchover
+    for (int j = 0; j < npeers; j++) {
+        if (!peers[j].standby) continue;
+        printf("[FAILOVER] activating standby 0x%02X\n", peers[j].server_id);
+        peers[j].standby = 0;
+        activate(&peers[j]);
+        return;
+    }
+}
+
+// ===========================================================================
+// Load-aware selection
+// ===========================================================================
+
+// Lower is better. Connections dominate; throughput, tail latency and any
+// backlog act as tie-breakers that push away from a struggling server.
+static double load_score(const HeartbeatPayload *hb) {
+    return hb->connections
+         + hb->requests_per_sec / 100.0
+         + hb->p99_us / 1000.0
+         + hb->outbound_kib / 64.0
+         + hb->repl_backlog / 100.0;
+}
+
+// Registered, not standby, and heard from within three intervals.
+static Peer *least_loaded(void) {
+    Peer  *best  = NULL;
+    double score = 0;
+    double now   = now_ms();
+    for (int i = 0; i < npeers; i++) {
+        Peer *p = &peers[i];
+        if (p->server_id == 0 || p->hb_ms == 0) continue;
+        if (p->hb.flags & HB_FLAG_STANDBY) continue;
+        if (now - p->hb_ms > 3.0 * HEARTBEAT_INTERVAL_MS) continue;
+        double sc = load_score(&p->hb);
+        if (!best || sc < score) { best = p; score = sc; }
+    }
+    return best;
+}
+
+static void on_heartbeat(Peer *p, const uint8_t *buf, uint32_t len) {
+    HeartbeatPayload hb;
+    if (heartbeat_decode(&hb, buf, len) < 0) return;
+    p->hb    = hb;
+    p->hb_ms = now_ms();
+}
+
+// Get Active Server: the spec answers with the server's ip and id
+static void on_get_active_server(Peer *p) {
+    Peer *s = least_loaded();
+    if (!s) {
+        GlobalHeader h = {
+            .version_major = PROTO_VER_MAJOR, .version_minor = PROTO_VER_MINOR,
+            .resource_type = RES_SYSTEM, .crud = CRUD_READ, .ack = IS_ACK,
+            .status        = STATUS_SERVICE_UNAVAILABLE
+        };
+        uint8_t raw[HEADER_SIZE];
+        header_encode(&h, raw);
+        send(p->sock, raw, HEADER_SIZE, MSG_NOSIGNAL);
+        printf("[ROUTE] no live server\n");
+        return;
+    }
+    RegisterPayload r = { .server_ip = s->server_ip, .server_id = s->server_id };
+    uint8_t         raw[REGISTER_SIZE];
+    send_frame(p->sock, RES_SYSTEM, CRUD_READ, IS_ACK, raw, register_payload_encode(&r, raw));
+    printf("[ROUTE] client → 0x%02X (score %.1f)\n", s->server_id, load_score(&s->hb));
+}
+
+static void on_frame(int i, GlobalHeader *h, uint8_t *buf, uint32_t len) {
+    Peer *p = &peers[i];
+
+    if (h->resource_type == RES_SYSTEM && h->crud == CRUD_CREATE && h->ack == IS_REQ) {
+        RegisterPayload reg;
+        if (register_payload_decode(&reg, buf, len) < 0) return;
+        p->server_id = next_id++;
+        p->server_ip = reg.server_ip;
+        reg.server_id = p->server_id;
+        send_frame(p->sock, RES_SYSTEM, CRUD_CREATE, IS_ACK, buf, register_payload_encode(&reg, buf));
+        printf("[+] registered server 0x%02X\n", p->server_id);
+    }
+    else if (h->resource_type == RES_SYSTEM && h->crud == CRUD_UPDATE && h->ack == IS_ACK) {
+        printf("[ACTIVATE] server 0x%02X live after %.2f ms\n",
+               p->server_id, now_ms() - p->activate_sent_ms);
+    }
+    else if (h->resource_type == RES_SYSTEM && h->crud == CRUD_DELETE && h->ack == IS_REQ) {
+        on_heartbeat(p, buf, len);
+    }
+    else if (h->resource_type == RES_SYSTEM && h->crud == CRUD_READ && h->ack == IS_REQ) {
+        on_get_active_server(p);
+    }
+    else if (h->resource_type == RES_LOG) {
+        LogPayload lp;
+        if (log_payload_decode(&lp, buf, len) < 0) return;
+        uint16_t n = lp.log_length;
+        if (n > len - LOG_SIZE) n = (uint16_t)(len - LOG_SIZE);
+        printf("[LOG 0x%02X] %.*s\n", lp.server_id, n, buf + LOG_SIZE);
+    }
+    else if (h->resource_type == RES_REPLICATE) {
+        int relayed = 0;
+        for (int j = 0; j < npeers; j++) {
+            if (j == i || peers[j].server_id == 0) continue;
+            send_frame(peers[j].sock, RES_REPLICATE, h->crud, IS_REQ, buf, len);
+            relayed++;
+        }
+        printf("[REPLICA] 0x%02X → %d peer(s), %u bytes\n", p->server_id, relayed, len);
+    }
+    else {
+        printf("[?] res=%d crud=%d ack=%d from 0x%02X\n",
+               h->resource_type, h->crud, h->ack, p->server_id);
+    }
+}
+
+static void on_command(char *line) {
+    unsigned id;
+    if (strncmp(line, "list", 4) == 0) {
+        for (int i = 0; i < npeers; i++) {
+            char ip[INET_ADDRSTRLEN];
+            Peer *p = &peers[i];
+            if (p->server_id == 0) continue;
+            inet_ntop(AF_INET, &p->server_ip, ip, sizeof(ip));
+            printf("  0x%02X  %-15s", p->server_id, ip);
+            if (p->hb_ms == 0) { printf("  (no heartbeat)\n"); continue; }
+            printf("  %s conns=%u rps=%u mps=%u p99=%uus out=%uKiB spool=%u repl=%u  %.0f ms ago\n",
+                   p->hb.flags & HB_FLAG_STANDBY ? "standby" : "live   ",
+                   p->hb.connections, p->hb.requests_per_sec, p->hb.messages_per_sec,
+                   p->hb.p99_us, p->hb.outbound_kib, p->hb.spool_records,
+                   p->hb.repl_backlog, now_ms() - p->hb_ms);
+        }
+    } else if (sscanf(line, "activate %u", &id) == 1) {
+        for (int i = 0; i < npeers; i++) {
+            if (peers[i].server_id != id) continue;
+            peers[i].standby = 0;
+            activate(&peers[i]);
+            return;
+        }
+        printf("no server 0x%02X\n", id);
+    } else if (sscanf(line, "standby %u", &id) == 1) {
+        for (int i = 0; i < npeers; i++) {
+            if (peers[i].server_id != id) continue;
+            peers[i].standby = 1;
+            printf("0x%02X is the failover target\n", id);
+            return;
+        }
+        printf("no server 0x%02X\n", id);
+    }
+}
+
+// ===========================================================================
+// main
+// ===========================================================================
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <Port>\n", argv[0]);
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(atoi(argv[1])),
+        .sin_addr.s_addr = INADDR_ANY
+    };
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 16) < 0) {
+        perror("listen");
+        return 1;
+    }
+    printf("mock manager on port %s\n", argv[1]);
+
+    static uint8_t buf[BUFFER_SIZE];
+
+    while (1) {
+        struct pollfd fds[MAX_SERVERS + 2];
+        fds[0] = (struct pollfd){ .fd = lfd, .events = POLLIN };
+        fds[1] = (struct pollfd){ .fd = stdin_open ? STDIN_FILENO : -1, .events = POLLIN };
+        for (int i = 0; i < npeers; i++)
+            fds[i + 2] = (struct pollfd){ .fd = peers[i].sock, .events = POLLIN };
+
+        int n = npeers;
+        if (poll(fds, (nfds_t)(n + 2), -1) < 0) continue;
+
+        for (int i = n - 1; i >= 0; i--) {
+            if (!(fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            GlobalHeader h;
+            int len = recv_frame(peers[i].sock, &h, buf);
+            if (len < 0) drop_peer(i);
+            else on_frame(i, &h, buf, (uint32_t)len);
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char line[128];
+            if (fgets(line, sizeof(line), stdin)) on_command(line);
+            else stdin_open = 0;
+        }
+
+        if ((fds[0].revents & POLLIN) && npeers < MAX_SERVERS) {
+            int s = accept(lfd, NULL, NULL);
+            if (s >= 0) peers[npeers++] = (Peer){ .sock = s };
+        }
+    }
+}
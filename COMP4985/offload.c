@@ -0,0 +1,192 @@
+#include "protocol.h"
+#include "offload.h"
+#include "affinity.h"
+#include "logsink.h"
+
+#include <sched.h>
+#include <sys/eventfd.h>
+
+uint32_t offload_workers;
+
+// ===========================================================================
+// Completion queue — Vyukov's intrusive MPSC list
+//
+// Producers swap themselves in at head and then link the previous head to
+// themselves; the consumer walks from tail. The stub keeps the list
+// non-empty so producers never touch tail. Between a producer's swap and
+// its link the consumer sees an empty queue and waits for the eventfd,
+// which is written only after the link.
+// ===========================================================================
+
+int offload_queue_init(OffloadQueue *q) {
+    atomic_store_explicit(&q->stub.done_next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&q->head, &q->stub, memory_order_relaxed);
+    q->tail = &q->stub;
+    q->efd  = eventfd(0, EFD_CLOEXEC);
+    return q->efd < 0 ? -1 : 0;
+}
+
+void offload_queue_close(OffloadQueue *q) {
+    if (q->efd >= 0) close(q->efd);
+    q->efd = -1;
+}
+
+static void queue_push(OffloadQueue *q, OffloadTask *t) {
+    atomic_store_explicit(&t->done_next, NULL, memory_order_relaxed);
+    OffloadTask *prev = atomic_exchange_explicit(&q->head, t, memory_order_acq_rel);
+    atomic_store_explicit(&prev->done_next, t, memory_order_release);
+}
+
+static OffloadTask *queue_pop(OffloadQueue *q) {
+    OffloadTask *tail = q->tail;
+    OffloadTask *next = atomic_load_explicit(&tail->done_next, memory_order_acquire);
+
+    if (tail == &q->stub) {
+        if (!next) return NULL;
+        q->tail = tail = next;
+        next = atomic_load_explicit(&tail->done_next, memory_order_acquire);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    // tail is the last linked task: a producer may be mid-push behind it
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire))
+        return NULL;
+    queue_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->done_next, memory_order_acquire);
+    if (!next) return NULL;
+    q->tail = next;
+    return tail;
+}
+
+static void complete(OffloadTask *t) {
+    OffloadQueue *q = t->done;
+    queue_push(q, t);
+    if (q->efd >= 0) {
+        uint64_t one = 1;
+        ssize_t  n   = write(q->efd, &one, sizeof(one));
+        (void)n;   // only fails if the counter would overflow: already signalled
+    }
+}
+
+OffloadTask *offload_wait(OffloadQueue *q) {
+    OffloadTask *t;
+    while ((t = queue_pop(q)) == NULL) {
+        uint64_t v;
+        if (q->efd < 0 || read(q->efd, &v, sizeof(v)) < 0)
+            sched_yield();
+    }
+    return t;
+}
+
+// ===========================================================================
+// Workers
+// ===========================================================================
+
+typedef struct {
+    pthread_mutex_t lock;
+    OffloadTask    *head, *tail;   // owner takes head, thieves take tail
+} Worker;
+
+static Worker           workers[OFFLOAD_MAX_WORKERS];
+static int              n_workers;
+static _Atomic uint32_t next_worker;
+static _Atomic int64_t  queued;     // submitted, not yet taken
+static _Atomic int      sleepers;
+static pthread_mutex_t  idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   idle_cond = PTHREAD_COND_INITIALIZER;
+
+static OffloadTask *take(Worker *w, int from_back) {
+    pthread_mutex_lock(&w->lock);
+    OffloadTask *t = from_back ? w->tail : w->head;
+    if (t) {
+        if (t->prev) t->prev->next = t->next; else w->head = t->next;
+        if (t->next) t->next->prev = t->prev; else w->tail = t->prev;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return t;
+}
+
+static OffloadTask *find_work(int self) {
+    OffloadTask *t = take(&workers[self], 0);
+    for (int k = 1; !t && k < n_workers; k++)
+        t = take(&workers[(self + k) % n_workers], 1);
+    if (t) atomic_fetch_sub(&queued, 1);
+    return t;
+}
+
+static void *worker_thread(void *arg) {
+    int self = (int)(intptr_t)arg;
+    affinity_enter(AFF_OFFLOAD);
+
+    while (1) {
+        OffloadTask *t = find_work(self);
+        if (t) {
+            t->run(t);
+            complete(t);
+            continue;
+        }
+        // Sleep until a submit. sleepers is raised before queued is
+        // re-checked, and submit raises queued before reading sleepers, so
+        // one of the two always sees the other.
+        pthread_mutex_lock(&idle_lock);
+        atomic_fetch_add(&sleepers, 1);
+        while (atomic_load(&queued) == 0)
+            pthread_cond_wait(&idle_cond, &idle_lock);
+        atomic_fetch_sub(&sleepers, 1);
+        pthread_mutex_unlock(&idle_lock);
+    }
+    return NULL;
+}
+
+void offload_start(void) {
+    if (n_workers > 0) return;
+
+    int n = (int)offload_workers;
+    if (n == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = cpus > 1 ? (int)(cpus / 2) : 1;
+    }
+    if (n > OFFLOAD_MAX_WORKERS) n = OFFLOAD_MAX_WORKERS;
+
+    for (int i = 0; i < n; i++)
+        pthread_mutex_init(&workers[i].lock, NULL);
+    for (int i = 0; i < n; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker_thread, (void *)(intptr_t)i) != 0)
+            break;
+        pthread_detach(tid);
+        n_workers = i + 1;   // only started workers are stolen from
+    }
+    server_log("[OFFLOAD] %d worker%s", n_workers, n_workers == 1 ? "" : "s");
+}
+
+void offload_submit(OffloadTask *t, OffloadQueue *q) {
+    t->done = q;
+    if (n_workers == 0 || q->efd < 0) {
+        t->run(t);
+        complete(t);
+        return;
+    }
+
+    Worker *w = &workers[atomic_fetch_add(&next_worker, 1) % (uint32_t)n_workers];
+    pthread_mutex_lock(&w->lock);
+    t->next = NULL;
+    t->prev = w->tail;
+    if (w->tail) w->tail->next = t; else w->head = t;
+    w->tail = t;
+    pthread_mutex_unlock(&w->lock);
+
+    atomic_fetch_add(&queued, 1);
+    if (atomic_load(&sleepers) > 0) {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+void offload_run(OffloadTask *t, OffloadQueue *q) {
+    offload_submit(t, q);
+    while (offload_wait(q) != t) {}
+}
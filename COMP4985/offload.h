@@ -0,0 +1,71 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_OFFLOAD_H
+#define COMP4985_OFFLOAD_H
+
+#include "protocol.h"
+#include <stdatomic.h>
+
+// ---------------------------------------------------------------------------
+// Offload pool
+//
+// A fixed set of worker threads for CPU-heavy or blocking work (password
+// hashing today). Connection threads hand a task to the pool and sleep on
+// their own completion queue until it comes back, so a burst of logins
+// occupies at most offload_workers cores and every other connection keeps
+// the rest of the machine for framing and small requests.
+//
+// Each worker owns a deque. Submissions are spread round-robin; a worker
+// takes from the front of its own deque and, when that is empty, steals
+// from the back of the others'. Finished tasks are pushed onto the
+// submitter's OffloadQueue — a lock-free multi-producer / single-consumer
+// list — and its eventfd is signalled.
+//
+// Workers run in the "offload" affinity role (cpu.offload).
+// ---------------------------------------------------------------------------
+#define OFFLOAD_MAX_WORKERS  64
+
+extern uint32_t offload_workers;   // 0 = half the online CPUs, at least 1
+
+typedef struct OffloadTask OffloadTask;
+typedef void (*OffloadFn)(OffloadTask *t);
+
+struct OffloadTask {
+    OffloadFn    run;    // called on a worker
+    void        *arg;
+
+    // Owned by the pool while the task is in flight
+    OffloadTask *prev, *next;               // worker deque
+    _Atomic(OffloadTask *) done_next;       // completion queue
+    struct OffloadQueue   *done;
+};
+
+// Per-connection completion queue. Only the owning thread pops.
+typedef struct OffloadQueue {
+    _Atomic(OffloadTask *) head;   // producers push here
+    OffloadTask           *tail;   // consumer pops here
+    OffloadTask            stub;
+    int                    efd;    // eventfd, -1 if unavailable
+} OffloadQueue;
+
+// Starts the workers. Until then (or if it fails) tasks run inline on the
+// submitting thread.
+void offload_start(void);
+
+// Returns 0, or -1 if no eventfd could be created (tasks then run inline).
+int  offload_queue_init(OffloadQueue *q);
+void offload_queue_close(OffloadQueue *q);
+
+// Queues t; it is pushed onto q once t->run has returned.
+void offload_submit(OffloadTask *t, OffloadQueue *q);
+
+// Next completed task on q, blocking until there is one.
+OffloadTask *offload_wait(OffloadQueue *q);
+
+// submit + wait for that task: the common "do this off-thread" call, for a
+// queue with nothing else in flight.
+void offload_run(OffloadTask *t, OffloadQueue *q);
+
+#endif //COMP4985_OFFLOAD_H
@@ -0,0 +1,586 @@
+#include "protocol.h"
+#include "persist.h"
+#include "store.h"
+#include "directory.h"
+#include "readmark.h"
+#include "metrics.h"
+#include "logsink.h"
+#include "affinity.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#ifdef __APPLE__
+#define fdatasync fsync   // no fdatasync on macOS
+#endif
+
+uint32_t persist_retention_secs = PERSIST_RETENTION_SECS;
+
+// ===========================================================================
+// On-disk framing
+// ===========================================================================
+
+// Version 2: 32-bit channel / user IDs. Version-1 snapshots and records
+// (types 1 and 2) are ignored rather than misread.
+// Version 3: directory entries carry the password verifier. Version-2
+// snapshots and directory records still load, their accounts without one.
+#define SNAP_MAGIC    "C4985SN3"
+#define SNAP_MAGIC_V2 "C4985SN2"
+#define REC_MESSAGE   3
+#define REC_DIRECTORY 4
+#define REC_READMARK  5
+
+typedef struct __attribute__((packed)) {
+    char     magic[8];
+    uint64_t cut;            // first segment NOT covered by this snapshot
+    uint64_t created;        // unix seconds
+    uint64_t body_length;    // bytes after this header, checksum excluded
+} SnapHeader;
+// followed by: directory section | store section | read marker section
+// (absent from older snapshots) | uint32_t checksum(body)
+
+typedef struct __attribute__((packed)) {
+    uint32_t length;         // body bytes
+    uint32_t checksum;       // of the body
+    uint8_t  type;           // REC_*
+} LogRecHeader;
+
+// FNV-1a — catches torn tails and bit rot, not adversaries
+static uint32_t checksum_update(uint32_t h, const void *p, size_t n) {
+    const uint8_t *b = p;
+    for (size_t i = 0; i < n; i++) {
+        h ^= b[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+#define CHECKSUM_INIT 2166136261u
+
+// ===========================================================================
+// State
+// ===========================================================================
+
+static char            data_dir[512];
+static int             enabled;
+static TrackedMutex    log_mutex = TRACKED_MUTEX_INITIALIZER(LOCK_PERSIST_LOG);
+static int             seg_fd = -1;     // -1 while off or restoring
+static uint64_t        seg_id;          // current segment
+static uint64_t        seg_bytes;       // bytes in the current segment
+static uint64_t        log_since_snap;  // bytes appended since the last cut
+
+// Group commit. LSN = total bytes appended since start; a record is
+// durable once durable_lsn reaches the LSN just past it.
+static uint64_t        written_lsn;     // under log_mutex
+static pthread_mutex_t commit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  commit_cond  = PTHREAD_COND_INITIALIZER;
+static uint64_t        durable_lsn;     // under commit_mutex
+static int             flushing;        // a leader is in fdatasync
+
+// End LSN of the last directory record this thread logged
+static _Thread_local uint64_t my_dir_lsn;
+
+static void seg_path(char *out, size_t cap, uint64_t id) {
+    snprintf(out, cap, "%s/%016llx.seg", data_dir, (unsigned long long)id);
+}
+
+// Opens segment id for appending. Caller holds log_mutex (or is starting).
+// The previous segment is synced before it is closed, so a commit that
+// only syncs the current segment covers everything before it too.
+static int seg_open(uint64_t id) {
+    char path[600];
+    seg_path(path, sizeof(path), id);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        server_log("[PERSIST] Cannot open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (seg_fd >= 0) {
+        fdatasync(seg_fd);
+        close(seg_fd);
+    }
+    seg_fd    = fd;
+    seg_id    = id;
+    seg_bytes = 0;
+    return 0;
+}
+
+// ===========================================================================
+// Log hooks
+// ===========================================================================
+
+// Returns the LSN just past the record, or 0 if nothing was written.
+static uint64_t log_append(uint8_t type, const void *a, size_t alen,
+                           const void *b, size_t blen)
+{
+    uint64_t lsn = 0;
+    tracked_lock(&log_mutex);
+    if (seg_fd < 0) {
+        tracked_unlock(&log_mutex);
+        return 0;
+    }
+
+    LogRecHeader h = {
+        .length   = (uint32_t)(alen + blen),
+        .checksum = checksum_update(checksum_update(CHECKSUM_INIT, a, alen), b, blen),
+        .type     = type
+    };
+    struct iovec iov[3] = {
+        { .iov_base = &h,        .iov_len = sizeof(h) },
+        { .iov_base = (void *)a, .iov_len = alen },
+        { .iov_base = (void *)b, .iov_len = blen }
+    };
+    ssize_t want = (ssize_t)(sizeof(h) + alen + blen);
+    if (writev(seg_fd, iov, blen ? 3 : 2) != want) {
+        server_log("[PERSIST] Log write failed: %s — persistence stopped", strerror(errno));
+        close(seg_fd);
+        seg_fd = -1;
+    } else {
+        seg_bytes      += (uint64_t)want;
+        log_since_snap += (uint64_t)want;
+        written_lsn    += (uint64_t)want;
+        lsn             = written_lsn;
+        if (seg_bytes >= PERSIST_SEGMENT_BYTES) seg_open(seg_id + 1);
+    }
+    tracked_unlock(&log_mutex);
+    return lsn;
+}
+
+void persist_log_message(const PersistMsg *m, const char *text) {
+    log_append(REC_MESSAGE, m, sizeof(*m), text, m->length);
+}
+
+void persist_log_dir(const PersistDir *d) {
+    uint64_t lsn = log_append(REC_DIRECTORY, d, sizeof(*d), NULL, 0);
+    if (lsn) my_dir_lsn = lsn;
+}
+
+void persist_log_mark(const PersistMark *m) {
+    log_append(REC_READMARK, m, sizeof(*m), NULL, 0);
+}
+
+// ===========================================================================
+// Group commit
+//
+// Leader/follower: the first committer to find no flush in progress syncs
+// everything written so far; everyone who arrives meanwhile waits and is
+// usually covered by that same fdatasync, or by the next one. N concurrent
+// commits cost ~2 syncs instead of N.
+// ===========================================================================
+
+static void commit_to(uint64_t lsn) {
+    pthread_mutex_lock(&commit_mutex);
+    if (durable_lsn >= lsn) {
+        pthread_mutex_unlock(&commit_mutex);
+        return;
+    }
+    metric_add(METRIC_PERSIST_COMMITS, 1);
+
+    while (durable_lsn < lsn) {
+        if (flushing) {
+            pthread_cond_wait(&commit_cond, &commit_mutex);
+            continue;
+        }
+        flushing = 1;
+        pthread_mutex_unlock(&commit_mutex);
+
+        // dup so a concurrent segment roll cannot close the fd under us;
+        // the roll syncs the old segment itself
+        tracked_lock(&log_mutex);
+        uint64_t target = written_lsn;
+        int fd = seg_fd >= 0 ? dup(seg_fd) : -1;
+        tracked_unlock(&log_mutex);
+
+        int ok = fd >= 0 && fdatasync(fd) == 0;
+        if (fd >= 0) close(fd);
+        metric_add(METRIC_PERSIST_FSYNCS, 1);
+
+        pthread_mutex_lock(&commit_mutex);
+        flushing = 0;
+        if (ok && target > durable_lsn) durable_lsn = target;
+        pthread_cond_broadcast(&commit_cond);
+        if (!ok) {
+            server_log("[PERSIST] fdatasync failed: %s", strerror(errno));
+            break;
+        }
+    }
+    pthread_mutex_unlock(&commit_mutex);
+}
+
+void persist_commit_dir(void) {
+    if (!enabled || my_dir_lsn == 0) return;
+    commit_to(my_dir_lsn);
+}
+
+// ===========================================================================
+// Snapshot writer (runs in the forked child: no locks, no malloc, no stdio)
+// ===========================================================================
+
+struct SnapWriter {
+    int      fd;
+    int      failed;
+    uint32_t checksum;
+    uint64_t written;
+    size_t   used;
+    uint8_t  buf[1 << 16];
+};
+
+static SnapWriter writer;   // static: the child only touches its COW copy
+
+static int snap_flush(SnapWriter *w) {
+    size_t off = 0;
+    while (!w->failed && off < w->used) {
+        ssize_t n = write(w->fd, w->buf + off, w->used - off);
+        if (n <= 0) w->failed = 1;
+        else off += (size_t)n;
+    }
+    w->used = 0;
+    return w->failed ? -1 : 0;
+}
+
+int snap_write(SnapWriter *w, const void *p, size_t n) {
+    const uint8_t *b = p;
+    w->checksum = checksum_update(w->checksum, p, n);
+    w->written += n;
+    while (n > 0 && !w->failed) {
+        size_t room = sizeof(w->buf) - w->used;
+        size_t k    = n < room ? n : room;
+        memcpy(w->buf + w->used, b, k);
+        w->used += k;
+        b += k;
+        n -= k;
+        if (w->used == sizeof(w->buf)) snap_flush(w);
+    }
+    return w->failed ? -1 : 0;
+}
+
+int snap_read(SnapReader *r, void *out, size_t n) {
+    if ((size_t)(r->end - r->p) < n) return -1;
+    memcpy(out, r->p, n);
+    r->p += n;
+    return 0;
+}
+
+// Child side of persist_snapshot. Exit status 0 on success.
+static int write_snapshot(uint64_t cut) {
+    char tmp[600], path[600];
+    snprintf(tmp,  sizeof(tmp),  "%s/snapshot.tmp", data_dir);
+    snprintf(path, sizeof(path), "%s/snapshot",     data_dir);
+
+    SnapWriter *w = &writer;
+    w->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) return 1;
+
+    // Header is rewritten with the body length once it is known
+    SnapHeader h = { .cut = cut, .created = (uint64_t)time(NULL) };
+    memcpy(h.magic, SNAP_MAGIC, 8);
+    if (write(w->fd, &h, sizeof(h)) != sizeof(h)) return 1;
+
+    w->checksum = CHECKSUM_INIT;
+    directory_snapshot(w);
+    store_snapshot(w);
+    readmark_snapshot(w);
+    uint32_t sum = w->checksum;
+    h.body_length = w->written;
+    if (snap_flush(w) < 0) return 1;
+
+    if (write(w->fd, &sum, sizeof(sum)) != sizeof(sum)) return 1;
+    if (pwrite(w->fd, &h, sizeof(h), 0) != sizeof(h)) return 1;
+    if (fsync(w->fd) < 0 || close(w->fd) < 0) return 1;
+    if (rename(tmp, path) < 0) return 1;
+
+    int dfd = open(data_dir, O_RDONLY);
+    if (dfd >= 0) { fsync(dfd); close(dfd); }
+    return 0;
+}
+
+// ===========================================================================
+// Snapshot + compaction
+// ===========================================================================
+
+static void drop_segments_before(uint64_t cut) {
+    DIR *d = opendir(data_dir);
+    if (!d) return;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        unsigned long long id;
+        char tail[8];
+        if (sscanf(e->d_name, "%16llx%7s", &id, tail) != 2 || strcmp(tail, ".seg") != 0)
+            continue;
+        if (id >= cut) continue;
+        char path[600];
+        seg_path(path, sizeof(path), id);
+        if (unlink(path) == 0) metric_add(METRIC_PERSIST_SEGMENTS_DROPPED, 1);
+    }
+    closedir(d);
+}
+
+static void persist_snapshot(void) {
+    // Retention first, so the snapshot never carries expired messages
+    if (persist_retention_secs) {
+        uint64_t n = store_trim_before((uint32_t)time(NULL) - persist_retention_secs);
+        if (n) {
+            metric_add(METRIC_STORE_TRIMMED, n);
+            server_log("[PERSIST] Retention dropped %llu message(s)", (unsigned long long)n);
+        }
+    }
+
+    // Freeze every writer, cut the log, fork, thaw. The child sees exactly
+    // the state up to the start of segment `cut`.
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    store_lock_all();
+    directory_lock();
+    readmark_lock_all();
+    tracked_lock(&log_mutex);
+
+    uint64_t cut = seg_id + 1;
+    if (seg_fd < 0 || seg_open(cut) < 0) {
+        tracked_unlock(&log_mutex);
+        readmark_unlock_all();
+        directory_unlock();
+        store_unlock_all();
+        return;
+    }
+    log_since_snap = 0;
+
+    pid_t pid = fork();
+    if (pid == 0) _exit(write_snapshot(cut));
+
+    tracked_unlock(&log_mutex);
+    readmark_unlock_all();
+    directory_unlock();
+    store_unlock_all();
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    long pause_us = (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_nsec - t0.tv_nsec) / 1000;
+    metric_set(METRIC_PERSIST_PAUSE_US, (uint64_t)pause_us);
+
+    if (pid < 0) {
+        server_log("[PERSIST] fork failed: %s", strerror(errno));
+        return;
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    long ms = (t1.tv_sec - t0.tv_sec) * 1000L + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        server_log("[PERSIST] Snapshot failed — keeping all segments");
+        return;
+    }
+
+    char path[600];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/snapshot", data_dir);
+    if (stat(path, &st) == 0) metric_set(METRIC_PERSIST_SNAPSHOT_BYTES, (uint64_t)st.st_size);
+    metric_add(METRIC_PERSIST_SNAPSHOTS, 1);
+
+    drop_segments_before(cut);
+    server_log("[PERSIST] Snapshot %lld bytes in %ld ms (writers paused %ld us)",
+               (long long)st.st_size, ms, pause_us);
+}
+
+void* persist_thread(void *arg) {
+    (void)arg;
+    if (!enabled) return NULL;
+    affinity_enter(AFF_STORAGE);
+
+    time_t last = time(NULL);
+    while (1) {
+        sleep(1);
+        tracked_lock(&log_mutex);
+        uint64_t pending = log_since_snap;
+        tracked_unlock(&log_mutex);
+        metric_set(METRIC_PERSIST_LOG_BYTES, pending);
+
+        time_t now = time(NULL);
+        if (pending == 0) continue;
+        if (pending < PERSIST_SNAPSHOT_LOG_BYTES && now - last < PERSIST_SNAPSHOT_SECS)
+            continue;
+
+        persist_snapshot();
+        last = now;
+    }
+    return NULL;
+}
+
+// ===========================================================================
+// Restore
+// ===========================================================================
+
+// Loads <dir>/snapshot. Returns the cut (0 when there is none), -1 on a
+// corrupt file.
+static int64_t load_snapshot(uint64_t *bytes) {
+    char path[600];
+    snprintf(path, sizeof(path), "%s/snapshot", data_dir);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SnapHeader) + sizeof(uint32_t)) {
+        close(fd);
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    SnapHeader h;
+    memcpy(&h, map, sizeof(h));
+    const uint8_t *body = map + sizeof(h);
+    int64_t rc = -1;
+
+    int version = memcmp(h.magic, SNAP_MAGIC, 8) == 0    ? 3 :
+                  memcmp(h.magic, SNAP_MAGIC_V2, 8) == 0 ? 2 : 0;
+    if (version &&
+        h.body_length == (uint64_t)st.st_size - sizeof(h) - sizeof(uint32_t)) {
+        uint32_t sum;
+        memcpy(&sum, body + h.body_length, sizeof(sum));
+        if (checksum_update(CHECKSUM_INIT, body, h.body_length) == sum) {
+            SnapReader r = { .p = body, .end = body + h.body_length, .version = version };
+            if (directory_load_snapshot(&r) == 0 && store_load_snapshot(&r) == 0 &&
+                readmark_load_snapshot(&r) == 0) {
+                rc     = (int64_t)h.cut;
+                *bytes = (uint64_t)st.st_size;
+            }
+        }
+    }
+    munmap(map, (size_t)st.st_size);
+    return rc;
+}
+
+// Replays one segment. A torn or corrupt tail is cut off. Returns the
+// bytes replayed.
+static uint64_t replay_segment(uint64_t id, uint64_t *records) {
+    char path[600];
+    seg_path(path, sizeof(path), id);
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        unlink(path);   // a restart before anything was logged
+        return 0;
+    }
+    uint8_t *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+
+    uint64_t off = 0, size = (uint64_t)st.st_size;
+    while (size - off >= sizeof(LogRecHeader)) {
+        LogRecHeader h;
+        memcpy(&h, map + off, sizeof(h));
+        const uint8_t *body = map + off + sizeof(h);
+        if (size - off - sizeof(h) < h.length ||
+            checksum_update(CHECKSUM_INIT, body, h.length) != h.checksum)
+            break;
+
+        if (h.type == REC_MESSAGE && h.length >= sizeof(PersistMsg)) {
+            PersistMsg m;
+            memcpy(&m, body, sizeof(m));
+            if (h.length == sizeof(m) + m.length)
+                store_restore(&m, (const char *)body + sizeof(m));
+        } else if (h.type == REC_DIRECTORY && (h.length == sizeof(PersistDir) ||
+                                               h.length == PERSIST_DIR_V2_SIZE)) {
+            PersistDir d = {0};
+            memcpy(&d, body, h.length);
+            directory_restore(&d);
+        } else if (h.type == REC_READMARK && h.length == sizeof(PersistMark)) {
+            PersistMark m;
+            memcpy(&m, body, sizeof(m));
+            readmark_restore(&m);
+        }
+        off += sizeof(h) + h.length;
+        (*records)++;
+    }
+
+    munmap(map, (size_t)st.st_size);
+    if (off < size) {
+        server_log("[PERSIST] %016llx.seg: dropping %llu corrupt tail byte(s)",
+                   (unsigned long long)id, (unsigned long long)(size - off));
+        if (ftruncate(fd, (off_t)off) < 0)
+            server_log("[PERSIST] truncate failed: %s", strerror(errno));
+    }
+    close(fd);
+    return off;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int persist_open(const char *dir) {
+    snprintf(data_dir, sizeof(data_dir), "%s", dir);
+    if (mkdir(data_dir, 0755) < 0 && errno != EEXIST) {
+        server_log("[PERSIST] Cannot create %s: %s", data_dir, strerror(errno));
+        return -1;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    uint64_t snap_bytes = 0;
+    int64_t  cut        = load_snapshot(&snap_bytes);
+    if (cut < 0) {
+        server_log("[PERSIST] %s/snapshot is corrupt — refusing to start from a partial state",
+                   data_dir);
+        return -1;
+    }
+
+    // Segments at or after the cut, in order
+    uint64_t *ids = NULL;
+    size_t    nids = 0, cap = 0;
+    DIR *d = opendir(data_dir);
+    if (!d) return -1;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        unsigned long long id;
+        char tail[8];
+        if (sscanf(e->d_name, "%16llx%7s", &id, tail) != 2 || strcmp(tail, ".seg") != 0)
+            continue;
+        if (nids == cap) {
+            cap = cap ? cap * 2 : 16;
+            uint64_t *n = realloc(ids, cap * sizeof(uint64_t));
+            if (!n) break;
+            ids = n;
+        }
+        ids[nids++] = id;
+    }
+    closedir(d);
+    qsort(ids, nids, sizeof(uint64_t), cmp_u64);
+
+    uint64_t replayed = 0, records = 0, next = (uint64_t)cut;
+    for (size_t i = 0; i < nids; i++) {
+        if (ids[i] < (uint64_t)cut) continue;   // left over from a crash mid-compaction
+        replayed += replay_segment(ids[i], &records);
+        next = ids[i] + 1;
+    }
+    free(ids);
+    drop_segments_before((uint64_t)cut);
+
+    // Always start a new segment: a torn tail never gets appended to
+    if (seg_open(next) < 0) return -1;
+    log_since_snap = replayed;
+    enabled        = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    long ms = (t1.tv_sec - t0.tv_sec) * 1000L + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+
+    uint32_t nusers, nchannels;
+    directory_counts(&nusers, &nchannels);
+    server_log("[PERSIST] Restored %u users, %u channels in %ld ms "
+               "(snapshot %llu B, replayed %llu records / %llu B)",
+               nusers, nchannels, ms, (unsigned long long)snap_bytes,
+               (unsigned long long)records, (unsigned long long)replayed);
+    return 0;
+}
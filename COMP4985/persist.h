@@ -0,0 +1,120 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_PERSIST_H
+#define COMP4985_PERSIST_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Persistence — optional, enabled with --data <dir>
+//
+//   <dir>/<id>.seg    append-only log segments: every message stored and
+//                     every directory journal entry, in order
+//   <dir>/snapshot    full directory + message + read marker state as of
+//                     the start of one segment (the "cut")
+//
+// A background thread periodically forks: the child writes the snapshot
+// from its copy-on-write image while the parent keeps serving, so request
+// threads only pause for the fork itself. Once a snapshot is in place the
+// segments before its cut are deleted, and messages older than the
+// retention window are dropped from memory first, so the snapshot stays
+// bounded too. Restart = load snapshot + replay the segments after the
+// cut: proportional to the snapshot, not the total history.
+//
+// Directory mutations (accounts, channels, membership) are additionally
+// made durable before they are acknowledged; messages are written to the
+// log but not synced per request.
+//
+// Files are in host byte order and only meant to be read back by the
+// same build on the same machine.
+// ---------------------------------------------------------------------------
+#define PERSIST_SEGMENT_BYTES        (16u << 20)   // roll the log past this
+#define PERSIST_SNAPSHOT_SECS        300           // snapshot at least this often...
+#define PERSIST_SNAPSHOT_LOG_BYTES   (64u << 20)   // ...or once this much log piled up
+#define PERSIST_RETENTION_SECS       (7u * 24 * 3600)
+
+extern uint32_t persist_retention_secs;   // 0 = keep everything
+
+// Log record bodies. origin_seq / seq are host order here.
+typedef struct __attribute__((packed)) {
+    uint32_t channel_id;
+    uint8_t  local;
+    uint8_t  origin_id;
+    uint32_t sender_id;
+    uint64_t seq;
+    uint64_t origin_seq;
+    uint64_t timestamp;
+    uint32_t stored_at;     // unix seconds, for retention
+    char     sender[16];
+    uint16_t length;
+} PersistMsg;   // 54 bytes + text
+
+typedef struct __attribute__((packed)) {
+    uint8_t  kind;          // DirectoryRecord fields
+    uint64_t origin_seq;
+    uint32_t id;
+    uint32_t member_id;
+    char     name[16];
+    uint8_t  local;
+    uint8_t  origin_id;
+    uint8_t  salt[16];      // DIR_REC_USER: password verifier
+    uint8_t  hash[32];
+    uint32_t iterations;
+} PersistDir;   // 87 bytes
+
+// Directory records written before verifiers were kept end at origin_id
+#define PERSIST_DIR_V2_SIZE  35
+
+typedef struct __attribute__((packed)) {
+    uint32_t user_id;
+    uint32_t channel_id;
+    uint64_t seq;           // read up to here
+} PersistMark;   // 16 bytes
+
+// ---------------------------------------------------------------------------
+// Startup / background
+// ---------------------------------------------------------------------------
+
+// Restores state from dir (created if missing) and opens a fresh log
+// segment. Call before the listener and replication start. Returns -1 if
+// the directory cannot be used.
+int  persist_open(const char *dir);
+
+// Snapshot + compaction loop. No-op thread if persistence is off.
+void* persist_thread(void *arg);
+
+// ---------------------------------------------------------------------------
+// Log hooks — called by store.c / directory.c under their own locks.
+// No-ops while persistence is off or state is being restored.
+// ---------------------------------------------------------------------------
+void persist_log_message(const PersistMsg *m, const char *text);
+void persist_log_dir(const PersistDir *d);
+void persist_log_mark(const PersistMark *m);
+
+// Blocks until every directory record this thread has logged is on disk.
+// Concurrent callers share fsyncs (group commit). Call before ACKing an
+// account or channel mutation. Returns at once when persistence is off
+// or nothing is pending.
+void persist_commit_dir(void);
+
+// ---------------------------------------------------------------------------
+// Snapshot writer — store.c / directory.c / readmark.c serialise their own
+// sections
+// ---------------------------------------------------------------------------
+typedef struct SnapWriter SnapWriter;
+
+// Returns -1 once any write has failed (later writes are skipped).
+int snap_write(SnapWriter *w, const void *p, size_t n);
+
+// Bounds-checked reader over a loaded snapshot. Returns -1 past the end.
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    int            version;   // of the snapshot format, 2 or 3
+} SnapReader;
+
+int snap_read(SnapReader *r, void *out, size_t n);
+
+#endif //COMP4985_PERSIST_H
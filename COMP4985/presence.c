@@ -0,0 +1,301 @@
+#include "protocol.h"
+#include "presence.h"
+#include "client.h"
+#include "directory.h"
+#include "idmap.h"
+
+#include <sys/eventfd.h>
+
+// ===========================================================================
+// Online table
+// ===========================================================================
+
+#define PRESENCE_SUB_STRIPES  64
+#define PRESENCE_CANCELLED    0xFF   // PresenceChange.online of a dropped record
+
+typedef struct {
+    uint32_t    sessions;    // connections logged in as this user
+    uint8_t     published;   // state subscribers last heard about
+    uint8_t     dirty;       // queued in dirty[]
+    uint64_t    fanned;      // tick thread: last change delivered to this peer
+    ClientConn *subs;        // subscribed connections, under sub_lock()
+} PresenceUser;
+
+// Lock order: presence_lock, then a subscriber stripe, then an inbox.
+// The tick thread delivers under the stripe alone, which is also what
+// keeps a subscribed connection from going away under it.
+static pthread_mutex_t presence_lock = PTHREAD_MUTEX_INITIALIZER;
+static IdMap           online_users;   // user_id → PresenceUser *, never removed
+static uint32_t       *dirty;          // users to publish, oldest first
+static uint32_t        dirty_count, dirty_cap;
+static pthread_mutex_t sub_locks[PRESENCE_SUB_STRIPES];
+
+static pthread_mutex_t *sub_lock(uint32_t user_id) {
+    return &sub_locks[(id_hash(user_id) >> 16) % PRESENCE_SUB_STRIPES];
+}
+
+// Caller holds presence_lock
+static PresenceUser *user_get(uint32_t user_id, int create) {
+    PresenceUser *u = idmap_get(&online_users, user_id);
+    if (u || !create) return u;
+    u = calloc(1, sizeof(PresenceUser));
+    if (u && idmap_put(&online_users, user_id, u) < 0) {
+        free(u);
+        u = NULL;
+    }
+    return u;
+}
+
+static void mark_dirty(PresenceUser *u, uint32_t user_id) {
+    if (u->dirty) return;
+    if (dirty_count == dirty_cap) {
+        uint32_t  ncap = dirty_cap ? dirty_cap * 2 : 256;
+        uint32_t *n    = realloc(dirty, ncap * sizeof(uint32_t));
+        if (!n) return;   // published the next time this user changes
+        dirty     = n;
+        dirty_cap = ncap;
+    }
+    dirty[dirty_count++] = user_id;
+    u->dirty = 1;
+}
+
+static pthread_once_t stripes_once = PTHREAD_ONCE_INIT;
+
+static void stripes_init(void) {
+    for (int i = 0; i < PRESENCE_SUB_STRIPES; i++)
+        pthread_mutex_init(&sub_locks[i], NULL);
+}
+
+void presence_init(PresenceInbox *p) {
+    pthread_once(&stripes_once, stripes_init);
+    memset(p, 0, sizeof(*p));
+    p->fd = -1;
+    pthread_mutex_init(&p->lock, NULL);
+}
+
+// Caller holds presence_lock
+static void logout_locked(ClientConn *c) {
+    PresenceInbox *p = &c->presence;
+    PresenceUser  *u = p->user_id ? user_get(p->user_id, 0) : NULL;
+    if (!u) return;
+
+    pthread_mutex_lock(sub_lock(p->user_id));
+    if (p->sub_prev)      p->sub_prev->presence.sub_next = p->sub_next;
+    else if (u->subs == c) u->subs = p->sub_next;
+    if (p->sub_next)      p->sub_next->presence.sub_prev = p->sub_prev;
+    p->sub_prev = p->sub_next = NULL;
+    pthread_mutex_unlock(sub_lock(p->user_id));
+
+    if (u->sessions > 0 && --u->sessions == 0)
+        mark_dirty(u, p->user_id);
+    p->user_id = 0;
+}
+
+void presence_login(ClientConn *c, uint32_t user_id, int subscribe) {
+    PresenceInbox *p = &c->presence;
+    if (subscribe && p->fd < 0)
+        p->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    pthread_mutex_lock(&presence_lock);
+    logout_locked(c);
+    PresenceUser *u = user_get(user_id, 1);
+    if (u) {
+        if (u->sessions++ == 0)
+            mark_dirty(u, user_id);
+        p->user_id = user_id;
+        if (subscribe && p->fd >= 0) {
+            pthread_mutex_lock(sub_lock(user_id));
+            p->sub_next = u->subs;
+            if (u->subs) u->subs->presence.sub_prev = c;
+            u->subs = c;
+            pthread_mutex_unlock(sub_lock(user_id));
+        }
+    }
+    pthread_mutex_unlock(&presence_lock);
+}
+
+void presence_logout(ClientConn *c) {
+    pthread_mutex_lock(&presence_lock);
+    logout_locked(c);
+    pthread_mutex_unlock(&presence_lock);
+}
+
+void presence_release(ClientConn *c) {
+    presence_logout(c);
+    if (c->presence.fd >= 0) close(c->presence.fd);
+    c->presence.fd = -1;
+    pthread_mutex_destroy(&c->presence.lock);
+}
+
+int presence_online(uint32_t user_id) {
+    pthread_mutex_lock(&presence_lock);
+    PresenceUser *u = user_get(user_id, 0);
+    int online = u && u->sessions > 0;
+    pthread_mutex_unlock(&presence_lock);
+    return online;
+}
+
+// ===========================================================================
+// Inboxes
+// ===========================================================================
+
+// Slot of user_id in p->index, or the empty slot where it would go.
+// Caller holds p->lock.
+static uint16_t *inbox_slot(PresenceInbox *p, uint32_t user_id) {
+    uint32_t i = id_hash(user_id) & (PRESENCE_INDEX_SLOTS - 1);
+    while (p->index[i] && p->rec[p->index[i] - 1].user_id != user_id)
+        i = (i + 1) & (PRESENCE_INDEX_SLOTS - 1);
+    return &p->index[i];
+}
+
+// Tick thread, under c's subscriber stripe (so c cannot go away). Changes
+// for one user strictly alternate, so a second one before the flush
+// cancels the first: the connection never saw the intermediate state.
+static void inbox_add(ClientConn *c, uint32_t user_id, uint8_t online) {
+    PresenceInbox *p = &c->presence;
+    pthread_mutex_lock(&p->lock);
+    int was_empty = p->count == 0 && !p->truncated;
+
+    uint16_t *slot = inbox_slot(p, user_id);
+    if (*slot) {
+        PresenceChange *r = &p->rec[*slot - 1];
+        r->online = r->online == PRESENCE_CANCELLED ? online : PRESENCE_CANCELLED;
+    } else if (p->count < PRESENCE_MAX_RECORDS) {
+        p->rec[p->count++] = (PresenceChange){ user_id, online };
+        *slot = (uint16_t)p->count;
+    } else {
+        p->truncated = 1;
+    }
+
+    int wake = was_empty && (p->count > 0 || p->truncated);
+    pthread_mutex_unlock(&p->lock);
+
+    if (wake) {
+        uint64_t one = 1;
+        ssize_t  n   = write(p->fd, &one, sizeof(one));
+        (void)n;   // EAGAIN: counter already non-zero
+    }
+}
+
+uint32_t presence_take(ClientConn *c, PresenceChange *out, uint8_t *truncated) {
+    PresenceInbox *p = &c->presence;
+    if (p->fd >= 0) {
+        uint64_t v;
+        ssize_t  r = read(p->fd, &v, sizeof(v));
+        (void)r;   // EAGAIN: woken for an earlier batch already taken
+    }
+
+    pthread_mutex_lock(&p->lock);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < p->count; i++)
+        if (p->rec[i].online != PRESENCE_CANCELLED) out[n++] = p->rec[i];
+    if (p->count) memset(p->index, 0, sizeof(p->index));
+    *truncated   = p->truncated;
+    p->count     = 0;
+    p->truncated = 0;
+    pthread_mutex_unlock(&p->lock);
+    return n;
+}
+
+// ===========================================================================
+// Tick
+// ===========================================================================
+
+#define PRESENCE_RESOLVE_CHUNK  256   // member ids looked up per hold of presence_lock
+
+// Scratch lists for the tick thread
+static uint32_t       *chan_buf, chan_cap;
+static uint32_t       *member_buf, member_cap;
+static PresenceChange  batch[PRESENCE_MAX_CHANGES];
+static uint64_t        fanout_seq;   // numbers each change, for PresenceUser.fanned
+
+// Fills *buf via fetch, doubling it until the result fits
+static uint32_t fetch_all(uint32_t **buf, uint32_t *cap, uint32_t key,
+                          uint32_t (*fetch)(uint32_t key, uint32_t *out, uint32_t cap))
+{
+    while (1) {
+        if (*cap == 0 || *buf == NULL) {
+            *cap = 256;
+            *buf = malloc(*cap * sizeof(uint32_t));
+            if (!*buf) { *cap = 0; return 0; }
+        }
+        uint32_t n = fetch(key, *buf, *cap);
+        if (n < *cap || *cap >= DIR_MAX_USER_ID / 2) return n;
+        uint32_t *nb = realloc(*buf, (size_t)*cap * 2 * sizeof(uint32_t));
+        if (!nb) return n;
+        *buf = nb;
+        *cap *= 2;
+    }
+}
+
+static uint32_t channel_members_all(uint32_t channel_id, uint32_t *out, uint32_t cap) {
+    return directory_channel_members(channel_id, DIR_MAX_USER_ID, out, cap);
+}
+
+// Delivers one change to the subscribers among members (excluding the
+// user itself, and peers already reached through another channel).
+static void fan_out(uint32_t user_id, uint8_t online, const uint32_t *members, uint32_t n) {
+    for (uint32_t done = 0; done < n; done += PRESENCE_RESOLVE_CHUNK) {
+        uint32_t      chunk = n - done < PRESENCE_RESOLVE_CHUNK ? n - done : PRESENCE_RESOLVE_CHUNK;
+        PresenceUser *peers[PRESENCE_RESOLVE_CHUNK];
+
+        // Entries are never freed, so the pointers outlive the lock
+        pthread_mutex_lock(&presence_lock);
+        for (uint32_t j = 0; j < chunk; j++)
+            peers[j] = members[done + j] == user_id ? NULL
+                                                    : user_get(members[done + j], 0);
+        pthread_mutex_unlock(&presence_lock);
+
+        for (uint32_t j = 0; j < chunk; j++) {
+            PresenceUser *peer = peers[j];
+            if (!peer || peer->fanned == fanout_seq) continue;
+            peer->fanned = fanout_seq;
+
+            pthread_mutex_t *lock = sub_lock(members[done + j]);
+            pthread_mutex_lock(lock);
+            for (ClientConn *s = peer->subs; s; s = s->presence.sub_next)
+                inbox_add(s, user_id, online);
+            pthread_mutex_unlock(lock);
+        }
+    }
+}
+
+static void publish(uint32_t user_id, uint8_t online) {
+    fanout_seq++;
+    uint32_t nch = fetch_all(&chan_buf, &chan_cap, user_id, directory_user_channels);
+    for (uint32_t i = 0; i < nch; i++) {
+        uint32_t nm = fetch_all(&member_buf, &member_cap, chan_buf[i], channel_members_all);
+        fan_out(user_id, online, member_buf, nm);
+    }
+}
+
+static void presence_tick(void) {
+    // Take the batch under the lock, publish it without
+    uint32_t nb = 0;
+    pthread_mutex_lock(&presence_lock);
+    uint32_t n = dirty_count < PRESENCE_MAX_CHANGES ? dirty_count : PRESENCE_MAX_CHANGES;
+    for (uint32_t i = 0; i < n; i++) {
+        PresenceUser *u = user_get(dirty[i], 0);
+        if (!u) continue;
+        u->dirty = 0;
+        uint8_t online = u->sessions > 0;
+        if (online == u->published) continue;   // flapped back within the tick
+        u->published = online;
+        batch[nb++] = (PresenceChange){ dirty[i], online };
+    }
+    memmove(dirty, dirty + n, (dirty_count - n) * sizeof(uint32_t));
+    dirty_count -= n;
+    pthread_mutex_unlock(&presence_lock);
+
+    for (uint32_t i = 0; i < nb; i++)
+        publish(batch[i].user_id, batch[i].online);
+}
+
+void* presence_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        usleep(PRESENCE_TICK_MS * 1000);
+        presence_tick();
+    }
+    return NULL;
+}
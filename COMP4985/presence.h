@@ -0,0 +1,75 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_PRESENCE_H
+#define COMP4985_PRESENCE_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Presence
+//
+// Who is online, keyed by user ID: a user is online while at least one
+// connection is logged in as them. Login, logout and disconnect only bump
+// a session count and mark the user dirty; presence_thread publishes once
+// per PRESENCE_TICK_MS, and only for users whose state differs from what
+// was last published — a user who drops and reconnects within a tick
+// costs nothing. Each change fans out to the members of the user's
+// channels that opted in (HDR_FLAG_PRESENCE), into a small per-connection
+// inbox the connection's own thread drains into one Presence Update.
+//
+// A reconnect storm is bounded three ways: each user is published at most
+// once per tick, at most PRESENCE_MAX_CHANGES users per tick (the rest
+// wait for the next), and each connection buffers at most
+// PRESENCE_MAX_RECORDS changes between flushes before its next update is
+// marked PRESENCE_TRUNCATED. The tick copies its batch out of the online
+// table and fans it out without the table lock, so logins never wait on
+// a fan-out; inboxes are indexed by user, so adding a change costs O(1).
+// ---------------------------------------------------------------------------
+#define PRESENCE_TICK_MS      250
+#define PRESENCE_MAX_CHANGES  4096
+#define PRESENCE_MAX_RECORDS  256
+#define PRESENCE_INDEX_SLOTS  512   // power of two, 2x the records
+
+typedef struct {
+    uint32_t user_id;
+    uint8_t  online;
+} PresenceChange;
+
+// Per-connection presence state, embedded in ClientConn
+typedef struct {
+    uint32_t           user_id;   // logged-in account, 0 if none
+    int                fd;        // eventfd, readable while the inbox has news; -1 if not subscribed
+    struct ClientConn *sub_prev, *sub_next;   // subscribers of the same user
+
+    pthread_mutex_t    lock;      // inbox
+    uint8_t            truncated;
+    uint32_t           count;     // records used, cancelled ones included
+    PresenceChange     rec[PRESENCE_MAX_RECORDS];
+    uint16_t           index[PRESENCE_INDEX_SLOTS];   // user_id hash → rec + 1
+} PresenceInbox;
+
+void presence_init(PresenceInbox *p);
+
+// c logged in as user_id; with subscribe it also receives its channel
+// peers' changes from now on. A second login replaces the first.
+void presence_login(struct ClientConn *c, uint32_t user_id, int subscribe);
+
+// c logged out (or is closing): no longer counts towards its user's
+// sessions and receives nothing more.
+void presence_logout(struct ClientConn *c);
+
+// presence_logout plus releasing the eventfd. Call before c goes away.
+void presence_release(struct ClientConn *c);
+
+int  presence_online(uint32_t user_id);
+
+// Empties c's inbox into out (PRESENCE_MAX_RECORDS entries). Returns the
+// count; *truncated is set if changes were dropped since the last call.
+uint32_t presence_take(struct ClientConn *c, PresenceChange *out, uint8_t *truncated);
+
+// Publishes dirty users every PRESENCE_TICK_MS.
+void* presence_thread(void *arg);
+
+#endif //COMP4985_PRESENCE_H
@@ -8,6 +8,9 @@
 #ifdef __APPLE__
 #include <libkern/OSByteOrder.h>
 #define htole16(x) OSSwapHostToLittleInt16(x)
+#define le16toh(x) OSSwapLittleToHostInt16(x)
+#define htobe64(x) OSSwapHostToBigInt64(x)
+#define be64toh(x) OSSwapBigToHostInt64(x)
 #else
 #include <endian.h>
 #endif
@@ -24,6 +27,7 @@
 #include <stdint.h>
 #include <time.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 
 #define BUFFER_SIZE 65536
 
@@ -33,6 +37,14 @@
 #define PROTO_VER_MAJOR  0x0    // 4-bit: 0000
 #define PROTO_VER_MINOR  0x2    // 4-bit: 0010  → v0.2
 
+// v0.3 widens client, user and channel IDs to 32 bits (the *V3 payloads
+// below). A client picks the version with its first frame and keeps it for
+// the connection; the server answers in the same version, so v0.2 and v0.3
+// clients share one listener. Server IDs stay 8-bit: the manager assigns
+// them and speaks v0.2 only.
+#define PROTO_VER_MINOR_WIDE  0x3   // 4-bit: 0011  → v0.3
+#define PROTO_V2_MAX_ID       0xFF  // largest ID a v0.2 client can carry
+
 // ---------------------------------------------------------------------------
 // Resource Type  (5-bit field)
 // ---------------------------------------------------------------------------
@@ -42,6 +54,10 @@
 #define RES_CHANNEL   0x04   // 00100
 #define RES_CHANNELS  0x05   // 00101
 #define RES_MESSAGE   0x06   // 00110
+#define RES_MESSAGES  0x07   // 00111
+#define RES_REPLICATE 0x08   // 01000  server → manager → peer servers
+#define RES_PRESENCE  0x09   // 01001
+#define RES_SEARCH    0x0A   // 01010
 
 // ---------------------------------------------------------------------------
 // CRUD  (2-bit field)
@@ -49,6 +65,7 @@
 #define CRUD_CREATE  0x0   // 00
 #define CRUD_READ    0x1   // 01
 #define CRUD_UPDATE  0x2   // 10
+#define CRUD_DELETE  0x3   // 11  (RES_SYSTEM: server heartbeat)
 
 // ---------------------------------------------------------------------------
 // ACK  (1-bit field)
@@ -92,127 +109,426 @@
 #define MAX_MESSAGE_SIZE  65535   // refuse any message payload larger than this (uint16_t max)
 
 // ===========================================================================
-// GlobalHeader — 8 bytes packed, exact spec bit widths
+// Wire schema
+//
+// Every frame is declared once, as a list of fields with an explicit wire
+// encoding. codec.h expands each list into a plain C struct (host byte
+// order, natural alignment) plus <name>_decode / <name>_encode routines
+// and a <NAME>_SIZE constant; nothing ever casts a struct onto a buffer.
+//
+// Field encodings:
+//   U8       1 byte
+//   U16      2 bytes, network byte order
+//   U16LE    2 bytes, little-endian
+//   U32      4 bytes, network byte order
+//   U64      8 bytes, network byte order
+//   ADDR     4 bytes copied as-is: an IPv4 address, kept in network order
+//   OPAQUE64 8 bytes copied as-is: a client value the server only echoes
+//   STR16    16-byte name, NUL padded but not necessarily terminated
+//   BYTES16  16 / 32 raw bytes (salts, hashes)
+//   BYTES32
+// ===========================================================================
+
+// ===========================================================================
+// GlobalHeader — 8 bytes
 //
-//  Byte 0:  version_major[4] | version_minor[4]
-//  Byte 1:  resource_type[5] | crud[2] | ack[1]
-//  Byte 2:  status_major[4]  | status_minor[4]
-//  Byte 3:  padding[8]
+//  Byte 0:  version_minor[7:4] | version_major[3:0]
+//  Byte 1:  ack[7] | crud[6:5] | resource_type[4:0]
+//  Byte 2:  status low nibble[7:4] | status high nibble[3:0]
+//  Byte 3:  flags[8]           (was padding; 0 from peers that predate it)
 //  Bytes 4-7: message_length[32]  network byte order
+//
+// The layout is what the original bit-field struct produced under GCC and
+// Clang (first field in the low bits), so v0.2 reads as 0x20 on the wire.
+// Coded by hand in codec.c since the fields are narrower than a byte.
 // ===========================================================================
-typedef struct __attribute__((packed)) {
-    uint8_t  version_major : 4;
-    uint8_t  version_minor : 4;
+typedef struct {
+    uint8_t  version_major;    // 4 bits
+    uint8_t  version_minor;    // 4 bits
+    uint8_t  resource_type;    // 5 bits
+    uint8_t  crud;             // 2 bits
+    uint8_t  ack;              // 1 bit
+    uint8_t  status;           // STATUS_*
+    uint8_t  flags;            // HDR_FLAG_* below
+    uint32_t message_length;
+} GlobalHeader;
+
+#define HEADER_SIZE  8
 
-    uint8_t  resource_type : 5;
-    uint8_t  crud          : 2;
-    uint8_t  ack           : 1;
+// ---------------------------------------------------------------------------
+// Header flags (byte 3)
+//
+// Compression is negotiated per connection: the client sets
+// HDR_FLAG_COMPRESS_OK on its Login request and the server confirms by
+// setting it on the Login ACK. After that either side may send a payload
+// of COMPRESS_THRESHOLD bytes or more with HDR_FLAG_COMPRESSED, in which
+// case message_length is the compressed size and the payload starts with a
+// CompressedPrefix. Smaller frames (login, ACKs, errors) are never
+// compressed.
+// ---------------------------------------------------------------------------
+#define HDR_FLAG_COMPRESSED   0x01
+#define HDR_FLAG_COMPRESS_OK  0x02
 
-    uint8_t  status_major  : 4;
-    uint8_t  status_minor  : 4;
+// Presence is opt-in the same way: HDR_FLAG_PRESENCE on the Login request,
+// confirmed on the Login ACK. Only connections that opted in ever receive
+// an unsolicited Presence Update.
+#define HDR_FLAG_PRESENCE     0x04
 
-    uint8_t  padding;
+// HDR_FLAG_UNREAD on a Channels Read request from a logged-in account asks
+// for unread counts; the ACK sets it when they are appended.
+#define HDR_FLAG_UNREAD       0x08
 
-    uint32_t message_length;   // network byte order
-} GlobalHeader;   // 8 bytes
+// followed by the compressed block; dict_id names the preset dictionary
+// both sides were built with
+#define COMPRESSED_PREFIX_FIELDS(F)                                         \
+    F(U8,       dict_id)                                                    \
+    F(U32,      raw_length)       /* size after decompression */
 
 // ===========================================================================
-// Payload structures (all packed)
+// Payloads
 // ===========================================================================
 
 // --- System resource (RES_SYSTEM = 00000) ---
 
-typedef struct __attribute__((packed)) {
-    uint32_t server_ip;
-    uint8_t  server_id;
-} RegisterPayload;   // 5 bytes
-// Used by: Register REQ/ACK, Activate REQ/ACK
-
-// For Get Active Server REQ the spec says server_ip=0, server_id=0
-typedef RegisterPayload GetActiveServerPayload;
+// Used by: Register REQ/ACK, Activate REQ/ACK, and Get Active Server
+// (REQ: server_ip=0, server_id=0)
+#define REGISTER_FIELDS(F)                                                  \
+    F(ADDR,     server_ip)                                                  \
+    F(U8,       server_id)
+
+// Heartbeat REQ (server → manager, res=00000 crud=11, no ACK), sent every
+// HEARTBEAT_INTERVAL_MS once registered. Rates and p99 cover the last
+// interval; queue depths are instantaneous.
+#define HEARTBEAT_INTERVAL_MS  1000
+#define HB_FLAG_STANDBY        0x01   // not serving clients yet
+
+#define HEARTBEAT_FIELDS(F)                                                 \
+    F(U8,       server_id)                                                  \
+    F(U8,       flags)            /* HB_FLAG_* */                           \
+    F(U16,      interval_ms)      /* span the rates cover */                \
+    F(U32,      connections)                                                \
+    F(U32,      requests_per_sec)                                           \
+    F(U32,      messages_per_sec) /* Message Create */                      \
+    F(U32,      p99_us)           /* request handling latency */            \
+    F(U32,      outbound_kib)     /* bytes queued in client sends */        \
+    F(U32,      spool_records)    /* Forward Logs awaiting the link */      \
+    F(U32,      repl_backlog)     /* messages not yet shipped to peers */
 
 // --- User resource (RES_USER = 00010) ---
 
 // Create Account REQ: client_id must be 0
 // Create Account ACK: server fills in client_id
-typedef struct __attribute__((packed)) {
-    char    username[16];
-    char    password[16];
-    uint8_t client_id;
-} AccountCreatePayload;   // 33 bytes
+#define ACCOUNT_CREATE_FIELDS(F)                                            \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(U8,       client_id)
+
+#define ACCOUNT_CREATE_V3_FIELDS(F)                                         \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(U32,      client_id)
 
 // Login  REQ/ACK: status = STATUS_LOGIN  (0x00)
 // Logout REQ/ACK: status = STATUS_LOGOUT (0x01)
-typedef struct __attribute__((packed)) {
-    char     username[16];
-    char     password[16];
-    uint32_t client_ip;
-    uint8_t  status;
-} LoginLogoutPayload;   // 37 bytes
+#define LOGIN_LOGOUT_FIELDS(F)                                              \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(ADDR,     client_ip)                                                  \
+    F(U8,       status)
 
 // User Read REQ: username_for_user_id = target name, user_id = 0
 // User Read ACK: server fills in user_id
-typedef struct __attribute__((packed)) {
-    char    username[16];
-    char    password[16];
-    char    username_for_user_id[16];
-    uint8_t user_id;
-} UserReadPayload;   // 49 bytes
+#define USER_READ_FIELDS(F)                                                 \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(STR16,    username_for_user_id)                                       \
+    F(U8,       user_id)
+
+#define USER_READ_V3_FIELDS(F)                                              \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(STR16,    username_for_user_id)                                       \
+    F(U32,      user_id)
 
 // --- Log resource (RES_LOG = 00011) ---
 
 // Forward Logs: log_length is LITTLE-ENDIAN (Wireshark dissector requirement)
-typedef struct __attribute__((packed)) {
-    uint8_t  server_id;
-    uint16_t log_length;   // little-endian!
-    // followed by log_length bytes of log text
-} LogPayload;   // 3 bytes header + variable
+// followed by log_length bytes of log text
+#define LOG_FIELDS(F)                                                       \
+    F(U8,       server_id)                                                  \
+    F(U16LE,    log_length)
 
 // --- Channel resource (RES_CHANNEL = 00100) ---
 
-// Channel Read REQ/ACK (variable length due to user_id_array)
-typedef struct __attribute__((packed)) {
-    char    username[16];
-    char    password[16];
-    char    channel_name[16];
-    uint8_t channel_id;
-    uint8_t user_id_array_length;
-    // followed by user_id_array_length × uint8_t user IDs
-} ChannelReadHeader;   // 50 bytes + variable
+// Channel Read REQ/ACK, followed by user_id_array_length user IDs:
+// one byte each in v0.2, U32 in v0.3
+#define CHANNEL_READ_FIELDS(F)                                              \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(STR16,    channel_name)                                               \
+    F(U8,       channel_id)                                                 \
+    F(U8,       user_id_array_length)
+
+#define CHANNEL_READ_V3_FIELDS(F)                                           \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(STR16,    channel_name)                                               \
+    F(U32,      channel_id)                                                 \
+    F(U32,      user_id_array_length)
 
 // --- Channels resource (RES_CHANNELS = 00101) ---
 
 // Channels Read REQ: channel_list_length=0, no list
-// Channels Read ACK: server fills length + list
-typedef struct __attribute__((packed)) {
-    char    username[16];
-    char    password[16];
-    uint8_t channel_list_length;
-    // followed by channel_list_length × uint8_t channel IDs
-} ChannelsReadHeader;   // 33 bytes + variable
+// Channels Read ACK: server fills length + list (U8 / U32 channel IDs).
+// With HDR_FLAG_UNREAD the list is followed by channel_list_length × U32
+// (both versions): messages in that channel after the account's read
+// marker, which Message Sync advances, saturated at UINT32_MAX.
+#define CHANNELS_READ_FIELDS(F)                                             \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(U8,       channel_list_length)
+
+#define CHANNELS_READ_V3_FIELDS(F)                                          \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(U32,      channel_list_length)
 
 // --- Message resource (RES_MESSAGE = 00110) ---
 
-// Message Create REQ (no ACK in spec)
-typedef struct __attribute__((packed)) {
-    char     username[16];
-    char     password[16];
-    uint64_t timestamp;        // 8 bytes
-    uint16_t message_length;
-    uint8_t  channel_id;
-    // followed by message_length bytes of message text
-} MessageCreateHeader;   // 43 bytes + variable
-
-// Message Read REQ / Message Read ACK
-typedef struct __attribute__((packed)) {
-    char     username[16];
-    char     password[16];
-    uint64_t timestamp;
-    uint16_t message_length;
-    uint8_t  channel_id;
-    uint8_t  user_id_of_sender;
-    // followed by message_length bytes of message text
-} MessageReadHeader;   // 44 bytes + variable
+// Message Create REQ (no ACK in spec), followed by message_length bytes of
+// message text. timestamp is opaque: stored and echoed exactly as sent.
+// Text longer than STORE_MAX_TEXT (store.h) is refused with
+// STATUS_MESSAGE_TOO_LARGE.
+#define MESSAGE_CREATE_FIELDS(F)                                            \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(OPAQUE64, timestamp)                                                  \
+    F(U16,      message_length)                                             \
+    F(U8,       channel_id)
+
+#define MESSAGE_CREATE_V3_FIELDS(F)                                         \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(OPAQUE64, timestamp)                                                  \
+    F(U16,      message_length)                                             \
+    F(U32,      channel_id)
+
+// Message Read REQ / Message Read ACK, followed by the message text
+#define MESSAGE_READ_FIELDS(F)                                              \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(OPAQUE64, timestamp)                                                  \
+    F(U16,      message_length)                                             \
+    F(U8,       channel_id)                                                 \
+    F(U8,       user_id_of_sender)
+
+#define MESSAGE_READ_V3_FIELDS(F)                                           \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(OPAQUE64, timestamp)                                                  \
+    F(U16,      message_length)                                             \
+    F(U32,      channel_id)                                                 \
+    F(U32,      user_id_of_sender)
+
+// --- Messages resource (RES_MESSAGES = 00111) ---
+
+// Message Sync REQ: since_seq = highest sequence the client already holds
+//                   (0 = from the start), max_records = 0 for server default
+// Message Sync ACK: server fills record_count and head_seq (newest seq in
+//                   the channel), followed by record_count × (record +
+//                   message text)
+// Every message stored through Message Create gets the next per-channel
+// sequence number, starting at 1. A reconnecting client sends the last seq
+// it saw and receives exactly the messages after it, oldest first; if
+// last returned seq < head_seq it simply asks again from there. For a
+// logged-in account, since_seq and every record returned count as read.
+#define MESSAGE_SYNC_FIELDS(F)                                              \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(U8,       channel_id)                                                 \
+    F(U64,      since_seq)                                                  \
+    F(U16,      max_records)                                                \
+    F(U16,      record_count)                                               \
+    F(U64,      head_seq)
+
+#define MESSAGE_SYNC_RECORD_FIELDS(F)                                       \
+    F(U64,      seq)                                                        \
+    F(OPAQUE64, timestamp)        /* as sent in Message Create */           \
+    F(U8,       user_id_of_sender)                                          \
+    F(U16,      message_length)
+
+// v0.3 Message Sync: same fields, 32-bit channel / sender IDs. A v0.2
+// client is shown sender IDs above PROTO_V2_MAX_ID as 0 (unknown).
+#define MESSAGE_SYNC_V3_FIELDS(F)                                           \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(U32,      channel_id)                                                 \
+    F(U64,      since_seq)                                                  \
+    F(U16,      max_records)                                                \
+    F(U16,      record_count)                                               \
+    F(U64,      head_seq)
+
+#define MESSAGE_SYNC_RECORD_V3_FIELDS(F)                                    \
+    F(U64,      seq)                                                        \
+    F(OPAQUE64, timestamp)                                                  \
+    F(U32,      user_id_of_sender)                                          \
+    F(U16,      message_length)
+
+// --- Replicate resource (RES_REPLICATE = 01000) ---
+
+// Replica Batch (no ACK): a server ships the messages it stored itself to
+// the manager, which relays the frame unchanged to every other server.
+// Followed by record_count × (ReplicaRecord + message text).
+//
+// Each record names the origin's previous record in the same stream
+// (prev_seq; a stream is one origin's messages in one channel, or its
+// directory journal). A peer applies a record only when it holds
+// everything up to prev_seq, drops records it has already applied, and
+// drops anything past a gap and sends Replica Sync again. Batches may
+// therefore arrive in any order or twice: a server that registers late
+// sees live batches before the re-shipped history, and nothing is skipped.
+#define REPLICA_BATCH_FIELDS(F)                                             \
+    F(U8,       origin_server_id)                                           \
+    F(U16,      record_count)
+
+#define REPLICA_RECORD_FIELDS(F)                                            \
+    F(U32,      channel_id)                                                 \
+    F(U64,      origin_seq)       /* seq on the origin server */            \
+    F(U64,      prev_seq)         /* previous in the stream, 0 = none */    \
+    F(OPAQUE64, timestamp)        /* as sent in Message Create */           \
+    F(U32,      user_id_of_sender)                                          \
+    F(STR16,    sender)                                                     \
+    F(U16,      message_length)
+
+// Directory Batch (res=01000 crud=10, no ACK): same ReplicaBatchHeader,
+// followed by record_count × DirectoryRecord. Carries account creation and
+// channel registry changes so a standby holds the same directory. User
+// records carry the account's password verifier (see credential.h), so a
+// peer can check logins without ever seeing the password.
+#define DIR_REC_USER     0x01   // id = user_id,    name = username
+#define DIR_REC_CHANNEL  0x02   // id = channel_id, name = channel name
+#define DIR_REC_MEMBER   0x03   // id = channel_id, member_id joins it
+
+#define DIRECTORY_RECORD_FIELDS(F)                                          \
+    F(U8,       kind)             /* DIR_REC_* */                           \
+    F(U64,      origin_seq)       /* origin's journal seq */                \
+    F(U64,      prev_seq)         /* previous in the stream, 0 = none */    \
+    F(U32,      id)                                                         \
+    F(U32,      member_id)                                                  \
+    F(STR16,    name)                                                       \
+    F(BYTES16,  salt)             /* DIR_REC_USER only */                   \
+    F(BYTES32,  hash)                                                       \
+    F(U32,      iterations)
+
+// Replica Sync (res=01000 crud=01, no ACK): sent by a server right after it
+// registers, listing what it already holds. Each peer re-ships its own
+// messages and directory records from those marks (0 if absent).
+// Followed by mark_count × ReplicaMark.
+#define REPL_STREAM_DIRECTORY  0x00
+#define REPL_STREAM_CHANNEL    0x01
+
+#define REPLICA_SYNC_FIELDS(F)                                              \
+    F(U8,       requester_id)                                               \
+    F(U16,      mark_count)
+
+#define REPLICA_MARK_FIELDS(F)                                              \
+    F(U8,       origin_server_id)                                           \
+    F(U8,       stream)           /* REPL_STREAM_* */                       \
+    F(U32,      channel_id)       /* REPL_STREAM_CHANNEL only */            \
+    F(U64,      applied_seq)
+
+// --- Presence resource (RES_PRESENCE = 01001) ---
+
+// Presence Read REQ/ACK (res=01001 crud=01): same payload as Channel Read;
+// the ACK lists only the members that are online right now.
+//
+// Presence Update (res=01001 crud=10 ack=1, unsolicited, never answered):
+// users sharing a channel with the receiver who came online or went
+// offline since the last update. Changes are coalesced per tick, so a user
+// who reconnects within one tick produces nothing. Followed by
+// record_count × PresenceRecord (U8 user IDs in v0.2, which never sees IDs
+// above PROTO_V2_MAX_ID, U32 in v0.3).
+#define PRESENCE_TRUNCATED  0x01   // changes were dropped: Presence Read again
+
+#define PRESENCE_UPDATE_FIELDS(F)                                           \
+    F(U8,       flags)            /* PRESENCE_* */                          \
+    F(U16,      record_count)
+
+#define PRESENCE_RECORD_FIELDS(F)                                           \
+    F(U8,       user_id)                                                    \
+    F(U8,       online)           /* 1 = came online, 0 = went offline */
+
+#define PRESENCE_RECORD_V3_FIELDS(F)                                        \
+    F(U32,      user_id)                                                    \
+    F(U8,       online)
+
+// --- Search resource (RES_SEARCH = 01010) ---
+
+// Search REQ (res=01010 crud=01), followed by query_length bytes of query
+// text: messages of the channel containing every word of it. before_seq =
+// 0 searches from the newest message, otherwise only older ones (page by
+// sending the last hit); max_results = 0 for the server default.
+// Search ACK: same header with query_length = 0 and result_count and
+// indexed_seq (newest seq the index covers; later messages are not
+// searched yet) filled, followed by result_count × U64 seq, newest first.
+// A hit is fetched with Message Sync, since_seq = seq - 1.
+#define SEARCH_FIELDS(F)                                                    \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(U8,       channel_id)                                                 \
+    F(U64,      before_seq)                                                 \
+    F(U16,      max_results)                                                \
+    F(U16,      query_length)                                               \
+    F(U16,      result_count)                                               \
+    F(U64,      indexed_seq)
+
+#define SEARCH_V3_FIELDS(F)                                                 \
+    F(STR16,    username)                                                   \
+    F(STR16,    password)                                                   \
+    F(U32,      channel_id)                                                 \
+    F(U64,      before_seq)                                                 \
+    F(U16,      max_results)                                                \
+    F(U16,      query_length)                                               \
+    F(U16,      result_count)                                               \
+    F(U64,      indexed_seq)
+
+// ---------------------------------------------------------------------------
+// Every frame body: type, codec function prefix, wire size constant, fields
+// ---------------------------------------------------------------------------
+#define PROTOCOL_MESSAGES(M)                                                                                \
+    M(CompressedPrefix,       compressed_prefix,   COMPRESSED_PREFIX_SIZE,   COMPRESSED_PREFIX_FIELDS)      \
+    M(RegisterPayload,        register_payload,    REGISTER_SIZE,            REGISTER_FIELDS)               \
+    M(HeartbeatPayload,       heartbeat,           HEARTBEAT_SIZE,           HEARTBEAT_FIELDS)              \
+    M(AccountCreatePayload,   account_create,      ACCOUNT_CREATE_SIZE,      ACCOUNT_CREATE_FIELDS)         \
+    M(AccountCreatePayloadV3, account_create_v3,   ACCOUNT_CREATE_V3_SIZE,   ACCOUNT_CREATE_V3_FIELDS)      \
+    M(LoginLogoutPayload,     login_logout,        LOGIN_LOGOUT_SIZE,        LOGIN_LOGOUT_FIELDS)           \
+    M(UserReadPayload,        user_read,           USER_READ_SIZE,           USER_READ_FIELDS)              \
+    M(UserReadPayloadV3,      user_read_v3,        USER_READ_V3_SIZE,        USER_READ_V3_FIELDS)           \
+    M(LogPayload,             log_payload,         LOG_SIZE,                 LOG_FIELDS)                    \
+    M(ChannelReadHeader,      channel_read,        CHANNEL_READ_SIZE,        CHANNEL_READ_FIELDS)           \
+    M(ChannelReadHeaderV3,    channel_read_v3,     CHANNEL_READ_V3_SIZE,     CHANNEL_READ_V3_FIELDS)        \
+    M(ChannelsReadHeader,     channels_read,       CHANNELS_READ_SIZE,       CHANNELS_READ_FIELDS)          \
+    M(ChannelsReadHeaderV3,   channels_read_v3,    CHANNELS_READ_V3_SIZE,    CHANNELS_READ_V3_FIELDS)       \
+    M(MessageCreateHeader,    message_create,      MESSAGE_CREATE_SIZE,      MESSAGE_CREATE_FIELDS)         \
+    M(MessageCreateHeaderV3,  message_create_v3,   MESSAGE_CREATE_V3_SIZE,   MESSAGE_CREATE_V3_FIELDS)      \
+    M(MessageReadHeader,      message_read,        MESSAGE_READ_SIZE,        MESSAGE_READ_FIELDS)           \
+    M(MessageReadHeaderV3,    message_read_v3,     MESSAGE_READ_V3_SIZE,     MESSAGE_READ_V3_FIELDS)        \
+    M(MessageSyncHeader,      message_sync,        MESSAGE_SYNC_SIZE,        MESSAGE_SYNC_FIELDS)           \
+    M(MessageSyncRecord,      sync_record,         SYNC_RECORD_SIZE,         MESSAGE_SYNC_RECORD_FIELDS)    \
+    M(MessageSyncHeaderV3,    message_sync_v3,     MESSAGE_SYNC_V3_SIZE,     MESSAGE_SYNC_V3_FIELDS)        \
+    M(MessageSyncRecordV3,    sync_record_v3,      SYNC_RECORD_V3_SIZE,      MESSAGE_SYNC_RECORD_V3_FIELDS) \
+    M(ReplicaBatchHeader,     replica_batch,       REPLICA_BATCH_SIZE,       REPLICA_BATCH_FIELDS)          \
+    M(ReplicaRecord,          replica_record,      REPLICA_RECORD_SIZE,      REPLICA_RECORD_FIELDS)         \
+    M(DirectoryRecord,        directory_record,    DIRECTORY_RECORD_SIZE,    DIRECTORY_RECORD_FIELDS)       \
+    M(ReplicaSyncHeader,      replica_sync,        REPLICA_SYNC_SIZE,        REPLICA_SYNC_FIELDS)           \
+    M(ReplicaMark,            replica_mark,        REPLICA_MARK_SIZE,        REPLICA_MARK_FIELDS)           \
+    M(PresenceUpdateHeader,   presence_update,     PRESENCE_UPDATE_SIZE,     PRESENCE_UPDATE_FIELDS)        \
+    M(PresenceRecord,         presence_record,     PRESENCE_RECORD_SIZE,     PRESENCE_RECORD_FIELDS)        \
+    M(PresenceRecordV3,       presence_record_v3,  PRESENCE_RECORD_V3_SIZE,  PRESENCE_RECORD_V3_FIELDS)     \
+    M(SearchHeader,           search,              SEARCH_SIZE,              SEARCH_FIELDS)                 \
+    M(SearchHeaderV3,         search_v3,           SEARCH_V3_SIZE,           SEARCH_V3_FIELDS)
+
+#include "codec.h"
 
 // ---------------------------------------------------------------------------
 
@@ -222,18 +538,19 @@ typedef struct {
     int  my_port;
 } ManagerInfo;
 
+#include "lockstat.h"
+
 // ===========================================================================
 // Globals
 // ===========================================================================
 
-extern uint8_t  my_server_id;
-extern uint32_t my_server_ip;
-extern int      manager_socket;
-extern int      manager_connected;
-extern pthread_mutex_t manager_mutex;
+extern _Atomic uint8_t my_server_id;   // 0 until the manager assigns one
+extern uint32_t        my_server_ip;
+extern int             manager_socket;
+extern _Atomic int     manager_connected;
+extern TrackedMutex    manager_mutex;
 
-extern uint8_t next_account_id;
-extern pthread_mutex_t acc_id_mutex;
+extern TrackedMutex acc_id_mutex;   // user id allocation, see directory.h
 
 // ===========================================================================
 // send_binary_msg / recv_binary_msg — declarations
@@ -243,6 +560,16 @@ int send_binary_msg(int sock,
                     uint8_t res_type, uint8_t crud, uint8_t ack,
                     const void *pay, uint32_t len);
 
+// send_binary_msg_flags — same as above with an explicit header flags byte
+int send_binary_msg_flags(int sock,
+                          uint8_t res_type, uint8_t crud, uint8_t ack,
+                          uint8_t flags, const void *pay, uint32_t len);
+
+// send_binary_msg_ver — same again, in protocol minor version `minor`
+int send_binary_msg_ver(int sock, uint8_t minor,
+                        uint8_t res_type, uint8_t crud, uint8_t ack,
+                        uint8_t flags, const void *pay, uint32_t len);
+
 int recv_binary_msg(int sock, GlobalHeader *h, void *pay, uint32_t max);
 
 // send_error_response — sends a header-only reply with the given status code
@@ -251,5 +578,17 @@ int send_error_response(int sock,
                         uint8_t res_type, uint8_t crud,
                         uint8_t status_code);
 
+// send_error_response_nowait — same frame, but never blocks on a full send
+// buffer. Used from the timer thread, where a stuck peer must not stall
+// every other deadline.
+int send_error_response_nowait(int sock,
+                               uint8_t res_type, uint8_t crud,
+                               uint8_t status_code);
+
+// send_error_response_ver — send_error_response in protocol minor `minor`
+int send_error_response_ver(int sock, uint8_t minor,
+                            uint8_t res_type, uint8_t crud,
+                            uint8_t status_code);
+
 
 #endif //COMP4985_PROTOCOL_H
\ No newline at end of file
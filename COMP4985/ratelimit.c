@@ -0,0 +1,127 @@
+#include "protocol.h"
+#include "ratelimit.h"
+
+// ===========================================================================
+// Limits
+// ===========================================================================
+
+RateRule rate_conn_rules[RL_OPS] = {
+    [RL_ACCOUNT_CREATE] = {   1,   3 },
+    [RL_LOGIN_LOGOUT]   = {   2,   5 },
+    [RL_USER_READ]      = {  50, 100 },
+    [RL_CHANNEL_READ]   = {  50, 100 },
+    [RL_CHANNELS_READ]  = {  20,  40 },
+    [RL_MESSAGE_CREATE] = {  20,  40 },
+    [RL_MESSAGE_READ]   = {  50, 100 },
+    [RL_MESSAGE_SYNC]   = {  20,  40 },
+    [RL_SEARCH]         = {  10,  20 },
+};
+
+// A user may hold several connections; these cap the sum across them.
+RateRule rate_user_rules[RL_OPS] = {
+    [RL_ACCOUNT_CREATE] = {   0,   0 },
+    [RL_LOGIN_LOGOUT]   = {   5,  10 },
+    [RL_USER_READ]      = { 100, 200 },
+    [RL_CHANNEL_READ]   = { 100, 200 },
+    [RL_CHANNELS_READ]  = {  40,  80 },
+    [RL_MESSAGE_CREATE] = {  30,  60 },
+    [RL_MESSAGE_READ]   = { 100, 200 },
+    [RL_MESSAGE_SYNC]   = {  40,  80 },
+    [RL_SEARCH]         = {  20,  40 },
+};
+
+int rate_op_for(uint8_t res_type, uint8_t crud) {
+    if (res_type == RES_USER     && crud == CRUD_CREATE) return RL_ACCOUNT_CREATE;
+    if (res_type == RES_USER     && crud == CRUD_UPDATE) return RL_LOGIN_LOGOUT;
+    if (res_type == RES_USER     && crud == CRUD_READ)   return RL_USER_READ;
+    if (res_type == RES_CHANNEL  && crud == CRUD_READ)   return RL_CHANNEL_READ;
+    if (res_type == RES_PRESENCE && crud == CRUD_READ)   return RL_CHANNEL_READ;
+    if (res_type == RES_CHANNELS && crud == CRUD_UPDATE) return RL_CHANNELS_READ;
+    if (res_type == RES_MESSAGE  && crud == CRUD_CREATE) return RL_MESSAGE_CREATE;
+    if (res_type == RES_MESSAGE  && crud == CRUD_READ)   return RL_MESSAGE_READ;
+    if (res_type == RES_MESSAGES && crud == CRUD_READ)   return RL_MESSAGE_SYNC;
+    if (res_type == RES_SEARCH   && crud == CRUD_READ)   return RL_SEARCH;
+    return -1;
+}
+
+// ===========================================================================
+// GCRA token bucket
+// ===========================================================================
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Each admitted request pushes the bucket's theoretical arrival time one
+// emission interval forward; the request is refused once that time runs
+// more than `burst` intervals ahead of now.
+static int bucket_admit(_Atomic uint64_t *tat, const RateRule *r) {
+    if (r->per_sec == 0) return 1;
+
+    uint64_t interval = 1000000000ull / r->per_sec;
+    uint64_t limit    = interval * (r->burst ? r->burst : 1);
+    uint64_t now      = mono_ns();
+    uint64_t old      = atomic_load_explicit(tat, memory_order_relaxed);
+
+    for (;;) {
+        uint64_t next = (old > now ? old : now) + interval;
+        if (next - now > limit) return 0;
+        if (atomic_compare_exchange_weak_explicit(tat, &old, next,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+            return 1;
+    }
+}
+
+int rate_admit_conn(RateBuckets *b, int op) {
+    return bucket_admit(&b->tat[op], &rate_conn_rules[op]);
+}
+
+// ===========================================================================
+// Per-user buckets
+//
+// Slots are claimed by CAS on the key and never released, so lookups never
+// take a lock. If the probe window is full the user shares the home slot's
+// buckets, which can only make the limit stricter, never looser.
+// ===========================================================================
+
+typedef struct {
+    _Atomic uint64_t key;   // username hash | 1; 0 = free
+    RateBuckets      buckets;
+} UserBucketSlot;
+
+static UserBucketSlot user_slots[RATE_USER_SLOTS];
+
+static uint64_t username_hash(const char username[16]) {
+    uint64_t h = 1469598103934665603ull;   // FNV-1a
+    for (int i = 0; i < 16 && username[i]; i++) {
+        h ^= (uint8_t)username[i];
+        h *= 1099511628211ull;
+    }
+    return h | 1;
+}
+
+static RateBuckets *user_buckets(const char username[16]) {
+    uint64_t key  = username_hash(username);
+    uint32_t home = (uint32_t)(key >> 20) % RATE_USER_SLOTS;
+
+    for (uint32_t i = 0; i < RATE_USER_PROBE; i++) {
+        UserBucketSlot *s = &user_slots[(home + i) % RATE_USER_SLOTS];
+        uint64_t cur = atomic_load_explicit(&s->key, memory_order_acquire);
+        if (cur == key) return &s->buckets;
+        if (cur == 0) {
+            uint64_t expected = 0;
+            if (atomic_compare_exchange_strong(&s->key, &expected, key) ||
+                expected == key)
+                return &s->buckets;
+        }
+    }
+    return &user_slots[home].buckets;
+}
+
+int rate_admit_user(const char username[16], int op) {
+    if (rate_user_rules[op].per_sec == 0) return 1;
+    return bucket_admit(&user_buckets(username)->tat[op], &rate_user_rules[op]);
+}
@@ -0,0 +1,59 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_RATELIMIT_H
+#define COMP4985_RATELIMIT_H
+
+#include "protocol.h"
+#include <stdatomic.h>
+
+// ---------------------------------------------------------------------------
+// Rate-limited operations — one bucket per resource/CRUD pair a client can
+// send. Anything not listed here is never limited.
+// ---------------------------------------------------------------------------
+typedef enum {
+    RL_ACCOUNT_CREATE = 0,   // res=00010 crud=00
+    RL_LOGIN_LOGOUT,         // res=00010 crud=10
+    RL_USER_READ,            // res=00010 crud=01
+    RL_CHANNEL_READ,         // res=00100 crud=01
+    RL_CHANNELS_READ,        // res=00101 crud=10
+    RL_MESSAGE_CREATE,       // res=00110 crud=00
+    RL_MESSAGE_READ,         // res=00110 crud=01
+    RL_MESSAGE_SYNC,         // res=00111 crud=01
+    RL_SEARCH,               // res=01010 crud=01
+    RL_OPS
+} RateOp;
+
+// per_sec = sustained rate, burst = how many may arrive back to back.
+// per_sec = 0 disables the limit.
+typedef struct {
+    uint32_t per_sec;
+    uint32_t burst;
+} RateRule;
+
+extern RateRule rate_conn_rules[RL_OPS];   // per connection
+extern RateRule rate_user_rules[RL_OPS];   // per logged-in user, all connections
+
+// ---------------------------------------------------------------------------
+// Token bucket state
+//
+// Each bucket is a single atomic word holding its theoretical arrival time
+// (GCRA), so admitting a request is one CAS with no lock: a flooding client
+// only ever contends with itself.
+// ---------------------------------------------------------------------------
+typedef struct {
+    _Atomic uint64_t tat[RL_OPS];
+} RateBuckets;
+
+#define RATE_USER_SLOTS  4096   // per-user bucket table (open addressing)
+#define RATE_USER_PROBE  16
+
+// Maps a request type to its RateOp, or -1 if it is not limited.
+int rate_op_for(uint8_t res_type, uint8_t crud);
+
+// 1 = admitted, 0 = over the limit.
+int rate_admit_conn(RateBuckets *b, int op);
+int rate_admit_user(const char username[16], int op);
+
+#endif //COMP4985_RATELIMIT_H
@@ -0,0 +1,176 @@
+#include "protocol.h"
+#include "readmark.h"
+#include "idmap.h"
+
+// ===========================================================================
+// Tables
+// ===========================================================================
+
+typedef struct {
+    uint32_t channel_id;
+    uint64_t seq;
+} ReadMark;
+
+typedef struct {
+    ReadMark *marks;   // sorted by channel_id
+    uint32_t  count, cap;
+} UserMarks;
+
+typedef struct {
+    pthread_mutex_t lock;
+    IdMap           users;   // user_id → UserMarks *, never removed
+} MarkShard;
+
+static MarkShard shards[READMARK_SHARDS] = {
+    [0 ... READMARK_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+static MarkShard *shard_of(uint32_t user_id) {
+    return &shards[(id_hash(user_id) >> 16) % READMARK_SHARDS];
+}
+
+// Index of the first mark with channel_id >= channel_id
+static uint32_t mark_search(const UserMarks *u, uint32_t channel_id) {
+    uint32_t lo = 0, hi = u->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (u->marks[mid].channel_id < channel_id) lo = mid + 1;
+        else                                       hi = mid;
+    }
+    return lo;
+}
+
+// Caller holds s->lock. NULL if out of memory.
+static ReadMark *mark_get(MarkShard *s, uint32_t user_id, uint32_t channel_id) {
+    UserMarks *u = idmap_get(&s->users, user_id);
+    if (!u) {
+        if (!(u = calloc(1, sizeof(UserMarks)))) return NULL;
+        if (idmap_put(&s->users, user_id, u) < 0) {
+            free(u);
+            return NULL;
+        }
+    }
+
+    uint32_t i = mark_search(u, channel_id);
+    if (i < u->count && u->marks[i].channel_id == channel_id) return &u->marks[i];
+
+    if (u->count == u->cap) {
+        uint32_t  ncap = u->cap ? u->cap * 2 : 8;
+        ReadMark *n    = realloc(u->marks, ncap * sizeof(ReadMark));
+        if (!n) return NULL;
+        u->marks = n;
+        u->cap   = ncap;
+    }
+    memmove(u->marks + i + 1, u->marks + i, (u->count - i) * sizeof(ReadMark));
+    u->marks[i] = (ReadMark){ channel_id, 0 };
+    u->count++;
+    return &u->marks[i];
+}
+
+// Caller holds the shard lock, so the log never runs behind a snapshot
+static void mark_raise(ReadMark *m, uint32_t user_id, uint64_t seq) {
+    if (seq <= m->seq) return;
+    m->seq = seq;
+    PersistMark pm = { .user_id = user_id, .channel_id = m->channel_id, .seq = seq };
+    persist_log_mark(&pm);
+}
+
+// ===========================================================================
+// Markers
+// ===========================================================================
+
+void readmark_advance(uint32_t user_id, uint32_t channel_id, uint64_t seq) {
+    if (user_id == 0 || seq == 0) return;
+    MarkShard *s = shard_of(user_id);
+    pthread_mutex_lock(&s->lock);
+    ReadMark *m = mark_get(s, user_id, channel_id);
+    if (m) mark_raise(m, user_id, seq);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void readmark_advance_from(uint32_t user_id, uint32_t channel_id,
+                           uint64_t from, uint64_t seq)
+{
+    if (user_id == 0 || seq == 0) return;
+    MarkShard *s = shard_of(user_id);
+    pthread_mutex_lock(&s->lock);
+    ReadMark *m = mark_get(s, user_id, channel_id);
+    if (m && m->seq == from) mark_raise(m, user_id, seq);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void readmark_fill(uint32_t user_id, const uint32_t *channels, uint32_t n,
+                   uint64_t *out)
+{
+    MarkShard *s = shard_of(user_id);
+    pthread_mutex_lock(&s->lock);
+    UserMarks *u = user_id ? idmap_get(&s->users, user_id) : NULL;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t k = u ? mark_search(u, channels[i]) : 0;
+        out[i] = u && k < u->count && u->marks[k].channel_id == channels[i]
+                 ? u->marks[k].seq : 0;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+// ===========================================================================
+// Persistence
+// ===========================================================================
+
+void readmark_lock_all(void) {
+    for (uint32_t i = 0; i < READMARK_SHARDS; i++)
+        pthread_mutex_lock(&shards[i].lock);
+}
+
+void readmark_unlock_all(void) {
+    for (uint32_t i = READMARK_SHARDS; i-- > 0;)
+        pthread_mutex_unlock(&shards[i].lock);
+}
+
+// Section layout: uint64_t count, then count × PersistMark. Snapshots
+// written before markers existed end without it.
+int readmark_snapshot(SnapWriter *w) {
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < READMARK_SHARDS; i++)
+        for (uint32_t k = 0; k < shards[i].users.cap; k++) {
+            UserMarks *u = shards[i].users.slots[k].val;
+            if (u) count += u->count;
+        }
+    snap_write(w, &count, sizeof(count));
+
+    for (uint32_t i = 0; i < READMARK_SHARDS; i++)
+        for (uint32_t k = 0; k < shards[i].users.cap; k++) {
+            UserMarks *u = shards[i].users.slots[k].val;
+            for (uint32_t j = 0; u && j < u->count; j++) {
+                PersistMark pm = {
+                    .user_id    = shards[i].users.slots[k].key,
+                    .channel_id = u->marks[j].channel_id,
+                    .seq        = u->marks[j].seq
+                };
+                if (snap_write(w, &pm, sizeof(pm)) < 0) return -1;
+            }
+        }
+    return 0;
+}
+
+int readmark_load_snapshot(SnapReader *r) {
+    if (r->p == r->end) return 0;
+
+    uint64_t count;
+    if (snap_read(r, &count, sizeof(count)) < 0) return -1;
+    for (uint64_t i = 0; i < count; i++) {
+        PersistMark pm;
+        if (snap_read(r, &pm, sizeof(pm)) < 0) return -1;
+        readmark_restore(&pm);
+    }
+    return 0;
+}
+
+void readmark_restore(const PersistMark *pm) {
+    if (pm->user_id == 0) return;
+    MarkShard *s = shard_of(pm->user_id);
+    pthread_mutex_lock(&s->lock);
+    ReadMark *m = mark_get(s, pm->user_id, pm->channel_id);
+    if (m && pm->seq > m->seq) m->seq = pm->seq;
+    pthread_mutex_unlock(&s->lock);
+}
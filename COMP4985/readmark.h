@@ -0,0 +1,57 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_READMARK_H
+#define COMP4985_READMARK_H
+
+#include "protocol.h"
+#include "persist.h"
+
+// ---------------------------------------------------------------------------
+// Read markers
+//
+// For each account and channel, the highest seq the account has fetched.
+// Message Sync moves it up to since_seq and past every record it returns;
+// it never moves back. Channels Read turns the markers into unread counts
+// (HDR_FLAG_UNREAD), so a client only syncs channels that have something
+// new.
+//
+// Markers live on this server only: they are logged and snapshotted like
+// messages (not synced per update) but not replicated, so after a
+// failover a client at worst sees old messages counted as unread again.
+//
+// Users are spread over READMARK_SHARDS locks; each user's markers are a
+// small array sorted by channel ID.
+// ---------------------------------------------------------------------------
+#define READMARK_SHARDS  64
+
+// Raises user_id's marker for channel_id to seq (no-op if already there).
+void readmark_advance(uint32_t user_id, uint32_t channel_id, uint64_t seq);
+
+// As readmark_advance, but only if the marker is exactly at from: a
+// reader who was caught up stays caught up after posting.
+void readmark_advance_from(uint32_t user_id, uint32_t channel_id,
+                           uint64_t from, uint64_t seq);
+
+// Fills out[i] with user_id's marker for channels[i] (0 = nothing read).
+void readmark_fill(uint32_t user_id, const uint32_t *channels, uint32_t n,
+                   uint64_t *out);
+
+// ---------------------------------------------------------------------------
+// Persistence (see persist.h)
+// ---------------------------------------------------------------------------
+
+// Takes / releases every shard lock.
+void readmark_lock_all(void);
+void readmark_unlock_all(void);
+
+// Writes every marker to w. Caller holds all shard locks, or is the
+// snapshot child.
+int readmark_snapshot(SnapWriter *w);
+int readmark_load_snapshot(SnapReader *r);
+
+// Re-applies a logged marker during restore (not logged again).
+void readmark_restore(const PersistMark *pm);
+
+#endif //COMP4985_READMARK_H
@@ -0,0 +1,459 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+// replay — plays a capture file (see capture.h) back against a server:
+//
+//     ./untitled17 --config prod.conf --capture traffic.cap       (record)
+//     ./untitled17 --config bench.conf --data /tmp/empty           (target)
+//     ./replay traffic.cap 127.0.0.1 8001 --speed 4
+//
+// Every captured session gets its own connection and sends its frames
+// byte for byte, in order. With a numeric speed (1 = as recorded, 4 = four
+// times faster) sessions open and frames go out on the recorded schedule
+// whether or not earlier replies are back, so a slower server shows up as
+// latency rather than as a slower replay. With --speed max every session
+// starts at once and sends each frame as soon as the one before it is
+// answered; sessions no longer wait for each other then, so a login may
+// overtake the account creation it relied on.
+//
+// Replies are matched to the oldest unanswered request of the same
+// resource and CRUD. Message Create has no ACK: it is counted, and its
+// errors are, but it has no latency. Presence Updates are counted apart.
+// The sessions create accounts and channels as recorded, so point the
+// tool at a server with an empty data_dir.
+//
+// Prints, per operation: frames sent, replies, error statuses, latency
+// quantiles in µs (16 buckets per power of two, ≤7 % error) and the rate
+// over the wall-clock time of the replay.
+//
+#include "protocol.h"
+#include "capture.h"
+
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/tcp.h>
+#include <stdatomic.h>
+
+#define REPLAY_DRAIN_MS       5000   // how long to wait for outstanding replies
+#define REPLAY_MAX_PENDING    1024   // unanswered requests per session
+#define REPLAY_STACK_BYTES    (256u << 10)
+#define REPLAY_OPS            (32 * 4)   // resource_type × crud
+#define LAT_SUB_BITS          4
+#define LAT_BUCKETS           ((32 - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
+
+typedef struct {
+    uint64_t       t_us;
+    const uint8_t *bytes;     // header + payload, inside the mapped file
+    uint32_t       len;
+} Frame;
+
+typedef struct {
+    uint64_t  open_us, close_us;
+    Frame    *frames;
+    uint32_t  count, cap;
+    int       seen;
+    pthread_t tid;
+} Session;
+
+typedef struct {
+    _Atomic uint64_t sent, replies, errors;
+    _Atomic uint64_t lat[LAT_BUCKETS];
+} OpStats;
+
+static Session  *sessions;        // indexed by session number
+static uint32_t  nsessions;       // highest session number + 1
+static uint64_t  frames_total;
+static uint64_t  first_us, last_us;
+
+static double    speed = 1.0;     // 0 = max
+static uint64_t  start_us;        // when the replay began
+static struct sockaddr_in target;
+
+static OpStats          ops[REPLAY_OPS];
+static _Atomic uint64_t status_counts[256];
+static _Atomic uint64_t lost, pushes;
+static _Atomic uint32_t failed_sessions;
+
+static const char *const op_names[REPLAY_OPS] = {
+    [RES_SYSTEM   << 2 | CRUD_CREATE] = "system",
+    [RES_USER     << 2 | CRUD_CREATE] = "account_create",
+    [RES_USER     << 2 | CRUD_UPDATE] = "login_logout",
+    [RES_USER     << 2 | CRUD_READ]   = "user_read",
+    [RES_CHANNEL  << 2 | CRUD_READ]   = "channel_read",
+    [RES_CHANNELS << 2 | CRUD_UPDATE] = "channels_read",
+    [RES_MESSAGE  << 2 | CRUD_CREATE] = "message_create",
+    [RES_MESSAGE  << 2 | CRUD_READ]   = "message_read",
+    [RES_MESSAGES << 2 | CRUD_READ]   = "message_sync",
+    [RES_PRESENCE << 2 | CRUD_READ]   = "presence_read",
+    [RES_SEARCH   << 2 | CRUD_READ]   = "search",
+};
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+// When a capture timestamp falls due in this replay
+static uint64_t due_us(uint64_t t_us) {
+    return speed > 0 ? start_us + (uint64_t)((double)(t_us - first_us) / speed) : 0;
+}
+
+static void sleep_until(uint64_t t) {
+    for (uint64_t now; (now = now_us()) < t;) {
+        struct timespec ts = { .tv_sec  = (time_t)((t - now) / 1000000u),
+                               .tv_nsec = (long)((t - now) % 1000000u) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+// ===========================================================================
+// Latency histogram
+// ===========================================================================
+
+static uint32_t lat_bucket(uint64_t us) {
+    if (us > UINT32_MAX) us = UINT32_MAX;
+    if (us < (1u << LAT_SUB_BITS)) return (uint32_t)us;
+    int k = 63 - __builtin_clzll(us);
+    return ((uint32_t)(k - LAT_SUB_BITS + 1) << LAT_SUB_BITS) |
+           ((uint32_t)(us >> (k - LAT_SUB_BITS)) & ((1u << LAT_SUB_BITS) - 1));
+}
+
+// Upper bound of bucket b
+static uint64_t lat_upper(uint32_t b) {
+    if (b < (1u << LAT_SUB_BITS)) return b;
+    int      k   = (int)(b >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+    uint64_t sub = (1u << LAT_SUB_BITS) | (b & ((1u << LAT_SUB_BITS) - 1));
+    return ((sub + 1) << (k - LAT_SUB_BITS)) - 1;
+}
+
+static uint64_t lat_quantile(const uint64_t *lat, uint64_t total, double q) {
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)(total - 1)) + 1, seen = 0;
+    for (uint32_t b = 0; b < LAT_BUCKETS; b++)
+        if ((seen += lat[b]) >= rank) return lat_upper(b);
+    return lat_upper(LAT_BUCKETS - 1);
+}
+
+// ===========================================================================
+// Capture file
+// ===========================================================================
+
+static Session *session_get(uint32_t id) {
+    if (id >= nsessions) {
+        uint32_t n = nsessions ? nsessions : 64;
+        while (n <= id) n *= 2;
+        Session *s = realloc(sessions, n * sizeof(Session));
+        if (!s) return NULL;
+        memset(s + nsessions, 0, (n - nsessions) * sizeof(Session));
+        sessions  = s;
+        nsessions = n;
+    }
+    return &sessions[id];
+}
+
+static int load_capture(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const uint8_t *p = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    CaptureFileHeader fh;
+    if (p == MAP_FAILED || size < sizeof(fh) ||
+        (memcpy(&fh, p, sizeof(fh)), memcmp(fh.magic, CAPTURE_MAGIC, sizeof(fh.magic)) != 0) ||
+        fh.version != CAPTURE_VERSION) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        return -1;
+    }
+
+    const uint8_t *end = p + size;
+    int first = 1;
+    for (p += sizeof(fh); p < end;) {
+        CaptureRecord r;
+        if ((size_t)(end - p) < sizeof(r)) break;
+        memcpy(&r, p, sizeof(r));
+        if ((size_t)(end - p) - sizeof(r) < r.length) break;
+        p += sizeof(r);
+
+        Session *s = session_get(r.session);
+        if (!s) return -1;
+        if (!s->seen) s->open_us = r.t_us;
+        s->seen     = 1;
+        s->close_us = r.t_us;
+        if (first) first_us = r.t_us;
+        first   = 0;
+        last_us = r.t_us;
+
+        if (r.kind == CAPTURE_FRAME && r.length >= HEADER_SIZE) {
+            if (s->count == s->cap) {
+                uint32_t ncap = s->cap ? s->cap * 2 : 16;
+                Frame   *f    = realloc(s->frames, ncap * sizeof(Frame));
+                if (!f) return -1;
+                s->frames = f;
+                s->cap    = ncap;
+            }
+            s->frames[s->count++] = (Frame){ r.t_us, p, r.length };
+            frames_total++;
+        }
+        p += r.length;
+    }
+    if (p < end)
+        fprintf(stderr, "%s: ignoring a truncated record at the end\n", path);
+    return 0;
+}
+
+// ===========================================================================
+// Sessions
+// ===========================================================================
+
+typedef struct {
+    uint8_t  op;
+    uint64_t sent_us;
+} Pending;
+
+static int send_all(int fd, const uint8_t *p, uint32_t n) {
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w;
+        n -= (uint32_t)w;
+    }
+    return 0;
+}
+
+static int recv_frame(int fd, GlobalHeader *h, uint8_t *buf) {
+    uint8_t raw[HEADER_SIZE];
+    if (recv(fd, raw, HEADER_SIZE, MSG_WAITALL) != HEADER_SIZE) return -1;
+    header_decode(h, raw);
+    uint32_t len = h->message_length;
+    if (len > BUFFER_SIZE) return -1;
+    if (len && recv(fd, buf, len, MSG_WAITALL) != (ssize_t)len) return -1;
+    return 0;
+}
+
+static void on_reply(const GlobalHeader *h, Pending *pend, uint32_t *npend) {
+    if (h->ack && h->resource_type == RES_PRESENCE && h->crud == CRUD_UPDATE) {
+        atomic_fetch_add(&pushes, 1);
+        return;
+    }
+    uint8_t  op = (uint8_t)((h->resource_type & 31) << 2 | (h->crud & 3));
+    OpStats *o  = &ops[op];
+    if (h->status != STATUS_OK) {
+        atomic_fetch_add(&o->errors, 1);
+        atomic_fetch_add(&status_counts[h->status], 1);
+    }
+
+    for (uint32_t i = 0; i < *npend; i++) {
+        if (pend[i].op != op) continue;
+        atomic_fetch_add(&o->lat[lat_bucket(now_us() - pend[i].sent_us)], 1);
+        atomic_fetch_add(&o->replies, 1);
+        memmove(pend + i, pend + i + 1, (*npend - i - 1) * sizeof(Pending));
+        (*npend)--;
+        return;
+    }
+}
+
+// Waits until t for one reply and handles it: 1 if one came, 0 at t, -1
+// once the connection has ended
+static int read_one(int fd, uint64_t t, Pending *pend, uint32_t *npend, uint8_t *buf) {
+    for (;;) {
+        uint64_t now = now_us();
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int rc = poll(&pfd, 1, t > now ? (int)((t - now + 999) / 1000) : 0);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc < 0) return -1;
+        if (rc == 0) return 0;
+
+        GlobalHeader h;
+        if (recv_frame(fd, &h, buf) < 0) return -1;
+        on_reply(&h, pend, npend);
+        return 1;
+    }
+}
+
+static void *session_thread(void *arg) {
+    const Session *s = arg;
+    Pending  pend[REPLAY_MAX_PENDING];
+    uint32_t npend = 0, next = 0;
+    uint8_t  buf[BUFFER_SIZE];
+    int      rc = 0;
+
+    sleep_until(due_us(s->open_us));
+    int fd  = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    if (fd < 0 || connect(fd, (struct sockaddr *)&target, sizeof(target)) < 0) {
+        if (fd >= 0) close(fd);
+        atomic_fetch_add(&failed_sessions, 1);
+        atomic_fetch_add(&lost, s->count);
+        return NULL;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    uint64_t last_send = now_us();
+    while (rc >= 0 && next < s->count) {
+        // Everything that is due: on schedule, or (max) once all is answered
+        while (next < s->count && npend < REPLAY_MAX_PENDING &&
+               (speed > 0 ? due_us(s->frames[next].t_us) <= now_us() : npend == 0)) {
+            const Frame *f = &s->frames[next];
+            GlobalHeader h;
+            header_decode(&h, f->bytes);
+            if (send_all(fd, f->bytes, f->len) < 0) {
+                rc = -1;
+                break;
+            }
+            uint8_t op = (uint8_t)(h.resource_type << 2 | h.crud);
+            atomic_fetch_add(&ops[op].sent, 1);
+            last_send = now_us();
+            if (!(h.resource_type == RES_MESSAGE && h.crud == CRUD_CREATE))
+                pend[npend++] = (Pending){ op, last_send };
+            next++;
+        }
+        if (rc < 0 || next == s->count) break;
+
+        // Otherwise the next frame's time, or a reply (max, or too far behind)
+        int waiting = !(speed > 0 && npend < REPLAY_MAX_PENDING);
+        rc = read_one(fd, waiting ? last_send + REPLAY_DRAIN_MS * 1000u
+                                  : due_us(s->frames[next].t_us),
+                      pend, &npend, buf);
+        if (rc == 0 && waiting) {
+            atomic_fetch_add(&lost, npend);   // give up on them and go on
+            npend = 0;
+        }
+    }
+
+    // Stay as long as the recorded session did, then half-close and read
+    // until the server hangs up: it answers in order, so every reply and
+    // error still owed arrives before its FIN
+    while (rc >= 0 && speed > 0 && (rc = read_one(fd, due_us(s->close_us), pend, &npend, buf)) > 0) {}
+    if (rc >= 0) {
+        shutdown(fd, SHUT_WR);
+        uint64_t until = now_us() + REPLAY_DRAIN_MS * 1000u;
+        while (read_one(fd, until, pend, &npend, buf) > 0) {}
+    }
+
+    atomic_fetch_add(&lost, npend + (s->count - next));
+    close(fd);
+    return NULL;
+}
+
+// ===========================================================================
+// Report
+// ===========================================================================
+
+static void report_row(const char *name, uint64_t sent, uint64_t replies,
+                       uint64_t errors, const uint64_t *lat, double secs)
+{
+    printf("%-16s %9llu %9llu %7llu", name, (unsigned long long)sent,
+           (unsigned long long)replies, (unsigned long long)errors);
+    if (replies)
+        printf(" %8llu %8llu %8llu %8llu",
+               (unsigned long long)lat_quantile(lat, replies, 0.50),
+               (unsigned long long)lat_quantile(lat, replies, 0.90),
+               (unsigned long long)lat_quantile(lat, replies, 0.99),
+               (unsigned long long)lat_quantile(lat, replies, 1.0));
+    else
+        printf(" %8s %8s %8s %8s", "-", "-", "-", "-");
+    printf(" %9.1f\n", secs > 0 ? (double)sent / secs : 0.0);
+}
+
+static void report(double secs) {
+    static uint64_t all[LAT_BUCKETS];
+    uint64_t sent = 0, replies = 0, errors = 0;
+
+    printf("\n%-16s %9s %9s %7s %8s %8s %8s %8s %9s\n", "operation", "sent",
+           "replies", "errors", "p50 us", "p90 us", "p99 us", "max us", "per sec");
+    for (int op = 0; op < REPLAY_OPS; op++) {
+        OpStats *o = &ops[op];
+        uint64_t s = atomic_load(&o->sent), r = atomic_load(&o->replies),
+                 e = atomic_load(&o->errors);
+        if (!s && !r && !e) continue;
+
+        uint64_t lat[LAT_BUCKETS];
+        for (uint32_t b = 0; b < LAT_BUCKETS; b++) {
+            lat[b]  = atomic_load(&o->lat[b]);
+            all[b] += lat[b];
+        }
+        char other[24];
+        snprintf(other, sizeof(other), "res=%d crud=%d", op >> 2, op & 3);
+        report_row(op_names[op] ? op_names[op] : other, s, r, e, lat, secs);
+        sent += s; replies += r; errors += e;
+    }
+    report_row("total", sent, replies, errors, all, secs);
+
+    printf("\n%.2f s, %llu unanswered or unsent, %llu presence updates",
+           secs, (unsigned long long)atomic_load(&lost),
+           (unsigned long long)atomic_load(&pushes));
+    if (atomic_load(&failed_sessions))
+        printf(", %u sessions could not connect", atomic_load(&failed_sessions));
+    printf("\n");
+
+    int any = 0;
+    for (int st = 0; st < 256; st++) {
+        uint64_t n = atomic_load(&status_counts[st]);
+        if (!n) continue;
+        printf("%s0x%02X ×%llu", any ? "  " : "error statuses: ", st, (unsigned long long)n);
+        any = 1;
+    }
+    if (any) printf("\n");
+}
+
+// ===========================================================================
+// main
+// ===========================================================================
+
+int main(int argc, char *argv[]) {
+    if (argc != 4 && !(argc == 6 && strcmp(argv[4], "--speed") == 0)) {
+        fprintf(stderr, "Usage: %s <capture> <host> <port> [--speed <N>|max]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 6) {
+        char *endp;
+        speed = strcmp(argv[5], "max") == 0 ? 0 : strtod(argv[5], &endp);
+        if (strcmp(argv[5], "max") != 0 && (*endp || speed <= 0)) {
+            fprintf(stderr, "Bad speed: %s\n", argv[5]);
+            return 1;
+        }
+    }
+
+    target.sin_family = AF_INET;
+    target.sin_port   = htons((uint16_t)atoi(argv[3]));
+    if (inet_pton(AF_INET, argv[2], &target.sin_addr) != 1) {
+        fprintf(stderr, "Bad address: %s\n", argv[2]);
+        return 1;
+    }
+    if (load_capture(argv[1]) < 0) return 1;
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < nsessions; i++) count += sessions[i].seen;
+    char pace[32];
+    if (speed > 0) snprintf(pace, sizeof(pace), "%gx", speed);
+    else           snprintf(pace, sizeof(pace), "max");
+    printf("%u sessions, %llu frames over %.1f s recorded; replaying at %s\n",
+           count, (unsigned long long)frames_total,
+           (double)(last_us - first_us) / 1e6, pace);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, REPLAY_STACK_BYTES);
+    start_us = now_us();
+    for (uint32_t i = 0; i < nsessions; i++)
+        if (sessions[i].seen &&
+            pthread_create(&sessions[i].tid, &attr, session_thread, &sessions[i]) != 0) {
+            fprintf(stderr, "Cannot start session %u\n", i);
+            sessions[i].seen = 0;
+            atomic_fetch_add(&failed_sessions, 1);
+        }
+    for (uint32_t i = 0; i < nsessions; i++)
+        if (sessions[i].seen) pthread_join(sessions[i].tid, NULL);
+
+    report((double)(now_us() - start_us) / 1e6);
+    return 0;
+}
@@ -0,0 +1,388 @@
+#include "protocol.h"
+#include "logsink.h"
+#include "manager.h"
+#include "replicate.h"
+#include "store.h"
+#include "directory.h"
+#include "metrics.h"
+#include "affinity.h"
+#include "stats.h"
+
+// ===========================================================================
+// Sender state
+// ===========================================================================
+
+// One per-channel mark from a peer's Replica Sync
+typedef struct {
+    uint8_t  origin_id;
+    uint32_t channel_id;
+    uint64_t seq;
+} ChannelMark;
+
+// What a peer asked for in Replica Sync. Channel marks are sorted by
+// (origin, channel) for lookup; anything absent counts as 0.
+typedef struct {
+    uint8_t      requester_id;
+    uint64_t     dir_marks[256];
+    ChannelMark *ch_marks;
+    uint32_t     ch_mark_count;
+} ResyncJob;
+
+static pthread_mutex_t repl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t  *shipped;        // by channel creation index: local seq handed to the link
+static uint32_t   shipped_cap;
+static uint64_t   shipped_total;  // sum of shipped[], for the backlog metric
+static uint64_t   dir_shipped;    // journal position handed to the link
+static ResyncJob *pending_resync;
+
+static _Atomic int      gap_seen;       // a record was dropped past a gap
+static _Atomic uint64_t last_sync_us;   // when Replica Sync was last sent
+
+static int cmp_mark(const void *a, const void *b) {
+    const ChannelMark *x = a, *y = b;
+    if (x->origin_id != y->origin_id) return x->origin_id < y->origin_id ? -1 : 1;
+    return x->channel_id < y->channel_id ? -1 : x->channel_id > y->channel_id;
+}
+
+static uint64_t job_mark(const ResyncJob *job, uint8_t origin_id, uint32_t channel_id) {
+    ChannelMark key = { .origin_id = origin_id, .channel_id = channel_id };
+    const ChannelMark *m = bsearch(&key, job->ch_marks, job->ch_mark_count,
+                                   sizeof(ChannelMark), cmp_mark);
+    return m ? m->seq : 0;
+}
+
+static void job_free(ResyncJob *job) {
+    if (!job) return;
+    free(job->ch_marks);
+    free(job);
+}
+
+// Makes room for a cursor per existing channel; new ones start at 0.
+// Returns the number of channels covered. Caller holds repl_mutex.
+static uint32_t shipped_reserve(void) {
+    uint32_t n = store_channel_count();
+    if (n > shipped_cap) {
+        uint32_t ncap = shipped_cap ? shipped_cap : 64;
+        while (ncap < n) ncap *= 2;
+        uint64_t *grown = realloc(shipped, ncap * sizeof(uint64_t));
+        if (!grown) return shipped_cap;
+        memset(grown + shipped_cap, 0, (ncap - shipped_cap) * sizeof(uint64_t));
+        shipped     = grown;
+        shipped_cap = ncap;
+    }
+    return n;
+}
+
+// ===========================================================================
+// Shipping
+// ===========================================================================
+
+// Ships messages of one channel from `origin` with origin_seq > since,
+// advancing *pos. Returns -1 if the link dropped (pos stays at the last
+// batch that made it out).
+static int ship_messages(uint32_t channel_id, int origin, uint64_t since,
+                         uint64_t *pos, uint8_t *buf)
+{
+    while (store_head_seq(channel_id) > *pos) {
+        uint64_t next  = *pos;
+        uint16_t count = 0;
+        uint32_t used  = store_collect(channel_id, origin, since, &next,
+                                       REPL_BATCH_RECORDS,
+                                       buf + REPLICA_BATCH_SIZE,
+                                       BUFFER_SIZE - REPLICA_BATCH_SIZE,
+                                       &count);
+        if (count > 0) {
+            ReplicaBatchHeader bh = {
+                .origin_server_id = origin == STORE_ORIGIN_LOCAL ? my_server_id
+                                                                 : (uint8_t)origin,
+                .record_count     = count
+            };
+            replica_batch_encode(&bh, buf);
+            if (send_to_manager(RES_REPLICATE, CRUD_CREATE, buf,
+                                REPLICA_BATCH_SIZE + used) < 0)
+                return -1;
+        }
+        if (next == *pos) break;
+        *pos = next;
+    }
+    return 0;
+}
+
+// Same for the directory journal.
+static int ship_directory(int origin, uint64_t since, uint64_t *pos, uint8_t *buf) {
+    DirectoryRecord recs[REPL_BATCH_RECORDS];
+
+    while (directory_journal_head() > *pos) {
+        uint64_t next  = *pos;
+        uint32_t count = directory_collect(origin, since, &next, recs, REPL_BATCH_RECORDS);
+        if (count > 0) {
+            ReplicaBatchHeader bh = {
+                .origin_server_id = origin == DIR_ORIGIN_LOCAL ? my_server_id
+                                                               : (uint8_t)origin,
+                .record_count     = (uint16_t)count
+            };
+            uint32_t used = replica_batch_encode(&bh, buf);
+            for (uint32_t i = 0; i < count; i++)
+                used += directory_record_encode(&recs[i], buf + used);
+            if (send_to_manager(RES_REPLICATE, CRUD_UPDATE, buf, used) < 0)
+                return -1;
+        }
+        *pos = next;
+    }
+    return 0;
+}
+
+// Ships this server's messages of the channel at creation index i.
+static int ship_local(uint32_t i, uint8_t *buf) {
+    uint64_t before = shipped[i];
+    int rc = ship_messages(store_channel_id_at(i), STORE_ORIGIN_LOCAL, 0, &shipped[i], buf);
+    shipped_total += shipped[i] - before;
+    return rc;
+}
+
+// Answers a peer's Replica Sync: rewind our own cursors to its marks (the
+// local pass then re-ships from there), then forward what we hold from
+// third-party origins it has not seen.
+static int run_resync(ResyncJob *job, uint8_t *buf) {
+    uint32_t nch = shipped_reserve();
+    for (uint32_t i = 0; i < nch; i++) {
+        uint64_t mark = job_mark(job, my_server_id, store_channel_id_at(i));
+        if (shipped[i] <= mark) continue;
+        shipped_total -= shipped[i] - mark;
+        shipped[i]     = mark;
+        store_mark_dirty(STORE_DIRTY_REPLICATE, i);
+    }
+    if (dir_shipped > job->dir_marks[my_server_id])
+        dir_shipped = job->dir_marks[my_server_id];
+
+    // Directory first, so the requester knows a user before their messages
+    for (int o = 1; o < 256; o++) {
+        if (o == my_server_id || o == job->requester_id) continue;
+        if (directory_applied_seq((uint8_t)o) <= job->dir_marks[o]) continue;
+        uint64_t pos = 0;
+        if (ship_directory(o, job->dir_marks[o], &pos, buf) < 0) return -1;
+    }
+
+    // Then each channel, visiting only the origins it holds replicas from
+    StoreOriginMark held[256];
+    for (uint32_t i = 0; i < nch; i++) {
+        uint32_t ch = store_channel_id_at(i);
+        uint32_t nh = store_applied_marks(ch, held);
+        for (uint32_t k = 0; k < nh; k++) {
+            uint8_t o = held[k].origin_id;
+            if (o == 0 || o == my_server_id || o == job->requester_id) continue;
+            uint64_t mark = job_mark(job, o, ch);
+            if (held[k].seq <= mark) continue;
+            uint64_t pos = 0;
+            if (ship_messages(ch, o, mark, &pos, buf) < 0) return -1;
+        }
+    }
+    return 0;
+}
+
+// Ships every channel with new local messages. On a link drop the
+// channel being shipped and the rest of the batch go back on the queue.
+static int ship_dirty(uint8_t *buf) {
+    uint32_t idx[REPL_BATCH_RECORDS], n;
+    do {
+        n = store_take_dirty(STORE_DIRTY_REPLICATE, idx, REPL_BATCH_RECORDS);
+        uint32_t nch = shipped_reserve();
+        for (uint32_t k = 0; k < n; k++) {
+            if (idx[k] < nch && ship_local(idx[k], buf) == 0) continue;
+            for (; k < n; k++) store_mark_dirty(STORE_DIRTY_REPLICATE, idx[k]);
+            return -1;
+        }
+    } while (n == REPL_BATCH_RECORDS);
+    return 0;
+}
+
+void* replication_thread(void *arg) {
+    (void)arg;
+    affinity_enter(AFF_REPLICATION);
+    uint8_t *buf = NULL;
+
+    while (1) {
+        usleep(REPL_FLUSH_MS * 1000);
+
+        // Backlog = log entries the local pass has not scanned yet
+        uint64_t heads = atomic_load(&store_head_total);
+        pthread_mutex_lock(&repl_mutex);
+        metric_set(METRIC_REPL_BACKLOG, heads > shipped_total ? heads - shipped_total : 0);
+        pthread_mutex_unlock(&repl_mutex);
+
+        if (!atomic_load(&manager_connected) || atomic_load(&my_server_id) == 0) continue;
+        if (atomic_load(&gap_seen) &&
+            stats_now_us() - atomic_load(&last_sync_us) >= REPL_RESYNC_MS * 1000u) {
+            atomic_store(&gap_seen, 0);
+            replication_request_sync();
+        }
+        if (!buf && !(buf = malloc(BUFFER_SIZE))) continue;   // retried next round
+
+        pthread_mutex_lock(&repl_mutex);
+        ResyncJob *job = pending_resync;
+        pending_resync = NULL;
+        int ok = 1;
+
+        if (job) {
+            ok = run_resync(job, buf) == 0;
+            if (ok) {
+                manager_log("[REPLICA] Re-shipped state for server 0x%02X", job->requester_id);
+                job_free(job);
+            } else if (!pending_resync) {
+                pending_resync = job;   // retry once the link is back
+            } else {
+                job_free(job);
+            }
+        }
+
+        // Directory first, so peers know a user before their messages arrive
+        if (ok) ok = ship_directory(DIR_ORIGIN_LOCAL, 0, &dir_shipped, buf) == 0;
+        if (ok) ship_dirty(buf);
+        pthread_mutex_unlock(&repl_mutex);
+    }
+    free(buf);
+    return NULL;
+}
+
+// ===========================================================================
+// Replica Sync
+// ===========================================================================
+
+// SEND: res=01000  crud=01  ack=0
+void replication_request_sync(void) {
+    uint8_t *buf = malloc(BUFFER_SIZE);
+    if (!buf) return;
+    atomic_store(&last_sync_us, stats_now_us());
+
+    uint32_t max  = (BUFFER_SIZE - REPLICA_SYNC_SIZE) / REPLICA_MARK_SIZE;
+    uint32_t n    = 0;
+    uint32_t nch  = store_channel_count();
+    if (max > UINT16_MAX) max = UINT16_MAX;   // mark_count is 16 bits
+    uint8_t *out  = buf + REPLICA_SYNC_SIZE;
+
+    // Only non-zero marks are sent; anything left out counts as 0, which
+    // at worst re-ships records the peer will drop as duplicates
+    for (int o = 1; o < 256 && n < max; o++) {
+        uint64_t d = directory_applied_seq((uint8_t)o);
+        if (!d) continue;
+        ReplicaMark m = { .origin_server_id = (uint8_t)o,
+                          .stream           = REPL_STREAM_DIRECTORY,
+                          .applied_seq      = d };
+        out += replica_mark_encode(&m, out);
+        n++;
+    }
+    StoreOriginMark held[256];
+    for (uint32_t i = 0; i < nch && n < max; i++) {
+        uint32_t ch = store_channel_id_at(i);
+        uint32_t nh = store_applied_marks(ch, held);
+        for (uint32_t k = 0; k < nh && n < max; k++) {
+            if (held[k].origin_id == 0) continue;
+            ReplicaMark m = { .origin_server_id = held[k].origin_id,
+                              .stream           = REPL_STREAM_CHANNEL,
+                              .channel_id       = ch,
+                              .applied_seq      = held[k].seq };
+            out += replica_mark_encode(&m, out);
+            n++;
+        }
+    }
+
+    ReplicaSyncHeader sh = {
+        .requester_id = my_server_id,
+        .mark_count   = (uint16_t)n
+    };
+    replica_sync_encode(&sh, buf);
+    send_to_manager(RES_REPLICATE, CRUD_READ, buf, (uint32_t)(out - buf));
+    manager_log("[REPLICA] Sync requested (%u marks)", n);
+    free(buf);
+}
+
+// RECV: res=01000  crud=01  ack=0
+void handle_replica_sync(uint8_t *buf, uint32_t len) {
+    ReplicaSyncHeader sh;
+    if (replica_sync_decode(&sh, buf, len) < 0) return;
+    if (sh.requester_id == my_server_id) return;
+
+    ResyncJob *job = calloc(1, sizeof(ResyncJob));
+    if (!job) return;
+    job->requester_id = sh.requester_id;
+
+    uint16_t n = sh.mark_count;
+    if (n > 0 && !(job->ch_marks = calloc(n, sizeof(ChannelMark)))) {
+        free(job);
+        return;
+    }
+    uint32_t off = REPLICA_SYNC_SIZE;
+    for (uint16_t i = 0; i < n; i++) {
+        ReplicaMark m;
+        if (replica_mark_decode(&m, buf + off, len - off) < 0) break;
+        off += REPLICA_MARK_SIZE;
+        if (m.stream == REPL_STREAM_DIRECTORY)
+            job->dir_marks[m.origin_server_id] = m.applied_seq;
+        else
+            job->ch_marks[job->ch_mark_count++] = (ChannelMark){
+                .origin_id  = m.origin_server_id,
+                .channel_id = m.channel_id,
+                .seq        = m.applied_seq
+            };
+    }
+    if (job->ch_mark_count)
+        qsort(job->ch_marks, job->ch_mark_count, sizeof(ChannelMark), cmp_mark);
+
+    pthread_mutex_lock(&repl_mutex);
+    job_free(pending_resync);
+    pending_resync = job;
+    pthread_mutex_unlock(&repl_mutex);
+}
+
+// ===========================================================================
+// Batches
+// ===========================================================================
+
+// RECV: res=01000  crud=00  ack=0
+void handle_replica_batch(uint8_t *buf, uint32_t len) {
+    ReplicaBatchHeader bh;
+    if (replica_batch_decode(&bh, buf, len) < 0) return;
+    if (bh.origin_server_id == my_server_id) return;   // our own, echoed back
+
+    uint32_t off = REPLICA_BATCH_SIZE;
+    int applied = 0, dup = 0, gap = 0;
+
+    for (uint16_t i = 0; i < bh.record_count; i++) {
+        ReplicaRecord rec;
+        if (replica_record_decode(&rec, buf + off, len - off) < 0) break;
+        off += REPLICA_RECORD_SIZE;
+        if (len - off < rec.message_length) break;
+
+        int rc = store_apply_replica(bh.origin_server_id, &rec, (const char *)(buf + off));
+        if (rc > 0) applied++;
+        else if (rc == 0) dup++;
+        else gap++;
+        off += rec.message_length;
+    }
+    if (gap) atomic_store(&gap_seen, 1);
+
+    manager_log("[REPLICA] From server 0x%02X: %d applied, %d duplicate, %d past a gap",
+                bh.origin_server_id, applied, dup, gap);
+}
+
+// RECV: res=01000  crud=10  ack=0
+void handle_directory_batch(uint8_t *buf, uint32_t len) {
+    ReplicaBatchHeader bh;
+    if (replica_batch_decode(&bh, buf, len) < 0) return;
+    if (bh.origin_server_id == my_server_id) return;
+
+    uint32_t off = REPLICA_BATCH_SIZE;
+    int applied = 0, gap = 0;
+    for (uint16_t i = 0; i < bh.record_count; i++) {
+        DirectoryRecord rec;
+        if (directory_record_decode(&rec, buf + off, len - off) < 0) break;
+        off += DIRECTORY_RECORD_SIZE;
+        int rc = directory_apply_replica(bh.origin_server_id, &rec);
+        if (rc > 0) applied++;
+        else if (rc < 0) gap++;
+    }
+    if (gap) atomic_store(&gap_seen, 1);
+
+    manager_log("[REPLICA] Directory from server 0x%02X: %d applied, %d past a gap",
+                bh.origin_server_id, applied, gap);
+}
@@ -0,0 +1,44 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_REPLICATE_H
+#define COMP4985_REPLICATE_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Replication through the manager link
+//
+// A background thread ships every locally stored message (Replica Batch)
+// and every local directory change (Directory Batch) to the manager, which
+// relays them to the other servers. Cursors only advance once a batch is
+// handed to the link, so after a reconnect the gap is re-sent and peers
+// drop what they already have (high-water mark per origin server).
+//
+// A server that has just registered sends Replica Sync with the marks it
+// already holds; every peer then re-ships whatever the newcomer is missing,
+// including what the peer itself received from other origins. That is how
+// a standby catches up with state written before it started.
+//
+// A received record that does not follow on from what is held (its
+// prev_seq is missing) is dropped, and the server sends Replica Sync
+// again, at most every REPL_RESYNC_MS: the peers then re-ship from the
+// marks, gap included.
+// ---------------------------------------------------------------------------
+#define REPL_FLUSH_MS       50    // batching window
+#define REPL_BATCH_RECORDS  256   // records per frame at most
+#define REPL_RESYNC_MS      2000  // least time between two Replica Syncs
+
+// Replication sender loop — started once from main
+void* replication_thread(void *arg);
+
+// SEND Replica Sync — called once the manager has assigned our server_id
+void replication_request_sync(void);
+
+// RECV from the manager (all res=01000, ack=0)
+void handle_replica_batch(uint8_t *buf, uint32_t len);     // crud=00
+void handle_directory_batch(uint8_t *buf, uint32_t len);   // crud=10
+void handle_replica_sync(uint8_t *buf, uint32_t len);      // crud=01
+
+#endif //COMP4985_REPLICATE_H
@@ -0,0 +1,412 @@
+#include "protocol.h"
+#include "search.h"
+#include "store.h"
+#include "idmap.h"
+#include "metrics.h"
+#include "affinity.h"
+
+// Messages are copied out of the store this much at a time; always enough
+// for one message of the largest size
+#define SEARCH_BATCH_BYTES (4 * SYNC_RESPONSE_MAX)
+
+// ===========================================================================
+// Posting lists
+// ===========================================================================
+
+typedef struct {
+    uint64_t seq;   // first entry of the block
+    uint32_t off;   // where the block's remaining deltas start in bytes
+} PostingSkip;
+
+typedef struct {
+    uint8_t     *bytes;   // LEB128 deltas, except each block's first entry
+    uint32_t     len, cap;
+    PostingSkip *skips;   // one per SEARCH_BLOCK entries
+    uint32_t     nskips, skip_cap;
+    uint32_t     count;
+    uint64_t     last;
+} Posting;
+
+// Appends seq (increasing). Returns the bytes of memory added, -1 if out
+// of memory. A word repeated in one message is only listed once.
+static int posting_add(Posting *p, uint64_t seq) {
+    if (p->count && seq <= p->last) return 0;
+
+    int added = 0;
+    if (p->count % SEARCH_BLOCK == 0) {
+        if (p->nskips == p->skip_cap) {
+            uint32_t     ncap = p->skip_cap ? p->skip_cap * 2 : 1;
+            PostingSkip *n    = realloc(p->skips, ncap * sizeof(PostingSkip));
+            if (!n) return -1;
+            added += (int)((ncap - p->skip_cap) * sizeof(PostingSkip));
+            p->skips    = n;
+            p->skip_cap = ncap;
+        }
+        p->skips[p->nskips++] = (PostingSkip){ seq, p->len };
+    } else {
+        if (p->len + 10 > p->cap) {
+            uint32_t ncap = p->cap ? p->cap * 2 : 16;
+            uint8_t *n    = realloc(p->bytes, ncap);
+            if (!n) return -1;
+            added += (int)(ncap - p->cap);
+            p->bytes = n;
+            p->cap   = ncap;
+        }
+        uint64_t d = seq - p->last;
+        while (d >= 0x80) {
+            p->bytes[p->len++] = (uint8_t)(d | 0x80);
+            d >>= 7;
+        }
+        p->bytes[p->len++] = (uint8_t)d;
+    }
+    p->last = seq;
+    p->count++;
+    return added;
+}
+
+// Decodes block b into out (SEARCH_BLOCK entries). Returns the count.
+static uint32_t posting_block(const Posting *p, uint32_t b, uint64_t *out) {
+    uint32_t off = p->skips[b].off;
+    uint32_t end = b + 1 < p->nskips ? p->skips[b + 1].off : p->len;
+    uint64_t seq = p->skips[b].seq;
+    uint32_t n   = 0;
+
+    out[n++] = seq;
+    while (off < end) {
+        uint64_t d = 0;
+        int shift  = 0;
+        uint8_t byte;
+        do {
+            byte   = p->bytes[off++];
+            d     |= (uint64_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        seq     += d;
+        out[n++] = seq;
+    }
+    return n;
+}
+
+// Last block whose first entry is <= seq, -1 if there is none
+static int64_t posting_find_block(const Posting *p, uint64_t seq) {
+    uint32_t lo = 0, hi = p->nskips;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (p->skips[mid].seq <= seq) lo = mid + 1;
+        else                          hi = mid;
+    }
+    return (int64_t)lo - 1;
+}
+
+// Membership tests for seqs in descending order, decoding each block once
+typedef struct {
+    const Posting *p;
+    int64_t        block;   // decoded into seqs, -1 = none
+    uint32_t       n;
+    uint64_t       seqs[SEARCH_BLOCK];
+} PostingCursor;
+
+static int cursor_has(PostingCursor *c, uint64_t seq) {
+    // The decoded block stays right until seq drops below its first entry
+    if (c->block < 0 || c->seqs[0] > seq) {
+        int64_t b = posting_find_block(c->p, seq);
+        if (b < 0) return 0;
+        c->n     = posting_block(c->p, (uint32_t)b, c->seqs);
+        c->block = b;
+    }
+    uint32_t lo = 0, hi = c->n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (c->seqs[mid] < seq) lo = mid + 1;
+        else                    hi = mid;
+    }
+    return lo < c->n && c->seqs[lo] == seq;
+}
+
+// ===========================================================================
+// Words
+// ===========================================================================
+
+typedef struct {
+    uint8_t len;
+    char    word[SEARCH_MAX_TERM];
+} SearchWord;
+
+static int word_byte(uint8_t c) {
+    return c >= 0x80 || (c >= '0' && c <= '9') ||
+           (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// Reads the next word of text[*pos..len) into w. Returns 0 at the end.
+static int next_word(const char *text, uint32_t len, uint32_t *pos, SearchWord *w) {
+    uint32_t i = *pos;
+    while (i < len && !word_byte((uint8_t)text[i])) i++;
+    if (i == len) {
+        *pos = i;
+        return 0;
+    }
+    w->len = 0;
+    for (; i < len && word_byte((uint8_t)text[i]); i++) {
+        uint8_t c = (uint8_t)text[i];
+        if (c >= 'A' && c <= 'Z') c |= 0x20;
+        if (w->len < SEARCH_MAX_TERM) w->word[w->len++] = (char)c;
+    }
+    *pos = i;
+    return 1;
+}
+
+static uint32_t word_hash(const SearchWord *w) {
+    uint32_t h = 2166136261u;
+    for (uint8_t i = 0; i < w->len; i++) {
+        h ^= (uint8_t)w->word[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// ===========================================================================
+// Per-channel index
+// ===========================================================================
+
+typedef struct {
+    SearchWord w;
+    Posting    post;
+} Term;
+
+typedef struct {
+    Term   **slots;      // open addressing on word_hash, NULL = empty
+    uint32_t cap, count;
+    uint64_t first;      // oldest seq indexed (0 = nothing yet)
+    uint64_t indexed;    // newest seq indexed
+    uint64_t bytes;      // memory held, for the metric
+} TermTable;
+
+typedef struct {
+    pthread_rwlock_t lock;   // indexer writes, searches read
+    TermTable        t;
+} ChannelIndex;
+
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+static IdMap            indexes;   // channel_id → ChannelIndex *, never removed
+
+static Term **table_slot(Term **slots, uint32_t cap, const SearchWord *w) {
+    uint32_t i = word_hash(w) & (cap - 1);
+    while (slots[i] && (slots[i]->w.len != w->len ||
+                        memcmp(slots[i]->w.word, w->word, w->len) != 0))
+        i = (i + 1) & (cap - 1);
+    return &slots[i];
+}
+
+static Term *table_find(const TermTable *t, const SearchWord *w) {
+    return t->cap ? *table_slot(t->slots, t->cap, w) : NULL;
+}
+
+// Finds or adds w; NULL if out of memory
+static Term *table_get(TermTable *t, const SearchWord *w) {
+    if ((t->count + 1) * 4 > t->cap * 3) {
+        uint32_t ncap  = t->cap ? t->cap * 2 : 256;
+        Term   **slots = calloc(ncap, sizeof(Term *));
+        if (!slots) return NULL;
+        for (uint32_t i = 0; i < t->cap; i++)
+            if (t->slots[i]) *table_slot(slots, ncap, &t->slots[i]->w) = t->slots[i];
+        free(t->slots);
+        t->bytes += (uint64_t)(ncap - t->cap) * sizeof(Term *);
+        t->slots  = slots;
+        t->cap    = ncap;
+    }
+    Term **slot = table_slot(t->slots, t->cap, w);
+    if (!*slot) {
+        if (!(*slot = calloc(1, sizeof(Term)))) return NULL;
+        (*slot)->w = *w;
+        t->bytes  += sizeof(Term);
+        t->count++;
+    }
+    return *slot;
+}
+
+static void table_free(TermTable *t) {
+    for (uint32_t i = 0; i < t->cap; i++) {
+        if (!t->slots[i]) continue;
+        free(t->slots[i]->post.bytes);
+        free(t->slots[i]->post.skips);
+        free(t->slots[i]);
+    }
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+// Out of memory leaves the message partly indexed; it is not retried.
+static void table_add_message(TermTable *t, uint64_t seq, const char *text, uint32_t len) {
+    SearchWord w;
+    uint32_t   pos = 0;
+    while (next_word(text, len, &pos, &w)) {
+        Term *term = table_get(t, &w);
+        int   n    = term ? posting_add(&term->post, seq) : -1;
+        if (n < 0) break;
+        t->bytes += (uint64_t)n;
+    }
+    if (t->first == 0) t->first = seq;
+    t->indexed = seq;
+}
+
+static ChannelIndex *index_get(uint32_t channel_id, int create) {
+    pthread_rwlock_rdlock(&index_lock);
+    ChannelIndex *ix = idmap_get(&indexes, channel_id);
+    pthread_rwlock_unlock(&index_lock);
+    if (ix || !create) return ix;
+
+    // Only the indexer creates entries, so there is no race to lose
+    if (!(ix = calloc(1, sizeof(ChannelIndex)))) return NULL;
+    pthread_rwlock_init(&ix->lock, NULL);
+    pthread_rwlock_wrlock(&index_lock);
+    int rc = idmap_put(&indexes, channel_id, ix);
+    pthread_rwlock_unlock(&index_lock);
+    if (rc < 0) {
+        pthread_rwlock_destroy(&ix->lock);
+        free(ix);
+        return NULL;
+    }
+    return ix;
+}
+
+// ===========================================================================
+// Indexer
+// ===========================================================================
+
+// Adds everything the store holds after t->indexed. Batches are copied
+// out of the store without lock; lock (if any) is held only while one is
+// added, so a search waits for at most one batch.
+static void catch_up(TermTable *t, uint32_t channel_id, pthread_rwlock_t *lock,
+                     uint8_t *buf)
+{
+    while (1) {
+        uint16_t n;
+        uint32_t used = store_read_since(channel_id, t->indexed, SYNC_MAX_RECORDS, 1,
+                                         buf, SEARCH_BATCH_BYTES, &n);
+        if (n == 0) return;
+
+        if (lock) pthread_rwlock_wrlock(lock);
+        for (uint32_t off = 0; off < used;) {
+            MessageSyncRecordV3 rec;
+            sync_record_v3_decode(&rec, buf + off, used - off);
+            table_add_message(t, rec.seq, (const char *)buf + off + SYNC_RECORD_V3_SIZE,
+                              rec.message_length);
+            off += SYNC_RECORD_V3_SIZE + rec.message_length;
+        }
+        if (lock) pthread_rwlock_unlock(lock);
+    }
+}
+
+// Brings channel_id's index up to date. Returns how much its memory use
+// changed (only this thread writes ix->t, so it reads it unlocked).
+static int64_t index_channel(uint32_t channel_id, uint8_t *buf) {
+    ChannelIndex *ix = index_get(channel_id, 1);
+    if (!ix) return 0;
+    uint64_t before = ix->t.bytes;
+
+    // Retention has dropped more than half of what the index covers:
+    // rebuild it from what is left, off to the side, and swap it in
+    uint64_t first = store_first_seq(channel_id);
+    if (ix->t.first && first > ix->t.first &&
+        (first - ix->t.first) * 2 > ix->t.indexed - ix->t.first + 1) {
+        TermTable fresh = { 0 };
+        fresh.indexed = first - 1;
+        catch_up(&fresh, channel_id, NULL, buf);
+
+        pthread_rwlock_wrlock(&ix->lock);
+        TermTable old = ix->t;
+        ix->t = fresh;
+        pthread_rwlock_unlock(&ix->lock);
+        table_free(&old);
+    }
+
+    catch_up(&ix->t, channel_id, &ix->lock, buf);
+    return (int64_t)(ix->t.bytes - before);
+}
+
+void* search_thread(void *arg) {
+    (void)arg;
+    affinity_enter(AFF_STORAGE);
+    uint8_t *buf   = malloc(SEARCH_BATCH_BYTES);
+    uint64_t bytes = 0;
+    uint32_t idx[SEARCH_DIRTY_BATCH];
+    if (!buf) return NULL;
+
+    // Only channels that were appended to since the last pass are visited
+    while (1) {
+        usleep(SEARCH_INDEX_MS * 1000);
+        uint32_t n;
+        while ((n = store_take_dirty(STORE_DIRTY_SEARCH, idx, SEARCH_DIRTY_BATCH)) > 0) {
+            for (uint32_t i = 0; i < n; i++)
+                bytes += (uint64_t)index_channel(store_channel_id_at(idx[i]), buf);
+            metric_set(METRIC_SEARCH_INDEX_BYTES, bytes);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+// ===========================================================================
+// Queries
+// ===========================================================================
+
+uint32_t search_query(uint32_t channel_id, const char *query, uint32_t qlen,
+                      uint64_t before, uint64_t *out, uint32_t max,
+                      uint64_t *indexed)
+{
+    SearchWord words[SEARCH_MAX_QUERY_TERMS];
+    uint32_t   nwords = 0;
+    SearchWord w;
+    uint32_t   pos = 0;
+    while (nwords < SEARCH_MAX_QUERY_TERMS && next_word(query, qlen, &pos, &w)) {
+        uint32_t k = 0;
+        while (k < nwords && (words[k].len != w.len ||
+                              memcmp(words[k].word, w.word, w.len) != 0)) k++;
+        if (k == nwords) words[nwords++] = w;
+    }
+
+    *indexed = 0;
+    ChannelIndex *ix = index_get(channel_id, 0);
+    if (!ix || nwords == 0 || max == 0) return 0;
+
+    // Messages below first were trimmed by retention
+    uint64_t first = store_first_seq(channel_id);
+    uint64_t bound = before ? before - 1 : UINT64_MAX;
+    uint32_t n     = 0;
+
+    PostingCursor cur[SEARCH_MAX_QUERY_TERMS];
+    uint64_t      blk[SEARCH_BLOCK];
+
+    pthread_rwlock_rdlock(&ix->lock);
+    *indexed = ix->t.indexed;
+
+    // Rarest word first: its list drives, the rest are only probed
+    for (uint32_t i = 0; i < nwords; i++) {
+        Term *term = table_find(&ix->t, &words[i]);
+        if (!term) goto done;
+        uint32_t k = i;
+        while (k > 0 && cur[k - 1].p->count > term->post.count) {
+            cur[k] = cur[k - 1];
+            k--;
+        }
+        cur[k].p     = &term->post;
+        cur[k].block = -1;
+    }
+
+    for (int64_t b = posting_find_block(cur[0].p, bound); b >= 0 && n < max; b--) {
+        uint32_t m = posting_block(cur[0].p, (uint32_t)b, blk);
+        while (m-- > 0 && n < max) {
+            uint64_t seq = blk[m];
+            if (seq > bound) continue;
+            if (seq < first) goto done;
+
+            uint32_t k = 1;
+            while (k < nwords && cursor_has(&cur[k], seq)) k++;
+            if (k == nwords) out[n++] = seq;
+        }
+    }
+
+done:
+    pthread_rwlock_unlock(&ix->lock);
+    return n;
+}
@@ -0,0 +1,54 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_SEARCH_H
+#define COMP4985_SEARCH_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Full-text search
+//
+// One inverted index per channel: word → the seqs of the messages that
+// contain it. search_thread builds it behind the store: every
+// SEARCH_INDEX_MS it takes the channels appended to since its last pass
+// off the store's dirty queue and copies their new messages out with
+// store_read_since, so Message Create never waits on it; a search sees
+// messages once the indexer has caught up (the ACK reports how far that
+// is).
+//
+// Words are runs of ASCII letters and digits, lowercased, with any byte
+// >= 0x80 counted as a letter so UTF-8 words stay whole (and
+// case-sensitive). Words longer than SEARCH_MAX_TERM are indexed and
+// matched by their prefix.
+//
+// Posting lists are seq deltas in LEB128, about one byte per entry. Every
+// SEARCH_BLOCK entries a skip entry records the block's first seq, so a
+// query decodes only the blocks it needs: it walks the rarest word's list
+// newest first and checks each candidate against the others' blocks.
+//
+// Hits trimmed away by retention are dropped at query time; once more
+// than half of what a channel's index covers is gone, it is rebuilt on
+// the channel's next append.
+// ---------------------------------------------------------------------------
+#define SEARCH_INDEX_MS         100    // indexer poll period
+#define SEARCH_DIRTY_BATCH      256    // channels taken off the queue at once
+#define SEARCH_BLOCK            128    // postings per skip entry
+#define SEARCH_MAX_TERM         32     // bytes of a word that are indexed
+#define SEARCH_MAX_QUERY_TERMS  8      // further query words are ignored
+#define SEARCH_DEFAULT_RESULTS  64     // used when the client sends max_results=0
+#define SEARCH_MAX_RESULTS      1024   // hard cap on hits per Search ACK
+
+// Fills out with up to max seqs of the messages in channel_id that contain
+// every word of query, newest first, all below before (0 = no bound).
+// *indexed receives the newest seq the index covers. Returns the count; 0
+// for a query without words.
+uint32_t search_query(uint32_t channel_id, const char *query, uint32_t qlen,
+                      uint64_t before, uint64_t *out, uint32_t max,
+                      uint64_t *indexed);
+
+// Indexes new messages every SEARCH_INDEX_MS.
+void* search_thread(void *arg);
+
+#endif //COMP4985_SEARCH_H
@@ -0,0 +1,263 @@
+#include "protocol.h"
+#include "server.h"
+#include "logsink.h"
+#include "manager.h"
+#include "client.h"
+#include "timer.h"
+#include "admission.h"
+#include "replicate.h"
+#include "metrics.h"
+#include "persist.h"
+#include "affinity.h"
+#include "offload.h"
+#include "presence.h"
+#include "search.h"
+#include "capture.h"
+#include "trace.h"
+
+#define SERVER_MAX_ACCEPTORS  64
+
+// One per CPU in cpu.acceptors, all on the same port with SO_REUSEPORT so
+// the kernel spreads incoming connections across them; a single unpinned
+// one (cpu -1) otherwise
+typedef struct {
+    int       fd;
+    int       cpu;
+    pthread_t tid;
+} Acceptor;
+
+static Acceptor  acceptors[SERVER_MAX_ACCEPTORS];
+static int       n_acceptors;
+static uint16_t  bound_port;
+static _Atomic int stopping;
+
+// ===========================================================================
+// Helpers
+// ===========================================================================
+
+static uint32_t get_my_ip(void) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port   = htons(53)
+    };
+    inet_pton(AF_INET, "8.8.8.8", &addr.sin_addr);
+    connect(sock, (struct sockaddr *)&addr, sizeof(addr));
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    getsockname(sock, (struct sockaddr *)&local, &len);
+    close(sock);
+    return local.sin_addr.s_addr;
+}
+
+// ===========================================================================
+// Background services — once per process
+// ===========================================================================
+
+// Before the listener: logging, identity, restored state, timers
+static int services_init(void) {
+    int use_ui = !server_config.headless && isatty(STDOUT_FILENO);
+    const char *log_file = server_config.log_file[0] ? server_config.log_file : NULL;
+    if (!server_config.logging)
+        log_mute();
+    else if (log_open(use_ui, log_file) < 0)
+        return -1;
+
+    my_server_ip = get_my_ip();
+    if (server_config.advertise_ip[0] &&
+        inet_pton(AF_INET, server_config.advertise_ip, &my_server_ip) != 1) {
+        server_log("Bad advertise_ip: %s", server_config.advertise_ip);
+        return -1;
+    }
+
+    // Restore before anything can touch the store or talk to peers
+    if (server_config.data_dir[0] && persist_open(server_config.data_dir) < 0)
+        return -1;
+    if (server_config.capture_file[0] && capture_open(server_config.capture_file) < 0)
+        return -1;
+    if (!server_config.trace_file[0])
+        trace_sample = 0;
+    else if (trace_sample)
+        trace_open(server_config.trace_file);
+
+    timer_wheel_start();
+    offload_start();
+    admission_start();
+    metrics_start();
+    return 0;
+}
+
+// After the listener: the manager link and everything that feeds it
+static void services_start(void) {
+    static ManagerInfo info;
+    pthread_t tid;
+
+    manager_enabled = server_config.manager_ip[0] && server_config.manager_port;
+    if (manager_enabled) {
+        strncpy(info.ip, server_config.manager_ip, sizeof(info.ip) - 1);
+        info.port    = (int)server_config.manager_port;
+        info.my_port = bound_port;
+
+        pthread_create(&tid, NULL, manager_connection_thread, &info);
+        pthread_create(&tid, NULL, replication_thread, NULL);
+        pthread_create(&tid, NULL, heartbeat_thread, NULL);
+    }
+
+    if (server_config.data_dir[0])
+        pthread_create(&tid, NULL, persist_thread, NULL);
+    pthread_create(&tid, NULL, presence_thread, NULL);
+    pthread_create(&tid, NULL, search_thread, NULL);
+    if (trace_sample)
+        pthread_create(&tid, NULL, trace_thread, NULL);
+}
+
+// ===========================================================================
+// Listeners
+// ===========================================================================
+
+// port 0 = ephemeral; the first listener's real port is used for the rest
+static int listener_open(uint16_t port, int reuseport) {
+    int fd  = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuseport)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    struct sockaddr_in saddr = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(port),
+        .sin_addr.s_addr = INADDR_ANY
+    };
+    socklen_t alen = sizeof(saddr);
+    if (fd < 0 ||
+        bind(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0 ||
+        listen(fd, (int)server_config.listen_backlog) < 0 ||
+        getsockname(fd, (struct sockaddr *)&saddr, &alen) < 0) {
+        server_log("Cannot listen on port %u: %s", port, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    bound_port = ntohs(saddr.sin_port);
+    return fd;
+}
+
+static void listeners_close(void) {
+    for (int i = 0; i < n_acceptors; i++)
+        close(acceptors[i].fd);
+    n_acceptors = 0;
+}
+
+static int listeners_open(void) {
+    const CpuSet *cpus = &affinity_sets[AFF_ACCEPTOR];
+    int n = cpuset_count(cpus);
+    if (n > SERVER_MAX_ACCEPTORS) {
+        server_log("cpu.acceptors lists %d CPUs; using the first %d", n, SERVER_MAX_ACCEPTORS);
+        n = SERVER_MAX_ACCEPTORS;
+    }
+
+    uint16_t port = (uint16_t)server_config.port;
+    for (int i = 0; i < (n ? n : 1); i++) {
+        int fd = listener_open(port, n > 0);
+        if (fd < 0) {
+            listeners_close();
+            return -1;
+        }
+        acceptors[i].fd  = fd;
+        acceptors[i].cpu = n ? cpuset_nth(cpus, i) : -1;
+        n_acceptors      = i + 1;
+        port             = bound_port;
+#ifdef SO_INCOMING_CPU
+        // Hint for the kernel's reuseport group: prefer the listener whose
+        // CPU handled the SYN, keeping the flow on one core end to end
+        if (acceptors[i].cpu >= 0)
+            setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU,
+                       &acceptors[i].cpu, sizeof(acceptors[i].cpu));
+#endif
+    }
+    return 0;
+}
+
+static void *accept_thread(void *arg) {
+    const Acceptor *a = arg;
+    if (a->cpu >= 0) affinity_enter_cpu(a->cpu);
+
+    while (!atomic_load(&stopping)) {
+        struct sockaddr_in caddr;
+        socklen_t clen = sizeof(caddr);
+        int csock = accept(a->fd, (struct sockaddr *)&caddr, &clen);
+        if (csock < 0) continue;   // server_stop shuts the listener down
+
+        // Saturated or at the connection cap: refuse before spawning
+        // anything, so the sessions already open keep their latency
+        if (!admission_accept()) {
+            send_error_response_nowait(csock, RES_SYSTEM, CRUD_CREATE,
+                                       STATUS_SERVICE_UNAVAILABLE);
+            close(csock);
+            continue;
+        }
+        int *p = malloc(sizeof(int));
+        *p = csock;
+        if (affinity_spawn_conn(a->cpu, handle_client, p) != 0) {
+            close(csock);
+            free(p);
+            admission_release();
+        }
+    }
+    return NULL;
+}
+
+// ===========================================================================
+// Start / stop
+// ===========================================================================
+
+int server_start(void) {
+    static int initialised, started;
+    if (n_acceptors > 0) return 0;
+
+    if (!initialised) {
+        if (services_init() < 0) return -1;
+        initialised = 1;
+    }
+    if (listeners_open() < 0) return -1;
+    if (!started) {
+        services_start();
+        started = 1;
+    }
+
+    atomic_store(&stopping, 0);
+    client_set_closing(0);
+    for (int i = 0; i < n_acceptors; i++) {
+        pthread_create(&acceptors[i].tid, NULL, accept_thread, &acceptors[i]);
+        if (acceptors[i].cpu >= 0)
+            server_log("[AFFINITY] Acceptor on CPU %d (node %d)", acceptors[i].cpu,
+                       affinity_node_of(acceptors[i].cpu));
+    }
+
+    server_log("Server online — port %u  (Protocol v0.2)%s%s", bound_port,
+               server_standby ? "  [standby]" : "",
+               manager_enabled ? "" : "  [no manager]");
+    return 0;
+}
+
+uint16_t server_port(void) {
+    return n_acceptors > 0 ? bound_port : 0;
+}
+
+void server_stop(void) {
+    if (n_acceptors == 0) return;
+
+    atomic_store(&stopping, 1);
+    for (int i = 0; i < n_acceptors; i++)
+        shutdown(acceptors[i].fd, SHUT_RDWR);   // wakes accept()
+    for (int i = 0; i < n_acceptors; i++)
+        pthread_join(acceptors[i].tid, NULL);
+    listeners_close();
+
+    // Every handler thread releases its admission slot on the way out
+    client_set_closing(1);
+    while (atomic_load(&active_connections) > 0)
+        usleep(1000);
+    capture_flush();
+    trace_export();
+
+    server_log("Server stopped");
+}
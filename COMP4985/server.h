@@ -0,0 +1,44 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_SERVER_H
+#define COMP4985_SERVER_H
+
+#include "protocol.h"
+#include "config.h"
+
+// ---------------------------------------------------------------------------
+// Embeddable server
+//
+// Everything except main.c builds into the comp4985_server library, so a
+// benchmark or test can run a complete server inside its own process:
+//
+//     config_set("port", "0");          // ephemeral
+//     config_set("logging", "false");   // or log_file = ...
+//     server_start();
+//     ... connect to 127.0.0.1:server_port() ...
+//     server_stop();
+//
+// Configure with config_set / config_load before the first server_start.
+// Without manager_ip / manager_port the server runs standalone: no
+// registration, replication, heartbeats or log forwarding.
+//
+// Background services (storage, timers, the manager link) start with the
+// first server_start and live as long as the process; server_stop closes
+// the listener and every client connection, and server_start may then
+// open a new listener.
+// ---------------------------------------------------------------------------
+
+// Returns 0, or -1 (logged) if storage or the listener cannot be set up.
+int      server_start(void);
+
+// Port the listener is bound to (the real one when configured as 0), or 0
+// while stopped.
+uint16_t server_port(void);
+
+// Stops accepting, disconnects every client and waits for their threads
+// to finish. No-op while stopped.
+void     server_stop(void);
+
+#endif //COMP4985_SERVER_H
@@ -0,0 +1,77 @@
+#include "protocol.h"
+#include "stats.h"
+
+// ===========================================================================
+// Shards
+// ===========================================================================
+
+typedef struct {
+    _Atomic uint64_t requests;
+    _Atomic uint64_t messages;
+    _Atomic uint64_t lat[STATS_LAT_BUCKETS];
+} __attribute__((aligned(64))) StatsShard;
+
+static StatsShard        shards[STATS_SHARDS];
+static _Atomic uint32_t  next_shard;
+static _Thread_local int my_shard = -1;
+
+// Bucket b < 4 holds exactly b µs. Above that, bucket 4(e-1)+s holds the
+// values whose top bit is e and whose next two bits are s.
+static int lat_bucket(uint32_t us) {
+    if (us < 4) return (int)us;
+    int e = 31 - __builtin_clz(us);
+    return 4 * (e - 1) + (int)((us >> (e - 2)) & 3);
+}
+
+static uint32_t bucket_upper_us(int b) {
+    if (b < 4) return (uint32_t)b;
+    int e = b / 4 + 1, s = b % 4;
+    uint64_t lower = (uint64_t)(4 + s) << (e - 2);
+    uint64_t upper = lower + (1ull << (e - 2)) - 1;
+    return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+}
+
+void stats_record(uint32_t latency_us, int is_message) {
+    if (my_shard < 0)
+        my_shard = (int)(atomic_fetch_add(&next_shard, 1) % STATS_SHARDS);
+    StatsShard *s = &shards[my_shard];
+
+    atomic_fetch_add_explicit(&s->requests, 1, memory_order_relaxed);
+    if (is_message)
+        atomic_fetch_add_explicit(&s->messages, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->lat[lat_bucket(latency_us)], 1, memory_order_relaxed);
+}
+
+// ===========================================================================
+// Readers
+// ===========================================================================
+
+void stats_snapshot(StatsSnapshot *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < STATS_SHARDS; i++) {
+        StatsShard *s = &shards[i];
+        out->requests += atomic_load_explicit(&s->requests, memory_order_relaxed);
+        out->messages += atomic_load_explicit(&s->messages, memory_order_relaxed);
+        for (int b = 0; b < STATS_LAT_BUCKETS; b++)
+            out->lat[b] += atomic_load_explicit(&s->lat[b], memory_order_relaxed);
+    }
+}
+
+uint32_t stats_quantile_us(const StatsSnapshot *now, const StatsSnapshot *prev,
+                           double q)
+{
+    uint64_t total = 0;
+    for (int b = 0; b < STATS_LAT_BUCKETS; b++)
+        total += now->lat[b] - prev->lat[b];
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)total);
+    if (rank >= total) rank = total - 1;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < STATS_LAT_BUCKETS; b++) {
+        seen += now->lat[b] - prev->lat[b];
+        if (seen > rank) return bucket_upper_us(b);
+    }
+    return bucket_upper_us(STATS_LAT_BUCKETS - 1);
+}
@@ -0,0 +1,46 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_STATS_H
+#define COMP4985_STATS_H
+
+#include "protocol.h"
+#include <stdatomic.h>
+
+// ---------------------------------------------------------------------------
+// Request statistics for the manager heartbeat
+//
+// Counters are sharded: each thread is given a shard on first use
+// (round-robin), so connection threads almost never share a cache line.
+// Readers sum all shards. Latencies go into a log-linear histogram —
+// 4 buckets per power of two, i.e. ≤25 % error — which is enough for a
+// p99 that only has to rank servers against each other.
+// ---------------------------------------------------------------------------
+#define STATS_SHARDS       64
+#define STATS_LAT_BUCKETS  128   // covers the full uint32_t µs range
+
+typedef struct {
+    uint64_t requests;
+    uint64_t messages;                  // Message Create only
+    uint64_t lat[STATS_LAT_BUCKETS];
+} StatsSnapshot;
+
+static inline uint64_t stats_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+// Records one handled request that took latency_us.
+void stats_record(uint32_t latency_us, int is_message);
+
+// Sums every shard into *out (cumulative since start).
+void stats_snapshot(StatsSnapshot *out);
+
+// Latency at quantile q (0..1) of the requests between two snapshots, as
+// the upper bound of its bucket in µs. 0 if there were none.
+uint32_t stats_quantile_us(const StatsSnapshot *now, const StatsSnapshot *prev,
+                           double q);
+
+#endif //COMP4985_STATS_H
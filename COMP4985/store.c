@@ -0,0 +1,629 @@
+#include "protocol.h"
+#include "store.h"
+#include "idmap.h"
+
+// ===========================================================================
+// Channel table
+//
+// Channels are created on first use and never freed, so a ChannelLog
+// pointer stays valid once looked up: table_lock only guards the id map
+// and the creation-order array, each channel has its own mutex for its
+// messages.
+// ===========================================================================
+
+// Replicated channels only. Resync walks held[], so a channel costs one
+// step per origin it has actually received from, not one per possible origin.
+typedef struct {
+    uint64_t seq[256];      // highest origin_seq applied per origin
+    uint8_t  held[256];     // origins with seq != 0, in the order first seen
+    uint32_t held_count;
+} OriginMarks;
+
+typedef struct ChannelLog ChannelLog;
+struct ChannelLog {
+    pthread_mutex_t lock;
+    uint32_t        channel_id;
+    uint32_t        index;      // creation order
+    _Atomic uint8_t dirty;      // bit q set while queued on dirty_queues[q]
+    ChannelLog     *dirty_next[STORE_DIRTY_QUEUES];
+    StoredMessage  *msgs;
+    size_t          count;
+    size_t          cap;
+    uint64_t        base_seq;   // seq of msgs[0]
+    uint64_t        local_last; // origin_seq of the newest local message
+    OriginMarks    *applied;    // replicas: how far each origin is held
+};
+
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+static IdMap            channels;         // channel_id → ChannelLog *
+static ChannelLog     **channel_order;    // creation order
+static uint32_t         channel_count;
+static uint32_t         channel_cap;
+
+_Atomic uint64_t store_head_total = 0;
+
+// Channels appended to since their consumer last took them, oldest first.
+// A channel is on each queue at most once (its dirty bit), so the links
+// live in the ChannelLog and queueing never allocates.
+typedef struct {
+    pthread_mutex_t lock;
+    ChannelLog     *head, *tail;
+} DirtyQueue;
+
+static DirtyQueue dirty_queues[STORE_DIRTY_QUEUES] = {
+    [STORE_DIRTY_REPLICATE] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+    [STORE_DIRTY_SEARCH]    = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+// Looks channel_id up, creating it if asked to. Returns NULL if it does
+// not exist (or cannot be allocated).
+static ChannelLog *channel_get(uint32_t channel_id, int create) {
+    pthread_rwlock_rdlock(&table_lock);
+    ChannelLog *ch = idmap_get(&channels, channel_id);
+    pthread_rwlock_unlock(&table_lock);
+    if (ch || !create) return ch;
+
+    pthread_rwlock_wrlock(&table_lock);
+    ch = idmap_get(&channels, channel_id);   // lost a race to create it?
+    if (!ch && channel_count == channel_cap) {
+        uint32_t     ncap = channel_cap ? channel_cap * 2 : 64;
+        ChannelLog **n    = realloc(channel_order, ncap * sizeof(ChannelLog *));
+        if (n) {
+            channel_order = n;
+            channel_cap   = ncap;
+        }
+    }
+    if (!ch && channel_count < channel_cap && (ch = calloc(1, sizeof(ChannelLog)))) {
+        pthread_mutex_init(&ch->lock, NULL);
+        ch->channel_id = channel_id;
+        ch->index      = channel_count;
+        ch->base_seq   = 1;
+        if (idmap_put(&channels, channel_id, ch) < 0) {
+            pthread_mutex_destroy(&ch->lock);
+            free(ch);
+            ch = NULL;
+        } else {
+            channel_order[channel_count++] = ch;
+        }
+    }
+    pthread_rwlock_unlock(&table_lock);
+    return ch;
+}
+
+uint32_t store_channel_count(void) {
+    pthread_rwlock_rdlock(&table_lock);
+    uint32_t n = channel_count;
+    pthread_rwlock_unlock(&table_lock);
+    return n;
+}
+
+uint32_t store_channel_id_at(uint32_t index) {
+    pthread_rwlock_rdlock(&table_lock);
+    uint32_t id = index < channel_count ? channel_order[index]->channel_id : 0;
+    pthread_rwlock_unlock(&table_lock);
+    return id;
+}
+
+// ===========================================================================
+// Dirty-channel queues
+// ===========================================================================
+
+// Queues ch on q unless it is queued already. Called after the append has
+// been made under ch->lock, so a consumer that takes ch sees it.
+static void channel_dirty(ChannelLog *ch, StoreDirtyQueue q) {
+    uint8_t bit = (uint8_t)(1u << q);
+    if (atomic_fetch_or(&ch->dirty, bit) & bit) return;
+
+    DirtyQueue *dq = &dirty_queues[q];
+    pthread_mutex_lock(&dq->lock);
+    ch->dirty_next[q] = NULL;
+    if (dq->tail) dq->tail->dirty_next[q] = ch;
+    else          dq->head = ch;
+    dq->tail = ch;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+uint32_t store_take_dirty(StoreDirtyQueue q, uint32_t *out, uint32_t max) {
+    DirtyQueue *dq = &dirty_queues[q];
+    uint32_t    n  = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    while (n < max && dq->head) {
+        ChannelLog *ch = dq->head;
+        dq->head = ch->dirty_next[q];
+        if (!dq->head) dq->tail = NULL;
+        atomic_fetch_and(&ch->dirty, (uint8_t)~(1u << q));
+        out[n++] = ch->index;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return n;
+}
+
+void store_mark_dirty(StoreDirtyQueue q, uint32_t index) {
+    pthread_rwlock_rdlock(&table_lock);
+    ChannelLog *ch = index < channel_count ? channel_order[index] : NULL;
+    pthread_rwlock_unlock(&table_lock);
+    if (ch) channel_dirty(ch, q);
+}
+
+// ===========================================================================
+// Append / read
+// ===========================================================================
+
+// Writes m to the persistent log. Caller holds ch->lock, so the log
+// order matches seq order within the channel.
+static void channel_log(const ChannelLog *ch, const StoredMessage *m) {
+    PersistMsg pm = {
+        .channel_id = ch->channel_id,
+        .local      = m->local,
+        .origin_id  = m->origin_id,
+        .sender_id  = m->sender_id,
+        .seq        = m->seq,
+        .origin_seq = m->origin_seq,
+        .timestamp  = m->timestamp,
+        .stored_at  = m->stored_at,
+        .length     = m->length
+    };
+    memcpy(pm.sender, m->sender, sizeof(pm.sender));
+    persist_log_message(&pm, m->text);
+}
+
+// Moves the seq of an empty channel's first message to base_seq, keeping
+// store_head_total in step. Caller holds ch->lock.
+static void channel_rebase(ChannelLog *ch, uint64_t base_seq) {
+    if (base_seq > ch->base_seq)
+        atomic_fetch_add(&store_head_total, base_seq - ch->base_seq);
+    else
+        atomic_fetch_sub(&store_head_total, ch->base_seq - base_seq);
+    ch->base_seq = base_seq;
+}
+
+// Reserves the next slot of ch. Caller holds ch->lock.
+static StoredMessage *channel_push(ChannelLog *ch) {
+    if (ch->count == ch->cap) {
+        size_t ncap = ch->cap ? ch->cap * 2 : 64;
+        StoredMessage *n = realloc(ch->msgs, ncap * sizeof(StoredMessage));
+        if (!n) return NULL;
+        ch->msgs = n;
+        ch->cap  = ncap;
+    }
+    StoredMessage *m = &ch->msgs[ch->count];
+    memset(m, 0, sizeof(*m));
+    m->seq = ch->base_seq + ch->count;
+    ch->count++;
+    atomic_fetch_add(&store_head_total, 1);
+    return m;
+}
+
+uint64_t store_append(uint32_t channel_id, const char sender[16],
+                      uint32_t sender_id, uint64_t timestamp,
+                      const char *text, uint16_t length)
+{
+    ChannelLog *ch = channel_get(channel_id, 1);
+    if (!ch) return 0;
+
+    char *copy = malloc(length ? length : 1);
+    if (!copy) return 0;
+    memcpy(copy, text, length);
+
+    pthread_mutex_lock(&ch->lock);
+    StoredMessage *m = channel_push(ch);
+    if (!m) {
+        pthread_mutex_unlock(&ch->lock);
+        free(copy);
+        return 0;
+    }
+    m->timestamp  = timestamp;
+    m->sender_id  = sender_id;
+    memcpy(m->sender, sender, sizeof(m->sender));
+    m->length     = length;
+    m->text       = copy;
+    m->local      = 1;
+    m->origin_seq = m->seq;
+    m->prev_seq   = ch->local_last;
+    ch->local_last = m->seq;
+    m->stored_at  = (uint32_t)time(NULL);
+    channel_log(ch, m);
+
+    uint64_t seq = m->seq;
+    pthread_mutex_unlock(&ch->lock);
+
+    channel_dirty(ch, STORE_DIRTY_REPLICATE);
+    channel_dirty(ch, STORE_DIRTY_SEARCH);
+    return seq;
+}
+
+uint64_t store_head_seq(uint32_t channel_id) {
+    ChannelLog *ch = channel_get(channel_id, 0);
+    if (!ch) return 0;
+
+    pthread_mutex_lock(&ch->lock);
+    uint64_t head = ch->base_seq + ch->count - 1;
+    pthread_mutex_unlock(&ch->lock);
+    return head;
+}
+
+uint64_t store_count_since(uint32_t channel_id, uint64_t since_seq) {
+    ChannelLog *ch = channel_get(channel_id, 0);
+    if (!ch) return 0;
+
+    pthread_mutex_lock(&ch->lock);
+    uint64_t end  = ch->base_seq + ch->count;   // one past the newest
+    pthread_mutex_unlock(&ch->lock);
+    if (since_seq >= end - 1) return 0;         // before since_seq + 1 can wrap
+    uint64_t from = since_seq + 1 > ch->base_seq ? since_seq + 1 : ch->base_seq;
+    return end - from;
+}
+
+uint64_t store_first_seq(uint32_t channel_id) {
+    ChannelLog *ch = channel_get(channel_id, 0);
+    if (!ch) return 0;
+
+    pthread_mutex_lock(&ch->lock);
+    uint64_t first = ch->base_seq;
+    pthread_mutex_unlock(&ch->lock);
+    return first;
+}
+
+uint32_t store_read_since(uint32_t channel_id, uint64_t since_seq,
+                          uint32_t max_records, int wide,
+                          uint8_t *out, uint32_t out_cap, uint16_t *count)
+{
+    ChannelLog *ch = channel_get(channel_id, 0);
+    uint32_t used = 0;
+    uint16_t n    = 0;
+    *count = 0;
+    if (!ch) return 0;
+
+    uint32_t rec_size = wide ? SYNC_RECORD_V3_SIZE : SYNC_RECORD_SIZE;
+
+    pthread_mutex_lock(&ch->lock);
+    if (since_seq >= ch->base_seq + ch->count - 1) {   // at or past the head
+        pthread_mutex_unlock(&ch->lock);
+        return 0;
+    }
+
+    // First wanted seq is since_seq + 1; anything below base_seq is gone.
+    size_t i = 0;
+    if (since_seq + 1 > ch->base_seq)
+        i = (size_t)(since_seq + 1 - ch->base_seq);
+
+    for (; i < ch->count && n < max_records; i++) {
+        StoredMessage *m = &ch->msgs[i];
+        uint32_t need = rec_size + m->length;
+        if (used + need > out_cap) break;
+
+        if (wide) {
+            MessageSyncRecordV3 rec = {
+                .seq               = m->seq,
+                .timestamp         = m->timestamp,
+                .user_id_of_sender = m->sender_id,
+                .message_length    = m->length
+            };
+            sync_record_v3_encode(&rec, out + used);
+        } else {
+            MessageSyncRecord rec = {
+                .seq               = m->seq,
+                .timestamp         = m->timestamp,
+                .user_id_of_sender = m->sender_id <= PROTO_V2_MAX_ID ? (uint8_t)m->sender_id : 0,
+                .message_length    = m->length
+            };
+            sync_record_encode(&rec, out + used);
+        }
+        memcpy(out + used + rec_size, m->text, m->length);
+        used += need;
+        n++;
+    }
+
+    pthread_mutex_unlock(&ch->lock);
+    *count = n;
+    return used;
+}
+
+// ===========================================================================
+// Replication
+// ===========================================================================
+
+// STORE_MAX_TEXT is sized for a Message Sync ACK; a Replica Batch must hold
+// at least as much
+_Static_assert(REPLICA_BATCH_SIZE + REPLICA_RECORD_SIZE + STORE_MAX_TEXT <= BUFFER_SIZE,
+               "a maximum-size message must fit one Replica Batch");
+
+uint32_t store_collect(uint32_t channel_id, int origin, uint64_t since,
+                       uint64_t *pos, uint32_t max_records,
+                       uint8_t *out, uint32_t out_cap, uint16_t *count)
+{
+    ChannelLog *ch = channel_get(channel_id, 0);
+    uint32_t used = 0;
+    uint16_t n    = 0;
+    *count = 0;
+    if (!ch) return 0;
+
+    pthread_mutex_lock(&ch->lock);
+
+    // Retention may have dropped messages past *pos. Then the first record
+    // sent may name one of them as prev_seq, which no peer could ever
+    // catch up to, so it is sent as following on from since instead.
+    size_t i       = 0;
+    int    trimmed = *pos + 1 < ch->base_seq;
+    if (*pos + 1 > ch->base_seq)
+        i = (size_t)(*pos + 1 - ch->base_seq);
+
+    for (; i < ch->count && n < max_records; i++) {
+        StoredMessage *m = &ch->msgs[i];
+        int match = origin == STORE_ORIGIN_LOCAL ? m->local
+                                                 : (!m->local && m->origin_id == origin);
+        if (match && m->origin_seq > since) {
+            uint32_t need = REPLICA_RECORD_SIZE + m->length;
+            if (used + need > out_cap) break;
+
+            ReplicaRecord rec = {
+                .channel_id        = channel_id,
+                .origin_seq        = m->origin_seq,
+                .prev_seq          = trimmed && m->prev_seq > since ? since : m->prev_seq,
+                .timestamp         = m->timestamp,
+                .user_id_of_sender = m->sender_id,
+                .message_length    = m->length
+            };
+            memcpy(rec.sender, m->sender, sizeof(rec.sender));
+            replica_record_encode(&rec, out + used);
+            memcpy(out + used + REPLICA_RECORD_SIZE, m->text, m->length);
+            used   += need;
+            trimmed = 0;
+            n++;
+        }
+        *pos = m->seq;
+    }
+
+    pthread_mutex_unlock(&ch->lock);
+    *count = n;
+    return used;
+}
+
+// Allocates ch->applied on first use. Caller holds ch->lock.
+static int marks_init(ChannelLog *ch) {
+    if (!ch->applied) ch->applied = calloc(1, sizeof(OriginMarks));
+    return ch->applied ? 0 : -1;
+}
+
+// Raises the mark of origin_id to seq. Caller holds ch->lock.
+static void marks_raise(ChannelLog *ch, uint8_t origin_id, uint64_t seq) {
+    OriginMarks *am = ch->applied;
+    if (seq <= am->seq[origin_id]) return;
+    if (am->seq[origin_id] == 0) am->held[am->held_count++] = origin_id;
+    am->seq[origin_id] = seq;
+}
+
+uint32_t store_applied_marks(uint32_t channel_id, StoreOriginMark out[256]) {
+    ChannelLog *ch = channel_get(channel_id, 0);
+    uint32_t    n  = 0;
+    if (!ch) return 0;
+
+    pthread_mutex_lock(&ch->lock);
+    if (ch->applied) {
+        for (; n < ch->applied->held_count; n++) {
+            uint8_t o = ch->applied->held[n];
+            out[n] = (StoreOriginMark){ .origin_id = o, .seq = ch->applied->seq[o] };
+        }
+    }
+    pthread_mutex_unlock(&ch->lock);
+    return n;
+}
+
+int store_apply_replica(uint8_t origin_id, const ReplicaRecord *rec,
+                        const char *text)
+{
+    ChannelLog *ch      = channel_get(rec->channel_id, 1);
+    uint64_t origin_seq = rec->origin_seq;
+    uint16_t length     = rec->message_length;
+    if (!ch) return -1;
+
+    pthread_mutex_lock(&ch->lock);
+    if (marks_init(ch) < 0) {
+        pthread_mutex_unlock(&ch->lock);
+        return -1;
+    }
+    if (origin_seq <= ch->applied->seq[origin_id]) {
+        pthread_mutex_unlock(&ch->lock);
+        return 0;
+    }
+    if (rec->prev_seq > ch->applied->seq[origin_id]) {
+        pthread_mutex_unlock(&ch->lock);   // something before it is missing
+        return -1;
+    }
+
+    char *copy = malloc(length ? length : 1);
+    StoredMessage *m = copy ? channel_push(ch) : NULL;
+    if (!m) {
+        pthread_mutex_unlock(&ch->lock);
+        free(copy);
+        return -1;
+    }
+    memcpy(copy, text, length);
+    m->timestamp  = rec->timestamp;
+    m->sender_id  = rec->user_id_of_sender;
+    memcpy(m->sender, rec->sender, sizeof(m->sender));
+    m->length     = length;
+    m->text       = copy;
+    m->origin_id  = origin_id;
+    m->origin_seq = origin_seq;
+    m->prev_seq   = ch->applied->seq[origin_id];
+    m->stored_at  = (uint32_t)time(NULL);
+    marks_raise(ch, origin_id, origin_seq);
+    channel_log(ch, m);
+
+    pthread_mutex_unlock(&ch->lock);
+    channel_dirty(ch, STORE_DIRTY_SEARCH);
+    return 1;
+}
+
+// ===========================================================================
+// Persistence
+// ===========================================================================
+
+// Holding table_lock for writing also keeps new channels from appearing
+// while everything is locked.
+void store_lock_all(void) {
+    pthread_rwlock_wrlock(&table_lock);
+    for (uint32_t i = 0; i < channel_count; i++)
+        pthread_mutex_lock(&channel_order[i]->lock);
+}
+
+void store_unlock_all(void) {
+    for (uint32_t i = channel_count; i-- > 0;)
+        pthread_mutex_unlock(&channel_order[i]->lock);
+    pthread_rwlock_unlock(&table_lock);
+}
+
+// Section layout: uint32_t channel count, then per channel in creation order
+//   SnapChannel | applied[256] if has_applied | count × (PersistMsg + text)
+typedef struct __attribute__((packed)) {
+    uint32_t channel_id;
+    uint8_t  has_applied;
+    uint64_t base_seq;
+    uint64_t count;
+} SnapChannel;
+
+int store_snapshot(SnapWriter *w) {
+    snap_write(w, &channel_count, sizeof(channel_count));
+
+    for (uint32_t i = 0; i < channel_count; i++) {
+        ChannelLog *ch = channel_order[i];
+
+        SnapChannel sc = {
+            .channel_id  = ch->channel_id,
+            .has_applied = ch->applied != NULL,
+            .base_seq    = ch->base_seq,
+            .count       = ch->count
+        };
+        snap_write(w, &sc, sizeof(sc));
+        if (ch->applied) snap_write(w, ch->applied->seq, sizeof(ch->applied->seq));
+
+        for (size_t k = 0; k < ch->count; k++) {
+            StoredMessage *m = &ch->msgs[k];
+            PersistMsg pm = {
+                .channel_id = ch->channel_id,
+                .local      = m->local,
+                .origin_id  = m->origin_id,
+                .sender_id  = m->sender_id,
+                .seq        = m->seq,
+                .origin_seq = m->origin_seq,
+                .timestamp  = m->timestamp,
+                .stored_at  = m->stored_at,
+                .length     = m->length
+            };
+            memcpy(pm.sender, m->sender, sizeof(pm.sender));
+            snap_write(w, &pm, sizeof(pm));
+            if (snap_write(w, m->text, m->length) < 0) return -1;
+        }
+    }
+    return 0;
+}
+
+int store_load_snapshot(SnapReader *r) {
+    uint32_t n;
+    if (snap_read(r, &n, sizeof(n)) < 0) return -1;
+
+    for (uint32_t c = 0; c < n; c++) {
+        SnapChannel sc;
+        if (snap_read(r, &sc, sizeof(sc)) < 0) return -1;
+        ChannelLog *ch = channel_get(sc.channel_id, 1);
+        if (!ch) return -1;
+
+        pthread_mutex_lock(&ch->lock);
+        if (ch->count == 0) channel_rebase(ch, sc.base_seq);
+        pthread_mutex_unlock(&ch->lock);
+        if (sc.has_applied) {
+            uint64_t seq[256];
+            if (snap_read(r, seq, sizeof(seq)) < 0) return -1;
+            pthread_mutex_lock(&ch->lock);
+            int ok = marks_init(ch) == 0;
+            for (int o = 0; ok && o < 256; o++) marks_raise(ch, (uint8_t)o, seq[o]);
+            pthread_mutex_unlock(&ch->lock);
+            if (!ok) return -1;
+        }
+        for (uint64_t k = 0; k < sc.count; k++) {
+            PersistMsg pm;
+            if (snap_read(r, &pm, sizeof(pm)) < 0) return -1;
+            if ((size_t)(r->end - r->p) < pm.length) return -1;
+            if (store_restore(&pm, (const char *)r->p) < 0) return -1;
+            r->p += pm.length;
+        }
+    }
+    return 0;
+}
+
+int store_restore(const PersistMsg *pm, const char *text) {
+    ChannelLog *ch = channel_get(pm->channel_id, 1);
+    if (!ch) return -1;
+
+    pthread_mutex_lock(&ch->lock);
+    // Trimmed away since it was logged, or already loaded from the snapshot
+    if (pm->seq < ch->base_seq + ch->count) {
+        pthread_mutex_unlock(&ch->lock);
+        return 0;
+    }
+    // A gap means the front was trimmed before these were logged
+    if (ch->count == 0) channel_rebase(ch, pm->seq);
+
+    char *copy = malloc(pm->length ? pm->length : 1);
+    StoredMessage *m = copy ? channel_push(ch) : NULL;
+    if (!m) {
+        pthread_mutex_unlock(&ch->lock);
+        free(copy);
+        return -1;
+    }
+    memcpy(copy, text, pm->length);
+    m->timestamp  = pm->timestamp;
+    m->sender_id  = pm->sender_id;
+    memcpy(m->sender, pm->sender, sizeof(m->sender));
+    m->length     = pm->length;
+    m->text       = copy;
+    m->local      = pm->local;
+    m->origin_id  = pm->origin_id;
+    m->origin_seq = pm->origin_seq;
+    m->stored_at  = pm->stored_at;
+
+    // The log holds each stream in order, so the previous record of a
+    // stream is the last one restored
+    if (m->local) {
+        m->prev_seq    = ch->local_last;
+        ch->local_last = m->origin_seq;
+    } else {
+        if (marks_init(ch) == 0) {
+            m->prev_seq = ch->applied->seq[pm->origin_id];
+            marks_raise(ch, pm->origin_id, pm->origin_seq);
+        }
+    }
+    pthread_mutex_unlock(&ch->lock);
+
+    if (m->local) channel_dirty(ch, STORE_DIRTY_REPLICATE);
+    channel_dirty(ch, STORE_DIRTY_SEARCH);
+    return 1;
+}
+
+uint64_t store_trim_before(uint32_t cutoff) {
+    uint64_t dropped = 0;
+    uint32_t n = store_channel_count();
+
+    for (uint32_t i = 0; i < n; i++) {
+        pthread_rwlock_rdlock(&table_lock);
+        ChannelLog *ch = channel_order[i];
+        pthread_rwlock_unlock(&table_lock);
+        pthread_mutex_lock(&ch->lock);
+
+        size_t k = 0;
+        while (k < ch->count && ch->msgs[k].stored_at < cutoff) {
+            free(ch->msgs[k].text);
+            k++;
+        }
+        if (k > 0) {
+            memmove(ch->msgs, ch->msgs + k, (ch->count - k) * sizeof(StoredMessage));
+            ch->count    -= k;
+            ch->base_seq += k;
+            dropped      += k;
+        }
+        pthread_mutex_unlock(&ch->lock);
+    }
+    return dropped;
+}
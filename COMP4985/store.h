@@ -0,0 +1,152 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_STORE_H
+#define COMP4985_STORE_H
+
+#include "protocol.h"
+#include "persist.h"
+#include <stdatomic.h>
+
+// ---------------------------------------------------------------------------
+// Message store limits
+// ---------------------------------------------------------------------------
+#define SYNC_DEFAULT_RECORDS 64    // used when the client sends max_records=0
+#define SYNC_MAX_RECORDS     512   // hard cap on records per Message Sync ACK
+
+// Largest Message Sync ACK payload (either version): the wire limit.
+#define SYNC_RESPONSE_MAX BUFFER_SIZE
+
+// Longest message text the store takes. One such message must fit on its
+// own in a v0.3 Message Sync ACK and in a Replica Batch, whose header and
+// record are smaller, so neither a catch-up nor replication can stall on
+// it. Message Create refuses anything longer.
+#define STORE_MAX_TEXT (SYNC_RESPONSE_MAX - MESSAGE_SYNC_V3_SIZE - SYNC_RECORD_V3_SIZE)
+
+// ===========================================================================
+// Per-channel message log
+//
+// Each channel is an append-only array. The message at index i carries
+// seq = base_seq + i, so a since-cursor read is a direct index followed by
+// a bounded forward copy — no search, no duplicates, no over-fetching.
+// ===========================================================================
+
+typedef struct {
+    uint64_t seq;
+    uint64_t timestamp;        // opaque, exactly as the client sent it
+    uint32_t sender_id;
+    char     sender[16];
+    uint16_t length;
+    char    *text;
+    uint8_t  local;            // stored through this server's Message Create
+    uint8_t  origin_id;        // replicas: server the message came from
+    uint64_t origin_seq;       // replicas: its seq on that server
+    uint64_t prev_seq;         // origin_seq of the one before it from the same origin
+    uint32_t stored_at;        // unix seconds, for retention
+} StoredMessage;
+
+// Sum of every channel's head seq, i.e. log entries ever assigned a seq
+extern _Atomic uint64_t store_head_total;
+
+// Appends a message to channel_id and returns its sequence number (>= 1),
+// or 0 if the store is out of memory.
+uint64_t store_append(uint32_t channel_id, const char sender[16],
+                      uint32_t sender_id, uint64_t timestamp,
+                      const char *text, uint16_t length);
+
+// Newest sequence number in channel_id (0 if the channel is empty).
+uint64_t store_head_seq(uint32_t channel_id);
+
+// Messages still held in channel_id with seq > since_seq.
+uint64_t store_count_since(uint32_t channel_id, uint64_t since_seq);
+
+// Oldest sequence number still held in channel_id (retention trims the
+// front); head + 1 if it holds nothing, 0 if the channel does not exist.
+uint64_t store_first_seq(uint32_t channel_id);
+
+// Copies up to max_records messages with seq > since_seq into out as
+// MessageSyncRecordV3 (wide) or MessageSyncRecord + text, stopping before
+// out_cap would be exceeded. Returns the number of bytes written; *count
+// receives the record count.
+uint32_t store_read_since(uint32_t channel_id, uint64_t since_seq,
+                          uint32_t max_records, int wide,
+                          uint8_t *out, uint32_t out_cap, uint16_t *count);
+
+// ---------------------------------------------------------------------------
+// Replication
+// ---------------------------------------------------------------------------
+
+// Channels in creation order: index 0 .. store_channel_count()-1. A
+// channel keeps its index for the life of the process.
+uint32_t store_channel_count(void);
+uint32_t store_channel_id_at(uint32_t index);
+
+// Dirty-channel queues: each one collects the channels appended to since
+// its consumer last took them, so the consumer only visits those instead
+// of every channel.
+typedef enum {
+    STORE_DIRTY_REPLICATE,     // local messages (appended or restored)
+    STORE_DIRTY_SEARCH,        // every append, local, replicated or restored
+    STORE_DIRTY_QUEUES
+} StoreDirtyQueue;
+
+// Takes up to max channels off queue q, oldest first, writing their
+// creation indexes to out. Returns how many were taken. A channel
+// appended to again after being taken is queued again.
+uint32_t store_take_dirty(StoreDirtyQueue q, uint32_t *out, uint32_t max);
+
+// Puts a channel back on q, e.g. when its consumer could not finish it.
+void store_mark_dirty(StoreDirtyQueue q, uint32_t index);
+
+// Origin filter for store_collect: this server's own messages
+#define STORE_ORIGIN_LOCAL  (-1)
+
+// Copies messages of channel_id that came from `origin` (STORE_ORIGIN_LOCAL
+// for this server's own) with origin_seq > since into out as ReplicaRecord
+// + text, up to max_records / out_cap, scanning forward from local seq
+// *pos. *pos is advanced past everything examined, so the next call
+// continues where this one stopped.
+uint32_t store_collect(uint32_t channel_id, int origin, uint64_t since,
+                       uint64_t *pos, uint32_t max_records,
+                       uint8_t *out, uint32_t out_cap, uint16_t *count);
+
+// Every origin channel_id holds replicas from, with the highest origin_seq
+// applied from it, read under one lock. Returns how many went to out.
+typedef struct {
+    uint8_t  origin_id;
+    uint64_t seq;
+} StoreOriginMark;
+uint32_t store_applied_marks(uint32_t channel_id, StoreOriginMark out[256]);
+
+// Appends a peer's message (rec decoded, text follows it on the wire)
+// unless (origin_id, channel, origin_seq) has already been applied.
+// Returns 1 if applied, 0 if a duplicate, -1 if not applied: a gap before
+// it (rec->prev_seq not held yet) or out of memory.
+int store_apply_replica(uint8_t origin_id, const ReplicaRecord *rec,
+                        const char *text);
+
+// ---------------------------------------------------------------------------
+// Persistence (see persist.h)
+// ---------------------------------------------------------------------------
+
+// Takes / releases every channel lock, in creation order.
+void store_lock_all(void);
+void store_unlock_all(void);
+
+// Writes every channel to w. Caller holds all channel locks, or is the
+// snapshot child.
+int store_snapshot(SnapWriter *w);
+
+// Loads the section written by store_snapshot into empty channels.
+int store_load_snapshot(SnapReader *r);
+
+// Re-appends a logged message during restore (not logged again). Records
+// at or below a channel's current head are skipped.
+int store_restore(const PersistMsg *m, const char *text);
+
+// Drops messages stored before cutoff (unix seconds) from the front of
+// every channel. Returns the number dropped.
+uint64_t store_trim_before(uint32_t cutoff);
+
+#endif //COMP4985_STORE_H
@@ -0,0 +1,212 @@
+#include "protocol.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+// ---------------------------------------------------------------------------
+// Test: a standby that registers while its peer keeps taking messages
+//
+// Starts mock_manager and server A, writes an account and some history to
+// A, then starts server B while still posting to A. The manager relays
+// A's live batches to B as soon as B registers, before A has answered B's
+// Replica Sync, so B sees new records ahead of the history they follow.
+// B must still end up with the account and every message.
+//
+//   test_late_join <mock_manager> <server> <work dir>
+// ---------------------------------------------------------------------------
+
+#define LJ_CHANNELS  5
+#define LJ_HISTORY   200   // per channel, before B starts
+#define LJ_LIVE      100   // per channel, while B starts
+#define LJ_WAIT_MS   15000
+
+static pid_t children[3];
+static int   nchildren;
+
+static void stop_children(void) {
+    for (int i = 0; i < nchildren; i++) kill(children[i], SIGTERM);
+    for (int i = 0; i < nchildren; i++) waitpid(children[i], NULL, 0);
+    nchildren = 0;
+}
+
+static void fail(const char *msg) {
+    fprintf(stderr, "late_join: %s\n", msg);
+    stop_children();
+    exit(1);
+}
+
+static void spawn(char *const argv[]) {
+    pid_t pid = fork();
+    if (pid < 0) fail("fork");
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    children[nchildren++] = pid;
+}
+
+static void write_config(const char *path, int port, int manager_port) {
+    FILE *f = fopen(path, "w");
+    if (!f) fail("cannot write config");
+    fprintf(f, "port = %d\nmanager_ip = 127.0.0.1\nmanager_port = %d\n"
+               "headless = true\nlogging = false\nhash_iterations = 100\n"
+               "rate.conn.message_create = 0\nrate.user.message_create = 0\n",
+            port, manager_port);
+    fclose(f);
+}
+
+static void sleep_ms(int ms) {
+    usleep((useconds_t)ms * 1000);
+}
+
+// Connects to 127.0.0.1:port, retrying while the server starts up
+static int dial(int port) {
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port) };
+    inet_pton(AF_INET, "127.0.0.1", &a.sin_addr);
+    for (int tries = 0; tries < 100; tries++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *)&a, sizeof(a)) == 0) return fd;
+        close(fd);
+        sleep_ms(50);
+    }
+    fail("server did not come up");
+    return -1;
+}
+
+static void send_req(int fd, uint8_t res, uint8_t crud, const uint8_t *pay, uint32_t len) {
+    GlobalHeader h = {
+        .version_major  = PROTO_VER_MAJOR, .version_minor = PROTO_VER_MINOR_WIDE,
+        .resource_type  = res, .crud = crud, .ack = IS_REQ,
+        .message_length = len
+    };
+    uint8_t raw[HEADER_SIZE];
+    header_encode(&h, raw);
+    if (send(fd, raw, HEADER_SIZE, MSG_NOSIGNAL) != HEADER_SIZE ||
+        send(fd, pay, len, MSG_NOSIGNAL) != (ssize_t)len)
+        fail("send");
+}
+
+static void recv_full(int fd, uint8_t *p, uint32_t n) {
+    while (n > 0) {
+        ssize_t got = recv(fd, p, n, 0);
+        if (got <= 0) fail("connection closed");
+        p += got;
+        n -= (uint32_t)got;
+    }
+}
+
+// Reads one reply into buf (BUFFER_SIZE); returns its status
+static uint8_t recv_reply(int fd, uint8_t *buf, uint32_t *len) {
+    uint8_t      raw[HEADER_SIZE];
+    GlobalHeader h;
+    recv_full(fd, raw, HEADER_SIZE);
+    header_decode(&h, raw);
+    if (h.message_length > BUFFER_SIZE) fail("oversized reply");
+    recv_full(fd, buf, h.message_length);
+    *len = h.message_length;
+    return h.status;
+}
+
+static void post(int fd, uint32_t channel_id, int k) {
+    uint8_t buf[MESSAGE_CREATE_V3_SIZE + 32];
+    MessageCreateHeaderV3 mc = { .timestamp = (uint64_t)k, .channel_id = channel_id };
+    strcpy(mc.username, "late");
+    int n = snprintf((char *)buf + MESSAGE_CREATE_V3_SIZE, 32, "m%u-%d", channel_id, k);
+    mc.message_length = (uint16_t)n;
+    message_create_v3_encode(&mc, buf);
+    send_req(fd, RES_MESSAGE, CRUD_CREATE, buf, MESSAGE_CREATE_V3_SIZE + (uint32_t)n);
+}
+
+// Newest seq B holds in channel_id, via a one-record Message Sync
+static uint64_t head_of(int fd, uint32_t channel_id, uint8_t *buf) {
+    MessageSyncHeaderV3 ms = { .channel_id = channel_id, .max_records = 1 };
+    strcpy(ms.username, "probe");
+    send_req(fd, RES_MESSAGES, CRUD_READ, buf, message_sync_v3_encode(&ms, buf));
+    uint32_t len;
+    if (recv_reply(fd, buf, &len) != STATUS_OK) return 0;
+    return message_sync_v3_decode(&ms, buf, len) < 0 ? 0 : ms.head_seq;
+}
+
+static int has_user(int fd, const char *name, uint8_t *buf) {
+    UserReadPayloadV3 ur = { 0 };
+    strcpy(ur.username, "probe");
+    strcpy(ur.username_for_user_id, name);
+    send_req(fd, RES_USER, CRUD_READ, buf, user_read_v3_encode(&ur, buf));
+    uint32_t len;
+    return recv_reply(fd, buf, &len) == STATUS_OK &&
+           user_read_v3_decode(&ur, buf, len) >= 0 && ur.user_id != 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <mock_manager> <server> <work dir>\n", argv[0]);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int  base = 20000 + getpid() % 20000;
+    char mport[16], aconf[PATH_MAX], bconf[PATH_MAX];
+    snprintf(mport, sizeof(mport), "%d", base);
+    snprintf(aconf, sizeof(aconf), "%s/late_join_a.conf", argv[3]);
+    snprintf(bconf, sizeof(bconf), "%s/late_join_b.conf", argv[3]);
+    write_config(aconf, base + 1, base);
+    write_config(bconf, base + 2, base);
+
+    uint8_t *buf = malloc(BUFFER_SIZE);
+    if (!buf) fail("out of memory");
+
+    spawn((char *[]){ argv[1], mport, NULL });
+    sleep_ms(200);
+    spawn((char *[]){ argv[2], "--config", aconf, NULL });
+
+    int a = dial(base + 1);
+    AccountCreatePayloadV3 ac = { 0 };
+    strcpy(ac.username, "late");
+    strcpy(ac.password, "pw");
+    send_req(a, RES_USER, CRUD_CREATE, buf, account_create_v3_encode(&ac, buf));
+    uint32_t len;
+    if (recv_reply(a, buf, &len) != STATUS_OK) fail("account not created on A");
+
+    for (int k = 0; k < LJ_HISTORY; k++)
+        for (uint32_t c = 1; c <= LJ_CHANNELS; c++) post(a, c, k);
+    sleep_ms(300);
+
+    // B registers in the middle of a stream of new messages
+    spawn((char *[]){ argv[2], "--config", bconf, NULL });
+    for (int k = LJ_HISTORY; k < LJ_HISTORY + LJ_LIVE; k++) {
+        for (uint32_t c = 1; c <= LJ_CHANNELS; c++) post(a, c, k);
+        sleep_ms(2);
+    }
+
+    int b = dial(base + 2);
+    uint64_t want = LJ_HISTORY + LJ_LIVE, head[LJ_CHANNELS + 1] = { 0 };
+    int      user = 0, done = 0;
+    for (int waited = 0; waited < LJ_WAIT_MS && !done; waited += 100) {
+        sleep_ms(100);
+        user = user || has_user(b, "late", buf);
+        done = user;
+        for (uint32_t c = 1; c <= LJ_CHANNELS; c++) {
+            head[c] = head_of(b, c, buf);
+            if (head[c] != want) done = 0;
+        }
+    }
+    if (!done) {
+        fprintf(stderr, "late_join: B has account: %s\n", user ? "yes" : "no");
+        for (uint32_t c = 1; c <= LJ_CHANNELS; c++)
+            fprintf(stderr, "late_join: channel %u on B: %llu of %llu messages\n",
+                    c, (unsigned long long)head[c], (unsigned long long)want);
+        fail("B did not catch up");
+    }
+
+    close(a);
+    close(b);
+    free(buf);
+    stop_children();
+    printf("late_join: B caught up (%d channels, %llu messages each)\n",
+           LJ_CHANNELS, (unsigned long long)want);
+    return 0;
+}
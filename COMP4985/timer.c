@@ -0,0 +1,159 @@
+#include "protocol.h"
+#include "timer.h"
+#include "affinity.h"
+
+#include <stdatomic.h>
+
+// ===========================================================================
+// Wheel state
+// ===========================================================================
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  done;       // signalled after each callback returns
+    TimerEntry      slots[TIMER_LEVELS][TIMER_SLOTS];   // list sentinels
+    uint64_t        now;        // last processed tick
+    TimerEntry     *running;    // entry whose callback is executing
+    _Atomic uint32_t lag_us;    // lateness of the last tick
+} wheel = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER
+};
+
+static void list_unlink(TimerEntry *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+    t->pending = 0;
+}
+
+static void list_push(TimerEntry *head, TimerEntry *t) {
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+    t->pending = 1;
+}
+
+// Places t in the lowest level whose span covers its remaining delay.
+// Caller holds wheel.lock.
+static void wheel_insert(TimerEntry *t) {
+    uint64_t delta = t->expires - wheel.now;
+    int level = 0;
+
+    while (level < TIMER_LEVELS - 1 &&
+           delta >= (1ull << (TIMER_SLOT_BITS * (level + 1))))
+        level++;
+
+    uint64_t max = (1ull << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
+    if (delta > max) t->expires = wheel.now + max;
+
+    int slot = (int)((t->expires >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1));
+    list_push(&wheel.slots[level][slot], t);
+}
+
+// Re-files every entry of one higher level slot into the levels below.
+static void wheel_cascade(int level) {
+    int slot = (int)((wheel.now >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1));
+    TimerEntry *head = &wheel.slots[level][slot];
+
+    while (head->next != head) {
+        TimerEntry *t = head->next;
+        list_unlink(t);
+        wheel_insert(t);
+    }
+}
+
+// Advances one tick and fires everything due. Caller holds wheel.lock;
+// it is dropped around each callback.
+static void wheel_tick(void) {
+    wheel.now++;
+
+    for (int level = 1; level < TIMER_LEVELS; level++) {
+        if ((wheel.now & ((1ull << (TIMER_SLOT_BITS * level)) - 1)) != 0) break;
+        wheel_cascade(level);
+    }
+
+    TimerEntry *head = &wheel.slots[0][wheel.now & (TIMER_SLOTS - 1)];
+    while (head->next != head) {
+        TimerEntry *t = head->next;
+        list_unlink(t);
+
+        wheel.running = t;
+        pthread_mutex_unlock(&wheel.lock);
+        t->fire(t);
+        pthread_mutex_lock(&wheel.lock);
+        wheel.running = NULL;
+        pthread_cond_broadcast(&wheel.done);
+    }
+}
+
+// ===========================================================================
+// Tick thread
+// ===========================================================================
+
+static void* timer_thread(void *arg) {
+    (void)arg;
+    affinity_enter(AFF_TIMER);
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (1) {
+        next.tv_nsec += TIMER_TICK_MS * 1000000L;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        struct timespec woke;
+        clock_gettime(CLOCK_MONOTONIC, &woke);
+        int64_t late = (int64_t)(woke.tv_sec - next.tv_sec) * 1000000 +
+                       (woke.tv_nsec - next.tv_nsec) / 1000;
+        atomic_store_explicit(&wheel.lag_us,
+                              late > 0 ? (late > UINT32_MAX ? UINT32_MAX : (uint32_t)late) : 0,
+                              memory_order_relaxed);
+
+        pthread_mutex_lock(&wheel.lock);
+        wheel_tick();
+        pthread_mutex_unlock(&wheel.lock);
+    }
+    return NULL;
+}
+
+void timer_wheel_start(void) {
+    for (int l = 0; l < TIMER_LEVELS; l++)
+        for (int s = 0; s < TIMER_SLOTS; s++)
+            wheel.slots[l][s].next = wheel.slots[l][s].prev = &wheel.slots[l][s];
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, timer_thread, NULL);
+    pthread_detach(tid);
+}
+
+uint32_t timer_lag_us(void) {
+    return atomic_load_explicit(&wheel.lag_us, memory_order_relaxed);
+}
+
+// ===========================================================================
+// Arm / cancel
+// ===========================================================================
+
+void timer_arm(TimerEntry *t, uint32_t ms) {
+    uint64_t ticks = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (ticks == 0) ticks = 1;
+
+    pthread_mutex_lock(&wheel.lock);
+    if (t->pending) list_unlink(t);
+    t->expires = wheel.now + ticks;
+    wheel_insert(t);
+    pthread_mutex_unlock(&wheel.lock);
+}
+
+void timer_cancel_sync(TimerEntry *t) {
+    pthread_mutex_lock(&wheel.lock);
+    if (t->pending) list_unlink(t);
+    while (wheel.running == t)
+        pthread_cond_wait(&wheel.done, &wheel.lock);
+    pthread_mutex_unlock(&wheel.lock);
+}
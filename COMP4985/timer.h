@@ -0,0 +1,53 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_TIMER_H
+#define COMP4985_TIMER_H
+
+#include "protocol.h"
+
+// ---------------------------------------------------------------------------
+// Hierarchical timer wheel
+//
+// 4 levels × 64 slots at TIMER_TICK_MS resolution: level 0 covers 6.4 s,
+// level 1 ~7 min, level 2 ~7 h, level 3 ~19 days. Arming, re-arming and
+// cancelling are O(1) list operations; entries only move when a higher
+// level slot cascades down. One background thread advances the wheel and
+// runs expired callbacks, one at a time, with the wheel lock released.
+// ---------------------------------------------------------------------------
+#define TIMER_TICK_MS    100
+#define TIMER_LEVELS     4
+#define TIMER_SLOT_BITS  6
+#define TIMER_SLOTS      (1 << TIMER_SLOT_BITS)
+
+typedef struct TimerEntry TimerEntry;
+typedef void (*TimerFn)(TimerEntry *t);
+
+// Embed one of these in the owning object; zero-initialise, then set fire
+// (and arg if the callback needs it) before the first timer_arm.
+struct TimerEntry {
+    TimerEntry *next;
+    TimerEntry *prev;
+    uint64_t    expires;   // absolute tick
+    TimerFn     fire;
+    void       *arg;
+    int         pending;
+};
+
+// Starts the tick thread. Call once before arming any timer.
+void timer_wheel_start(void);
+
+// How late (µs) the most recent tick ran compared with its schedule. Grows
+// when the box is CPU-starved or a callback blocks, so it doubles as the
+// server's event-loop lag signal.
+uint32_t timer_lag_us(void);
+
+// (Re)arms t to fire after ms milliseconds, replacing any earlier deadline.
+void timer_arm(TimerEntry *t, uint32_t ms);
+
+// Disarms t. If t's callback is running right now, waits for it to finish,
+// so the caller may free t as soon as this returns.
+void timer_cancel_sync(TimerEntry *t);
+
+#endif //COMP4985_TIMER_H
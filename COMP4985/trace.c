@@ -0,0 +1,195 @@
+#include "protocol.h"
+#include "trace.h"
+#include "logsink.h"
+#include "affinity.h"
+#include "stats.h"
+
+#include <stdatomic.h>
+
+#define TRACE_CALIBRATE_MS  20
+
+uint32_t trace_sample = TRACE_DEFAULT_SAMPLE;
+_Thread_local TraceRequest *trace_current;
+
+static char     trace_path[256];
+static double   ticks_per_us = 1000.0;   // the nanosecond clock unless calibrated
+static uint64_t tick_base;               // ticks when tracing began
+
+// Sampled requests, oldest overwritten
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TraceRequest   *ring;
+static uint64_t        ring_head;        // requests ever kept
+static uint64_t        exported_head;    // ring_head at the last export
+
+static _Atomic uint32_t       next_track;
+static _Thread_local uint32_t track;     // 0 until this thread keeps a request
+static _Thread_local uint64_t rng;       // xorshift state, seeded on first use
+
+static const char *const stage_names[TRACE_STAGES] = {
+    [TRACE_READ]     = "read",
+    [TRACE_VALIDATE] = "validate",
+    [TRACE_HANDLER]  = "handler",
+    [TRACE_LOG]      = "client_log",
+    [TRACE_FORWARD]  = "send_log_to_manager",
+    [TRACE_SEND]     = "send_binary_msg",
+};
+
+// Indexed by resource_type << 2 | crud
+static const char *const op_names[32 * 4] = {
+    [RES_USER     << 2 | CRUD_CREATE] = "account_create",
+    [RES_USER     << 2 | CRUD_UPDATE] = "login_logout",
+    [RES_USER     << 2 | CRUD_READ]   = "user_read",
+    [RES_CHANNEL  << 2 | CRUD_READ]   = "channel_read",
+    [RES_CHANNELS << 2 | CRUD_UPDATE] = "channels_read",
+    [RES_MESSAGE  << 2 | CRUD_CREATE] = "message_create",
+    [RES_MESSAGE  << 2 | CRUD_READ]   = "message_read",
+    [RES_MESSAGES << 2 | CRUD_READ]   = "message_sync",
+    [RES_PRESENCE << 2 | CRUD_READ]   = "presence_read",
+    [RES_SEARCH   << 2 | CRUD_READ]   = "search",
+};
+
+// ===========================================================================
+// Recording
+// ===========================================================================
+
+void trace_span(TraceStage stage, uint64_t begin, uint64_t end) {
+    TraceRequest *r = trace_current;
+    if (!r || r->nspans == TRACE_MAX_SPANS) return;
+    r->spans[r->nspans++] = (TraceSpan){ .begin = begin, .end = end, .stage = (uint8_t)stage };
+}
+
+void trace_begin(TraceRequest *r, uint64_t first_tick) {
+    r->begin      = first_tick;
+    r->status     = STATUS_OK;
+    r->nspans     = 0;
+    trace_current = r;
+}
+
+// About one call in trace_sample returns 1
+static int sampled(void) {
+    if (rng == 0) rng = trace_ticks() ^ (uint64_t)(uintptr_t)&rng ^ 0x9E3779B97F4A7C15u;
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng % trace_sample == 0;
+}
+
+void trace_end(TraceRequest *r, uint8_t res_type, uint8_t crud) {
+    trace_current = NULL;
+    if (!ring || !sampled()) return;
+
+    r->end      = trace_ticks();
+    r->res_type = res_type;
+    r->crud     = crud;
+    if (track == 0) track = atomic_fetch_add(&next_track, 1) + 1;
+    r->track    = track;
+
+    size_t keep = offsetof(TraceRequest, spans) + r->nspans * sizeof(TraceSpan);
+    pthread_mutex_lock(&ring_mutex);
+    memcpy(&ring[ring_head % TRACE_RING_SIZE], r, keep);
+    ring_head++;
+    pthread_mutex_unlock(&ring_mutex);
+}
+
+// ===========================================================================
+// Export
+// ===========================================================================
+
+static double tick_us(uint64_t t) {
+    return t > tick_base ? (double)(t - tick_base) / ticks_per_us : 0.0;
+}
+
+static void write_event(FILE *f, int *first, const char *name, const char *cat,
+                        uint32_t tid, uint64_t begin, uint64_t end)
+{
+    fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,"
+               "\"ts\":%.3f,\"dur\":%.3f",
+            *first ? "" : ",", name, cat, (int)getpid(), tid,
+            tick_us(begin), end > begin ? (double)(end - begin) / ticks_per_us : 0.0);
+    *first = 0;
+}
+
+void trace_open(const char *path) {
+    strncpy(trace_path, path, sizeof(trace_path) - 1);
+    ring = calloc(TRACE_RING_SIZE, sizeof(TraceRequest));
+    if (!ring) {
+        server_log("[TRACE] No memory for the trace ring — tracing off");
+        trace_sample = 0;
+        return;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // The counter runs at a fixed rate on anything recent; measure it
+    uint64_t us0 = stats_now_us(), t0 = trace_ticks();
+    usleep(TRACE_CALIBRATE_MS * 1000);
+    uint64_t us1 = stats_now_us(), t1 = trace_ticks();
+    if (us1 > us0 && t1 > t0) ticks_per_us = (double)(t1 - t0) / (double)(us1 - us0);
+#endif
+    tick_base = trace_ticks();
+    server_log("[TRACE] Sampling 1 request in %u to %s (%.0f ticks/us)",
+               trace_sample, trace_path, ticks_per_us);
+}
+
+void trace_export(void) {
+    if (!ring) return;
+
+    pthread_mutex_lock(&ring_mutex);
+    uint64_t head = ring_head;
+    uint32_t n    = head < TRACE_RING_SIZE ? (uint32_t)head : TRACE_RING_SIZE;
+    TraceRequest *copy = head != exported_head ? malloc((size_t)n * sizeof(TraceRequest)) : NULL;
+    if (copy) {
+        // Oldest first
+        for (uint32_t i = 0; i < n; i++)
+            copy[i] = ring[(head - n + i) % TRACE_RING_SIZE];
+        exported_head = head;
+    }
+    pthread_mutex_unlock(&ring_mutex);
+    if (!copy) return;
+
+    // Written beside the file and renamed over it, so readers never see
+    // half a trace
+    char tmp[sizeof(trace_path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", trace_path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        server_log("[TRACE] Cannot write %s: %s", tmp, strerror(errno));
+        free(copy);
+        return;
+    }
+
+    int first = 1;
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", f);
+    for (uint32_t i = 0; i < n; i++) {
+        const TraceRequest *r = &copy[i];
+        char other[24];
+        const char *name = op_names[(r->res_type & 31) << 2 | (r->crud & 3)];
+        if (!name) {
+            snprintf(other, sizeof(other), "res=%u crud=%u", r->res_type, r->crud);
+            name = other;
+        }
+        write_event(f, &first, name, "request", r->track, r->begin, r->end);
+        fprintf(f, ",\"args\":{\"res\":%u,\"crud\":%u,\"status\":%u}}",
+                r->res_type, r->crud, r->status);
+
+        for (uint8_t k = 0; k < r->nspans; k++) {
+            const TraceSpan *s = &r->spans[k];
+            write_event(f, &first, stage_names[s->stage], "stage", r->track, s->begin, s->end);
+            fputc('}', f);
+        }
+    }
+    fputs("\n]}\n", f);
+    free(copy);
+
+    if (fclose(f) != 0 || rename(tmp, trace_path) != 0)
+        server_log("[TRACE] Cannot write %s: %s", trace_path, strerror(errno));
+}
+
+void* trace_thread(void *arg) {
+    (void)arg;
+    affinity_enter(AFF_STORAGE);
+    while (1) {
+        sleep(TRACE_EXPORT_SECS);
+        trace_export();
+    }
+    return NULL;
+}
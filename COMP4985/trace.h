@@ -0,0 +1,126 @@
+//
+// Created by Jin Siang Teh on 2026-03-01.
+//
+
+#ifndef COMP4985_TRACE_H
+#define COMP4985_TRACE_H
+
+#include "protocol.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// Request tracing
+//
+// With trace_file set, handle_client stamps the stages of every request
+// with the CPU timestamp counter (rdtsc on x86, the monotonic clock
+// elsewhere):
+//
+//   read                   first header byte → whole frame received
+//   validate               checks 1–7 in handle_client, decompression too
+//   handler                the handle_* call, which contains any of:
+//     client_log             formatting and writing to the local sinks
+//     send_log_to_manager    forwarding the line to the manager
+//     send_binary_msg        writing a reply or error to the socket
+//
+// About one request in trace_sample (picked at random, per thread) is
+// kept: its spans go into a ring of the last TRACE_RING_SIZE sampled
+// requests. Every TRACE_EXPORT_SECS, and when the server stops, the ring
+// is written to trace_file as a Chrome trace (JSON), which
+// chrome://tracing and ui.perfetto.dev open: one track per connection
+// thread, one slice per request named after its operation, with the
+// stages nested inside it.
+//
+// Requests that are not kept cost a handful of counter reads and touch
+// nothing shared.
+// ---------------------------------------------------------------------------
+#define TRACE_RING_SIZE       8192
+#define TRACE_MAX_SPANS       16     // stages kept per request, later ones dropped
+#define TRACE_EXPORT_SECS     10
+#define TRACE_DEFAULT_SAMPLE  100
+
+// Keep 1 request in N. 0 = tracing off, which it is set to at startup
+// when there is no trace_file.
+extern uint32_t trace_sample;
+
+typedef enum {
+    TRACE_READ,
+    TRACE_VALIDATE,
+    TRACE_HANDLER,
+    TRACE_LOG,
+    TRACE_FORWARD,
+    TRACE_SEND,
+    TRACE_STAGES
+} TraceStage;
+
+typedef struct {
+    uint64_t begin, end;        // ticks
+    uint8_t  stage;             // TraceStage
+} TraceSpan;
+
+typedef struct {
+    uint64_t  begin, end;       // ticks: first byte → reply sent
+    uint32_t  track;            // connection thread, numbered from 1
+    uint8_t   res_type, crud;
+    uint8_t   status;           // last error status sent, STATUS_OK if none
+    uint8_t   nspans;
+    TraceSpan spans[TRACE_MAX_SPANS];
+} TraceRequest;
+
+// The request the calling thread is tracing, NULL if none
+extern _Thread_local TraceRequest *trace_current;
+
+static inline uint64_t trace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Records a finished stage of the current request.
+void trace_span(TraceStage stage, uint64_t begin, uint64_t end);
+
+// Brackets a nested stage: trace_enter returns 0 when nothing is being
+// traced, and trace_leave then does nothing.
+static inline uint64_t trace_enter(void) {
+    return trace_current ? trace_ticks() : 0;
+}
+static inline void trace_leave(TraceStage stage, uint64_t begin) {
+    if (begin) trace_span(stage, begin, trace_ticks());
+}
+
+// Notes an error status sent for the current request.
+static inline void trace_status(uint8_t status) {
+    if (trace_current) trace_current->status = status;
+}
+
+// ---------------------------------------------------------------------------
+// Driven by handle_client
+// ---------------------------------------------------------------------------
+
+// Starts tracing a request whose first byte arrived at first_tick.
+void trace_begin(TraceRequest *r, uint64_t first_tick);
+
+// Ends it: keeps it in the ring if sampled, then clears trace_current.
+void trace_end(TraceRequest *r, uint8_t res_type, uint8_t crud);
+
+// ---------------------------------------------------------------------------
+// Export
+// ---------------------------------------------------------------------------
+
+// Calibrates the counter and remembers where to export. Call once before
+// any connection if tracing is on.
+void trace_open(const char *path);
+
+// Writes the ring to the trace file now (no-op if nothing new).
+void trace_export(void);
+
+// Exports every TRACE_EXPORT_SECS.
+void* trace_thread(void *arg);
+
+#endif //COMP4985_TRACE_H